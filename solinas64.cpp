@@ -30,6 +30,39 @@
 
 #include <string.h>
 
+#if defined(SOLINAS64_ENABLE_STATS)
+# include <algorithm>
+# include <atomic>
+# include <mutex>
+# include <vector>
+#endif
+
+
+#if defined(SOLINAS64_TRY_AVX2)
+# include <immintrin.h>
+# ifdef _MSC_VER
+#  include <intrin.h> // __cpuidex, _xgetbv
+# endif
+#endif
+
+// Compiler-specific target attributes for the runtime-dispatched kernels
+#if defined(_MSC_VER)
+# define SOLINAS64_TARGET_AVX2
+# define SOLINAS64_TARGET_AVX512
+#else
+# define SOLINAS64_TARGET_AVX2 __attribute__((target("avx2")))
+# define SOLINAS64_TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+
+// Hint to fetch a cache line for reading.  It does not fault on bad addresses
+#if defined(SOLINAS64_TRY_AVX2)
+# define SOLINAS64_PREFETCH(ptr) _mm_prefetch(reinterpret_cast<const char*>(ptr), _MM_HINT_T0)
+#elif defined(__GNUC__)
+# define SOLINAS64_PREFETCH(ptr) __builtin_prefetch(ptr)
+#else
+# define SOLINAS64_PREFETCH(ptr)
+#endif
+
 namespace solinas64 {
 
 
@@ -72,6 +105,160 @@ uint64_t Inverse(uint64_t u)
 }
 
 
+//------------------------------------------------------------------------------
+// Constant-Time Inverse
+
+// Branch-free versions of the field operations for InverseCT().
+// The compiler is free to turn the branches in Add() and Subtract() into
+// jumps, so these derive the correction from the carry with a mask instead.
+
+static SOLINAS64_FORCE_INLINE uint64_t AddCT(uint64_t x, uint64_t y)
+{
+    const uint64_t carry = adc(x, y) ? 1 : 0;
+    x += (0 - carry) & kPrimeSubC;
+    return x;
+}
+
+static SOLINAS64_FORCE_INLINE uint64_t SubtractCT(uint64_t x, uint64_t y)
+{
+    const uint64_t borrow = sbb(x, y) ? 1 : 0;
+    x -= (0 - borrow) & kPrimeSubC;
+    return x;
+}
+
+static SOLINAS64_FORCE_INLINE uint64_t MultiplyCT(uint64_t x, uint64_t y)
+{
+    uint64_t p_lo, p_hi;
+    CAT_MUL128(p_hi, p_lo, x, y);
+
+    const uint32_t a2 = static_cast<uint32_t>(p_hi);
+    const uint32_t a3 = static_cast<uint32_t>(p_hi >> 32);
+
+    const uint64_t t = (static_cast<uint64_t>(a2) << 32) - a2;
+
+    return SubtractCT(AddCT(p_lo, t), a3);
+}
+
+static SOLINAS64_FORCE_INLINE uint64_t SquareCT(uint64_t x, unsigned count)
+{
+    for (unsigned i = 0; i < count; ++i) {
+        x = MultiplyCT(x, x);
+    }
+    return x;
+}
+
+static SOLINAS64_FORCE_INLINE uint64_t FinalizeCT(uint64_t x)
+{
+    const uint64_t borrow = sbb(x, kPrime) ? 1 : 0;
+    x += (0 - borrow) & kPrime;
+    return x;
+}
+
+// p - 2 = 0xfffffffeffffffff = (2^31 - 1) * 2^33 + (2^32 - 1)
+// Powers x^(2^k - 1) are written as xk below.
+uint64_t InverseCT(uint64_t x)
+{
+    const uint64_t x1 = x;
+    const uint64_t x2 = MultiplyCT(SquareCT(x1, 1), x1);
+    const uint64_t x3 = MultiplyCT(SquareCT(x2, 1), x1);
+    const uint64_t x6 = MultiplyCT(SquareCT(x3, 3), x3);
+    const uint64_t x12 = MultiplyCT(SquareCT(x6, 6), x6);
+    const uint64_t x15 = MultiplyCT(SquareCT(x12, 3), x3);
+    const uint64_t x30 = MultiplyCT(SquareCT(x15, 15), x15);
+    const uint64_t x31 = MultiplyCT(SquareCT(x30, 1), x1);
+    const uint64_t x32 = MultiplyCT(SquareCT(x31, 1), x1);
+
+    return FinalizeCT(MultiplyCT(SquareCT(x31, 33), x32));
+}
+
+uint64_t Power(uint64_t x, uint64_t e)
+{
+    uint64_t r = 1;
+    for (; e != 0; e >>= 1)
+    {
+        if (e & 1) {
+            r = Multiply(r, x);
+        }
+        x = Multiply(x, x);
+    }
+    return Finalize(r);
+}
+
+void BatchInverse(uint64_t* values, unsigned count, uint64_t* scratch)
+{
+    if (count == 0) {
+        return;
+    }
+
+    // scratch[i] = product of the nonzero values before i
+    uint64_t product = 1;
+    for (unsigned i = 0; i < count; ++i)
+    {
+        scratch[i] = product;
+
+        const uint64_t value = Finalize(values[i]);
+        values[i] = value;
+        if (value != 0) {
+            product = Multiply(product, value);
+        }
+    }
+
+    uint64_t inv = InverseCT(product);
+
+    // Peel off one inverse at a time from the end
+    for (unsigned i = count; i-- > 0;)
+    {
+        const uint64_t value = values[i];
+        if (value != 0)
+        {
+            values[i] = Finalize(Multiply(inv, scratch[i]));
+            inv = Multiply(inv, value);
+        }
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// Extension Fields
+
+Fp2 Inverse(const Fp2& x)
+{
+    // (x0 + x1 * u) * (x0 - x1 * u) = x0^2 - 7 * x1^2, which is in GF(p)
+    const uint64_t norm = Subtract(
+        Multiply(x.c0, x.c0),
+        Multiply(Multiply(x.c1, x.c1), kFp2NonResidue));
+    const uint64_t inv = Inverse(norm);
+
+    const Fp2 r = {
+        Finalize(Multiply(x.c0, inv)),
+        Finalize(Multiply(kPrime - Finalize(x.c1), inv))
+    };
+    return r;
+}
+
+Fp3 Inverse(const Fp3& x)
+{
+    // x * (t0 + t1 * u + t2 * u^2) = norm, which is in GF(p)
+    const uint64_t t0 = Subtract(Multiply(x.c0, x.c0), Multiply(Add(x.c1, x.c1), x.c2));
+    const uint64_t t1 = Subtract(Multiply(Add(x.c2, x.c2), x.c2), Multiply(x.c0, x.c1));
+    const uint64_t t2 = Subtract(Multiply(x.c1, x.c1), Multiply(x.c0, x.c2));
+
+    Accum128 sum;
+    sum.Clear();
+    sum.MultiplyAdd(x.c0, t0);
+    sum.MultiplyAdd(Add(x.c2, x.c2), t1);
+    sum.MultiplyAdd(Add(x.c1, x.c1), t2);
+    const uint64_t inv = Inverse(sum.Reduce());
+
+    const Fp3 r = {
+        Finalize(Multiply(t0, inv)),
+        Finalize(Multiply(t1, inv)),
+        Finalize(Multiply(t2, inv))
+    };
+    return r;
+}
+
+
 //------------------------------------------------------------------------------
 // Memory Reading
 
@@ -103,12 +290,17 @@ void WriteBytes_LE(uint8_t* data, unsigned bytes, uint64_t value)
     case 8: WriteU64_LE(data, value);
         return;
     case 7: data[6] = (uint8_t)(value >> 48);
+        // Fall through
     case 6: data[5] = (uint8_t)(value >> 40);
+        // Fall through
     case 5: data[4] = (uint8_t)(value >> 32);
+        // Fall through
     case 4: WriteU32_LE(data, static_cast<uint32_t>(value));
         return;
     case 3: data[2] = (uint8_t)(value >> 16);
+        // Fall through
     case 2: data[1] = (uint8_t)(value >> 8);
+        // Fall through
     case 1: data[0] = (uint8_t)value;
     default: break;
     }
@@ -118,17 +310,6 @@ void WriteBytes_LE(uint8_t* data, unsigned bytes, uint64_t value)
 //------------------------------------------------------------------------------
 // Random
 
-// From http://xoshiro.di.unimi.it/splitmix64.c
-// Written in 2015 by Sebastiano Vigna (vigna@acm.org)
-uint64_t HashU64(uint64_t x)
-{
-    x += 0x9e3779b97f4a7c15;
-    uint64_t z = x;
-    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
-    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
-    return z ^ (z >> 31);
-}
-
 void Random::Seed(uint64_t x)
 {
     // Fill initial state as recommended by authors
@@ -144,159 +325,3002 @@ void Random::Seed(uint64_t x)
 
 
 //------------------------------------------------------------------------------
-// Bulk Operations
+// CPU Features
 
-unsigned MultiplyRegion(
-    const uint8_t* data,
-    unsigned bytes,
-    uint64_t coeff,
-    uint8_t* workspace,
-    uint8_t* output)
+#if defined(SOLINAS64_TRY_AVX2)
+
+#define CPUID_ECX_OSXSAVE 0x08000000
+#define CPUID_ECX_AVX     0x10000000
+#define CPUID_EBX_AVX2    0x00000020
+#define CPUID_EBX_AVX512F 0x00010000
+
+#define XCR0_AVX_STATE    0x00000006 /* XMM and YMM registers */
+#define XCR0_AVX512_STATE 0x000000e6 /* Also opmask and ZMM registers */
+
+static void _cpuid(unsigned int cpu_info[4U], const unsigned int cpu_info_type)
 {
-    const unsigned minimumOutputBytes = (bytes + 7) & ~7u;
+#if defined(_MSC_VER)
+    __cpuidex((int *) cpu_info, cpu_info_type, 0);
+#elif defined(__i386__)
+    __asm__ __volatile__ ("xchgl %%ebx, %k1; cpuid; xchgl %%ebx, %k1" :
+                          "=a" (cpu_info[0]), "=&r" (cpu_info[1]),
+                          "=c" (cpu_info[2]), "=d" (cpu_info[3]) :
+                          "0" (cpu_info_type), "2" (0U));
+#else
+    __asm__ __volatile__ ("xchgq %%rbx, %q1; cpuid; xchgq %%rbx, %q1" :
+                          "=a" (cpu_info[0]), "=&r" (cpu_info[1]),
+                          "=c" (cpu_info[2]), "=d" (cpu_info[3]) :
+                          "0" (cpu_info_type), "2" (0U));
+#endif
+}
+
+// Returns the register state enabled by the OS in XCR0.
+// Precondition: CPUID reports OSXSAVE
+static uint64_t _xgetbv0()
+{
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    uint32_t eax, edx;
+    __asm__ __volatile__ ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+    return ((uint64_t)edx << 32) | eax;
+#endif
+}
 
-    // Special fast cases
-    if (coeff <= 1)
+struct CpuFeatures
+{
+    bool HasAVX2;
+    bool HasAVX512;
+
+    CpuFeatures()
     {
-        if (coeff == 0) {
-            memset(output, 0, minimumOutputBytes);
+        HasAVX2 = false;
+        HasAVX512 = false;
+
+        unsigned int cpu_info[4];
+
+        _cpuid(cpu_info, 0);
+        const unsigned maxLeaf = cpu_info[0];
+        if (maxLeaf < 7) {
+            return;
         }
-        else
-        {
-            memcpy(output, data, bytes);
-            memset(output + bytes, 0, minimumOutputBytes - bytes);
+
+        // The OS must save the vector registers on context switches
+        _cpuid(cpu_info, 1);
+        if ((cpu_info[2] & (CPUID_ECX_OSXSAVE | CPUID_ECX_AVX)) != (CPUID_ECX_OSXSAVE | CPUID_ECX_AVX)) {
+            return;
         }
-        return minimumOutputBytes;
+        const uint64_t xcr0 = _xgetbv0();
+
+        _cpuid(cpu_info, 7);
+        HasAVX2 = (cpu_info[1] & CPUID_EBX_AVX2) != 0 &&
+            (xcr0 & XCR0_AVX_STATE) == XCR0_AVX_STATE;
+
+#if defined(SOLINAS64_TRY_AVX512)
+        HasAVX512 = (cpu_info[1] & CPUID_EBX_AVX512F) != 0 &&
+            (xcr0 & XCR0_AVX512_STATE) == XCR0_AVX512_STATE;
+#endif // SOLINAS64_TRY_AVX512
     }
+};
 
-    AppDataReader reader;
-    reader.SetupWorkspace(workspace);
+// Detected on first use, which is thread-safe in C++11
+static const CpuFeatures& GetCpuFeatures()
+{
+    static const CpuFeatures features;
+    return features;
+}
 
-    while (bytes >= 32)
-    {
-        bytes -= 32;
+#endif // SOLINAS64_TRY_AVX2
 
-        uint64_t x0 = Multiply(coeff, reader.ReadNext8Bytes(data));
-        uint64_t x1 = Multiply(coeff, reader.ReadNext8Bytes(data + 8));
-        uint64_t x2 = Multiply(coeff, reader.ReadNext8Bytes(data + 16));
-        uint64_t x3 = Multiply(coeff, reader.ReadNext8Bytes(data + 24));
 
-        data += 32;
+//------------------------------------------------------------------------------
+// Coefficient Forms
 
-        WriteU64_LE(output, x0);
-        WriteU64_LE(output + 8, x1);
-        WriteU64_LE(output + 16, x2);
-        WriteU64_LE(output + 24, x3);
+/*
+    Generator matrices often use a coefficient of 1 (parity rows) or other
+    small powers of two.  For coefficient 2^k the 128-bit product is just the
+    input shifted left by k bits, so the 64x64 multiply can be skipped, and
+    for 1 there is nothing to reduce.  The same reduction as Multiply() is
+    applied to the shifted product, so the results are bit-identical to the
+    general kernels.
 
-        output += 32;
-    }
+    Coefficients that fit in 32 bits need only two of the four 32x32->64
+    partial products, and the high 32 bits of the product are zero, so the
+    final Subtract() in the reduction is skipped as well.
+*/
 
-    while (bytes >= 8)
-    {
-        bytes -= 8;
+enum CoeffForm
+{
+    kCoeffGeneral,  ///< Param = coefficient
+    kCoeffOne,      ///< Param unused
+    kCoeffShift,    ///< Param = k for coefficient 2^k, 0 < k < 64
+    kCoeffSmall     ///< Param = coefficient < 2^32
+};
 
-        uint64_t x0 = Multiply(coeff, reader.ReadNext8Bytes(data));
-        data += 8;
+// Returns the cheapest form for a coefficient and its parameter
+static SOLINAS64_FORCE_INLINE CoeffForm GetCoeffForm(uint64_t coeff, uint64_t& param)
+{
+    param = coeff;
 
-        WriteU64_LE(output, x0);
-        output += 8;
+    if (coeff == 1) {
+        return kCoeffOne;
+    }
+    if (coeff == 0) {
+        return kCoeffGeneral;
+    }
+    if ((coeff & (coeff - 1)) != 0) {
+        return (coeff >> 32) == 0 ? kCoeffSmall : kCoeffGeneral;
     }
 
-    if (bytes > 0)
-    {
-        uint64_t x0 = Multiply(coeff, reader.ReadFinalBytes(data, bytes));
-        WriteU64_LE(output, x0);
-        output += 8;
+    param = 0;
+    while ((coeff >> param) != 1) {
+        ++param;
     }
+    return kCoeffShift;
+}
 
-    // Finalize the overflow bits
-    const unsigned extraWordBytes = reader.FlushAndGetWordCount() * 8;
-    const uint8_t* readPtr = reader.Data;
+// Reduce (p_hi, p_lo) as in Multiply()
+static SOLINAS64_FORCE_INLINE uint64_t Reduce128(uint64_t p_lo, uint64_t p_hi)
+{
+    const uint32_t a2 = static_cast<uint32_t>(p_hi);
+    const uint32_t a3 = static_cast<uint32_t>(p_hi >> 32);
 
-    // Also work on the overflow bits
-    for (unsigned i = 0; i < extraWordBytes; i += 8)
+    const uint64_t t = (static_cast<uint64_t>(a2) << 32) - a2;
+
+    return Subtract(Add(p_lo, t), a3);
+}
+
+// Same result as Multiply(x, coeff) for a coefficient of the given form
+template<int Form>
+static SOLINAS64_FORCE_INLINE uint64_t Scale(uint64_t x, uint64_t param)
+{
+    if (Form == kCoeffOne) {
+        return x;
+    }
+    if (Form == kCoeffShift) {
+        return Reduce128(x << param, x >> (64 - param));
+    }
+    if (Form == kCoeffSmall)
     {
-        WriteU64_LE(
-            output + i,
-            Multiply(
-                coeff,
-                ReadU64_LE(readPtr + i)));
+#if defined(SOLINAS64_MUL_32BIT_LIMBS)
+        // Two of the four 32x32->64 partial products are zero
+        const uint64_t p0 = static_cast<uint64_t>(static_cast<uint32_t>(x)) * static_cast<uint32_t>(param);
+        const uint64_t middle = static_cast<uint64_t>(static_cast<uint32_t>(x >> 32)) * static_cast<uint32_t>(param) + (p0 >> 32);
+        const uint64_t p_lo = (middle << 32) | static_cast<uint32_t>(p0);
+        const uint64_t p_hi = middle >> 32;
+#else
+        uint64_t p_lo, p_hi;
+        CAT_MUL128(p_hi, p_lo, param, x);
+#endif // SOLINAS64_MUL_32BIT_LIMBS
+
+        // p_hi < 2^32 so there is no a3 term to subtract
+        return Add(p_lo, (p_hi << 32) - p_hi);
     }
+    return Multiply(param, x);
+}
 
-    return minimumOutputBytes + extraWordBytes;
+void MulConst::Set(uint64_t coeff)
+{
+    Coeff = coeff;
+    Form = GetCoeffForm(coeff, Param);
 }
 
-unsigned MultiplyAddRegion(
-    const uint8_t* data,
-    unsigned bytes,
-    uint64_t coeff,
-    uint8_t* workspace,
-    uint8_t* output)
+
+//------------------------------------------------------------------------------
+// Extra Bits
+
+#if defined(SOLINAS64_TRY_AVX2)
+
+/*
+    The vector readers find the ambiguous words in a block with one compare,
+    and then emit all of their extra bits with one EmitBits() call instead of
+    a branch per word.  Blocks without ambiguous words skip this, which is a
+    well-predicted branch for typical data.
+
+    kExtraBitTable[(ambiguous << 4) | high] packs the high bits of the
+    ambiguous words among 4 words in word order into the low nibble, with
+    the number of ambiguous words in the high nibble.  Bit i of `ambiguous`
+    and `high` is for word i.
+*/
+static const uint8_t kExtraBitTable[256] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x10, 0x11, 0x10, 0x11, 0x10, 0x11, 0x10, 0x11, 0x10, 0x11, 0x10, 0x11, 0x10, 0x11, 0x10, 0x11,
+    0x10, 0x10, 0x11, 0x11, 0x10, 0x10, 0x11, 0x11, 0x10, 0x10, 0x11, 0x11, 0x10, 0x10, 0x11, 0x11,
+    0x20, 0x21, 0x22, 0x23, 0x20, 0x21, 0x22, 0x23, 0x20, 0x21, 0x22, 0x23, 0x20, 0x21, 0x22, 0x23,
+    0x10, 0x10, 0x10, 0x10, 0x11, 0x11, 0x11, 0x11, 0x10, 0x10, 0x10, 0x10, 0x11, 0x11, 0x11, 0x11,
+    0x20, 0x21, 0x20, 0x21, 0x22, 0x23, 0x22, 0x23, 0x20, 0x21, 0x20, 0x21, 0x22, 0x23, 0x22, 0x23,
+    0x20, 0x20, 0x21, 0x21, 0x22, 0x22, 0x23, 0x23, 0x20, 0x20, 0x21, 0x21, 0x22, 0x22, 0x23, 0x23,
+    0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+    0x20, 0x21, 0x20, 0x21, 0x20, 0x21, 0x20, 0x21, 0x22, 0x23, 0x22, 0x23, 0x22, 0x23, 0x22, 0x23,
+    0x20, 0x20, 0x21, 0x21, 0x20, 0x20, 0x21, 0x21, 0x22, 0x22, 0x23, 0x23, 0x22, 0x22, 0x23, 0x23,
+    0x30, 0x31, 0x32, 0x33, 0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x34, 0x35, 0x36, 0x37,
+    0x20, 0x20, 0x20, 0x20, 0x21, 0x21, 0x21, 0x21, 0x22, 0x22, 0x22, 0x22, 0x23, 0x23, 0x23, 0x23,
+    0x30, 0x31, 0x30, 0x31, 0x32, 0x33, 0x32, 0x33, 0x34, 0x35, 0x34, 0x35, 0x36, 0x37, 0x36, 0x37,
+    0x30, 0x30, 0x31, 0x31, 0x32, 0x32, 0x33, 0x33, 0x34, 0x34, 0x35, 0x35, 0x36, 0x36, 0x37, 0x37,
+    0x40, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x4b, 0x4c, 0x4d, 0x4e, 0x4f
+};
+
+// Emit the extra bits of 4 words
+static SOLINAS64_FORCE_INLINE void EmitExtraBits4(
+    AppDataReader& reader,
+    unsigned ambiguous,
+    unsigned high)
 {
-    const unsigned minimumOutputBytes = (bytes + 7) & ~7u;
+    const unsigned packed = kExtraBitTable[(ambiguous << 4) | high];
+    reader.EmitBits(packed & 15, static_cast<int>(packed >> 4));
+}
 
-    // Special fast case
-    if (coeff == 0)
-    {
-        // TODO: Add a special case for coeff = 1
-        return minimumOutputBytes;
+// Emit the extra bits of 8 words
+static SOLINAS64_FORCE_INLINE void EmitExtraBits8(
+    AppDataReader& reader,
+    unsigned ambiguous,
+    unsigned high)
+{
+    const unsigned lo = kExtraBitTable[((ambiguous & 15) << 4) | (high & 15)];
+    const unsigned hi = kExtraBitTable[(ambiguous & 0xf0) | (high >> 4)];
+    reader.EmitBits((lo & 15) | ((hi & 15) << (lo >> 4)), static_cast<int>((lo >> 4) + (hi >> 4)));
+}
+
+#endif // SOLINAS64_TRY_AVX2
+
+
+//------------------------------------------------------------------------------
+// Memory Hints
+
+/// Bytes ahead of the current block that kHintPrefetch fetches.
+/// This is far enough ahead to cover memory latency at the kernel speed
+static const unsigned kPrefetchBytes = 8 * 64;
+
+/// Returns true if kHintStreamOutput is set and the output is aligned for
+/// the non-temporal stores of the given vector size
+static SOLINAS64_FORCE_INLINE bool CanStreamOutput(
+    unsigned hints,
+    const uint8_t* output,
+    unsigned alignment)
+{
+    return (hints & kHintStreamOutput) != 0 &&
+        (reinterpret_cast<uintptr_t>(output) & (alignment - 1)) == 0;
+}
+
+
+//------------------------------------------------------------------------------
+// AVX2 Kernels
+
+#if defined(SOLINAS64_TRY_AVX2)
+
+/*
+    The vector kernels process 4 (AVX2) or 8 (AVX-512) words at a time and
+    perform exactly the same steps as the scalar code for each lane, so the
+    output is bit-identical regardless of which kernel ran:
+
+    The 64x64->128 product is formed from four 32x32->64 vpmuludq products
+    as in Emulate64x64to128(), and then reduced as in Multiply() using the
+    special form of p:  2^64 = 2^32 - 1 (mod p), 2^96 = -1 (mod p).
+
+    Ambiguous words emit their extra bits in the same order as
+    ReadNext8Bytes(), packed with kExtraBitTable.
+*/
+
+// Store 4 words, bypassing the cache if `stream` is set.
+// Precondition: If `stream` is set, out is 32-byte aligned
+SOLINAS64_FORCE_INLINE SOLINAS64_TARGET_AVX2 void Store_AVX2(uint8_t* out, __m256i x, bool stream)
+{
+    if (stream) {
+        _mm256_stream_si256(reinterpret_cast<__m256i*>(out), x);
+    } else {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), x);
     }
+}
 
-    AppDataReader reader;
-    reader.SetupWorkspace(workspace);
+// Unsigned x < y for each lane
+SOLINAS64_FORCE_INLINE SOLINAS64_TARGET_AVX2 __m256i LessThan_AVX2(__m256i x, __m256i y)
+{
+    const __m256i sign = _mm256_set1_epi64x((int64_t)0x8000000000000000ULL);
+    return _mm256_cmpgt_epi64(_mm256_xor_si256(y, sign), _mm256_xor_si256(x, sign));
+}
 
-    /**** This loop takes over 95% of the execution time. ****/
-    while (bytes >= 32)
-    {
-        bytes -= 32;
+// Add() for each lane
+SOLINAS64_FORCE_INLINE SOLINAS64_TARGET_AVX2 __m256i Add_AVX2(__m256i x, __m256i y)
+{
+    const __m256i subC = _mm256_set1_epi64x(kPrimeSubC);
+    const __m256i r = _mm256_add_epi64(x, y);
+    const __m256i c = _mm256_and_si256(LessThan_AVX2(r, y), subC);
+    const __m256i s = _mm256_add_epi64(r, c);
+    return _mm256_add_epi64(s, _mm256_and_si256(LessThan_AVX2(s, c), subC));
+}
 
-        WriteU64_LE(output, Add(Multiply(coeff, reader.ReadNext8Bytes(data)), ReadU64_LE(output)));
-        WriteU64_LE(output + 8, Add(Multiply(coeff, reader.ReadNext8Bytes(data + 8)), ReadU64_LE(output + 8)));
-        WriteU64_LE(output + 16, Add(Multiply(coeff, reader.ReadNext8Bytes(data + 16)), ReadU64_LE(output + 16)));
-        WriteU64_LE(output + 24, Add(Multiply(coeff, reader.ReadNext8Bytes(data + 24)), ReadU64_LE(output + 24)));
+// Subtract() for each lane
+SOLINAS64_FORCE_INLINE SOLINAS64_TARGET_AVX2 __m256i Subtract_AVX2(__m256i x, __m256i y)
+{
+    const __m256i subC = _mm256_set1_epi64x(kPrimeSubC);
+    const __m256i r = _mm256_sub_epi64(x, y);
+    const __m256i b = _mm256_and_si256(LessThan_AVX2(x, y), subC);
+    const __m256i s = _mm256_sub_epi64(r, b);
+    return _mm256_sub_epi64(s, _mm256_and_si256(LessThan_AVX2(r, b), subC));
+}
 
-        data += 32;
-        output += 32;
+// Add() and Subtract() for each lane, with the single correction that is
+// enough when y < p, as for the terms in Reduce128()
+SOLINAS64_FORCE_INLINE SOLINAS64_TARGET_AVX2 __m256i AddOnce_AVX2(__m256i x, __m256i y)
+{
+    const __m256i subC = _mm256_set1_epi64x(kPrimeSubC);
+    const __m256i r = _mm256_add_epi64(x, y);
+    return _mm256_add_epi64(r, _mm256_and_si256(LessThan_AVX2(r, y), subC));
+}
+SOLINAS64_FORCE_INLINE SOLINAS64_TARGET_AVX2 __m256i SubtractOnce_AVX2(__m256i x, __m256i y)
+{
+    const __m256i subC = _mm256_set1_epi64x(kPrimeSubC);
+    const __m256i r = _mm256_sub_epi64(x, y);
+    return _mm256_sub_epi64(r, _mm256_and_si256(LessThan_AVX2(x, y), subC));
+}
+
+// Reduce128() for each lane
+SOLINAS64_FORCE_INLINE SOLINAS64_TARGET_AVX2 __m256i Reduce128_AVX2(__m256i r_lo, __m256i r_hi)
+{
+    const __m256i lowMask = _mm256_set1_epi64x(0xffffffff);
+    const __m256i a2 = _mm256_and_si256(r_hi, lowMask);
+    const __m256i a3 = _mm256_srli_epi64(r_hi, 32);
+    const __m256i t = _mm256_sub_epi64(_mm256_slli_epi64(a2, 32), a2);
+
+    return SubtractOnce_AVX2(AddOnce_AVX2(r_lo, t), a3);
+}
+
+// Multiply() for each lane, where y_hi = y >> 32
+SOLINAS64_FORCE_INLINE SOLINAS64_TARGET_AVX2 __m256i Multiply_AVX2(__m256i x, __m256i y, __m256i y_hi)
+{
+    const __m256i lowMask = _mm256_set1_epi64x(0xffffffff);
+    const __m256i x_hi = _mm256_srli_epi64(x, 32);
+
+    // Calculate 32x32->64 bit products
+    const __m256i p11 = _mm256_mul_epu32(x_hi, y_hi);
+    const __m256i p01 = _mm256_mul_epu32(x, y_hi);
+    const __m256i p10 = _mm256_mul_epu32(x_hi, y);
+    const __m256i p00 = _mm256_mul_epu32(x, y);
+
+    // 64-bit product + two 32-bit values
+    const __m256i middle = _mm256_add_epi64(p10, _mm256_add_epi64(
+        _mm256_srli_epi64(p00, 32), _mm256_and_si256(p01, lowMask)));
+
+    // 64-bit product + two 32-bit values
+    const __m256i r_hi = _mm256_add_epi64(p11, _mm256_add_epi64(
+        _mm256_srli_epi64(middle, 32), _mm256_srli_epi64(p01, 32)));
+    const __m256i r_lo = _mm256_or_si256(
+        _mm256_slli_epi64(middle, 32), _mm256_and_si256(p00, lowMask));
+
+    return Reduce128_AVX2(r_lo, r_hi);
+}
+
+// Multiply() for each lane, where y < 2^32
+SOLINAS64_FORCE_INLINE SOLINAS64_TARGET_AVX2 __m256i Multiply32_AVX2(__m256i x, __m256i y)
+{
+    const __m256i lowMask = _mm256_set1_epi64x(0xffffffff);
+
+    const __m256i p10 = _mm256_mul_epu32(_mm256_srli_epi64(x, 32), y);
+    const __m256i p00 = _mm256_mul_epu32(x, y);
+    const __m256i middle = _mm256_add_epi64(p10, _mm256_srli_epi64(p00, 32));
+
+    // The high word is a2 alone, and a3 = 0
+    const __m256i a2 = _mm256_srli_epi64(middle, 32);
+    const __m256i r_lo = _mm256_or_si256(
+        _mm256_slli_epi64(middle, 32), _mm256_and_si256(p00, lowMask));
+    const __m256i t = _mm256_sub_epi64(_mm256_slli_epi64(a2, 32), a2);
+
+    return AddOnce_AVX2(r_lo, t);
+}
+
+// Scale() for each lane: For kCoeffShift, y = k and y_hi = 64 - k
+template<int Form>
+SOLINAS64_FORCE_INLINE SOLINAS64_TARGET_AVX2 __m256i Scale_AVX2(__m256i x, __m256i y, __m256i y_hi)
+{
+    if (Form == kCoeffOne) {
+        return x;
     }
+    if (Form == kCoeffShift) {
+        return Reduce128_AVX2(_mm256_sllv_epi64(x, y), _mm256_srlv_epi64(x, y_hi));
+    }
+    if (Form == kCoeffSmall) {
+        return Multiply32_AVX2(x, y);
+    }
+    return Multiply_AVX2(x, y, y_hi);
+}
 
-    while (bytes >= 8)
-    {
-        bytes -= 8;
+// Scale_AVX2() parameters
+template<int Form>
+SOLINAS64_FORCE_INLINE SOLINAS64_TARGET_AVX2 void SetupScale_AVX2(uint64_t param, __m256i& y, __m256i& y_hi)
+{
+    y = _mm256_set1_epi64x(param);
+    if (Form == kCoeffShift) {
+        y_hi = _mm256_set1_epi64x(64 - param);
+    } else {
+        y_hi = _mm256_srli_epi64(y, 32);
+    }
+}
 
-        uint64_t x0 = Add(Multiply(coeff, reader.ReadNext8Bytes(data)), ReadU64_LE(output));
-        data += 8;
+// ReadNext8Bytes() for 4 words
+SOLINAS64_FORCE_INLINE SOLINAS64_TARGET_AVX2 __m256i ReadNext32Bytes_AVX2(
+    AppDataReader& reader,
+    const uint8_t* data)
+{
+    const __m256i ambiguityMask = _mm256_set1_epi64x(kAmbiguityMask);
+    const __m256i highBit = _mm256_set1_epi64x((int64_t)~kHighBitMask);
 
-        WriteU64_LE(output, x0);
-        output += 8;
+    const __m256i word = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+    const __m256i ambiguous = _mm256_cmpeq_epi64(
+        _mm256_and_si256(word, ambiguityMask), ambiguityMask);
+
+    // Most data has no ambiguous words, so skip the table lookup for those
+    if (_mm256_testz_si256(ambiguous, ambiguous)) {
+        return word;
     }
 
-    if (bytes > 0)
+    // Emit the extra bits in order
+    EmitExtraBits4(
+        reader,
+        static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(ambiguous))),
+        static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(word))));
+
+    // Clear high bit of ambiguous words
+    return _mm256_andnot_si256(_mm256_and_si256(ambiguous, highBit), word);
+}
+
+template<int Form>
+static SOLINAS64_TARGET_AVX2 unsigned MultiplyRegion_AVX2(
+    AppDataReader& reader,
+    const uint8_t* data,
+    unsigned bytes,
+    uint64_t param,
+    uint8_t* output,
+    unsigned hints)
+{
+    __m256i y, y_hi;
+    SetupScale_AVX2<Form>(param, y, y_hi);
+    const bool prefetch = (hints & kHintPrefetch) != 0;
+    const bool stream = CanStreamOutput(hints, output, 32);
+    unsigned processed = 0;
+
+    while (bytes - processed >= 64)
     {
-        uint64_t x0 = Add(Multiply(coeff, reader.ReadFinalBytes(data, bytes)), ReadU64_LE(output));
+        if (prefetch) {
+            SOLINAS64_PREFETCH(data + processed + kPrefetchBytes);
+        }
 
-        WriteU64_LE(output, x0);
-        output += 8;
+        const __m256i x0 = Scale_AVX2<Form>(ReadNext32Bytes_AVX2(reader, data + processed), y, y_hi);
+        const __m256i x1 = Scale_AVX2<Form>(ReadNext32Bytes_AVX2(reader, data + processed + 32), y, y_hi);
+
+        Store_AVX2(output + processed, x0, stream);
+        Store_AVX2(output + processed + 32, x1, stream);
+
+        processed += 64;
     }
 
-    // Finalize the overflow bits
-    const unsigned extraWordBytes = reader.FlushAndGetWordCount() * 8;
-    const uint8_t* readPtr = reader.Data;
+    if (stream) {
+        _mm_sfence();
+    }
+    return processed;
+}
+
+template<int Form>
+static SOLINAS64_TARGET_AVX2 unsigned MultiplyAddRegion_AVX2(
+    AppDataReader& reader,
+    const uint8_t* data,
+    unsigned bytes,
+    uint64_t param,
+    uint8_t* output,
+    unsigned hints)
+{
+    __m256i y, y_hi;
+    SetupScale_AVX2<Form>(param, y, y_hi);
+    const bool prefetch = (hints & kHintPrefetch) != 0;
+    const bool stream = CanStreamOutput(hints, output, 32);
+    unsigned processed = 0;
+
+    while (bytes - processed >= 64)
+    {
+        uint8_t* out = output + processed;
+
+        if (prefetch)
+        {
+            SOLINAS64_PREFETCH(data + processed + kPrefetchBytes);
+            SOLINAS64_PREFETCH(out + kPrefetchBytes);
+        }
+
+        const __m256i x0 = Scale_AVX2<Form>(ReadNext32Bytes_AVX2(reader, data + processed), y, y_hi);
+        const __m256i x1 = Scale_AVX2<Form>(ReadNext32Bytes_AVX2(reader, data + processed + 32), y, y_hi);
+
+        Store_AVX2(out, Add_AVX2(x0, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(out))), stream);
+        Store_AVX2(out + 32, Add_AVX2(x1, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(out + 32))), stream);
+
+        processed += 64;
+    }
+
+    if (stream) {
+        _mm_sfence();
+    }
+    return processed;
+}
+
+static SOLINAS64_TARGET_AVX2 unsigned MultiplyAddRegionMulti_AVX2(
+    AppDataReader& reader,
+    const uint8_t* data,
+    unsigned bytes,
+    const uint64_t* coeffs,
+    unsigned count,
+    uint8_t* const* outputs,
+    unsigned outputOffset)
+{
+    unsigned processed = 0;
+
+    while (bytes - processed >= 32)
+    {
+        const __m256i x = ReadNext32Bytes_AVX2(reader, data + processed);
+
+        for (unsigned i = 0; i < count; ++i)
+        {
+            const __m256i y = _mm256_set1_epi64x(coeffs[i]);
+            const __m256i y_hi = _mm256_srli_epi64(y, 32);
+            __m256i* out = reinterpret_cast<__m256i*>(outputs[i] + outputOffset + processed);
+
+            _mm256_storeu_si256(out, Add_AVX2(Multiply_AVX2(x, y, y_hi), _mm256_loadu_si256(out)));
+        }
+
+        processed += 32;
+    }
+
+    return processed;
+}
+
+static SOLINAS64_TARGET_AVX2 unsigned MultiplyWords_AVX2(
+    const uint8_t* words,
+    unsigned bytes,
+    uint64_t coeff,
+    uint8_t* output,
+    bool add)
+{
+    const __m256i y = _mm256_set1_epi64x(coeff);
+    const __m256i y_hi = _mm256_srli_epi64(y, 32);
+    unsigned processed = 0;
+
+    while (bytes - processed >= 32)
+    {
+        __m256i* out = reinterpret_cast<__m256i*>(output + processed);
+
+        __m256i x = Multiply_AVX2(_mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(words + processed)), y, y_hi);
+        if (add) {
+            x = Add_AVX2(x, _mm256_loadu_si256(out));
+        }
+        _mm256_storeu_si256(out, x);
+
+        processed += 32;
+    }
+
+    return processed;
+}
+
+static SOLINAS64_TARGET_AVX2 unsigned RestoreWords_AVX2(
+    AppDataWriter& writer,
+    const uint8_t* words,
+    unsigned bytes,
+    uint8_t* output)
+{
+    const __m256i prime = _mm256_set1_epi64x((int64_t)kPrime);
+    const __m256i ambiguityMask = _mm256_set1_epi64x(kAmbiguityMask);
+    unsigned processed = 0;
+
+    while (bytes - processed >= 32)
+    {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + processed));
+
+        // Finalize() each lane
+        x = _mm256_sub_epi64(x, _mm256_andnot_si256(LessThan_AVX2(x, prime), prime));
+
+        const __m256i ambiguous = _mm256_cmpeq_epi64(
+            _mm256_and_si256(x, ambiguityMask), ambiguityMask);
+
+        if (_mm256_testz_si256(ambiguous, ambiguous)) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(output + processed), x);
+        }
+        else
+        {
+            // Restore the high bits in order
+            for (unsigned i = 0; i < 32; i += 8) {
+                writer.WriteNext8Bytes(output + processed + i, ReadU64_LE(words + processed + i));
+            }
+        }
+
+        processed += 32;
+    }
+
+    return processed;
+}
+
+// NTTStageDIF() or NTTStageDIT() for one block, 4 butterflies at a time
+template<bool DIT>
+static SOLINAS64_TARGET_AVX2 unsigned NTTButterflies_AVX2(
+    uint64_t* x,
+    uint64_t* y,
+    const uint64_t* twiddles,
+    unsigned half)
+{
+    unsigned j = 0;
+
+    for (; half - j >= 4; j += 4)
+    {
+        const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x + j));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(y + j));
+        const __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(twiddles + j));
+        const __m256i w_hi = _mm256_srli_epi64(w, 32);
+
+        if (DIT)
+        {
+            b = Multiply_AVX2(b, w, w_hi);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(x + j), Add_AVX2(a, b));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(y + j), Subtract_AVX2(a, b));
+        }
+        else
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(x + j), Add_AVX2(a, b));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(y + j), Multiply_AVX2(Subtract_AVX2(a, b), w, w_hi));
+        }
+    }
+
+    return j;
+}
+
+// MultiplyWordsFp2() for 2 elements at a time.  Each output word pairs one
+// product of the input with c0 and one of the swapped input coordinates:
+// (x0 * c0 + x1 * c1n, x1 * c0 + x0 * c1), where c1n = 7 * c1
+static SOLINAS64_TARGET_AVX2 unsigned MultiplyWordsFp2_AVX2(
+    const uint8_t* words,
+    unsigned bytes,
+    uint64_t c0,
+    uint64_t c1,
+    uint64_t c1n,
+    uint8_t* output,
+    bool add)
+{
+    const __m256i y0 = _mm256_set1_epi64x(c0);
+    const __m256i y0_hi = _mm256_srli_epi64(y0, 32);
+    const __m256i y1 = _mm256_set_epi64x(c1, c1n, c1, c1n);
+    const __m256i y1_hi = _mm256_srli_epi64(y1, 32);
+    unsigned processed = 0;
+
+    while (bytes - processed >= 32)
+    {
+        __m256i* out = reinterpret_cast<__m256i*>(output + processed);
+
+        const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + processed));
+        const __m256i swapped = _mm256_shuffle_epi32(x, _MM_SHUFFLE(1, 0, 3, 2));
+
+        __m256i r = Add_AVX2(Multiply_AVX2(x, y0, y0_hi), Multiply_AVX2(swapped, y1, y1_hi));
+        if (add) {
+            r = Add_AVX2(r, _mm256_loadu_si256(out));
+        }
+        _mm256_storeu_si256(out, r);
+
+        processed += 32;
+    }
+
+    return processed;
+}
+
+// PolyHashRegion() for 64 bytes at a time: 8 lanes of h = h * key^8 + x
+static SOLINAS64_TARGET_AVX2 unsigned PolyHashRegion_AVX2(
+    AppDataReader& reader,
+    const uint8_t* data,
+    unsigned bytes,
+    uint64_t key8,
+    uint64_t* lanes)
+{
+    const __m256i k = _mm256_set1_epi64x(key8);
+    const __m256i k_hi = _mm256_srli_epi64(k, 32);
+    __m256i h0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lanes));
+    __m256i h1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lanes + 4));
+    unsigned processed = 0;
+
+    // h = h * k^2 + x0 * k + x1, with one multiply on the chain through h
+    const __m256i k2 = _mm256_set1_epi64x(Multiply(key8, key8));
+    const __m256i k2_hi = _mm256_srli_epi64(k2, 32);
+
+    while (bytes - processed >= 128)
+    {
+        const __m256i x0 = ReadNext32Bytes_AVX2(reader, data + processed);
+        const __m256i x1 = ReadNext32Bytes_AVX2(reader, data + processed + 32);
+        const __m256i y0 = ReadNext32Bytes_AVX2(reader, data + processed + 64);
+        const __m256i y1 = ReadNext32Bytes_AVX2(reader, data + processed + 96);
+
+        h0 = Add_AVX2(Multiply_AVX2(h0, k2, k2_hi), Add_AVX2(Multiply_AVX2(x0, k, k_hi), y0));
+        h1 = Add_AVX2(Multiply_AVX2(h1, k2, k2_hi), Add_AVX2(Multiply_AVX2(x1, k, k_hi), y1));
+
+        processed += 128;
+    }
+
+    while (bytes - processed >= 64)
+    {
+        h0 = Add_AVX2(Multiply_AVX2(h0, k, k_hi), ReadNext32Bytes_AVX2(reader, data + processed));
+        h1 = Add_AVX2(Multiply_AVX2(h1, k, k_hi), ReadNext32Bytes_AVX2(reader, data + processed + 32));
+
+        processed += 64;
+    }
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), h0);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes + 4), h1);
+    return processed;
+}
+
+#endif // SOLINAS64_TRY_AVX2
+
+
+//------------------------------------------------------------------------------
+// AVX-512 Kernels
+
+#if defined(SOLINAS64_TRY_AVX512)
+
+/*
+    GCC builds the unmasked forms of the shift, multiply and shuffle
+    intrinsics from _mm512_undefined_epi32(), whose self-initialized __Y is
+    reported by -Wmaybe-uninitialized wherever a kernel gets inlined, such as
+    into the dispatch functions in SOLINAS64_ENABLE_STATS builds.  A pragma
+    around this section does not reach those.  The zero-masked forms with every
+    lane selected compile to the same unmasked instructions without it.
+*/
+SOLINAS64_FORCE_INLINE SOLINAS64_TARGET_AVX512 __m512i ShiftRight32_AVX512(__m512i x)
+{
+    return _mm512_maskz_srli_epi64(0xff, x, 32);
+}
+SOLINAS64_FORCE_INLINE SOLINAS64_TARGET_AVX512 __m512i ShiftLeft32_AVX512(__m512i x)
+{
+    return _mm512_maskz_slli_epi64(0xff, x, 32);
+}
+SOLINAS64_FORCE_INLINE SOLINAS64_TARGET_AVX512 __m512i ShiftRightV_AVX512(__m512i x, __m512i count)
+{
+    return _mm512_maskz_srlv_epi64(0xff, x, count);
+}
+SOLINAS64_FORCE_INLINE SOLINAS64_TARGET_AVX512 __m512i ShiftLeftV_AVX512(__m512i x, __m512i count)
+{
+    return _mm512_maskz_sllv_epi64(0xff, x, count);
+}
+
+// 32x32->64 product of the low halves of each lane
+SOLINAS64_FORCE_INLINE SOLINAS64_TARGET_AVX512 __m512i MultiplyLow32_AVX512(__m512i x, __m512i y)
+{
+    return _mm512_maskz_mul_epu32(0xff, x, y);
+}
+
+// Store 8 words, bypassing the cache if `stream` is set.
+// Precondition: If `stream` is set, out is 64-byte aligned
+SOLINAS64_FORCE_INLINE SOLINAS64_TARGET_AVX512 void Store_AVX512(uint8_t* out, __m512i x, bool stream)
+{
+    if (stream) {
+        _mm512_stream_si512(reinterpret_cast<__m512i*>(out), x);
+    } else {
+        _mm512_storeu_si512(out, x);
+    }
+}
+
+// Add() for each lane
+SOLINAS64_FORCE_INLINE SOLINAS64_TARGET_AVX512 __m512i Add_AVX512(__m512i x, __m512i y)
+{
+    const __m512i subC = _mm512_set1_epi64(kPrimeSubC);
+    const __m512i r = _mm512_add_epi64(x, y);
+    const __mmask8 c = _mm512_cmplt_epu64_mask(r, y);
+    const __m512i s = _mm512_mask_add_epi64(r, c, r, subC);
+    return _mm512_mask_add_epi64(s, _mm512_mask_cmplt_epu64_mask(c, s, subC), s, subC);
+}
+
+// Subtract() for each lane
+SOLINAS64_FORCE_INLINE SOLINAS64_TARGET_AVX512 __m512i Subtract_AVX512(__m512i x, __m512i y)
+{
+    const __m512i subC = _mm512_set1_epi64(kPrimeSubC);
+    const __m512i r = _mm512_sub_epi64(x, y);
+    const __mmask8 b = _mm512_cmplt_epu64_mask(x, y);
+    const __m512i s = _mm512_mask_sub_epi64(r, b, r, subC);
+    return _mm512_mask_sub_epi64(s, _mm512_mask_cmplt_epu64_mask(b, r, subC), s, subC);
+}
+
+// Add() and Subtract() for each lane, with the single correction that is
+// enough when y < p, as for the terms in Reduce128()
+SOLINAS64_FORCE_INLINE SOLINAS64_TARGET_AVX512 __m512i AddOnce_AVX512(__m512i x, __m512i y)
+{
+    const __m512i subC = _mm512_set1_epi64(kPrimeSubC);
+    const __m512i r = _mm512_add_epi64(x, y);
+    return _mm512_mask_add_epi64(r, _mm512_cmplt_epu64_mask(r, y), r, subC);
+}
+SOLINAS64_FORCE_INLINE SOLINAS64_TARGET_AVX512 __m512i SubtractOnce_AVX512(__m512i x, __m512i y)
+{
+    const __m512i subC = _mm512_set1_epi64(kPrimeSubC);
+    const __m512i r = _mm512_sub_epi64(x, y);
+    return _mm512_mask_sub_epi64(r, _mm512_cmplt_epu64_mask(x, y), r, subC);
+}
+
+// Reduce128() for each lane
+SOLINAS64_FORCE_INLINE SOLINAS64_TARGET_AVX512 __m512i Reduce128_AVX512(__m512i r_lo, __m512i r_hi)
+{
+    const __m512i lowMask = _mm512_set1_epi64(0xffffffff);
+    const __m512i a2 = _mm512_and_si512(r_hi, lowMask);
+    const __m512i a3 = ShiftRight32_AVX512(r_hi);
+    const __m512i t = _mm512_sub_epi64(ShiftLeft32_AVX512(a2), a2);
+
+    return SubtractOnce_AVX512(AddOnce_AVX512(r_lo, t), a3);
+}
+
+// Multiply() for each lane, where y_hi = y >> 32
+SOLINAS64_FORCE_INLINE SOLINAS64_TARGET_AVX512 __m512i Multiply_AVX512(__m512i x, __m512i y, __m512i y_hi)
+{
+    const __m512i lowMask = _mm512_set1_epi64(0xffffffff);
+    const __m512i x_hi = ShiftRight32_AVX512(x);
+
+    // Calculate 32x32->64 bit products
+    const __m512i p11 = MultiplyLow32_AVX512(x_hi, y_hi);
+    const __m512i p01 = MultiplyLow32_AVX512(x, y_hi);
+    const __m512i p10 = MultiplyLow32_AVX512(x_hi, y);
+    const __m512i p00 = MultiplyLow32_AVX512(x, y);
+
+    // 64-bit product + two 32-bit values
+    const __m512i middle = _mm512_add_epi64(p10, _mm512_add_epi64(
+        ShiftRight32_AVX512(p00), _mm512_and_si512(p01, lowMask)));
+
+    // 64-bit product + two 32-bit values
+    const __m512i r_hi = _mm512_add_epi64(p11, _mm512_add_epi64(
+        ShiftRight32_AVX512(middle), ShiftRight32_AVX512(p01)));
+    const __m512i r_lo = _mm512_or_si512(
+        ShiftLeft32_AVX512(middle), _mm512_and_si512(p00, lowMask));
+
+    return Reduce128_AVX512(r_lo, r_hi);
+}
+
+// Multiply() for each lane, where y < 2^32
+SOLINAS64_FORCE_INLINE SOLINAS64_TARGET_AVX512 __m512i Multiply32_AVX512(__m512i x, __m512i y)
+{
+    const __m512i lowMask = _mm512_set1_epi64(0xffffffff);
+
+    const __m512i p10 = MultiplyLow32_AVX512(ShiftRight32_AVX512(x), y);
+    const __m512i p00 = MultiplyLow32_AVX512(x, y);
+    const __m512i middle = _mm512_add_epi64(p10, ShiftRight32_AVX512(p00));
+
+    // The high word is a2 alone, and a3 = 0
+    const __m512i a2 = ShiftRight32_AVX512(middle);
+    const __m512i r_lo = _mm512_or_si512(
+        ShiftLeft32_AVX512(middle), _mm512_and_si512(p00, lowMask));
+    const __m512i t = _mm512_sub_epi64(ShiftLeft32_AVX512(a2), a2);
+
+    return AddOnce_AVX512(r_lo, t);
+}
+
+// Scale() for each lane: For kCoeffShift, y = k and y_hi = 64 - k
+template<int Form>
+SOLINAS64_FORCE_INLINE SOLINAS64_TARGET_AVX512 __m512i Scale_AVX512(__m512i x, __m512i y, __m512i y_hi)
+{
+    if (Form == kCoeffOne) {
+        return x;
+    }
+    if (Form == kCoeffShift) {
+        return Reduce128_AVX512(ShiftLeftV_AVX512(x, y), ShiftRightV_AVX512(x, y_hi));
+    }
+    if (Form == kCoeffSmall) {
+        return Multiply32_AVX512(x, y);
+    }
+    return Multiply_AVX512(x, y, y_hi);
+}
+
+// Scale_AVX512() parameters
+template<int Form>
+SOLINAS64_FORCE_INLINE SOLINAS64_TARGET_AVX512 void SetupScale_AVX512(uint64_t param, __m512i& y, __m512i& y_hi)
+{
+    y = _mm512_set1_epi64(param);
+    if (Form == kCoeffShift) {
+        y_hi = _mm512_set1_epi64(64 - param);
+    } else {
+        y_hi = ShiftRight32_AVX512(y);
+    }
+}
+
+// ReadNext8Bytes() for 8 words
+SOLINAS64_FORCE_INLINE SOLINAS64_TARGET_AVX512 __m512i ReadNext64Bytes_AVX512(
+    AppDataReader& reader,
+    const uint8_t* data)
+{
+    const __m512i ambiguityMask = _mm512_set1_epi64(kAmbiguityMask);
+    const __m512i highBitMask = _mm512_set1_epi64(kHighBitMask);
+
+    const __m512i word = _mm512_loadu_si512(data);
+    const __mmask8 ambiguous = _mm512_cmpeq_epu64_mask(
+        _mm512_and_si512(word, ambiguityMask), ambiguityMask);
+
+    // Most data has no ambiguous words, so skip the table lookup for those
+    if (ambiguous == 0) {
+        return word;
+    }
+
+    // Emit the extra bits in order
+    const __mmask8 high = _mm512_cmplt_epi64_mask(word, _mm512_setzero_si512());
+    EmitExtraBits8(reader, ambiguous, high);
+
+    // Clear high bit of ambiguous words
+    return _mm512_mask_and_epi64(word, ambiguous, word, highBitMask);
+}
+
+template<int Form>
+static SOLINAS64_TARGET_AVX512 unsigned MultiplyRegion_AVX512(
+    AppDataReader& reader,
+    const uint8_t* data,
+    unsigned bytes,
+    uint64_t param,
+    uint8_t* output,
+    unsigned hints)
+{
+    __m512i y, y_hi;
+    SetupScale_AVX512<Form>(param, y, y_hi);
+    const bool prefetch = (hints & kHintPrefetch) != 0;
+    const bool stream = CanStreamOutput(hints, output, 64);
+    unsigned processed = 0;
+
+    while (bytes - processed >= 64)
+    {
+        if (prefetch) {
+            SOLINAS64_PREFETCH(data + processed + kPrefetchBytes);
+        }
+
+        const __m512i x = Scale_AVX512<Form>(ReadNext64Bytes_AVX512(reader, data + processed), y, y_hi);
+        Store_AVX512(output + processed, x, stream);
+
+        processed += 64;
+    }
+
+    if (stream) {
+        _mm_sfence();
+    }
+    return processed;
+}
+
+template<int Form>
+static SOLINAS64_TARGET_AVX512 unsigned MultiplyAddRegion_AVX512(
+    AppDataReader& reader,
+    const uint8_t* data,
+    unsigned bytes,
+    uint64_t param,
+    uint8_t* output,
+    unsigned hints)
+{
+    __m512i y, y_hi;
+    SetupScale_AVX512<Form>(param, y, y_hi);
+    const bool prefetch = (hints & kHintPrefetch) != 0;
+    const bool stream = CanStreamOutput(hints, output, 64);
+    unsigned processed = 0;
+
+    while (bytes - processed >= 64)
+    {
+        uint8_t* out = output + processed;
+
+        if (prefetch)
+        {
+            SOLINAS64_PREFETCH(data + processed + kPrefetchBytes);
+            SOLINAS64_PREFETCH(out + kPrefetchBytes);
+        }
+
+        const __m512i x = Scale_AVX512<Form>(ReadNext64Bytes_AVX512(reader, data + processed), y, y_hi);
+        Store_AVX512(out, Add_AVX512(x, _mm512_loadu_si512(out)), stream);
+
+        processed += 64;
+    }
+
+    if (stream) {
+        _mm_sfence();
+    }
+    return processed;
+}
+
+static SOLINAS64_TARGET_AVX512 unsigned MultiplyAddRegionMulti_AVX512(
+    AppDataReader& reader,
+    const uint8_t* data,
+    unsigned bytes,
+    const uint64_t* coeffs,
+    unsigned count,
+    uint8_t* const* outputs,
+    unsigned outputOffset)
+{
+    unsigned processed = 0;
+
+    while (bytes - processed >= 64)
+    {
+        const __m512i x = ReadNext64Bytes_AVX512(reader, data + processed);
+
+        for (unsigned i = 0; i < count; ++i)
+        {
+            const __m512i y = _mm512_set1_epi64(coeffs[i]);
+            const __m512i y_hi = ShiftRight32_AVX512(y);
+            uint8_t* out = outputs[i] + outputOffset + processed;
+
+            _mm512_storeu_si512(out, Add_AVX512(Multiply_AVX512(x, y, y_hi), _mm512_loadu_si512(out)));
+        }
+
+        processed += 64;
+    }
+
+    return processed;
+}
+
+static SOLINAS64_TARGET_AVX512 unsigned MultiplyWords_AVX512(
+    const uint8_t* words,
+    unsigned bytes,
+    uint64_t coeff,
+    uint8_t* output,
+    bool add)
+{
+    const __m512i y = _mm512_set1_epi64(coeff);
+    const __m512i y_hi = ShiftRight32_AVX512(y);
+    unsigned processed = 0;
+
+    while (bytes - processed >= 64)
+    {
+        uint8_t* out = output + processed;
+
+        __m512i x = Multiply_AVX512(_mm512_loadu_si512(words + processed), y, y_hi);
+        if (add) {
+            x = Add_AVX512(x, _mm512_loadu_si512(out));
+        }
+        _mm512_storeu_si512(out, x);
+
+        processed += 64;
+    }
+
+    return processed;
+}
+
+static SOLINAS64_TARGET_AVX512 unsigned RestoreWords_AVX512(
+    AppDataWriter& writer,
+    const uint8_t* words,
+    unsigned bytes,
+    uint8_t* output)
+{
+    const __m512i prime = _mm512_set1_epi64(kPrime);
+    const __m512i ambiguityMask = _mm512_set1_epi64(kAmbiguityMask);
+    unsigned processed = 0;
+
+    while (bytes - processed >= 64)
+    {
+        __m512i x = _mm512_loadu_si512(words + processed);
+
+        // Finalize() each lane
+        x = _mm512_mask_sub_epi64(x, _mm512_cmpge_epu64_mask(x, prime), x, prime);
+
+        const __mmask8 ambiguous = _mm512_cmpeq_epu64_mask(
+            _mm512_and_si512(x, ambiguityMask), ambiguityMask);
+
+        if (ambiguous == 0) {
+            _mm512_storeu_si512(output + processed, x);
+        }
+        else
+        {
+            // Restore the high bits in order
+            for (unsigned i = 0; i < 64; i += 8) {
+                writer.WriteNext8Bytes(output + processed + i, ReadU64_LE(words + processed + i));
+            }
+        }
+
+        processed += 64;
+    }
+
+    return processed;
+}
+
+// NTTStageDIF() or NTTStageDIT() for one block, 8 butterflies at a time
+template<bool DIT>
+static SOLINAS64_TARGET_AVX512 unsigned NTTButterflies_AVX512(
+    uint64_t* x,
+    uint64_t* y,
+    const uint64_t* twiddles,
+    unsigned half)
+{
+    unsigned j = 0;
+
+    for (; half - j >= 8; j += 8)
+    {
+        const __m512i a = _mm512_loadu_si512(x + j);
+        __m512i b = _mm512_loadu_si512(y + j);
+        const __m512i w = _mm512_loadu_si512(twiddles + j);
+        const __m512i w_hi = ShiftRight32_AVX512(w);
+
+        if (DIT)
+        {
+            b = Multiply_AVX512(b, w, w_hi);
+            _mm512_storeu_si512(x + j, Add_AVX512(a, b));
+            _mm512_storeu_si512(y + j, Subtract_AVX512(a, b));
+        }
+        else
+        {
+            _mm512_storeu_si512(x + j, Add_AVX512(a, b));
+            _mm512_storeu_si512(y + j, Multiply_AVX512(Subtract_AVX512(a, b), w, w_hi));
+        }
+    }
+
+    return j;
+}
+
+// MultiplyWordsFp2() for 4 elements at a time
+static SOLINAS64_TARGET_AVX512 unsigned MultiplyWordsFp2_AVX512(
+    const uint8_t* words,
+    unsigned bytes,
+    uint64_t c0,
+    uint64_t c1,
+    uint64_t c1n,
+    uint8_t* output,
+    bool add)
+{
+    const __m512i y0 = _mm512_set1_epi64(c0);
+    const __m512i y0_hi = ShiftRight32_AVX512(y0);
+    const __m512i y1 = _mm512_set_epi64(c1, c1n, c1, c1n, c1, c1n, c1, c1n);
+    const __m512i y1_hi = ShiftRight32_AVX512(y1);
+    unsigned processed = 0;
+
+    while (bytes - processed >= 64)
+    {
+        uint8_t* out = output + processed;
+
+        const __m512i x = _mm512_loadu_si512(words + processed);
+        // Zero-masked like ShiftRight32_AVX512()
+        const __m512i swapped = _mm512_maskz_shuffle_epi32(0xffff, x, _MM_PERM_BADC);
+
+        __m512i r = Add_AVX512(Multiply_AVX512(x, y0, y0_hi), Multiply_AVX512(swapped, y1, y1_hi));
+        if (add) {
+            r = Add_AVX512(r, _mm512_loadu_si512(out));
+        }
+        _mm512_storeu_si512(out, r);
+
+        processed += 64;
+    }
+
+    return processed;
+}
+
+// PolyHashRegion() for 64 bytes at a time
+static SOLINAS64_TARGET_AVX512 unsigned PolyHashRegion_AVX512(
+    AppDataReader& reader,
+    const uint8_t* data,
+    unsigned bytes,
+    uint64_t key8,
+    uint64_t* lanes)
+{
+    const __m512i k = _mm512_set1_epi64(key8);
+    const __m512i k_hi = ShiftRight32_AVX512(k);
+    __m512i h = _mm512_loadu_si512(lanes);
+    unsigned processed = 0;
+
+    // h = h * k^4 + x0 * k^3 + x1 * k^2 + x2 * k + x3, so only one of the
+    // multiplies is on the chain through h
+    const uint64_t key16 = Multiply(key8, key8);
+    const __m512i k2 = _mm512_set1_epi64(key16);
+    const __m512i k3 = _mm512_set1_epi64(Multiply(key16, key8));
+    const __m512i k4 = _mm512_set1_epi64(Multiply(key16, key16));
+    const __m512i k2_hi = ShiftRight32_AVX512(k2);
+    const __m512i k3_hi = ShiftRight32_AVX512(k3);
+    const __m512i k4_hi = ShiftRight32_AVX512(k4);
+
+    while (bytes - processed >= 256)
+    {
+        const __m512i x0 = ReadNext64Bytes_AVX512(reader, data + processed);
+        const __m512i x1 = ReadNext64Bytes_AVX512(reader, data + processed + 64);
+        const __m512i x2 = ReadNext64Bytes_AVX512(reader, data + processed + 128);
+        const __m512i x3 = ReadNext64Bytes_AVX512(reader, data + processed + 192);
+
+        const __m512i t = Add_AVX512(
+            Add_AVX512(Multiply_AVX512(x0, k3, k3_hi), Multiply_AVX512(x1, k2, k2_hi)),
+            Add_AVX512(Multiply_AVX512(x2, k, k_hi), x3));
+        h = Add_AVX512(Multiply_AVX512(h, k4, k4_hi), t);
+
+        processed += 256;
+    }
+
+    while (bytes - processed >= 64)
+    {
+        h = Add_AVX512(Multiply_AVX512(h, k, k_hi), ReadNext64Bytes_AVX512(reader, data + processed));
+
+        processed += 64;
+    }
+
+    _mm512_storeu_si512(lanes, h);
+    return processed;
+}
+
+#endif // SOLINAS64_TRY_AVX512
+
+
+//------------------------------------------------------------------------------
+// Vector Dispatch
+
+/*
+    These process as much of the full-word prefix of the data as the best
+    available vector unit can handle, advancing the reader accordingly.
+    They return the number of bytes processed, which is a multiple of 32.
+    The scalar code handles the rest.
+*/
+
+template<int Form>
+static SOLINAS64_FORCE_INLINE unsigned VectorMultiplyRegion(
+    AppDataReader& reader,
+    const uint8_t* data,
+    unsigned bytes,
+    uint64_t param,
+    uint8_t* output,
+    unsigned hints)
+{
+#if defined(SOLINAS64_TRY_AVX512)
+    if (GetCpuFeatures().HasAVX512) {
+        return MultiplyRegion_AVX512<Form>(reader, data, bytes, param, output, hints);
+    }
+#endif // SOLINAS64_TRY_AVX512
+#if defined(SOLINAS64_TRY_AVX2)
+    if (GetCpuFeatures().HasAVX2) {
+        return MultiplyRegion_AVX2<Form>(reader, data, bytes, param, output, hints);
+    }
+#endif // SOLINAS64_TRY_AVX2
+    (void)reader, (void)data, (void)bytes, (void)param, (void)output, (void)hints;
+    return 0;
+}
+
+template<int Form>
+static SOLINAS64_FORCE_INLINE unsigned VectorMultiplyAddRegion(
+    AppDataReader& reader,
+    const uint8_t* data,
+    unsigned bytes,
+    uint64_t param,
+    uint8_t* output,
+    unsigned hints)
+{
+#if defined(SOLINAS64_TRY_AVX512)
+    if (GetCpuFeatures().HasAVX512) {
+        return MultiplyAddRegion_AVX512<Form>(reader, data, bytes, param, output, hints);
+    }
+#endif // SOLINAS64_TRY_AVX512
+#if defined(SOLINAS64_TRY_AVX2)
+    if (GetCpuFeatures().HasAVX2) {
+        return MultiplyAddRegion_AVX2<Form>(reader, data, bytes, param, output, hints);
+    }
+#endif // SOLINAS64_TRY_AVX2
+    (void)reader, (void)data, (void)bytes, (void)param, (void)output, (void)hints;
+    return 0;
+}
+
+static SOLINAS64_FORCE_INLINE unsigned VectorMultiplyAddRegionMulti(
+    AppDataReader& reader,
+    const uint8_t* data,
+    unsigned bytes,
+    const uint64_t* coeffs,
+    unsigned count,
+    uint8_t* const* outputs,
+    unsigned outputOffset)
+{
+#if defined(SOLINAS64_TRY_AVX512)
+    if (GetCpuFeatures().HasAVX512) {
+        return MultiplyAddRegionMulti_AVX512(reader, data, bytes, coeffs, count, outputs, outputOffset);
+    }
+#endif // SOLINAS64_TRY_AVX512
+#if defined(SOLINAS64_TRY_AVX2)
+    if (GetCpuFeatures().HasAVX2) {
+        return MultiplyAddRegionMulti_AVX2(reader, data, bytes, coeffs, count, outputs, outputOffset);
+    }
+#endif // SOLINAS64_TRY_AVX2
+    (void)reader, (void)data, (void)bytes, (void)coeffs, (void)count, (void)outputs, (void)outputOffset;
+    return 0;
+}
+
+static SOLINAS64_FORCE_INLINE unsigned VectorMultiplyWords(
+    const uint8_t* words,
+    unsigned bytes,
+    uint64_t coeff,
+    uint8_t* output,
+    bool add)
+{
+#if defined(SOLINAS64_TRY_AVX512)
+    if (GetCpuFeatures().HasAVX512) {
+        return MultiplyWords_AVX512(words, bytes, coeff, output, add);
+    }
+#endif // SOLINAS64_TRY_AVX512
+#if defined(SOLINAS64_TRY_AVX2)
+    if (GetCpuFeatures().HasAVX2) {
+        return MultiplyWords_AVX2(words, bytes, coeff, output, add);
+    }
+#endif // SOLINAS64_TRY_AVX2
+    (void)words, (void)bytes, (void)coeff, (void)output, (void)add;
+    return 0;
+}
+
+static SOLINAS64_FORCE_INLINE unsigned VectorRestoreWords(
+    AppDataWriter& writer,
+    const uint8_t* words,
+    unsigned bytes,
+    uint8_t* output)
+{
+#if defined(SOLINAS64_TRY_AVX512)
+    if (GetCpuFeatures().HasAVX512) {
+        return RestoreWords_AVX512(writer, words, bytes, output);
+    }
+#endif // SOLINAS64_TRY_AVX512
+#if defined(SOLINAS64_TRY_AVX2)
+    if (GetCpuFeatures().HasAVX2) {
+        return RestoreWords_AVX2(writer, words, bytes, output);
+    }
+#endif // SOLINAS64_TRY_AVX2
+    (void)writer, (void)words, (void)bytes, (void)output;
+    return 0;
+}
+
+template<bool DIT>
+static SOLINAS64_FORCE_INLINE unsigned VectorNTTButterflies(
+    uint64_t* x,
+    uint64_t* y,
+    const uint64_t* twiddles,
+    unsigned half)
+{
+#if defined(SOLINAS64_TRY_AVX512)
+    if (GetCpuFeatures().HasAVX512 && half >= 8) {
+        return NTTButterflies_AVX512<DIT>(x, y, twiddles, half);
+    }
+#endif // SOLINAS64_TRY_AVX512
+#if defined(SOLINAS64_TRY_AVX2)
+    if (GetCpuFeatures().HasAVX2) {
+        return NTTButterflies_AVX2<DIT>(x, y, twiddles, half);
+    }
+#endif // SOLINAS64_TRY_AVX2
+    (void)x, (void)y, (void)twiddles, (void)half;
+    return 0;
+}
+
+static SOLINAS64_FORCE_INLINE unsigned VectorMultiplyWordsFp2(
+    const uint8_t* words,
+    unsigned bytes,
+    uint64_t c0,
+    uint64_t c1,
+    uint64_t c1n,
+    uint8_t* output,
+    bool add)
+{
+#if defined(SOLINAS64_TRY_AVX512)
+    if (GetCpuFeatures().HasAVX512) {
+        return MultiplyWordsFp2_AVX512(words, bytes, c0, c1, c1n, output, add);
+    }
+#endif // SOLINAS64_TRY_AVX512
+#if defined(SOLINAS64_TRY_AVX2)
+    if (GetCpuFeatures().HasAVX2) {
+        return MultiplyWordsFp2_AVX2(words, bytes, c0, c1, c1n, output, add);
+    }
+#endif // SOLINAS64_TRY_AVX2
+    (void)words, (void)bytes, (void)c0, (void)c1, (void)c1n, (void)output, (void)add;
+    return 0;
+}
+
+static SOLINAS64_FORCE_INLINE unsigned VectorPolyHashRegion(
+    AppDataReader& reader,
+    const uint8_t* data,
+    unsigned bytes,
+    uint64_t key8,
+    uint64_t* lanes)
+{
+#if defined(SOLINAS64_TRY_AVX512)
+    if (GetCpuFeatures().HasAVX512) {
+        return PolyHashRegion_AVX512(reader, data, bytes, key8, lanes);
+    }
+#endif // SOLINAS64_TRY_AVX512
+#if defined(SOLINAS64_TRY_AVX2)
+    if (GetCpuFeatures().HasAVX2) {
+        return PolyHashRegion_AVX2(reader, data, bytes, key8, lanes);
+    }
+#endif // SOLINAS64_TRY_AVX2
+    (void)reader, (void)data, (void)bytes, (void)key8, (void)lanes;
+    return 0;
+}
+
+SimdBackend GetSimdBackend()
+{
+#if defined(SOLINAS64_TRY_AVX512)
+    if (GetCpuFeatures().HasAVX512) {
+        return SimdBackend::AVX512;
+    }
+#endif // SOLINAS64_TRY_AVX512
+#if defined(SOLINAS64_TRY_AVX2)
+    if (GetCpuFeatures().HasAVX2) {
+        return SimdBackend::AVX2;
+    }
+#endif // SOLINAS64_TRY_AVX2
+    return SimdBackend::Scalar;
+}
+
+
+//------------------------------------------------------------------------------
+// Region Statistics
+
+void RegionStats::Add(const RegionStats& other)
+{
+    Calls += other.Calls;
+    Bytes += other.Bytes;
+    ZeroCoeffCalls += other.ZeroCoeffCalls;
+    OneCoeffCalls += other.OneCoeffCalls;
+    AmbiguousWords += other.AmbiguousWords;
+    OverflowBytes += other.OverflowBytes;
+}
+
+static RegionStats MakeEmptyRegionStats()
+{
+    RegionStats stats;
+    memset(&stats, 0, sizeof(stats));
+#if defined(SOLINAS64_ENABLE_STATS)
+    stats.Enabled = true;
+#endif // SOLINAS64_ENABLE_STATS
+    stats.Backend = GetSimdBackend();
+    return stats;
+}
+
+#if defined(SOLINAS64_ENABLE_STATS)
+
+/*
+    Only the owning thread writes its counters, so each update is a relaxed
+    load and store with no lock prefix.  They are atomic so that a snapshot
+    from another thread reads whole values.
+*/
+struct ThreadRegionCounters
+{
+    std::atomic<uint64_t> Calls;
+    std::atomic<uint64_t> Bytes;
+    std::atomic<uint64_t> ZeroCoeffCalls;
+    std::atomic<uint64_t> OneCoeffCalls;
+    std::atomic<uint64_t> AmbiguousWords;
+    std::atomic<uint64_t> OverflowBytes;
+
+    ThreadRegionCounters();
+    ~ThreadRegionCounters();
+
+    static SOLINAS64_FORCE_INLINE void Increment(std::atomic<uint64_t>& counter, uint64_t x)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + x, std::memory_order_relaxed);
+    }
+
+    void Read(RegionStats& stats) const
+    {
+        stats.Calls = Calls.load(std::memory_order_relaxed);
+        stats.Bytes = Bytes.load(std::memory_order_relaxed);
+        stats.ZeroCoeffCalls = ZeroCoeffCalls.load(std::memory_order_relaxed);
+        stats.OneCoeffCalls = OneCoeffCalls.load(std::memory_order_relaxed);
+        stats.AmbiguousWords = AmbiguousWords.load(std::memory_order_relaxed);
+        stats.OverflowBytes = OverflowBytes.load(std::memory_order_relaxed);
+    }
+
+    void Clear()
+    {
+        Calls.store(0, std::memory_order_relaxed);
+        Bytes.store(0, std::memory_order_relaxed);
+        ZeroCoeffCalls.store(0, std::memory_order_relaxed);
+        OneCoeffCalls.store(0, std::memory_order_relaxed);
+        AmbiguousWords.store(0, std::memory_order_relaxed);
+        OverflowBytes.store(0, std::memory_order_relaxed);
+    }
+};
+
+// Counters of the live threads, and the totals of the exited threads
+struct RegionStatsRegistry
+{
+    std::mutex Lock;
+    std::vector<ThreadRegionCounters*> Threads;
+    RegionStats Retired;
+};
+
+// Never destroyed, since threads may exit after static destructors run
+static RegionStatsRegistry& GetRegionStatsRegistry()
+{
+    static RegionStatsRegistry* registry = new RegionStatsRegistry;
+    return *registry;
+}
+
+ThreadRegionCounters::ThreadRegionCounters()
+{
+    Clear();
+
+    RegionStatsRegistry& registry = GetRegionStatsRegistry();
+    std::lock_guard<std::mutex> locker(registry.Lock);
+    registry.Threads.push_back(this);
+}
+
+ThreadRegionCounters::~ThreadRegionCounters()
+{
+    RegionStats stats = MakeEmptyRegionStats();
+    Read(stats);
+
+    RegionStatsRegistry& registry = GetRegionStatsRegistry();
+    std::lock_guard<std::mutex> locker(registry.Lock);
+    registry.Retired.Add(stats);
+    registry.Threads.erase(
+        std::find(registry.Threads.begin(), registry.Threads.end(), this));
+}
+
+static thread_local ThreadRegionCounters RegionCounters;
+
+#endif // SOLINAS64_ENABLE_STATS
+
+// Count one call.  This compiles to nothing without SOLINAS64_ENABLE_STATS
+static SOLINAS64_FORCE_INLINE void RecordRegionCall(
+    unsigned bytes,
+    const MulConst& coeff,
+    unsigned ambiguousWords,
+    unsigned overflowBytes)
+{
+#if defined(SOLINAS64_ENABLE_STATS)
+    ThreadRegionCounters& counters = RegionCounters;
+    ThreadRegionCounters::Increment(counters.Calls, 1);
+    ThreadRegionCounters::Increment(counters.Bytes, bytes);
+    if (coeff.Coeff == 0) {
+        ThreadRegionCounters::Increment(counters.ZeroCoeffCalls, 1);
+    }
+    else if (coeff.Form == kCoeffOne) {
+        ThreadRegionCounters::Increment(counters.OneCoeffCalls, 1);
+    }
+    ThreadRegionCounters::Increment(counters.AmbiguousWords, ambiguousWords);
+    ThreadRegionCounters::Increment(counters.OverflowBytes, overflowBytes);
+#else
+    (void)bytes, (void)coeff, (void)ambiguousWords, (void)overflowBytes;
+#endif // SOLINAS64_ENABLE_STATS
+}
+
+// Returns the number of extra bits emitted so far, one per ambiguous word.
+// Precondition: Called before FlushAndGetWordCount()
+static SOLINAS64_FORCE_INLINE unsigned GetEmittedBitCount(const AppDataReader& reader)
+{
+    return static_cast<unsigned>(reader.DataWritePtr - reader.Data) / 8 * 63 + reader.Available;
+}
+
+RegionStats GetThreadRegionStats()
+{
+    RegionStats stats = MakeEmptyRegionStats();
+#if defined(SOLINAS64_ENABLE_STATS)
+    RegionCounters.Read(stats);
+#endif // SOLINAS64_ENABLE_STATS
+    return stats;
+}
+
+RegionStats GetRegionStats()
+{
+    RegionStats stats = MakeEmptyRegionStats();
+#if defined(SOLINAS64_ENABLE_STATS)
+    RegionStatsRegistry& registry = GetRegionStatsRegistry();
+    std::lock_guard<std::mutex> locker(registry.Lock);
+    stats.Add(registry.Retired);
+    for (const ThreadRegionCounters* counters : registry.Threads)
+    {
+        RegionStats threadStats = MakeEmptyRegionStats();
+        counters->Read(threadStats);
+        stats.Add(threadStats);
+    }
+#endif // SOLINAS64_ENABLE_STATS
+    return stats;
+}
+
+void ResetThreadRegionStats()
+{
+#if defined(SOLINAS64_ENABLE_STATS)
+    RegionStats stats = MakeEmptyRegionStats();
+
+    RegionStatsRegistry& registry = GetRegionStatsRegistry();
+
+    // Move the counts to the totals of the exited threads, so the
+    // GetRegionStats() totals never go down.  The counters are created
+    // before taking the lock, since their constructor takes it too
+    ThreadRegionCounters& counters = RegionCounters;
+    std::lock_guard<std::mutex> locker(registry.Lock);
+    counters.Read(stats);
+    registry.Retired.Add(stats);
+    counters.Clear();
+#endif // SOLINAS64_ENABLE_STATS
+}
+
+
+//------------------------------------------------------------------------------
+// Bulk Operations
+
+template<int Form>
+static unsigned MultiplyRegionSliceT(
+    AppDataReader& reader,
+    const uint8_t* data,
+    unsigned bytes,
+    uint64_t param,
+    uint8_t* output,
+    unsigned hints)
+{
+    const unsigned outputBytes = (bytes + 7) & ~7u;
+
+    const unsigned vectorBytes = VectorMultiplyRegion<Form>(reader, data, bytes, param, output, hints);
+    data += vectorBytes;
+    output += vectorBytes;
+    bytes -= vectorBytes;
+
+    while (bytes >= 32)
+    {
+        bytes -= 32;
+
+        uint64_t x0 = Scale<Form>(reader.ReadNext8Bytes(data), param);
+        uint64_t x1 = Scale<Form>(reader.ReadNext8Bytes(data + 8), param);
+        uint64_t x2 = Scale<Form>(reader.ReadNext8Bytes(data + 16), param);
+        uint64_t x3 = Scale<Form>(reader.ReadNext8Bytes(data + 24), param);
+
+        data += 32;
+
+        WriteU64_LE(output, x0);
+        WriteU64_LE(output + 8, x1);
+        WriteU64_LE(output + 16, x2);
+        WriteU64_LE(output + 24, x3);
+
+        output += 32;
+    }
+
+    while (bytes >= 8)
+    {
+        bytes -= 8;
+
+        uint64_t x0 = Scale<Form>(reader.ReadNext8Bytes(data), param);
+        data += 8;
+
+        WriteU64_LE(output, x0);
+        output += 8;
+    }
+
+    if (bytes > 0)
+    {
+        uint64_t x0 = Scale<Form>(reader.ReadFinalBytes(data, bytes), param);
+        WriteU64_LE(output, x0);
+    }
+
+    return outputBytes;
+}
+
+template<int Form>
+static unsigned MultiplyAddRegionSliceT(
+    AppDataReader& reader,
+    const uint8_t* data,
+    unsigned bytes,
+    uint64_t param,
+    uint8_t* output,
+    unsigned hints)
+{
+    const unsigned outputBytes = (bytes + 7) & ~7u;
+
+    const unsigned vectorBytes = VectorMultiplyAddRegion<Form>(reader, data, bytes, param, output, hints);
+    data += vectorBytes;
+    output += vectorBytes;
+    bytes -= vectorBytes;
+
+    /**** This loop takes over 95% of the execution time. ****/
+    while (bytes >= 32)
+    {
+        bytes -= 32;
+
+        WriteU64_LE(output, Add(Scale<Form>(reader.ReadNext8Bytes(data), param), ReadU64_LE(output)));
+        WriteU64_LE(output + 8, Add(Scale<Form>(reader.ReadNext8Bytes(data + 8), param), ReadU64_LE(output + 8)));
+        WriteU64_LE(output + 16, Add(Scale<Form>(reader.ReadNext8Bytes(data + 16), param), ReadU64_LE(output + 16)));
+        WriteU64_LE(output + 24, Add(Scale<Form>(reader.ReadNext8Bytes(data + 24), param), ReadU64_LE(output + 24)));
+
+        data += 32;
+        output += 32;
+    }
+
+    while (bytes >= 8)
+    {
+        bytes -= 8;
+
+        uint64_t x0 = Add(Scale<Form>(reader.ReadNext8Bytes(data), param), ReadU64_LE(output));
+        data += 8;
+
+        WriteU64_LE(output, x0);
+        output += 8;
+    }
+
+    if (bytes > 0)
+    {
+        uint64_t x0 = Add(Scale<Form>(reader.ReadFinalBytes(data, bytes), param), ReadU64_LE(output));
+
+        WriteU64_LE(output, x0);
+    }
+
+    return outputBytes;
+}
+
+unsigned MultiplyRegionSlice(
+    AppDataReader& reader,
+    const uint8_t* data,
+    unsigned bytes,
+    const MulConst& coeff,
+    uint8_t* output,
+    unsigned hints)
+{
+    const uint64_t param = coeff.Param;
+    switch (coeff.Form)
+    {
+    case kCoeffOne:
+        return MultiplyRegionSliceT<kCoeffOne>(reader, data, bytes, param, output, hints);
+    case kCoeffShift:
+        return MultiplyRegionSliceT<kCoeffShift>(reader, data, bytes, param, output, hints);
+    case kCoeffSmall:
+        return MultiplyRegionSliceT<kCoeffSmall>(reader, data, bytes, param, output, hints);
+    default:
+        break;
+    }
+    return MultiplyRegionSliceT<kCoeffGeneral>(reader, data, bytes, param, output, hints);
+}
+
+unsigned MultiplyRegionSlice(
+    AppDataReader& reader,
+    const uint8_t* data,
+    unsigned bytes,
+    uint64_t coeff,
+    uint8_t* output,
+    unsigned hints)
+{
+    MulConst prepared;
+    prepared.Set(coeff);
+    return MultiplyRegionSlice(reader, data, bytes, prepared, output, hints);
+}
+
+unsigned MultiplyAddRegionSlice(
+    AppDataReader& reader,
+    const uint8_t* data,
+    unsigned bytes,
+    const MulConst& coeff,
+    uint8_t* output,
+    unsigned hints)
+{
+    const uint64_t param = coeff.Param;
+    switch (coeff.Form)
+    {
+    case kCoeffOne:
+        return MultiplyAddRegionSliceT<kCoeffOne>(reader, data, bytes, param, output, hints);
+    case kCoeffShift:
+        return MultiplyAddRegionSliceT<kCoeffShift>(reader, data, bytes, param, output, hints);
+    case kCoeffSmall:
+        return MultiplyAddRegionSliceT<kCoeffSmall>(reader, data, bytes, param, output, hints);
+    default:
+        break;
+    }
+    return MultiplyAddRegionSliceT<kCoeffGeneral>(reader, data, bytes, param, output, hints);
+}
+
+unsigned MultiplyAddRegionSlice(
+    AppDataReader& reader,
+    const uint8_t* data,
+    unsigned bytes,
+    uint64_t coeff,
+    uint8_t* output,
+    unsigned hints)
+{
+    MulConst prepared;
+    prepared.Set(coeff);
+    return MultiplyAddRegionSlice(reader, data, bytes, prepared, output, hints);
+}
+
+unsigned MultiplyRegion(
+    const uint8_t* data,
+    unsigned bytes,
+    const MulConst& coeff,
+    uint8_t* workspace,
+    uint8_t* output,
+    unsigned hints)
+{
+    const unsigned minimumOutputBytes = (bytes + 7) & ~7u;
+
+    // Special fast case
+    if (coeff.Coeff == 0)
+    {
+        memset(output, 0, minimumOutputBytes);
+        RecordRegionCall(bytes, coeff, 0, 0);
+        return minimumOutputBytes;
+    }
+
+    AppDataReader reader;
+    reader.SetupWorkspace(workspace);
+
+    output += MultiplyRegionSlice(reader, data, bytes, coeff, output, hints);
+
+    // Finalize the overflow bits
+    const unsigned ambiguousWords = GetEmittedBitCount(reader);
+    const unsigned extraWordBytes = reader.FlushAndGetWordCount() * 8;
+    RecordRegionCall(bytes, coeff, ambiguousWords, extraWordBytes);
+    const uint8_t* readPtr = reader.Data;
+
+    // Also work on the overflow bits
+    for (unsigned i = 0; i < extraWordBytes; i += 8)
+    {
+        WriteU64_LE(
+            output + i,
+            Multiply(
+                coeff.Coeff,
+                ReadU64_LE(readPtr + i)));
+    }
+
+    return minimumOutputBytes + extraWordBytes;
+}
+
+unsigned MultiplyRegion(
+    const uint8_t* data,
+    unsigned bytes,
+    uint64_t coeff,
+    uint8_t* workspace,
+    uint8_t* output,
+    unsigned hints)
+{
+    MulConst prepared;
+    prepared.Set(coeff);
+    return MultiplyRegion(data, bytes, prepared, workspace, output, hints);
+}
+
+unsigned MultiplyAddRegion(
+    const uint8_t* data,
+    unsigned bytes,
+    const MulConst& coeff,
+    uint8_t* workspace,
+    uint8_t* output,
+    unsigned hints)
+{
+    const unsigned minimumOutputBytes = (bytes + 7) & ~7u;
+
+    // Special fast case
+    if (coeff.Coeff == 0)
+    {
+        RecordRegionCall(bytes, coeff, 0, 0);
+        return minimumOutputBytes;
+    }
+
+    AppDataReader reader;
+    reader.SetupWorkspace(workspace);
+
+    output += MultiplyAddRegionSlice(reader, data, bytes, coeff, output, hints);
+
+    // Finalize the overflow bits
+    const unsigned ambiguousWords = GetEmittedBitCount(reader);
+    const unsigned extraWordBytes = reader.FlushAndGetWordCount() * 8;
+    RecordRegionCall(bytes, coeff, ambiguousWords, extraWordBytes);
+    const uint8_t* readPtr = reader.Data;
 
     // Also work on the overflow bits
     for (unsigned i = 0; i < extraWordBytes; i += 8)
     {
-        const uint64_t x = ReadU64_LE(output + i);
-        WriteU64_LE(
-            output + i,
-            Add(
-                Multiply(
-                    coeff,
-                    ReadU64_LE(readPtr + i)),
-                x));
+        const uint64_t x = ReadU64_LE(output + i);
+        WriteU64_LE(
+            output + i,
+            Add(
+                Multiply(
+                    coeff.Coeff,
+                    ReadU64_LE(readPtr + i)),
+                x));
+    }
+
+    return minimumOutputBytes + extraWordBytes;
+}
+
+unsigned MultiplyAddRegion(
+    const uint8_t* data,
+    unsigned bytes,
+    uint64_t coeff,
+    uint8_t* workspace,
+    uint8_t* output,
+    unsigned hints)
+{
+    MulConst prepared;
+    prepared.Set(coeff);
+    return MultiplyAddRegion(data, bytes, prepared, workspace, output, hints);
+}
+
+/*
+    The workspace-free versions run the slices in steps of kTailSliceBytes,
+    and after each step they apply the overflow words completed so far to
+    the output tail and rewind the reader to the start of a small buffer.
+    Each step emits at most kTailSliceBytes / 8 / 63 + 1 = 9 words.
+*/
+static const unsigned kTailSliceBytes = 63 * 64;
+static const unsigned kTailBufferWords = 16;
+
+template<bool Accumulate>
+static SOLINAS64_FORCE_INLINE uint8_t* ApplyTailWords(
+    AppDataReader& reader,
+    unsigned wordCount,
+    const MulConst& coeff,
+    uint8_t* tail)
+{
+    for (unsigned i = 0; i < wordCount; ++i, tail += 8)
+    {
+        uint64_t x = Multiply(coeff.Coeff, ReadU64_LE(reader.Data + i * 8));
+        if (Accumulate) {
+            x = Add(x, ReadU64_LE(tail));
+        }
+        WriteU64_LE(tail, x);
+    }
+    reader.DataWritePtr = reader.Data;
+    return tail;
+}
+
+template<bool Accumulate>
+static unsigned MultiplyRegionToTail(
+    const uint8_t* data,
+    unsigned bytes,
+    const MulConst& coeff,
+    uint8_t* output)
+{
+    const unsigned minimumOutputBytes = (bytes + 7) & ~7u;
+
+    uint64_t buffer[kTailBufferWords];
+    AppDataReader reader;
+    reader.SetupWorkspace(reinterpret_cast<uint8_t*>(buffer));
+
+    uint8_t* tail = output + minimumOutputBytes;
+    unsigned ambiguousWords = 0;
+
+    for (unsigned offset = 0; offset < bytes; offset += kTailSliceBytes)
+    {
+        unsigned sliceBytes = bytes - offset;
+        if (sliceBytes > kTailSliceBytes) {
+            sliceBytes = kTailSliceBytes;
+        }
+
+        if (Accumulate) {
+            MultiplyAddRegionSlice(reader, data + offset, sliceBytes, coeff, output + offset);
+        }
+        else {
+            MultiplyRegionSlice(reader, data + offset, sliceBytes, coeff, output + offset);
+        }
+
+        // Apply the overflow words that were completed in this step
+        const unsigned wordCount = static_cast<unsigned>(reader.DataWritePtr - reader.Data) / 8;
+        ambiguousWords += wordCount * 63;
+        tail = ApplyTailWords<Accumulate>(reader, wordCount, coeff, tail);
+    }
+
+    // Finalize the overflow bits
+    ambiguousWords += GetEmittedBitCount(reader);
+    tail = ApplyTailWords<Accumulate>(reader, reader.FlushAndGetWordCount(), coeff, tail);
+
+    const unsigned outputBytes = static_cast<unsigned>(tail - output);
+    RecordRegionCall(bytes, coeff, ambiguousWords, outputBytes - minimumOutputBytes);
+    return outputBytes;
+}
+
+unsigned MultiplyRegion(
+    const uint8_t* data,
+    unsigned bytes,
+    const MulConst& coeff,
+    uint8_t* output)
+{
+    // Special fast case
+    if (coeff.Coeff == 0)
+    {
+        const unsigned minimumOutputBytes = (bytes + 7) & ~7u;
+        memset(output, 0, minimumOutputBytes);
+        RecordRegionCall(bytes, coeff, 0, 0);
+        return minimumOutputBytes;
+    }
+
+    return MultiplyRegionToTail<false>(data, bytes, coeff, output);
+}
+
+unsigned MultiplyRegion(
+    const uint8_t* data,
+    unsigned bytes,
+    uint64_t coeff,
+    uint8_t* output)
+{
+    MulConst prepared;
+    prepared.Set(coeff);
+    return MultiplyRegion(data, bytes, prepared, output);
+}
+
+unsigned MultiplyAddRegion(
+    const uint8_t* data,
+    unsigned bytes,
+    const MulConst& coeff,
+    uint8_t* output)
+{
+    // Special fast case
+    if (coeff.Coeff == 0)
+    {
+        RecordRegionCall(bytes, coeff, 0, 0);
+        return (bytes + 7) & ~7u;
+    }
+
+    return MultiplyRegionToTail<true>(data, bytes, coeff, output);
+}
+
+unsigned MultiplyAddRegion(
+    const uint8_t* data,
+    unsigned bytes,
+    uint64_t coeff,
+    uint8_t* output)
+{
+    MulConst prepared;
+    prepared.Set(coeff);
+    return MultiplyAddRegion(data, bytes, prepared, output);
+}
+
+unsigned MultiplyAddRegionMultiSlice(
+    AppDataReader& reader,
+    const uint8_t* data,
+    unsigned bytes,
+    const uint64_t* coeffs,
+    unsigned count,
+    uint8_t* const* outputs,
+    unsigned outputOffset)
+{
+    const unsigned vectorBytes = VectorMultiplyAddRegionMulti(
+        reader, data, bytes, coeffs, count, outputs, outputOffset);
+    data += vectorBytes;
+    bytes -= vectorBytes;
+
+    unsigned offset = outputOffset + vectorBytes;
+
+    // Read each group of input words once and apply it to every output
+    while (bytes >= 32)
+    {
+        bytes -= 32;
+
+        const uint64_t x0 = reader.ReadNext8Bytes(data);
+        const uint64_t x1 = reader.ReadNext8Bytes(data + 8);
+        const uint64_t x2 = reader.ReadNext8Bytes(data + 16);
+        const uint64_t x3 = reader.ReadNext8Bytes(data + 24);
+
+        data += 32;
+
+        for (unsigned i = 0; i < count; ++i)
+        {
+            const uint64_t coeff = coeffs[i];
+            uint8_t* output = outputs[i] + offset;
+
+            WriteU64_LE(output, Add(Multiply(coeff, x0), ReadU64_LE(output)));
+            WriteU64_LE(output + 8, Add(Multiply(coeff, x1), ReadU64_LE(output + 8)));
+            WriteU64_LE(output + 16, Add(Multiply(coeff, x2), ReadU64_LE(output + 16)));
+            WriteU64_LE(output + 24, Add(Multiply(coeff, x3), ReadU64_LE(output + 24)));
+        }
+
+        offset += 32;
+    }
+
+    while (bytes >= 8)
+    {
+        bytes -= 8;
+
+        const uint64_t x0 = reader.ReadNext8Bytes(data);
+        data += 8;
+
+        for (unsigned i = 0; i < count; ++i)
+        {
+            uint8_t* output = outputs[i] + offset;
+            WriteU64_LE(output, Add(Multiply(coeffs[i], x0), ReadU64_LE(output)));
+        }
+
+        offset += 8;
+    }
+
+    if (bytes > 0)
+    {
+        const uint64_t x0 = reader.ReadFinalBytes(data, bytes);
+
+        for (unsigned i = 0; i < count; ++i)
+        {
+            uint8_t* output = outputs[i] + offset;
+            WriteU64_LE(output, Add(Multiply(coeffs[i], x0), ReadU64_LE(output)));
+        }
+
+        offset += 8;
+    }
+
+    return offset - outputOffset;
+}
+
+unsigned MultiplyAddRegionMulti(
+    const uint8_t* data,
+    unsigned bytes,
+    const uint64_t* coeffs,
+    unsigned count,
+    uint8_t* workspace,
+    uint8_t* const* outputs)
+{
+    AppDataReader reader;
+    reader.SetupWorkspace(workspace);
+
+    const unsigned offset = MultiplyAddRegionMultiSlice(
+        reader, data, bytes, coeffs, count, outputs, 0);
+
+    // Finalize the overflow bits
+    const unsigned extraWordBytes = reader.FlushAndGetWordCount() * 8;
+    const uint8_t* readPtr = reader.Data;
+
+    // Also work on the overflow bits
+    for (unsigned j = 0; j < extraWordBytes; j += 8)
+    {
+        const uint64_t x0 = ReadU64_LE(readPtr + j);
+
+        for (unsigned i = 0; i < count; ++i)
+        {
+            uint8_t* output = outputs[i] + offset + j;
+            WriteU64_LE(output, Add(Multiply(coeffs[i], x0), ReadU64_LE(output)));
+        }
+    }
+
+    return offset + extraWordBytes;
+}
+
+
+void MultiplyWords(
+    const uint8_t* words,
+    unsigned wordCount,
+    uint64_t coeff,
+    uint8_t* output)
+{
+    const unsigned bytes = wordCount * 8;
+    const unsigned vectorBytes = VectorMultiplyWords(words, bytes, coeff, output, false);
+
+    for (unsigned i = vectorBytes; i < bytes; i += 8) {
+        WriteU64_LE(output + i, Multiply(coeff, ReadU64_LE(words + i)));
+    }
+}
+
+void MultiplyAddWords(
+    const uint8_t* words,
+    unsigned wordCount,
+    uint64_t coeff,
+    uint8_t* output)
+{
+    const unsigned bytes = wordCount * 8;
+    const unsigned vectorBytes = VectorMultiplyWords(words, bytes, coeff, output, true);
+
+    for (unsigned i = vectorBytes; i < bytes; i += 8)
+    {
+        WriteU64_LE(
+            output + i,
+            Add(
+                Multiply(
+                    coeff,
+                    ReadU64_LE(words + i)),
+                ReadU64_LE(output + i)));
+    }
+}
+
+template<bool Accumulate>
+static void MultiplyWordsFp2T(
+    const uint8_t* words,
+    unsigned count,
+    const Fp2& coeff,
+    uint8_t* output)
+{
+    const unsigned bytes = count * 16;
+    const uint64_t c1n = Multiply(coeff.c1, kFp2NonResidue);
+    const unsigned vectorBytes = VectorMultiplyWordsFp2(
+        words, bytes, coeff.c0, coeff.c1, c1n, output, Accumulate);
+
+    // Same operations as the vector kernels, so the output is the same
+    for (unsigned i = vectorBytes; i < bytes; i += 16)
+    {
+        const uint64_t x0 = ReadU64_LE(words + i);
+        const uint64_t x1 = ReadU64_LE(words + i + 8);
+
+        uint64_t r0 = Add(Multiply(x0, coeff.c0), Multiply(x1, c1n));
+        uint64_t r1 = Add(Multiply(x1, coeff.c0), Multiply(x0, coeff.c1));
+        if (Accumulate)
+        {
+            r0 = Add(r0, ReadU64_LE(output + i));
+            r1 = Add(r1, ReadU64_LE(output + i + 8));
+        }
+
+        WriteU64_LE(output + i, r0);
+        WriteU64_LE(output + i + 8, r1);
+    }
+}
+
+void MultiplyWordsFp2(
+    const uint8_t* words,
+    unsigned count,
+    const Fp2& coeff,
+    uint8_t* output)
+{
+    MultiplyWordsFp2T<false>(words, count, coeff, output);
+}
+
+void MultiplyAddWordsFp2(
+    const uint8_t* words,
+    unsigned count,
+    const Fp2& coeff,
+    uint8_t* output)
+{
+    MultiplyWordsFp2T<true>(words, count, coeff, output);
+}
+
+template<bool Accumulate>
+static void MultiplyWordsFp3T(
+    const uint8_t* words,
+    unsigned count,
+    const Fp3& coeff,
+    uint8_t* output)
+{
+    const uint64_t c1d = Add(coeff.c1, coeff.c1);
+    const uint64_t c2d = Add(coeff.c2, coeff.c2);
+
+    for (unsigned i = 0; i < count * 24; i += 24)
+    {
+        const uint64_t x0 = ReadU64_LE(words + i);
+        const uint64_t x1 = ReadU64_LE(words + i + 8);
+        const uint64_t x2 = ReadU64_LE(words + i + 16);
+
+        // Multiply() in Fp3 with the doubled coefficients hoisted out
+        Accum128 r0, r1, r2;
+        r0.Clear();
+        r0.MultiplyAdd(x0, coeff.c0);
+        r0.MultiplyAdd(x1, c2d);
+        r0.MultiplyAdd(x2, c1d);
+        r1.Clear();
+        r1.MultiplyAdd(x0, coeff.c1);
+        r1.MultiplyAdd(x1, coeff.c0);
+        r1.MultiplyAdd(x2, c2d);
+        r2.Clear();
+        r2.MultiplyAdd(x0, coeff.c2);
+        r2.MultiplyAdd(x1, coeff.c1);
+        r2.MultiplyAdd(x2, coeff.c0);
+
+        if (Accumulate)
+        {
+            r0.Add(ReadU64_LE(output + i));
+            r1.Add(ReadU64_LE(output + i + 8));
+            r2.Add(ReadU64_LE(output + i + 16));
+        }
+
+        WriteU64_LE(output + i, r0.Reduce());
+        WriteU64_LE(output + i + 8, r1.Reduce());
+        WriteU64_LE(output + i + 16, r2.Reduce());
+    }
+}
+
+void MultiplyWordsFp3(
+    const uint8_t* words,
+    unsigned count,
+    const Fp3& coeff,
+    uint8_t* output)
+{
+    MultiplyWordsFp3T<false>(words, count, coeff, output);
+}
+
+void MultiplyAddWordsFp3(
+    const uint8_t* words,
+    unsigned count,
+    const Fp3& coeff,
+    uint8_t* output)
+{
+    MultiplyWordsFp3T<true>(words, count, coeff, output);
+}
+
+
+//------------------------------------------------------------------------------
+// Polynomial Hash
+
+/*
+    Data words are hashed in kPolyHashLanes interleaved lanes, each running
+    Horner's rule with key^kPolyHashLanes, so the multiplies are independent.
+    Lane j then counts key^(kPolyHashLanes - j) times toward the hash.
+
+    The extra words are hashed in their own chain as they are completed,
+    along with the power of the key to shift the data words past them.
+*/
+static const unsigned kPolyHashLanes = 8;
+
+// Fold the completed extra words into (hash, scale) and reset the buffer
+static SOLINAS64_FORCE_INLINE void PolyHashExtraWords(
+    AppDataReader& reader,
+    unsigned wordCount,
+    uint64_t key,
+    uint64_t& hash,
+    uint64_t& scale)
+{
+    for (unsigned i = 0; i < wordCount; ++i)
+    {
+        hash = Multiply(Add(hash, ReadU64_LE(reader.Data + i * 8)), key);
+        scale = Multiply(scale, key);
+    }
+    reader.DataWritePtr = reader.Data;
+}
+
+// Combine the data word hash with the extra words and the length
+static SOLINAS64_FORCE_INLINE uint64_t PolyHashFinish(
+    uint64_t hash,
+    uint64_t extraHash,
+    uint64_t extraScale,
+    unsigned bytes,
+    uint64_t key)
+{
+    hash = Add(Multiply(hash, extraScale), extraHash);
+    return Finalize(Multiply(Add(hash, bytes), key));
+}
+
+uint64_t PolyHashRegion(
+    const uint8_t* data,
+    unsigned bytes,
+    uint64_t key)
+{
+    const uint64_t key2 = Multiply(key, key);
+    const uint64_t key8 = Multiply(Multiply(key2, key2), Multiply(key2, key2));
+
+    uint64_t buffer[kTailBufferWords];
+    AppDataReader reader;
+    reader.SetupWorkspace(reinterpret_cast<uint8_t*>(buffer));
+
+    uint64_t lanes[kPolyHashLanes] = { 0 };
+    uint64_t extraHash = 0, extraScale = 1;
+
+    // Whole blocks of one word per lane, in slices that fit the buffer
+    const unsigned blockBytes = bytes & ~(kPolyHashLanes * 8 - 1);
+    for (unsigned offset = 0; offset < blockBytes; offset += kTailSliceBytes)
+    {
+        unsigned sliceBytes = blockBytes - offset;
+        if (sliceBytes > kTailSliceBytes) {
+            sliceBytes = kTailSliceBytes;
+        }
+        const uint8_t* slice = data + offset;
+
+        for (unsigned i = VectorPolyHashRegion(reader, slice, sliceBytes, key8, lanes);
+             i < sliceBytes; i += kPolyHashLanes * 8)
+        {
+            for (unsigned j = 0; j < kPolyHashLanes; ++j) {
+                lanes[j] = Add(Multiply(lanes[j], key8), reader.ReadNext8Bytes(slice + i + j * 8));
+            }
+        }
+
+        const unsigned wordCount = static_cast<unsigned>(reader.DataWritePtr - reader.Data) / 8;
+        PolyHashExtraWords(reader, wordCount, key, extraHash, extraScale);
+    }
+
+    uint64_t hash = 0;
+    for (unsigned j = 0; j < kPolyHashLanes; ++j) {
+        hash = Multiply(Add(hash, lanes[j]), key);
+    }
+
+    // Remaining words one at a time
+    unsigned offset = blockBytes;
+    for (; offset + 8 <= bytes; offset += 8) {
+        hash = Multiply(Add(hash, reader.ReadNext8Bytes(data + offset)), key);
+    }
+    if (offset < bytes) {
+        hash = Multiply(Add(hash, reader.ReadFinalBytes(data + offset, bytes - offset)), key);
+    }
+
+    PolyHashExtraWords(reader, reader.FlushAndGetWordCount(), key, extraHash, extraScale);
+
+    return PolyHashFinish(hash, extraHash, extraScale, bytes, key);
+}
+
+
+//------------------------------------------------------------------------------
+// Matrix-Vector Encoder
+
+// Each group is summed with an Accum128 and reduced once per word.
+// kEncodeRowGroup is far below Accum128::kMaxTerms so no folds are needed.
+
+// Accumulates one group of up to kEncodeRowGroup originals into the recovery
+// words, without the overflow words.  Returns the number of bytes written.
+// If Shift is true, then the group coefficients are the shifts from
+// GetCoeffForm() for a group that is all powers of two.
+// If Hash is true, then the PolyHashRegion() sums of the data words are also
+// written to groupHashes[], where the first word has weight hashStart and each
+// following word has the weight of the one before times hashStep.
+template<bool Shift, bool Hash>
+static unsigned EncodeRowGroupT(
+    AppDataReader* readers,
+    const uint8_t* const* groupData,
+    unsigned groupCount,
+    unsigned bytes,
+    const uint64_t* groupCoeffs,
+    bool accumulate,
+    uint64_t hashStart,
+    uint64_t hashStep,
+    uint64_t* groupHashes,
+    uint8_t* recovery)
+{
+    const unsigned fullWords = bytes / 8;
+    const unsigned finalBytes = bytes % 8;
+    uint8_t* output = recovery;
+    unsigned offset = 0;
+
+    // The weights are shared by the group, so each hash term is one product
+    Accum128 hashSums[kEncodeRowGroup];
+    uint64_t hashWeight = hashStart;
+    if (Hash) {
+        for (unsigned i = 0; i < groupCount; ++i) {
+            hashSums[i].Clear();
+        }
+    }
+
+    /**** This loop takes over 95% of the execution time. ****/
+    for (unsigned w = 0; w < fullWords; ++w)
+    {
+        Accum128 sum;
+        sum.Clear();
+
+        for (unsigned i = 0; i < groupCount; ++i)
+        {
+            const uint64_t x = readers[i].ReadNext8Bytes(groupData[i] + offset);
+            if (Hash) {
+                hashSums[i].MultiplyAdd(hashWeight, x);
+            }
+            if (Shift) {
+                sum.ShiftAdd(x, static_cast<unsigned>(groupCoeffs[i]));
+            } else {
+                sum.MultiplyAdd(groupCoeffs[i], x);
+            }
+        }
+
+        uint64_t x = sum.Reduce();
+        if (accumulate) {
+            x = Add(x, ReadU64_LE(output));
+        }
+        WriteU64_LE(output, x);
+
+        if (Hash) {
+            hashWeight = Multiply(hashWeight, hashStep);
+        }
+
+        output += 8;
+        offset += 8;
+    }
+
+    if (finalBytes > 0)
+    {
+        Accum128 sum;
+        sum.Clear();
+
+        for (unsigned i = 0; i < groupCount; ++i)
+        {
+            const uint64_t x = readers[i].ReadFinalBytes(groupData[i] + offset, finalBytes);
+            if (Hash) {
+                hashSums[i].MultiplyAdd(hashWeight, x);
+            }
+            if (Shift) {
+                sum.ShiftAdd(x, static_cast<unsigned>(groupCoeffs[i]));
+            } else {
+                sum.MultiplyAdd(groupCoeffs[i], x);
+            }
+        }
+
+        uint64_t x = sum.Reduce();
+        if (accumulate) {
+            x = Add(x, ReadU64_LE(output));
+        }
+        WriteU64_LE(output, x);
+
+        output += 8;
+    }
+
+    if (Hash) {
+        for (unsigned i = 0; i < groupCount; ++i) {
+            groupHashes[i] = hashSums[i].Reduce();
+        }
+    }
+
+    return static_cast<unsigned>(output - recovery);
+}
+
+/*
+    When all the coefficients in a group are powers of two, such as a parity
+    row of all ones, the products are just shifts of the inputs.  The exact
+    same 128-bit sums are accumulated, so the result is bit-identical.
+*/
+static unsigned EncodeRowGroup(
+    AppDataReader* readers,
+    const uint8_t* const* groupData,
+    unsigned groupCount,
+    unsigned bytes,
+    const uint64_t* groupCoeffs,
+    bool accumulate,
+    uint64_t hashStart,
+    uint64_t hashStep,
+    uint64_t* groupHashes,
+    uint8_t* recovery)
+{
+    uint64_t shifts[kEncodeRowGroup];
+    bool shift = true;
+
+    for (unsigned i = 0; i < groupCount; ++i)
+    {
+        uint64_t param;
+        const CoeffForm form = GetCoeffForm(groupCoeffs[i], param);
+
+        if (form == kCoeffOne) {
+            shifts[i] = 0;
+        } else if (form == kCoeffShift) {
+            shifts[i] = param;
+        } else {
+            shift = false;
+            break;
+        }
+    }
+
+    if (groupHashes)
+    {
+        if (shift) {
+            return EncodeRowGroupT<true, true>(
+                readers, groupData, groupCount, bytes, shifts, accumulate, hashStart, hashStep, groupHashes, recovery);
+        }
+        return EncodeRowGroupT<false, true>(
+            readers, groupData, groupCount, bytes, groupCoeffs, accumulate, hashStart, hashStep, groupHashes, recovery);
+    }
+
+    if (shift) {
+        return EncodeRowGroupT<true, false>(
+            readers, groupData, groupCount, bytes, shifts, accumulate, 0, 0, nullptr, recovery);
+    }
+    return EncodeRowGroupT<false, false>(
+        readers, groupData, groupCount, bytes, groupCoeffs, accumulate, 0, 0, nullptr, recovery);
+}
+
+unsigned EncodeRow(
+    const uint8_t* const* originals,
+    unsigned N,
+    unsigned bytes,
+    const uint64_t* coeffs,
+    uint8_t* workspace,
+    uint8_t* recovery)
+{
+    return EncodeRow(originals, N, bytes, coeffs, workspace, recovery, 0, nullptr);
+}
+
+unsigned EncodeRow(
+    const uint8_t* const* originals,
+    unsigned N,
+    unsigned bytes,
+    const uint64_t* coeffs,
+    uint8_t* workspace,
+    uint8_t* recovery,
+    uint64_t hashKey,
+    uint64_t* hashes)
+{
+    const unsigned minimumOutputBytes = (bytes + 7) & ~7u;
+    const unsigned workspaceBytes = AppDataReader::GetWorkspaceBytes(bytes);
+
+    // Overflow words are accumulated into the tail, so start it at zero
+    memset(recovery + minimumOutputBytes, 0, workspaceBytes);
+
+    unsigned extraWordBytes = 0;
+
+    // The data words of the hash have weights key^W down to key^1.
+    // The key may be secret, so the inverse is the constant-time one
+    uint64_t hashStart = 0, hashStep = 0;
+    if (hashes)
+    {
+        hashStart = Power(hashKey, minimumOutputBytes / 8);
+        hashStep = InverseCT(hashKey);
+    }
+
+    AppDataReader readers[kEncodeRowGroup];
+
+    for (unsigned first = 0; first < N; first += kEncodeRowGroup)
+    {
+        unsigned groupCount = N - first;
+        if (groupCount > kEncodeRowGroup) {
+            groupCount = kEncodeRowGroup;
+        }
+
+        const uint8_t* const* groupData = originals + first;
+        const uint64_t* groupCoeffs = coeffs + first;
+
+        for (unsigned i = 0; i < groupCount; ++i) {
+            readers[i].SetupWorkspace(workspace + i * workspaceBytes);
+        }
+
+        uint64_t* groupHashes = hashes ? hashes + first : nullptr;
+
+        uint8_t* output = recovery + EncodeRowGroup(
+            readers, groupData, groupCount, bytes, groupCoeffs, first != 0,
+            hashStart, hashStep, groupHashes, recovery);
+
+        // Finalize the overflow bits for each original in the group
+        for (unsigned i = 0; i < groupCount; ++i)
+        {
+            const unsigned wordBytes = readers[i].FlushAndGetWordCount() * 8;
+            const uint8_t* readPtr = readers[i].Data;
+            const uint64_t coeff = groupCoeffs[i];
+
+            for (unsigned j = 0; j < wordBytes; j += 8)
+            {
+                WriteU64_LE(
+                    output + j,
+                    Add(
+                        Multiply(
+                            coeff,
+                            ReadU64_LE(readPtr + j)),
+                        ReadU64_LE(output + j)));
+            }
+
+            if (extraWordBytes < wordBytes) {
+                extraWordBytes = wordBytes;
+            }
+
+            if (groupHashes)
+            {
+                uint64_t extraHash = 0, extraScale = 1;
+                PolyHashExtraWords(readers[i], wordBytes / 8, hashKey, extraHash, extraScale);
+                groupHashes[i] = PolyHashFinish(groupHashes[i], extraHash, extraScale, bytes, hashKey);
+            }
+        }
+    }
+
+    return minimumOutputBytes + extraWordBytes;
+}
+
+unsigned EncodeRowSlice(
+    AppDataReader* readers,
+    const uint8_t* const* originals,
+    unsigned N,
+    unsigned bytes,
+    const uint64_t* coeffs,
+    uint8_t* recovery)
+{
+    unsigned outputBytes = 0;
+
+    for (unsigned first = 0; first < N; first += kEncodeRowGroup)
+    {
+        unsigned groupCount = N - first;
+        if (groupCount > kEncodeRowGroup) {
+            groupCount = kEncodeRowGroup;
+        }
+
+        outputBytes = EncodeRowGroup(
+            readers + first,
+            originals + first,
+            groupCount,
+            bytes,
+            coeffs + first,
+            first != 0,
+            0,
+            0,
+            nullptr,
+            recovery);
+    }
+
+    return outputBytes;
+}
+
+
+//------------------------------------------------------------------------------
+// Restore
+
+void RestoreRegion(
+    const uint8_t* words,
+    unsigned bytes,
+    uint8_t* output)
+{
+    const unsigned fullBytes = bytes & ~7u;
+    const unsigned finalBytes = bytes % 8;
+
+    AppDataWriter writer;
+    writer.SetupExtraWords(words + ((bytes + 7) & ~7u));
+
+    // Blocks of words without any ambiguous words are just reduced
+    unsigned offset = VectorRestoreWords(writer, words, fullBytes, output);
+
+    for (; offset < fullBytes; offset += 8) {
+        writer.WriteNext8Bytes(output + offset, ReadU64_LE(words + offset));
+    }
+
+    if (finalBytes > 0) {
+        writer.WriteFinalBytes(output + fullBytes, finalBytes, ReadU64_LE(words + fullBytes));
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// Tiled Encoder
+
+/*
+    EncodeTiled() walks the recovery outputs one column tile at a time, and
+    applies each original to all of the outputs with the MultiplyAddRegion()
+    inner loop before moving on to the next tile.  So the recovery tiles stay
+    in cache while all N originals stream through once.
+
+    Each original keeps its own AppDataReader from tile to tile, so the
+    overflow bits are emitted in the same order as a serial pass.  The reader
+    state is copied in and out of the workspace because the workspace does
+    not need to be aligned.
+*/
+
+unsigned EncodeTiled(
+    const uint8_t* const* originals,
+    unsigned N,
+    unsigned bytes,
+    const uint64_t* coeffs,
+    unsigned R,
+    uint8_t* workspace,
+    uint8_t* const* recoveries,
+    unsigned tileBytes)
+{
+    const unsigned minimumOutputBytes = (bytes + 7) & ~7u;
+    const unsigned workspaceBytes = AppDataReader::GetWorkspaceBytes(bytes);
+
+    // Keep tiles a multiple of the vector kernel block size
+    tileBytes &= ~63u;
+    if (tileBytes == 0) {
+        tileBytes = 64;
+    }
+
+    // Reader state is stored first, followed by the overflow words
+    uint8_t* readerState = workspace;
+    uint8_t* extraWords = workspace + N * sizeof(AppDataReader);
+
+    for (unsigned i = 0; i < N; ++i)
+    {
+        AppDataReader reader;
+        reader.SetupWorkspace(extraWords + i * workspaceBytes);
+        memcpy(readerState + i * sizeof(AppDataReader), &reader, sizeof(reader));
+    }
+
+    for (unsigned offset = 0; offset < bytes; offset += tileBytes)
+    {
+        unsigned tile = bytes - offset;
+        if (tile > tileBytes) {
+            tile = tileBytes;
+        }
+        const unsigned tileOutputBytes = (tile + 7) & ~7u;
+
+        // Adding to zero is exact, so this matches storing the first product
+        for (unsigned r = 0; r < R; ++r) {
+            memset(recoveries[r] + offset, 0, tileOutputBytes);
+        }
+
+        for (unsigned i = 0; i < N; ++i)
+        {
+            AppDataReader reader;
+            memcpy(&reader, readerState + i * sizeof(AppDataReader), sizeof(reader));
+
+            MultiplyAddRegionMultiSlice(
+                reader,
+                originals[i] + offset,
+                tile,
+                coeffs + i * R,
+                R,
+                recoveries,
+                offset);
+
+            memcpy(readerState + i * sizeof(AppDataReader), &reader, sizeof(reader));
+        }
+    }
+
+    // Overflow words are accumulated into the tail, so start it at zero
+    for (unsigned r = 0; r < R; ++r) {
+        memset(recoveries[r] + minimumOutputBytes, 0, workspaceBytes);
+    }
+
+    unsigned extraWordBytes = 0;
+
+    for (unsigned i = 0; i < N; ++i)
+    {
+        AppDataReader reader;
+        memcpy(&reader, readerState + i * sizeof(AppDataReader), sizeof(reader));
+
+        const unsigned wordBytes = reader.FlushAndGetWordCount() * 8;
+        const uint64_t* columnCoeffs = coeffs + i * R;
+
+        for (unsigned j = 0; j < wordBytes; j += 8)
+        {
+            const uint64_t x = ReadU64_LE(reader.Data + j);
+
+            for (unsigned r = 0; r < R; ++r)
+            {
+                uint8_t* output = recoveries[r] + minimumOutputBytes + j;
+                WriteU64_LE(output, Add(Multiply(columnCoeffs[r], x), ReadU64_LE(output)));
+            }
+        }
+
+        if (extraWordBytes < wordBytes) {
+            extraWordBytes = wordBytes;
+        }
     }
 
     return minimumOutputBytes + extraWordBytes;
 }
 
 
+//------------------------------------------------------------------------------
+// Streaming
+
+void RegionStream::Begin(
+    uint64_t coeff,
+    uint8_t* output,
+    uint8_t* workspace,
+    unsigned maxBytes,
+    bool accumulate)
+{
+    Reader.SetupWorkspace(workspace);
+    Coeff = coeff;
+    Output = output;
+    MaxBytes = maxBytes;
+    Accumulate = accumulate;
+    InputBytes = 0;
+    OutputBytes = 0;
+    CarryBytes = 0;
+}
+
+bool RegionStream::Update(const uint8_t* data, unsigned bytes)
+{
+    if (bytes > MaxBytes - InputBytes) {
+        return false;
+    }
+    InputBytes += bytes;
+
+    // Complete the partial word from the last chunk first
+    if (CarryBytes > 0)
+    {
+        unsigned copyBytes = 8 - CarryBytes;
+        if (copyBytes > bytes) {
+            copyBytes = bytes;
+        }
+
+        memcpy(Carry + CarryBytes, data, copyBytes);
+        CarryBytes += copyBytes;
+        data += copyBytes;
+        bytes -= copyBytes;
+
+        if (CarryBytes < 8) {
+            return true;
+        }
+
+        ProcessWords(Carry, 8);
+        CarryBytes = 0;
+    }
+
+    const unsigned wordBytes = bytes & ~7u;
+    if (wordBytes > 0) {
+        ProcessWords(data, wordBytes);
+    }
+
+    CarryBytes = bytes - wordBytes;
+    memcpy(Carry, data + wordBytes, CarryBytes);
+    return true;
+}
+
+void RegionStream::ProcessWords(const uint8_t* data, unsigned bytes)
+{
+    uint8_t* output = Output + OutputBytes;
+
+    // Special fast case: Same as MultiplyRegion() for zero
+    if (Coeff == 0)
+    {
+        const unsigned outputBytes = (bytes + 7) & ~7u;
+        if (!Accumulate) {
+            memset(output, 0, outputBytes);
+        }
+        OutputBytes += outputBytes;
+    }
+    else if (Accumulate) {
+        OutputBytes += MultiplyAddRegionSlice(Reader, data, bytes, Coeff, output);
+    }
+    else {
+        OutputBytes += MultiplyRegionSlice(Reader, data, bytes, Coeff, output);
+    }
+}
+
+unsigned RegionStream::Finish()
+{
+    if (CarryBytes > 0)
+    {
+        ProcessWords(Carry, CarryBytes);
+        CarryBytes = 0;
+    }
+
+    if (Coeff == 0) {
+        return OutputBytes;
+    }
+
+    // Finalize the overflow bits
+    const unsigned extraWordBytes = Reader.FlushAndGetWordCount() * 8;
+    const uint8_t* readPtr = Reader.Data;
+    uint8_t* output = Output + OutputBytes;
+
+    for (unsigned i = 0; i < extraWordBytes; i += 8)
+    {
+        uint64_t x = Multiply(Coeff, ReadU64_LE(readPtr + i));
+        if (Accumulate) {
+            x = Add(x, ReadU64_LE(output + i));
+        }
+        WriteU64_LE(output + i, x);
+    }
+
+    return OutputBytes + extraWordBytes;
+}
+
+
+//------------------------------------------------------------------------------
+// Batch Operations
+
+template<bool Accumulate>
+static void MultiplyRegionBatchT(RegionBatchItem* items, unsigned count)
+{
+    // Prepared once per run of items with the same coefficient, such as the
+    // packets of a block multiplied by one generator value.
+    // The default is the same as Set(0)
+    MulConst coeff;
+
+    for (unsigned i = 0; i < count; ++i)
+    {
+        RegionBatchItem& item = items[i];
+
+        if (item.Coeff != coeff.Coeff) {
+            coeff.Set(item.Coeff);
+        }
+
+        if (coeff.Coeff == 0)
+        {
+            const unsigned minimumOutputBytes = (item.Bytes + 7) & ~7u;
+            if (!Accumulate) {
+                memset(item.Output, 0, minimumOutputBytes);
+            }
+            item.OutputBytes = minimumOutputBytes;
+            RecordRegionCall(item.Bytes, coeff, 0, 0);
+            continue;
+        }
+
+        item.OutputBytes = MultiplyRegionToTail<Accumulate>(item.Data, item.Bytes, coeff, item.Output);
+    }
+}
+
+void MultiplyRegionBatch(RegionBatchItem* items, unsigned count)
+{
+    MultiplyRegionBatchT<false>(items, count);
+}
+
+void MultiplyAddRegionBatch(RegionBatchItem* items, unsigned count)
+{
+    MultiplyRegionBatchT<true>(items, count);
+}
+
+
+//------------------------------------------------------------------------------
+// NTT Butterflies
+
+template<bool DIT>
+static void NTTStageT(
+    uint64_t* data,
+    unsigned count,
+    unsigned half,
+    const uint64_t* twiddles)
+{
+    for (unsigned block = 0; block < count; block += 2 * half)
+    {
+        uint64_t* x = data + block;
+        uint64_t* y = x + half;
+
+        for (unsigned j = VectorNTTButterflies<DIT>(x, y, twiddles, half); j < half; ++j)
+        {
+            const uint64_t a = x[j];
+
+            if (DIT)
+            {
+                const uint64_t b = Multiply(y[j], twiddles[j]);
+                x[j] = Add(a, b);
+                y[j] = Subtract(a, b);
+            }
+            else
+            {
+                const uint64_t b = y[j];
+                x[j] = Add(a, b);
+                y[j] = Multiply(Subtract(a, b), twiddles[j]);
+            }
+        }
+    }
+}
+
+void NTTStageDIF(
+    uint64_t* data,
+    unsigned count,
+    unsigned half,
+    const uint64_t* twiddles)
+{
+    NTTStageT<false>(data, count, half, twiddles);
+}
+
+void NTTStageDIT(
+    uint64_t* data,
+    unsigned count,
+    unsigned half,
+    const uint64_t* twiddles)
+{
+    NTTStageT<true>(data, count, half, twiddles);
+}
+
+
 } // namespace solinas64
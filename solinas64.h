@@ -45,6 +45,18 @@
 // Another reason to do this is if the platform is big-endian.
 //#define SOLINAS64_SAFE_MEMORY_ACCESSES
 
+// Define this to disable the AVX2/AVX-512 bulk kernels.
+// Otherwise the best available instruction set is selected at runtime.
+//#define SOLINAS64_DISABLE_SIMD
+
+// Define this to build the products from 32x32->64 multiplies, as is done
+// automatically on 32-bit targets.  This tests that code on 64-bit hosts.
+//#define SOLINAS64_MUL_32BIT_LIMBS
+
+// Define this to count the work done by MultiplyRegion() and
+// MultiplyAddRegion() in per-thread counters, reported by GetRegionStats().
+//#define SOLINAS64_ENABLE_STATS
+
 
 //------------------------------------------------------------------------------
 // Portability Macros
@@ -56,6 +68,16 @@
 # define SOLINAS64_FORCE_INLINE inline __attribute__((always_inline))
 #endif
 
+// Vector instruction sets that the bulk operations may select at runtime
+#if !defined(SOLINAS64_DISABLE_SIMD) && !defined(SOLINAS64_SAFE_MEMORY_ACCESSES)
+# if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#  if (defined(_MSC_VER) && _MSC_VER >= 1911) || defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5)
+#   define SOLINAS64_TRY_AVX2 /* 256-bit */
+#   define SOLINAS64_TRY_AVX512 /* 512-bit */
+#  endif
+# endif
+#endif
+
 
 //------------------------------------------------------------------------------
 // Portable 64x64->128 Multiply
@@ -121,7 +143,18 @@ SOLINAS64_FORCE_INLINE uint64_t Emulate64x64to128(
     return (middle << 32) | static_cast<uint32_t>(p00);
 }
 
-#if defined(_MSC_VER) && defined(_WIN64)
+#if !defined(SOLINAS64_MUL_32BIT_LIMBS) && \
+    !(defined(_MSC_VER) && defined(_WIN64)) && !defined(__SIZEOF_INT128__)
+# define SOLINAS64_MUL_32BIT_LIMBS
+#endif
+
+#if defined(SOLINAS64_MUL_32BIT_LIMBS)
+// Emulate 64x64->128-bit multiply with 32x32->64 operations
+
+# define CAT_MUL128(r_hi, r_lo, x, y) \
+    r_lo = Emulate64x64to128(r_hi, x, y);
+
+#elif defined(_MSC_VER) && defined(_WIN64)
 // Visual Studio 64-bit
 
 # include <intrin.h>
@@ -139,12 +172,6 @@ SOLINAS64_FORCE_INLINE uint64_t Emulate64x64to128(
         r_hi = (uint64_t)(w >> 64);                     \
     }
 
-#else
-// Emulate 64x64->128-bit multiply with 64x64->64 operations
-
-# define CAT_MUL128(r_hi, r_lo, x, y) \
-    r_lo = Emulate64x64to128(r_hi, x, y);
-
 #endif // End CAT_MUL128
 
 
@@ -184,8 +211,14 @@ SOLINAS64_FORCE_INLINE bool sbb(uint64_t& x, uint64_t y)
 */
 SOLINAS64_FORCE_INLINE uint64_t Add(uint64_t x, uint64_t y)
 {
-    if (adc(x, y)) {
-        adc(x, kPrimeSubC);
+    // The first carry is data-dependent and often mispredicted as a branch,
+    // so it selects the correction with a mask instead.
+    const uint64_t mask = (uint64_t)0 - (uint64_t)adc(x, y);
+
+    // This can only carry again if both inputs were >= p,
+    // and then x < kPrimeSubC so it cannot carry a third time.
+    if (adc(x, mask & kPrimeSubC)) {
+        x += kPrimeSubC;
     }
     return x;
 }
@@ -197,8 +230,12 @@ SOLINAS64_FORCE_INLINE uint64_t Add(uint64_t x, uint64_t y)
 */
 SOLINAS64_FORCE_INLINE uint64_t Subtract(uint64_t x, uint64_t y)
 {
-    if (sbb(x, y)) {
-        sbb(x, kPrimeSubC);
+    const uint64_t mask = (uint64_t)0 - (uint64_t)sbb(x, y);
+
+    // This can only borrow again if y > x + p,
+    // and then x >= p so it cannot borrow a third time.
+    if (sbb(x, mask & kPrimeSubC)) {
+        x -= kPrimeSubC;
     }
     return x;
 }
@@ -233,6 +270,22 @@ SOLINAS64_FORCE_INLINE uint64_t Multiply(uint64_t x, uint64_t y)
     return Subtract(Add(p_lo, t), a3);
 }
 
+/**
+    r = solinas64::Finalize(x)
+
+    Returns x reduced to the range 0 <= r < p.
+
+    The other operations accept and may produce any 64-bit value, which
+    only needs this final step when the unique value is needed.
+*/
+SOLINAS64_FORCE_INLINE uint64_t Finalize(uint64_t x)
+{
+    if (x >= kPrime) {
+        x -= kPrime;
+    }
+    return x;
+}
+
 /**
     r = solinas64::Inverse(x)
 
@@ -242,9 +295,7 @@ SOLINAS64_FORCE_INLINE uint64_t Multiply(uint64_t x, uint64_t y)
     This operation is kind of heavy so it should be avoided where possible.
 
     This operation is not constant-time.
-    A constant-time version can be implemented using Euler's totient method and
-    a straight line similar to
-    https://github.com/catid/snowshoe/blob/master/src/fp.inc#L545
+    See InverseCT() for a constant-time version.
 
     Returns the multiplicative inverse of x modulo p.
     0 < result < p
@@ -253,6 +304,401 @@ SOLINAS64_FORCE_INLINE uint64_t Multiply(uint64_t x, uint64_t y)
 */
 uint64_t Inverse(uint64_t x);
 
+/**
+    r = solinas64::InverseCT(x)
+
+    r = x^-1 (mod p)
+    The input value x can be any 64-bit value.
+
+    This is a constant-time version of Inverse() that computes x^(p-2) using
+    Euler's totient method, with a fixed addition chain of 64 squarings and
+    9 multiplies.  It has no branches or divisions, so the run time does not
+    depend on the input.  Where 64-bit division is slow it is also faster
+    than Inverse().
+
+    Returns the multiplicative inverse of x modulo p.
+    0 < result < p
+
+    If the inverse does not exist, it returns 0.
+*/
+uint64_t InverseCT(uint64_t x);
+
+/**
+    r = solinas64::Power(x, e)
+
+    r = x^e (mod p), by square-and-multiply.
+    The input value x can be any 64-bit value, and 0^0 = 1.
+
+    This is not constant-time: The run time depends on e.
+
+    Returns the power, fully reduced: 0 <= result < p
+*/
+uint64_t Power(uint64_t x, uint64_t e);
+
+/**
+    BatchInverse()
+
+    values[i] = values[i]^-1 (mod p), for i = 0..count-1
+
+    This uses Montgomery's trick to invert all of the values with a single
+    call to InverseCT() plus 3 multiplies per value, which is much cheaper
+    than inverting each value separately.
+
+    The input values can be any 64-bit values.  Values that have no inverse
+    are set to 0 as in Inverse(), without affecting the other results.
+    All the results are fully reduced: 0 <= values[i] < p.
+
+    Preconditions:
+        values != null, scratch != null
+        scratch has room for `count` values.
+*/
+void BatchInverse(uint64_t* values, unsigned count, uint64_t* scratch);
+
+
+//------------------------------------------------------------------------------
+// Compile-Time Arithmetic
+
+/*
+    constexpr versions of the field operations, for building coefficient
+    tables and other constants at compile time:
+
+        static constexpr uint64_t kTable[3] = {
+            solinas64::ConstPower(7, 1), solinas64::ConstPower(7, 2), ...
+        };
+
+    These are written as single return statements for C++11, with the
+    128-bit product built from 32-bit halves, so they are much slower than
+    the regular versions at run time.  The inputs can be any 64-bit values,
+    and the results are fully reduced: 0 <= r < p.  The results are the
+    Finalize() of the regular versions.
+*/
+
+/// Returns x reduced to 0 <= r < p
+constexpr uint64_t ConstFinalize(uint64_t x)
+{
+    return x >= kPrime ? x - kPrime : x;
+}
+
+/// Returns x + y (mod p) for 0 <= x, y < p.
+/// When the sum wraps, 2^64 = 2^32 - 1 (mod p) brings it below p
+constexpr uint64_t ConstAddReduced(uint64_t x, uint64_t y)
+{
+    return (x + y < x) ? (x + y + kPrimeSubC) : ConstFinalize(x + y);
+}
+
+/// Returns x - y (mod p) for 0 <= x, y < p
+constexpr uint64_t ConstSubtractReduced(uint64_t x, uint64_t y)
+{
+    return (x >= y) ? (x - y) : (x - y + kPrime);
+}
+
+/// r = x + y (mod p)
+constexpr uint64_t ConstAdd(uint64_t x, uint64_t y)
+{
+    return ConstAddReduced(ConstFinalize(x), ConstFinalize(y));
+}
+
+/// r = x - y (mod p)
+constexpr uint64_t ConstSubtract(uint64_t x, uint64_t y)
+{
+    return ConstSubtractReduced(ConstFinalize(x), ConstFinalize(y));
+}
+
+/// Returns the high 64 bits of x * y, from the 32-bit partial products
+constexpr uint64_t ConstMulHi(uint64_t x, uint64_t y)
+{
+    return (x >> 32) * (y >> 32)
+        + (((((x & 0xffffffff) * (y & 0xffffffff)) >> 32)
+            + (((x >> 32) * (y & 0xffffffff)) & 0xffffffff)
+            + (((x & 0xffffffff) * (y >> 32)) & 0xffffffff)) >> 32)
+        + (((x >> 32) * (y & 0xffffffff)) >> 32)
+        + (((x & 0xffffffff) * (y >> 32)) >> 32);
+}
+
+/// Reduce p_hi * 2^64 + p_lo as in Multiply(), where a2 * (2^32 - 1) < p
+constexpr uint64_t ConstReduce128(uint64_t p_hi, uint64_t p_lo)
+{
+    return ConstSubtractReduced(
+        ConstAddReduced(
+            ConstFinalize(p_lo),
+            ((p_hi & 0xffffffff) << 32) - (p_hi & 0xffffffff)),
+        p_hi >> 32);
+}
+
+/// r = x * y (mod p)
+constexpr uint64_t ConstMultiply(uint64_t x, uint64_t y)
+{
+    return ConstReduce128(ConstMulHi(x, y), x * y);
+}
+
+/// r = x^e (mod p), with 0^0 = 1.  The recursion depth is the bit length of e
+constexpr uint64_t ConstPower(uint64_t x, uint64_t e)
+{
+    return (e == 0) ? 1 : ConstMultiply(
+        ConstPower(ConstMultiply(x, x), e >> 1),
+        (e & 1) ? ConstFinalize(x) : 1);
+}
+
+
+//------------------------------------------------------------------------------
+// Lazy Reduction
+
+/**
+    Accum128
+
+    Sum of products with a single reduction at the end.
+
+    Each 64x64 product is 128 bits, and the carries out of the 128-bit sum
+    are counted in a third word, so adding a term is three additions with
+    carry and no branches.  The sum is:
+
+        Top * 2^128 + Hi * 2^64 + Lo
+
+    where 2^64 = 2^32 - 1 (mod p) and 2^128 = -2^32 (mod p), so Reduce()
+    costs about the same as one Multiply().
+
+    Each term adds at most one to Top, so up to kMaxTerms terms may be added
+    before calling Reduce().  For longer sums, Fold() the accumulator first.
+
+    Reduce() gives the same result as summing the terms with Multiply() and
+    Add() one at a time, up to a multiple of p.
+*/
+struct Accum128
+{
+    /// Maximum number of terms between folds
+    static const unsigned kMaxTerms = ~(uint32_t)0;
+
+    uint64_t Lo, Hi, Top;
+
+
+    /// Start a new sum at zero
+    SOLINAS64_FORCE_INLINE void Clear()
+    {
+        Lo = Hi = Top = 0;
+    }
+
+    /// Sum += x * y
+    SOLINAS64_FORCE_INLINE void MultiplyAdd(uint64_t x, uint64_t y)
+    {
+        uint64_t p_lo, p_hi;
+        CAT_MUL128(p_hi, p_lo, x, y);
+
+        p_hi += adc(Lo, p_lo);
+        Top += adc(Hi, p_hi);
+    }
+
+    /// Sum += x * 2^shift, for 0 <= shift < 64
+    SOLINAS64_FORCE_INLINE void ShiftAdd(uint64_t x, unsigned shift)
+    {
+        const uint64_t p_lo = x << shift;
+        uint64_t p_hi = (x >> 1) >> (63 - shift);
+
+        p_hi += adc(Lo, p_lo);
+        Top += adc(Hi, p_hi);
+    }
+
+    /// Sum += x
+    SOLINAS64_FORCE_INLINE void Add(uint64_t x)
+    {
+        Top += adc(Hi, adc(Lo, x) ? 1 : 0);
+    }
+
+    /// Returns the sum reduced to 64 bits (mod p).
+    /// Call Finalize() on the result for the unique value.
+    SOLINAS64_FORCE_INLINE uint64_t Reduce() const
+    {
+        const uint32_t a2 = static_cast<uint32_t>(Hi);
+        const uint32_t a3 = static_cast<uint32_t>(Hi >> 32);
+
+        const uint64_t t = (static_cast<uint64_t>(a2) << 32) - a2;
+
+        return Subtract(Subtract(solinas64::Add(Lo, t), a3), Top << 32);
+    }
+
+    /// Reduce the sum in place to allow another kMaxTerms terms
+    SOLINAS64_FORCE_INLINE void Fold()
+    {
+        Lo = Reduce();
+        Hi = Top = 0;
+    }
+};
+
+
+//------------------------------------------------------------------------------
+// Extension Fields
+
+/**
+    Fp2: GF(p^2) = GF(p)[u] / (u^2 - 7)
+
+    Elements are c0 + c1 * u.  7 is the smallest quadratic non-residue
+    modulo p, so u^2 - 7 is irreducible.
+
+    The coordinates may be any 64-bit values, and the operations below
+    return them not fully reduced, as for the base field.  Call Finalize()
+    for the unique values.
+
+    Elements are stored in memory as two consecutive field words c0, c1,
+    so a buffer of 2 * count words from the bulk operations is also a buffer
+    of count Fp2 elements.
+*/
+struct Fp2
+{
+    uint64_t c0, c1;
+};
+
+/// u^2 = kFp2NonResidue in Fp2
+static const uint64_t kFp2NonResidue = 7;
+
+/**
+    Fp3: GF(p^3) = GF(p)[u] / (u^3 - 2)
+
+    Elements are c0 + c1 * u + c2 * u^2.  2 has order 192, which is not a
+    divisor of (p - 1) / 3, so it is not a cube and u^3 - 2 is irreducible.
+    Multiplying by it is an Add().
+
+    Stored in memory as three consecutive field words, like Fp2.
+*/
+struct Fp3
+{
+    uint64_t c0, c1, c2;
+};
+
+/// u^3 = kFp3NonResidue in Fp3
+static const uint64_t kFp3NonResidue = 2;
+
+SOLINAS64_FORCE_INLINE Fp2 Add(const Fp2& x, const Fp2& y)
+{
+    const Fp2 r = { Add(x.c0, y.c0), Add(x.c1, y.c1) };
+    return r;
+}
+
+SOLINAS64_FORCE_INLINE Fp2 Subtract(const Fp2& x, const Fp2& y)
+{
+    const Fp2 r = { Subtract(x.c0, y.c0), Subtract(x.c1, y.c1) };
+    return r;
+}
+
+SOLINAS64_FORCE_INLINE Fp2 Finalize(const Fp2& x)
+{
+    const Fp2 r = { Finalize(x.c0), Finalize(x.c1) };
+    return r;
+}
+
+/**
+    r = solinas64::Multiply(x, y) in Fp2
+
+    c0 = x0 * y0 + 7 * x1 * y1
+    c1 = x0 * y1 + x1 * y0
+
+    Each coordinate is summed with an Accum128 and reduced once.  The factor
+    7 is applied to y, so it is hoisted out of loops that multiply by a
+    constant y, as in Horner's rule.
+*/
+SOLINAS64_FORCE_INLINE Fp2 Multiply(const Fp2& x, const Fp2& y)
+{
+    Accum128 c0, c1;
+    c0.Clear();
+    c0.MultiplyAdd(x.c0, y.c0);
+    c0.MultiplyAdd(x.c1, Multiply(y.c1, kFp2NonResidue));
+    c1.Clear();
+    c1.MultiplyAdd(x.c0, y.c1);
+    c1.MultiplyAdd(x.c1, y.c0);
+
+    const Fp2 r = { c0.Reduce(), c1.Reduce() };
+    return r;
+}
+
+/// r = x * x in Fp2
+SOLINAS64_FORCE_INLINE Fp2 Square(const Fp2& x)
+{
+    Accum128 c0;
+    c0.Clear();
+    c0.MultiplyAdd(x.c0, x.c0);
+    c0.MultiplyAdd(Multiply(x.c1, x.c1), kFp2NonResidue);
+
+    const Fp2 r = { c0.Reduce(), Multiply(x.c0, Add(x.c1, x.c1)) };
+    return r;
+}
+
+/// r = 1 / x in Fp2, or 0 if x = 0.  The result is fully reduced.
+Fp2 Inverse(const Fp2& x);
+
+SOLINAS64_FORCE_INLINE Fp3 Add(const Fp3& x, const Fp3& y)
+{
+    const Fp3 r = { Add(x.c0, y.c0), Add(x.c1, y.c1), Add(x.c2, y.c2) };
+    return r;
+}
+
+SOLINAS64_FORCE_INLINE Fp3 Subtract(const Fp3& x, const Fp3& y)
+{
+    const Fp3 r = { Subtract(x.c0, y.c0), Subtract(x.c1, y.c1), Subtract(x.c2, y.c2) };
+    return r;
+}
+
+SOLINAS64_FORCE_INLINE Fp3 Finalize(const Fp3& x)
+{
+    const Fp3 r = { Finalize(x.c0), Finalize(x.c1), Finalize(x.c2) };
+    return r;
+}
+
+/**
+    r = solinas64::Multiply(x, y) in Fp3
+
+    c0 = x0 * y0 + 2 * (x1 * y2 + x2 * y1)
+    c1 = x0 * y1 + x1 * y0 + 2 * x2 * y2
+    c2 = x0 * y2 + x1 * y1 + x2 * y0
+
+    Each coordinate is summed with an Accum128 and reduced once.  As for
+    Fp2, the factors of 2 are applied to y.
+*/
+SOLINAS64_FORCE_INLINE Fp3 Multiply(const Fp3& x, const Fp3& y)
+{
+    const uint64_t y1d = Add(y.c1, y.c1);
+    const uint64_t y2d = Add(y.c2, y.c2);
+
+    Accum128 c0, c1, c2;
+    c0.Clear();
+    c0.MultiplyAdd(x.c0, y.c0);
+    c0.MultiplyAdd(x.c1, y2d);
+    c0.MultiplyAdd(x.c2, y1d);
+    c1.Clear();
+    c1.MultiplyAdd(x.c0, y.c1);
+    c1.MultiplyAdd(x.c1, y.c0);
+    c1.MultiplyAdd(x.c2, y2d);
+    c2.Clear();
+    c2.MultiplyAdd(x.c0, y.c2);
+    c2.MultiplyAdd(x.c1, y.c1);
+    c2.MultiplyAdd(x.c2, y.c0);
+
+    const Fp3 r = { c0.Reduce(), c1.Reduce(), c2.Reduce() };
+    return r;
+}
+
+/// r = x * x in Fp3
+SOLINAS64_FORCE_INLINE Fp3 Square(const Fp3& x)
+{
+    const uint64_t x1d = Add(x.c1, x.c1);
+    const uint64_t x2d = Add(x.c2, x.c2);
+
+    // c0 = x0^2 + 4 * x1 * x2, c1 = 2 * x0 * x1 + 2 * x2^2, c2 = 2 * x0 * x2 + x1^2
+    Accum128 c0, c1, c2;
+    c0.Clear();
+    c0.MultiplyAdd(x.c0, x.c0);
+    c0.MultiplyAdd(x1d, x2d);
+    c1.Clear();
+    c1.MultiplyAdd(x.c0, x1d);
+    c1.MultiplyAdd(x2d, x.c2);
+    c2.Clear();
+    c2.MultiplyAdd(x.c0, x2d);
+    c2.MultiplyAdd(x.c1, x.c1);
+
+    const Fp3 r = { c0.Reduce(), c1.Reduce(), c2.Reduce() };
+    return r;
+}
+
+/// r = 1 / x in Fp3, or 0 if x = 0.  The result is fully reduced.
+Fp3 Inverse(const Fp3& x);
+
 
 //------------------------------------------------------------------------------
 // Memory Reading
@@ -358,28 +804,24 @@ struct AppDataReader
 
 
     /// Returns the number of extra temporary workspace bytes needed.
-    static SOLINAS64_FORCE_INLINE unsigned GetWorkspaceBytes(unsigned bytes)
+    /// This is constexpr, so buffers for a fixed size can be on the stack.
+    static constexpr unsigned GetWorkspaceBytes(unsigned bytes)
     {
-        const unsigned inputBits = bytes * 8;
-
         // All words may be expanded by one bit, hence the (bits / 64) factor,
         // but only full words can be too large, so we round down.
-        const unsigned maxExtraBits = inputBits / 64;
-
-        // Round up to the number of words needed.
-        const unsigned words = (maxExtraBits + 63) / 64;
-
-        // Return the number of bytes needed in the Data pointer.
-        return words * 8;
+        // Then round up to the number of words needed, where each word holds
+        // 63 bits so that it is always in the field.
+        return ((bytes * 8 / 64 + 62) / 63) * 8;
     }
 
     /// Returns the number of bytes overall that will be produced.
     /// This includes the original data converted to words plus the extra words
     /// that are generated by this class to handle input overflows.
-    static SOLINAS64_FORCE_INLINE unsigned GetMaxOutputBytes(unsigned bytes)
+    /// When every full word is ambiguous the output is exactly this size,
+    /// with one extra word per 63 full words of input (rounded up).
+    static constexpr unsigned GetMaxOutputBytes(unsigned bytes)
     {
-        const unsigned originalWords = (bytes + 7) / 8;
-        return GetWorkspaceBytes(bytes) + originalWords * 8;
+        return GetWorkspaceBytes(bytes) + (bytes + 7) / 8 * 8;
     }
 
     /// Provide the workspace data buffer of size GetWorkspaceBytes().
@@ -403,28 +845,32 @@ struct AppDataReader
         // If word needs a bit emitted:
         if (IsU64Ambiguous(word))
         {
-            // Emit words that have the high bit cleared so they are all in Fp:
+            // Emit words that have the high bit cleared so they are all in Fp
+            const uint64_t bit = word >> 63;
+            EmitBits(bit, 1);
+            word ^= bit << 63;
+        }
 
-            // If we ran out of space:
-            if (Available >= 63)
-            {
-                WriteU64_LE(DataWritePtr, Workspace);
+        return word;
+    }
 
-                DataWritePtr += 8;
-                Workspace = word >> 63;
-                Available = 1;
-            }
-            else
-            {
-                Workspace |= (word >> 63) << Available;
-                ++Available;
-            }
+    /// Emit 0 <= count <= 8 extra bits in order, as ReadNext8Bytes() would
+    /// for `count` ambiguous words with these high bits.
+    SOLINAS64_FORCE_INLINE void EmitBits(uint64_t bits, int count)
+    {
+        const int previous = Available;
+        Workspace |= bits << previous;
+        Available = previous + count;
 
-            // Clear high bit either way
-            word &= kHighBitMask;
-        }
+        // If we ran out of space, emit a word of 63 bits and keep the rest
+        if (Available > 63)
+        {
+            WriteU64_LE(DataWritePtr, Workspace & kHighBitMask);
+            DataWritePtr += 8;
 
-        return word;
+            Workspace = bits >> (63 - previous);
+            Available -= 63;
+        }
     }
 
     /// Read the final few bytes of data.
@@ -457,6 +903,91 @@ struct AppDataReader
 };
 
 
+//------------------------------------------------------------------------------
+// Writing Data
+
+/**
+    AppDataWriter
+
+    This is the inverse of AppDataReader: It converts field words back into
+    the original byte data.  Words that AppDataReader made fit in the field
+    by clearing the high bit still have the ambiguous pattern, so for each of
+    those words the next extra bit is put back into the high bit.
+
+    The extra words follow the data words, starting at roundup(bytes, 8).
+    Words may be non-canonical, e.g. the output of MultiplyWords(), because
+    they are reduced by Finalize() as they are written.
+*/
+struct AppDataWriter
+{
+    const uint8_t* ExtraReadPtr;
+    uint64_t Workspace;
+    int Available;
+
+
+    /// Provide the extra words that follow the data words.
+    SOLINAS64_FORCE_INLINE void SetupExtraWords(const uint8_t* extraWords)
+    {
+        ExtraReadPtr = extraWords;
+        Workspace = 0;
+        Available = 0;
+    }
+
+    /// Write the next word of original data.
+    /// This should be called from the first word of data until the last word.
+    SOLINAS64_FORCE_INLINE void WriteNext8Bytes(uint8_t* output, uint64_t word)
+    {
+        word = Finalize(word);
+
+        // One for ambiguous words, which consume an extra bit
+        const int ambiguous = IsU64Ambiguous(word) ? 1 : 0;
+
+        // If we ran out of extra bits:
+        if (ambiguous > Available)
+        {
+            Workspace = Finalize(ReadU64_LE(ExtraReadPtr));
+            ExtraReadPtr += 8;
+            Available = 63;
+        }
+
+        word |= (Workspace & static_cast<uint64_t>(ambiguous)) << 63;
+        Workspace >>= ambiguous;
+        Available -= ambiguous;
+
+        WriteU64_LE(output, word);
+    }
+
+    /// Write the final few bytes of data.
+    /// Precondition: 0 < bytes < 8.
+    SOLINAS64_FORCE_INLINE void WriteFinalBytes(uint8_t* output, unsigned bytes, uint64_t word)
+    {
+        // The final partial word is never ambiguous
+        WriteBytes_LE(output, bytes, Finalize(word));
+    }
+};
+
+/**
+    RestoreRegion()
+
+    Converts `words` produced by AppDataReader, such as a decoded packet,
+    back into `bytes` of original data.
+
+    The input holds the data words followed by the extra words, as laid out
+    by MultiplyRegion().  Blocks of words that have no ambiguous words are
+    reduced and stored with vector instructions, without the per-word extra
+    bit tracking.
+
+    Preconditions:
+        words != null, output != null, bytes > 0
+        The input is GetMaxOutputBytes(bytes) in size, zero-padded past the
+        extra words that were produced.
+*/
+void RestoreRegion(
+    const uint8_t* words,   ///< Input field words, read with ReadU64_LE()
+    unsigned bytes,         ///< Number of original data bytes
+    uint8_t* output);       ///< Output original data, `bytes` in size
+
+
 //------------------------------------------------------------------------------
 // Random Numbers
 
@@ -503,7 +1034,16 @@ struct Random
 };
 
 /// Hash a 64-bit value to another 64-bit value
-uint64_t HashU64(uint64_t x);
+/// From http://xoshiro.di.unimi.it/splitmix64.c
+/// Written in 2015 by Sebastiano Vigna (vigna@acm.org)
+SOLINAS64_FORCE_INLINE uint64_t HashU64(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15;
+    uint64_t z = x;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
 
 /// Hash a seed into a value from 1..p-1
 SOLINAS64_FORCE_INLINE uint64_t HashToNonzeroFp(uint64_t word)
@@ -526,31 +1066,110 @@ SOLINAS64_FORCE_INLINE uint64_t HashToNonzeroFp(uint64_t word)
 //------------------------------------------------------------------------------
 // Bulk Operations
 
+/// Instruction sets that the bulk operations can run on
+enum class SimdBackend
+{
+    Scalar,
+    AVX2,
+    AVX512
+};
+
+/// Returns the instruction set selected for the bulk operations on this CPU
+SimdBackend GetSimdBackend();
+
 /**
-    MultiplyRegion()
+    MulConst
 
-    output[] = data[] * coeff
+    A coefficient prepared for the bulk operations.
 
-    Preconditions:
-        0 <= coeff < p.
-        data != null, output != null, workspace != null, bytes > 0
+    Set() picks the cheapest kernel for the coefficient once: 1 needs no
+    multiply, 2^k is a shift, and coefficients below 2^32 need only half
+    of the 32x32->64 partial products.  Every kernel produces the same
+    bytes as the general multiply.
 
-    Note: This expands the input data up to solinas64::GetMaxOutputBytes() bytes.
+    Encoders that reuse the same coefficients for many blocks can prepare
+    them once and pass the MulConst to the region operations, which skips
+    this selection on every call.
 
-    Returns the number of bytes written.
+    A Shoup-style precomputed quotient does not help for this field:
+    p > 2^63, so the Shoup remainder needs 65 bits, and the reduction of a
+    general product is already just shifts and adds.
 */
-unsigned MultiplyRegion(
-    const uint8_t* data,    ///< Input data
-    unsigned bytes,         ///< Number of input data bytes
-    uint64_t coeff,         ///< Coefficient to multiply the data by
-    uint8_t* workspace,     ///< Size calculated by solinas64::GetWorkspaceBytes()
-    uint8_t* output);       ///< Size calculated by solinas64::GetMaxOutputBytes()
+struct MulConst
+{
+    /// Coefficient, 0 <= Coeff < p.  Defaults to 0, the same as Set(0)
+    uint64_t Coeff = 0;
 
-/**
+    /// Kernel selection and its parameter
+    uint64_t Param = 0;
+    unsigned Form = 0;
+
+
+    /// Prepare a coefficient 0 <= coeff < p
+    void Set(uint64_t coeff);
+};
+
+/**
+    Memory hints for MultiplyRegion() and MultiplyAddRegion()
+
+    These only change how memory is accessed, never the output bytes.
+    They help with regions much larger than the cache, such as 100 KB+
+    packets, and may slow down regions that are already in cache.
+    They apply to the vector kernels and are ignored by the scalar code.
+
+    kHintPrefetch: Prefetch the input data (and the output for
+    MultiplyAddRegion) a few cache lines ahead of the kernel.
+
+    kHintStreamOutput: Write the output with non-temporal stores that
+    bypass the cache.  Use this for the last pass over an output that goes
+    to a NIC or disk rather than being read again soon.  It needs an output
+    aligned to the vector size (32 bytes for AVX2, 64 bytes for AVX-512),
+    and is ignored otherwise.
+*/
+static const unsigned kHintPrefetch = 1;
+static const unsigned kHintStreamOutput = 2;
+
+/**
+    MultiplyRegion()
+
+    output[] = data[] * coeff
+
+    Coefficients of 1 and other powers of two up to 2^63 are handled
+    without multiplies, and coefficients below 2^32 with half the partial
+    products, with the same output as the general case.
+
+    Preconditions:
+        0 <= coeff < p.
+        data != null, output != null, workspace != null, bytes > 0
+
+    Note: This expands the input data up to solinas64::GetMaxOutputBytes() bytes.
+
+    Returns the number of bytes written.
+*/
+unsigned MultiplyRegion(
+    const uint8_t* data,    ///< Input data
+    unsigned bytes,         ///< Number of input data bytes
+    uint64_t coeff,         ///< Coefficient to multiply the data by
+    uint8_t* workspace,     ///< Size calculated by solinas64::GetWorkspaceBytes()
+    uint8_t* output,        ///< Size calculated by solinas64::GetMaxOutputBytes()
+    unsigned hints = 0);    ///< Memory hints: kHintPrefetch, kHintStreamOutput
+unsigned MultiplyRegion(
+    const uint8_t* data,    ///< Input data
+    unsigned bytes,         ///< Number of input data bytes
+    const MulConst& coeff,  ///< Prepared coefficient to multiply the data by
+    uint8_t* workspace,     ///< Size calculated by solinas64::GetWorkspaceBytes()
+    uint8_t* output,        ///< Size calculated by solinas64::GetMaxOutputBytes()
+    unsigned hints = 0);    ///< Memory hints: kHintPrefetch, kHintStreamOutput
+
+/**
     MultiplyAddRegion()
 
     output[] = output[] + data[] * coeff
 
+    Coefficients of 1 and other powers of two up to 2^63 are handled
+    without multiplies, and coefficients below 2^32 with half the partial
+    products, with the same output as the general case.
+
     Preconditions:
         0 <= coeff < p.
         data != null, output != null, workspace != null, bytes > 0
@@ -564,7 +1183,723 @@ unsigned MultiplyAddRegion(
     unsigned bytes,         ///< Number of input data bytes
     uint64_t coeff,         ///< Coefficient to multiply the data by
     uint8_t* workspace,     ///< Size calculated by solinas64::GetWorkspaceBytes()
+    uint8_t* output,        ///< Size calculated by solinas64::GetMaxOutputBytes()
+    unsigned hints = 0);    ///< Memory hints: kHintPrefetch, kHintStreamOutput
+unsigned MultiplyAddRegion(
+    const uint8_t* data,    ///< Input data
+    unsigned bytes,         ///< Number of input data bytes
+    const MulConst& coeff,  ///< Prepared coefficient to multiply the data by
+    uint8_t* workspace,     ///< Size calculated by solinas64::GetWorkspaceBytes()
+    uint8_t* output,        ///< Size calculated by solinas64::GetMaxOutputBytes()
+    unsigned hints = 0);    ///< Memory hints: kHintPrefetch, kHintStreamOutput
+
+/**
+    MultiplyRegion() and MultiplyAddRegion() without a workspace
+
+    These produce the same bytes as the versions above, but the overflow
+    words are multiplied into the tail of the output buffer as they fill,
+    rather than collected in a workspace and applied in a second pass.
+    So a single output buffer of GetMaxOutputBytes() is all that is needed,
+    which can be handed straight to the network stack.
+
+    Preconditions:
+        0 <= coeff < p.
+        data != null, output != null, bytes > 0
+
+    Returns the number of bytes written.
+*/
+unsigned MultiplyRegion(
+    const uint8_t* data,    ///< Input data
+    unsigned bytes,         ///< Number of input data bytes
+    uint64_t coeff,         ///< Coefficient to multiply the data by
+    uint8_t* output);       ///< Size calculated by solinas64::GetMaxOutputBytes()
+unsigned MultiplyRegion(
+    const uint8_t* data,    ///< Input data
+    unsigned bytes,         ///< Number of input data bytes
+    const MulConst& coeff,  ///< Prepared coefficient to multiply the data by
     uint8_t* output);       ///< Size calculated by solinas64::GetMaxOutputBytes()
+unsigned MultiplyAddRegion(
+    const uint8_t* data,    ///< Input data
+    unsigned bytes,         ///< Number of input data bytes
+    uint64_t coeff,         ///< Coefficient to multiply the data by
+    uint8_t* output);       ///< Size calculated by solinas64::GetMaxOutputBytes()
+unsigned MultiplyAddRegion(
+    const uint8_t* data,    ///< Input data
+    unsigned bytes,         ///< Number of input data bytes
+    const MulConst& coeff,  ///< Prepared coefficient to multiply the data by
+    uint8_t* output);       ///< Size calculated by solinas64::GetMaxOutputBytes()
+
+/**
+    MultiplyAddRegionMulti()
+
+    outputs[i][] = outputs[i][] + data[] * coeffs[i], for i = 0..count-1
+
+    This produces the same values (mod p) as calling MultiplyAddRegion() once
+    for each of the outputs, but each input word is read (and checked for
+    ambiguity) only once, so the input memory bandwidth is divided by `count`.
+
+    Preconditions:
+        0 <= coeffs[i] < p.
+        data != null, outputs[i] != null, workspace != null, bytes > 0
+
+    Note: This expands the input data up to solinas64::GetMaxOutputBytes() bytes.
+
+    Returns the number of bytes written to each output, including the
+    overflow words.  This is the same for every output: An output with a
+    zero coefficient has zero added to its overflow words, whereas
+    MultiplyAddRegion() with a zero coefficient returns only the rounded-up
+    input length and does not touch the words past it.
+*/
+unsigned MultiplyAddRegionMulti(
+    const uint8_t* data,    ///< Input data
+    unsigned bytes,         ///< Number of input data bytes
+    const uint64_t* coeffs, ///< Coefficients to multiply the data by, one per output
+    unsigned count,         ///< Number of coefficients and outputs
+    uint8_t* workspace,     ///< Size calculated by solinas64::GetWorkspaceBytes()
+    uint8_t* const* outputs); ///< Each sized by solinas64::GetMaxOutputBytes()
+
+/**
+    MultiplyWords()
+
+    output[] = words[] * coeff
+
+    Unlike MultiplyRegion(), the input is a sequence of field words such as
+    the recovery data produced by the other bulk operations.  So the words
+    are used as-is, without the AppDataReader expansion.
+    The input and output may be the same buffer.
+
+    Preconditions:
+        words != null, output != null
+*/
+void MultiplyWords(
+    const uint8_t* words,   ///< Input field words, read with ReadU64_LE()
+    unsigned wordCount,     ///< Number of 64-bit words
+    uint64_t coeff,         ///< Coefficient to multiply the words by
+    uint8_t* output);       ///< Output field words, wordCount * 8 bytes
+
+/**
+    MultiplyAddWords()
+
+    output[] = output[] + words[] * coeff
+
+    This is the MultiplyWords() counterpart of MultiplyAddRegion().
+*/
+void MultiplyAddWords(
+    const uint8_t* words,   ///< Input field words, read with ReadU64_LE()
+    unsigned wordCount,     ///< Number of 64-bit words
+    uint64_t coeff,         ///< Coefficient to multiply the words by
+    uint8_t* output);       ///< Output field words, wordCount * 8 bytes
+
+/**
+    MultiplyWordsFp2()
+
+    output[] = elements[] * coeff in Fp2
+
+    The words are read as `count` Fp2 elements of two words each, so any
+    even number of field words can be used, such as a packet from the bulk
+    operations.  The input and output may be the same buffer.
+
+    The results are congruent to Multiply() but may not be bit-identical.
+    They are the same on all the vector and scalar paths.
+
+    Preconditions:
+        words != null, output != null
+*/
+void MultiplyWordsFp2(
+    const uint8_t* words,   ///< Input Fp2 elements, 2 * count words
+    unsigned count,         ///< Number of Fp2 elements
+    const Fp2& coeff,       ///< Coefficient to multiply the elements by
+    uint8_t* output);       ///< Output Fp2 elements, count * 16 bytes
+
+/// output[] = output[] + elements[] * coeff in Fp2
+void MultiplyAddWordsFp2(
+    const uint8_t* words,   ///< Input Fp2 elements, 2 * count words
+    unsigned count,         ///< Number of Fp2 elements
+    const Fp2& coeff,       ///< Coefficient to multiply the elements by
+    uint8_t* output);       ///< Output Fp2 elements, count * 16 bytes
+
+/**
+    MultiplyWordsFp3()
+
+    output[] = elements[] * coeff in Fp3
+
+    The Fp3 counterpart of MultiplyWordsFp2(), with elements of three words.
+    Each output word is a sum of three products with one reduction.
+*/
+void MultiplyWordsFp3(
+    const uint8_t* words,   ///< Input Fp3 elements, 3 * count words
+    unsigned count,         ///< Number of Fp3 elements
+    const Fp3& coeff,       ///< Coefficient to multiply the elements by
+    uint8_t* output);       ///< Output Fp3 elements, count * 24 bytes
+
+/// output[] = output[] + elements[] * coeff in Fp3
+void MultiplyAddWordsFp3(
+    const uint8_t* words,   ///< Input Fp3 elements, 3 * count words
+    unsigned count,         ///< Number of Fp3 elements
+    const Fp3& coeff,       ///< Coefficient to multiply the elements by
+    uint8_t* output);       ///< Output Fp3 elements, count * 24 bytes
+
+/**
+    PolyHashRegion()
+
+    Returns a polynomial hash of the data, evaluated at `key`, for checking
+    that a packet was recovered intact or comparing packets across a link.
+
+    The data is expanded into field words as by MultiplyRegion(), followed by
+    the number of bytes, and the words s_1..s_n are hashed by Horner's rule:
+    h = (h + s_i) * key for each word in turn, so h = sum(s_i * key^(n-i+1)).
+    The result is canonical, 0 <= h < p.
+
+    For a key chosen uniformly at random and kept secret, two different
+    inputs of at most n words have the same hash with probability at most
+    n / p, about n * 2^-64.
+
+    The words are hashed in 8 interleaved lanes with key^8 so the multiplies
+    can run in parallel, with the same result as the serial evaluation.
+
+    Preconditions:
+        data != null or bytes == 0
+*/
+uint64_t PolyHashRegion(
+    const uint8_t* data,    ///< Input data
+    unsigned bytes,         ///< Number of input data bytes
+    uint64_t key);          ///< Evaluation point, ideally random and secret
+
+/// Number of originals that EncodeRow() accumulates before each output store
+static const unsigned kEncodeRowGroup = 16;
+
+/// Returns the number of workspace bytes needed by EncodeRow()
+constexpr unsigned GetEncodeRowWorkspaceBytes(unsigned bytes)
+{
+    return kEncodeRowGroup * AppDataReader::GetWorkspaceBytes(bytes);
+}
+
+/**
+    EncodeRow()
+
+    recovery[] = sum(originals[i][] * coeffs[i]), for i = 0..N-1
+
+    This is the matrix-vector product form of the encoder.  For each output
+    word it accumulates the 128-bit products from up to kEncodeRowGroup
+    originals without reduction, and only then reduces and stores it.
+    So the recovery data is written about N / kEncodeRowGroup times rather
+    than read and written N times as with MultiplyAddRegion().
+
+    The result is congruent modulo p to the same sum computed with
+    MultiplyRegion() and MultiplyAddRegion(), though the words may not be
+    bit-identical because the reductions happen in a different order.
+
+    The recovery buffer is fully written up to GetMaxOutputBytes(bytes),
+    with zeros past the returned length.
+
+    Preconditions:
+        0 <= coeffs[i] < p.
+        originals[i] != null, recovery != null, workspace != null
+        N > 0, bytes > 0
+
+    Returns the number of bytes in the recovery data.
+*/
+unsigned EncodeRow(
+    const uint8_t* const* originals, ///< N input packets of `bytes` each
+    unsigned N,             ///< Number of input packets
+    unsigned bytes,         ///< Number of bytes in each input packet
+    const uint64_t* coeffs, ///< N coefficients, one per input packet
+    uint8_t* workspace,     ///< Size calculated by solinas64::GetEncodeRowWorkspaceBytes()
+    uint8_t* recovery);     ///< Size calculated by solinas64::GetMaxOutputBytes()
+
+/**
+    EncodeRow() that also hashes the originals in the same pass
+
+    hashes[i] = PolyHashRegion(originals[i], bytes, hashKey), for i = 0..N-1
+
+    Each input word is read once for both the recovery data and the hashes.
+    Rather than Horner's rule, each word is multiplied by its power of the
+    key and summed in an Accum128, so a hash term costs about as much as an
+    encoder term.  The recovery data is the same as from EncodeRow() above.
+*/
+unsigned EncodeRow(
+    const uint8_t* const* originals, ///< N input packets of `bytes` each
+    unsigned N,             ///< Number of input packets
+    unsigned bytes,         ///< Number of bytes in each input packet
+    const uint64_t* coeffs, ///< N coefficients, one per input packet
+    uint8_t* workspace,     ///< Size calculated by solinas64::GetEncodeRowWorkspaceBytes()
+    uint8_t* recovery,      ///< Size calculated by solinas64::GetMaxOutputBytes()
+    uint64_t hashKey,       ///< Key for PolyHashRegion()
+    uint64_t* hashes);      ///< Output: N hashes, one per input packet
+
+
+//------------------------------------------------------------------------------
+// Region Statistics
+
+/**
+    RegionStats
+
+    Counters for MultiplyRegion(), MultiplyAddRegion() and their batch
+    versions, which are only updated when built with SOLINAS64_ENABLE_STATS.
+    The slice operations, the fixed-size templates and the encoders built on
+    them are not counted.
+
+    Each thread updates its own counters without atomic read-modify-writes,
+    so the cost is a few adds per call, not per word.  The counters only
+    increase, so a metrics exporter can report the change between snapshots.
+*/
+struct RegionStats
+{
+    /// True if built with SOLINAS64_ENABLE_STATS, or else all counts are 0
+    bool Enabled;
+
+    /// Instruction set used by the bulk operations
+    SimdBackend Backend;
+
+    /// Number of calls
+    uint64_t Calls;
+
+    /// Number of input bytes processed, including the fast paths
+    uint64_t Bytes;
+
+    /// Calls with coefficient 0, which do not read the input
+    uint64_t ZeroCoeffCalls;
+
+    /// Calls with coefficient 1, which need no multiplies
+    uint64_t OneCoeffCalls;
+
+    /// Number of ambiguous input words, each emitting an extra bit
+    uint64_t AmbiguousWords;
+
+    /// Number of overflow bytes appended to the outputs for the extra bits
+    uint64_t OverflowBytes;
+
+
+    /// Add the counts from `other`
+    void Add(const RegionStats& other);
+};
+
+/// Returns the counts for the calling thread
+RegionStats GetThreadRegionStats();
+
+/// Returns the counts summed over all threads, including threads that exited
+RegionStats GetRegionStats();
+
+/// Clear the counts for the calling thread.
+/// They remain in the GetRegionStats() totals.
+void ResetThreadRegionStats();
+
+
+//------------------------------------------------------------------------------
+// Slice Operations
+
+/*
+    These are the bodies of the bulk operations without the overflow word
+    handling, using AppDataReader objects provided by the caller.
+
+    A region can be processed as a series of slices that share the readers,
+    or as independent slices that each have their own readers.  All slices
+    except the last must be a multiple of 8 bytes.
+
+    The extra bits stay in the readers, and the caller is responsible for
+    applying them after the last slice, as the bulk operations do.
+
+    They return the number of bytes written, which is the slice size rounded
+    up to a multiple of 8 bytes.
+*/
+
+/// output[] = data[] * coeff, without the overflow words
+unsigned MultiplyRegionSlice(
+    AppDataReader& reader,  ///< Reader for the region
+    const uint8_t* data,    ///< Input data for the slice
+    unsigned bytes,         ///< Number of input data bytes
+    uint64_t coeff,         ///< Coefficient to multiply the data by
+    uint8_t* output,        ///< Output words for the slice
+    unsigned hints = 0);    ///< Memory hints: kHintPrefetch, kHintStreamOutput
+unsigned MultiplyRegionSlice(
+    AppDataReader& reader,  ///< Reader for the region
+    const uint8_t* data,    ///< Input data for the slice
+    unsigned bytes,         ///< Number of input data bytes
+    const MulConst& coeff,  ///< Prepared coefficient to multiply the data by
+    uint8_t* output,        ///< Output words for the slice
+    unsigned hints = 0);    ///< Memory hints: kHintPrefetch, kHintStreamOutput
+
+/// output[] = output[] + data[] * coeff, without the overflow words
+unsigned MultiplyAddRegionSlice(
+    AppDataReader& reader,  ///< Reader for the region
+    const uint8_t* data,    ///< Input data for the slice
+    unsigned bytes,         ///< Number of input data bytes
+    uint64_t coeff,         ///< Coefficient to multiply the data by
+    uint8_t* output,        ///< Output words for the slice
+    unsigned hints = 0);    ///< Memory hints: kHintPrefetch, kHintStreamOutput
+unsigned MultiplyAddRegionSlice(
+    AppDataReader& reader,  ///< Reader for the region
+    const uint8_t* data,    ///< Input data for the slice
+    unsigned bytes,         ///< Number of input data bytes
+    const MulConst& coeff,  ///< Prepared coefficient to multiply the data by
+    uint8_t* output,        ///< Output words for the slice
+    unsigned hints = 0);    ///< Memory hints: kHintPrefetch, kHintStreamOutput
+
+/// MultiplyAddRegionMulti() without the overflow words.
+/// Each output is written starting at outputs[i] + outputOffset.
+unsigned MultiplyAddRegionMultiSlice(
+    AppDataReader& reader,  ///< Reader for the region
+    const uint8_t* data,    ///< Input data for the slice
+    unsigned bytes,         ///< Number of input data bytes
+    const uint64_t* coeffs, ///< Coefficients to multiply the data by, one per output
+    unsigned count,         ///< Number of coefficients and outputs
+    uint8_t* const* outputs, ///< Output buffers
+    unsigned outputOffset); ///< Offset of the slice in each output buffer
+
+/// EncodeRow() without the overflow words: Needs one reader per original.
+/// The words are bit-identical to the ones that EncodeRow() produces.
+unsigned EncodeRowSlice(
+    AppDataReader* readers, ///< N readers, one per input packet
+    const uint8_t* const* originals, ///< N input slices of `bytes` each
+    unsigned N,             ///< Number of input packets
+    unsigned bytes,         ///< Number of bytes in each input slice
+    const uint64_t* coeffs, ///< N coefficients, one per input packet
+    uint8_t* recovery);     ///< Output words for the slice
+
+
+//------------------------------------------------------------------------------
+// Fixed-Size Regions
+
+/**
+    MultiplyRegion<Bytes>() and MultiplyAddRegion<Bytes>()
+
+    The workspace versions of MultiplyRegion() and MultiplyAddRegion() for a
+    packet size fixed at compile time, such as 1024 or 1280 bytes:
+
+        uint8_t workspace[AppDataReader::GetWorkspaceBytes(1280)];
+        uint8_t output[AppDataReader::GetMaxOutputBytes(1280)];
+        solinas64::MultiplyAddRegion<1280>(data, coeff, workspace, output);
+
+    The whole 64-byte blocks go straight to the slice kernels, and the rest
+    of the words, the final partial word and the overflow words are inlined
+    here with loop counts known at compile time.  When Bytes is a multiple
+    of 64 all of the tail code drops out.  There are no memory hints.
+
+    The output is the same as from the versions with a runtime length.
+
+    Preconditions:
+        data != null, output != null, workspace != null
+*/
+template<unsigned Bytes, bool Accumulate>
+SOLINAS64_FORCE_INLINE unsigned MultiplyRegionFixedT(
+    const uint8_t* data,
+    const MulConst& coeff,
+    uint8_t* workspace,
+    uint8_t* output)
+{
+    static_assert(Bytes > 0, "Bytes must be positive");
+
+    const unsigned kBlockBytes = Bytes & ~63u;
+    const unsigned kFullWordBytes = Bytes & ~7u;
+    const unsigned kMinimumOutputBytes = (Bytes + 7) & ~7u;
+    const unsigned kMaxExtraWords = AppDataReader::GetWorkspaceBytes(Bytes) / 8;
+
+    // Special fast case
+    if (coeff.Coeff == 0)
+    {
+        if (!Accumulate) {
+            for (unsigned i = 0; i < kMinimumOutputBytes; i += 8) {
+                WriteU64_LE(output + i, 0);
+            }
+        }
+        return kMinimumOutputBytes;
+    }
+
+    AppDataReader reader;
+    reader.SetupWorkspace(workspace);
+
+    if (kBlockBytes > 0)
+    {
+        if (Accumulate) {
+            MultiplyAddRegionSlice(reader, data, kBlockBytes, coeff, output);
+        } else {
+            MultiplyRegionSlice(reader, data, kBlockBytes, coeff, output);
+        }
+    }
+
+    for (unsigned i = kBlockBytes; i < kFullWordBytes; i += 8)
+    {
+        uint64_t x = Multiply(coeff.Coeff, reader.ReadNext8Bytes(data + i));
+        if (Accumulate) {
+            x = Add(x, ReadU64_LE(output + i));
+        }
+        WriteU64_LE(output + i, x);
+    }
+
+    if (Bytes % 8 != 0)
+    {
+        uint64_t x = Multiply(coeff.Coeff, reader.ReadFinalBytes(data + kFullWordBytes, Bytes % 8));
+        if (Accumulate) {
+            x = Add(x, ReadU64_LE(output + kFullWordBytes));
+        }
+        WriteU64_LE(output + kFullWordBytes, x);
+    }
+
+    // Finalize the overflow bits
+    const unsigned extraWords = reader.FlushAndGetWordCount();
+    uint8_t* tail = output + kMinimumOutputBytes;
+
+    for (unsigned i = 0; i < kMaxExtraWords && i < extraWords; ++i)
+    {
+        uint64_t x = Multiply(coeff.Coeff, ReadU64_LE(reader.Data + i * 8));
+        if (Accumulate) {
+            x = Add(x, ReadU64_LE(tail + i * 8));
+        }
+        WriteU64_LE(tail + i * 8, x);
+    }
+
+    return kMinimumOutputBytes + extraWords * 8;
+}
+
+/// output[] = data[] * coeff, for a fixed number of bytes
+template<unsigned Bytes>
+SOLINAS64_FORCE_INLINE unsigned MultiplyRegion(
+    const uint8_t* data,    ///< Input data of `Bytes` bytes
+    const MulConst& coeff,  ///< Prepared coefficient to multiply the data by
+    uint8_t* workspace,     ///< Size AppDataReader::GetWorkspaceBytes(Bytes)
+    uint8_t* output)        ///< Size AppDataReader::GetMaxOutputBytes(Bytes)
+{
+    return MultiplyRegionFixedT<Bytes, false>(data, coeff, workspace, output);
+}
+
+/// output[] = output[] + data[] * coeff, for a fixed number of bytes
+template<unsigned Bytes>
+SOLINAS64_FORCE_INLINE unsigned MultiplyAddRegion(
+    const uint8_t* data,    ///< Input data of `Bytes` bytes
+    const MulConst& coeff,  ///< Prepared coefficient to multiply the data by
+    uint8_t* workspace,     ///< Size AppDataReader::GetWorkspaceBytes(Bytes)
+    uint8_t* output)        ///< Size AppDataReader::GetMaxOutputBytes(Bytes)
+{
+    return MultiplyRegionFixedT<Bytes, true>(data, coeff, workspace, output);
+}
+
+
+//------------------------------------------------------------------------------
+// Tiled Encoder
+
+/// Default bytes of each packet that EncodeTiled() processes per tile.
+/// Tiles of 4-16 KB keep the recovery tiles for a few outputs in L1/L2 cache.
+static const unsigned kDefaultEncodeTileBytes = 8 * 1024;
+
+/// Returns the number of workspace bytes needed by EncodeTiled()
+SOLINAS64_FORCE_INLINE unsigned GetEncodeTiledWorkspaceBytes(unsigned N, unsigned bytes)
+{
+    return N * static_cast<unsigned>(sizeof(AppDataReader) + AppDataReader::GetWorkspaceBytes(bytes));
+}
+
+/**
+    EncodeTiled()
+
+    recoveries[r][] = sum(originals[i][] * coeffs[i * R + r]), for r = 0..R-1
+
+    This produces R recovery packets at once, one column tile of `tileBytes`
+    at a time: Each tile of every original is read once and applied to the
+    same tile of all R recovery packets, which stay in cache across all of
+    the N originals.  The overflow words are carried across tiles.
+
+    The coefficients are stored by original: The R coefficients for
+    original i are at coeffs[i * R].
+
+    The output is bit-identical to MultiplyRegion() for the first original
+    followed by MultiplyAddRegion() for the rest, for each recovery packet,
+    provided that chain writes into a zeroed buffer: MultiplyRegion() with
+    a zero coefficient does not clear the overflow words past the data.
+    Each recovery buffer is fully written up to GetMaxOutputBytes(bytes),
+    with zeros past the returned length.
+
+    Preconditions:
+        0 <= coeffs[i] < p.
+        originals[i] != null, recoveries[r] != null, workspace != null
+        N > 0, R > 0, bytes > 0
+
+    Returns the number of bytes in each recovery packet.
+*/
+unsigned EncodeTiled(
+    const uint8_t* const* originals, ///< N input packets of `bytes` each
+    unsigned N,             ///< Number of input packets
+    unsigned bytes,         ///< Number of bytes in each input packet
+    const uint64_t* coeffs, ///< N * R coefficients, grouped by input packet
+    unsigned R,             ///< Number of recovery packets to produce
+    uint8_t* workspace,     ///< Size calculated by solinas64::GetEncodeTiledWorkspaceBytes()
+    uint8_t* const* recoveries, ///< R outputs, each sized by solinas64::GetMaxOutputBytes()
+    unsigned tileBytes = kDefaultEncodeTileBytes); ///< Bytes per tile, rounded down to a multiple of 64
+
+
+//------------------------------------------------------------------------------
+// Streaming
+
+/**
+    RegionStream
+
+    Computes MultiplyRegion() or MultiplyAddRegion() for data that arrives
+    in chunks of any size, for example one network frame at a time:
+
+        Begin() with the coefficient, the output buffer and a workspace.
+        Update() with each chunk of data as it arrives.
+        Finish() after the last chunk.
+
+    Each chunk is multiplied into the output as soon as it arrives.  Only up
+    to 7 bytes of a partial word are held between calls, along with the
+    AppDataReader extra bit state.  The overflow words are collected in the
+    workspace as they fill, and Finish() applies them after the data words.
+
+    The output bytes and length are identical to calling MultiplyRegion()
+    (or MultiplyAddRegion() when `accumulate` is true) on the whole input.
+
+    The largest stream length must be given to Begin() to size the buffers:
+    The workspace is GetWorkspaceBytes(maxBytes) and the output is
+    GetMaxOutputBytes(maxBytes).
+*/
+class RegionStream
+{
+public:
+    /// Start a new stream.
+    /// Precondition: 0 <= coeff < p, output != null, workspace != null
+    void Begin(
+        uint64_t coeff,         ///< Coefficient to multiply the data by
+        uint8_t* output,        ///< Size calculated by solinas64::GetMaxOutputBytes(maxBytes)
+        uint8_t* workspace,     ///< Size calculated by solinas64::GetWorkspaceBytes(maxBytes)
+        unsigned maxBytes,      ///< Largest number of input bytes for the stream
+        bool accumulate = false); ///< Add to the output rather than overwriting it
+
+    /// Process the next chunk of input data.
+    /// Returns false if the stream would exceed `maxBytes`, without
+    /// processing any of the chunk.
+    bool Update(const uint8_t* data, unsigned bytes);
+
+    /// Finish the stream.
+    /// Returns the number of bytes written, or 0 if no data was provided.
+    unsigned Finish();
+
+    /// Returns the number of input bytes provided so far
+    unsigned GetInputBytes() const
+    {
+        return InputBytes;
+    }
+
+protected:
+    AppDataReader Reader;
+    uint64_t Coeff = 0;
+    uint8_t* Output = nullptr;
+    unsigned MaxBytes = 0;
+    bool Accumulate = false;
+
+    /// Number of input bytes provided so far
+    unsigned InputBytes = 0;
+
+    /// Bytes of output words written so far
+    unsigned OutputBytes = 0;
+
+    /// Partial word held until the next Update() or Finish()
+    uint8_t Carry[8];
+    unsigned CarryBytes = 0;
+
+
+    /// Process a multiple of 8 bytes, or the final bytes of the stream
+    void ProcessWords(const uint8_t* data, unsigned bytes);
+};
+
+
+//------------------------------------------------------------------------------
+// Batch Operations
+
+/**
+    RegionBatchItem
+
+    One region for MultiplyRegionBatch() or MultiplyAddRegionBatch().
+
+    The output must be AppDataReader::GetMaxOutputBytes(Bytes) in size.
+*/
+struct RegionBatchItem
+{
+    const uint8_t* Data;    ///< Input data
+    unsigned Bytes;         ///< Number of input data bytes
+    uint64_t Coeff;         ///< Coefficient to multiply the data by
+    uint8_t* Output;        ///< Output words
+    unsigned OutputBytes;   ///< Set to the number of bytes written
+};
+
+/**
+    MultiplyRegionBatch()
+
+    For each item: Output[] = Data[] * Coeff
+
+    Same as calling the workspace-free MultiplyRegion() for each item, for
+    callers that handle many small regions such as sub-100 byte packets.
+    This is a convenience loop over the items: The only work shared between
+    them is the MulConst, which is prepared once for each run of items with
+    the same coefficient.  Each region is otherwise processed on its own.
+
+    Preconditions:
+        The outputs do not overlap each other or any of the inputs.
+*/
+void MultiplyRegionBatch(
+    RegionBatchItem* items, ///< Regions to process
+    unsigned count);        ///< Number of items
+
+/**
+    MultiplyAddRegionBatch()
+
+    For each item: Output[] += Data[] * Coeff
+
+    Same as calling the workspace-free MultiplyAddRegion() for each item.
+    See MultiplyRegionBatch() for details.
+
+    Preconditions:
+        The outputs do not overlap each other or any of the inputs.
+*/
+void MultiplyAddRegionBatch(
+    RegionBatchItem* items, ///< Regions to process
+    unsigned count);        ///< Number of items
+
+
+
+//------------------------------------------------------------------------------
+// NTT Butterflies
+
+/*
+    These are the radix-2 stages of a number-theoretic transform over
+    blocks of 2 * half words.  The transforms in solinas64_ntt.h are built
+    on them.  The twiddle factors for each block are twiddles[0..half-1].
+
+    They run on the same vector kernels as the bulk operations, and produce
+    the same words as the scalar Add(), Subtract() and Multiply() steps.
+    The inputs can be any 64-bit values, and the outputs are not fully
+    reduced.
+
+    Preconditions:
+        half > 0, count is a multiple of 2 * half
+*/
+
+/**
+    NTTStageDIF()
+
+    Decimation-in-frequency (Gentleman-Sande) stage.  For each block and
+    j < half, with x = data[j] and y = data[j + half]:
+
+        data[j] = x + y
+        data[j + half] = (x - y) * twiddles[j]
+*/
+void NTTStageDIF(
+    uint64_t* data,         ///< Words to transform in place
+    unsigned count,         ///< Number of words
+    unsigned half,          ///< Half of the block size
+    const uint64_t* twiddles); ///< Twiddle factors, `half` of them
+
+/**
+    NTTStageDIT()
+
+    Decimation-in-time (Cooley-Tukey) stage.  For each block and j < half,
+    with x = data[j] and y = data[j + half] * twiddles[j]:
+
+        data[j] = x + y
+        data[j + half] = x - y
+*/
+void NTTStageDIT(
+    uint64_t* data,         ///< Words to transform in place
+    unsigned count,         ///< Number of words
+    unsigned half,          ///< Half of the block size
+    const uint64_t* twiddles); ///< Twiddle factors, `half` of them
 
 
 } // namespace solinas64
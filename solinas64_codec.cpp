@@ -0,0 +1,829 @@
+/*
+    Copyright (c) 2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of Solinas64 nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "solinas64_codec.h"
+
+#include <string.h>
+#include <algorithm>
+
+namespace solinas64 {
+
+
+//------------------------------------------------------------------------------
+// Encoder
+
+void GenerateCoefficients(
+    uint64_t seed,
+    unsigned rows,
+    unsigned cols,
+    uint64_t* out)
+{
+    for (unsigned r = 0; r < rows; ++r)
+    {
+        const uint64_t rowSeed = seed + r;
+        uint64_t* column = out + r;
+        unsigned c = 0;
+
+        if (rowSeed == kParitySeed)
+        {
+            for (; c < cols; ++c) {
+                column[c * rows] = 1;
+            }
+            continue;
+        }
+
+        if (rowSeed == kShiftSeed)
+        {
+            for (; c < cols && c < 64; ++c) {
+                column[c * rows] = (uint64_t)1 << c;
+            }
+        }
+
+        // Same as GetGeneratorCoefficient() with the row hash hoisted out
+        const uint64_t seedMix = HashU64(rowSeed);
+        for (; c < cols; ++c) {
+            column[c * rows] = HashToNonzeroFp(HashU64(seedMix + c));
+        }
+    }
+}
+
+const uint64_t* GeneratorCache::GetRow(uint64_t seed, unsigned N)
+{
+    std::vector<uint64_t>& row = Rows[std::make_pair(seed, N)];
+
+    if (row.empty() && N > 0)
+    {
+        row.resize(N);
+        GenerateCoefficients(seed, 1, N, &row[0]);
+    }
+
+    return row.data();
+}
+
+unsigned EncodeRecovery(
+    const uint8_t* const* originals,
+    unsigned N,
+    unsigned bytes,
+    uint64_t seed,
+    uint8_t* workspace,
+    uint8_t* recovery,
+    GeneratorCache* cache)
+{
+    if (cache) {
+        return EncodeRow(originals, N, bytes, cache->GetRow(seed, N), workspace, recovery);
+    }
+
+    std::vector<uint64_t> coeffs(N);
+    GenerateCoefficients(seed, 1, N, &coeffs[0]);
+
+    return EncodeRow(originals, N, bytes, &coeffs[0], workspace, recovery);
+}
+
+unsigned UpdateRecovery(
+    const uint8_t* oldData,
+    const uint8_t* newData,
+    unsigned bytes,
+    const uint64_t* coeffs,
+    unsigned count,
+    uint8_t* workspace,
+    uint8_t* const* recoveries)
+{
+    const unsigned maxBytes = AppDataReader::GetMaxOutputBytes(bytes);
+    uint8_t* delta = workspace;
+    uint8_t* readerWorkspace = workspace + maxBytes;
+
+    // delta = new - old, where either one may have more overflow words
+    const unsigned newBytes = MultiplyRegion(newData, bytes, 1, readerWorkspace, delta);
+    memset(delta + newBytes, 0, maxBytes - newBytes);
+    const unsigned oldBytes = MultiplyAddRegion(oldData, bytes, kPrime - 1, readerWorkspace, delta);
+
+    const unsigned deltaBytes = std::max(newBytes, oldBytes);
+    const unsigned wordCount = deltaBytes / 8;
+
+    for (unsigned offset = 0; offset < wordCount; offset += kUpdateRecoveryTileWords)
+    {
+        const unsigned tileWords = std::min(wordCount - offset, kUpdateRecoveryTileWords);
+        const uint8_t* tile = delta + offset * 8;
+
+        for (unsigned i = 0; i < count; ++i) {
+            if (coeffs[i] != 0) {
+                MultiplyAddWords(tile, tileWords, coeffs[i], recoveries[i] + offset * 8);
+            }
+        }
+    }
+
+    return deltaBytes;
+}
+
+
+//------------------------------------------------------------------------------
+// Encoder Context
+
+static SOLINAS64_FORCE_INLINE uint64_t RoundUpToAlignment(uint64_t bytes)
+{
+    return (bytes + kEncoderContextAlignment - 1) & ~(uint64_t)(kEncoderContextAlignment - 1);
+}
+
+bool EncoderContext::Initialize(unsigned maxN, unsigned maxBytes, unsigned recoveryCount)
+{
+    MaxN = MaxBytes = RecoveryCount = 0;
+    Arena.clear();
+    OriginalPtrs.clear();
+    FreeRecoveries.clear();
+
+    // Keep GetMaxOutputBytes() from overflowing
+    if (maxN == 0 || maxBytes == 0 || maxBytes > (1u << 28)) {
+        return false;
+    }
+
+    const uint64_t workspaceBytes = RoundUpToAlignment(GetEncodeRowWorkspaceBytes(maxBytes));
+    const uint64_t originalStride = RoundUpToAlignment(maxBytes);
+    const uint64_t recoveryStride = RoundUpToAlignment(AppDataReader::GetMaxOutputBytes(maxBytes));
+    const uint64_t arenaBytes = kEncoderContextAlignment + workspaceBytes
+        + originalStride * maxN + recoveryStride * recoveryCount;
+
+    if (arenaBytes != static_cast<size_t>(arenaBytes)) {
+        return false;
+    }
+
+    Arena.resize(static_cast<size_t>(arenaBytes));
+
+    uint8_t* base = Arena.data();
+    base += (kEncoderContextAlignment - reinterpret_cast<uintptr_t>(base) % kEncoderContextAlignment) % kEncoderContextAlignment;
+
+    Workspace = base;
+    Originals = Workspace + workspaceBytes;
+    Recoveries = Originals + originalStride * maxN;
+
+    MaxN = maxN;
+    MaxBytes = maxBytes;
+    OriginalStride = static_cast<unsigned>(originalStride);
+    RecoveryStride = static_cast<unsigned>(recoveryStride);
+    RecoveryCount = recoveryCount;
+
+    OriginalPtrs.resize(maxN);
+    for (unsigned i = 0; i < maxN; ++i) {
+        OriginalPtrs[i] = GetOriginal(i);
+    }
+
+    Coeffs.resize(maxN);
+
+    // Hand out the buffers from the front of the pool first
+    FreeRecoveries.reserve(recoveryCount);
+    for (unsigned i = recoveryCount; i > 0; --i) {
+        FreeRecoveries.push_back(Recoveries + (i - 1) * static_cast<size_t>(RecoveryStride));
+    }
+
+    return true;
+}
+
+uint8_t* EncoderContext::AcquireRecovery()
+{
+    if (FreeRecoveries.empty()) {
+        return nullptr;
+    }
+
+    uint8_t* recovery = FreeRecoveries.back();
+    FreeRecoveries.pop_back();
+    return recovery;
+}
+
+bool EncoderContext::ReleaseRecovery(uint8_t* recovery)
+{
+    if (!recovery || RecoveryCount == 0 || recovery < Recoveries) {
+        return false;
+    }
+
+    const size_t offset = static_cast<size_t>(recovery - Recoveries);
+    if (offset % RecoveryStride != 0 || offset / RecoveryStride >= RecoveryCount) {
+        return false;
+    }
+
+    // The pool is small, so a linear scan for double releases is cheap
+    if (std::find(FreeRecoveries.begin(), FreeRecoveries.end(), recovery) != FreeRecoveries.end()) {
+        return false;
+    }
+
+    // Does not allocate: The capacity was reserved for every buffer
+    FreeRecoveries.push_back(recovery);
+    return true;
+}
+
+unsigned EncoderContext::Encode(
+    const uint8_t* const* originals,
+    unsigned N,
+    unsigned bytes,
+    uint64_t seed,
+    uint8_t* recovery,
+    GeneratorCache* cache)
+{
+    if (N == 0 || N > MaxN || bytes == 0 || bytes > MaxBytes) {
+        return 0;
+    }
+
+    const uint64_t* coeffs;
+    if (cache) {
+        coeffs = cache->GetRow(seed, N);
+    }
+    else {
+        GenerateCoefficients(seed, 1, N, Coeffs.data());
+        coeffs = Coeffs.data();
+    }
+
+    return EncodeRow(originals, N, bytes, coeffs, Workspace, recovery);
+}
+
+
+//------------------------------------------------------------------------------
+// Decoder
+
+bool Decoder::Initialize(unsigned n, unsigned bytes)
+{
+    if (n == 0 || bytes == 0) {
+        return false;
+    }
+
+    N = n;
+    Bytes = bytes;
+    OriginalCount = 0;
+    Originals.assign(n, nullptr);
+    Recoveries.clear();
+    Decoded.clear();
+    return true;
+}
+
+bool Decoder::AddOriginal(unsigned column, const uint8_t* data)
+{
+    if (column >= N || !data) {
+        return false;
+    }
+
+    if (!Originals[column]) {
+        ++OriginalCount;
+    }
+    Originals[column] = data;
+    return true;
+}
+
+bool Decoder::AddRecovery(uint64_t seed, const uint8_t* data, unsigned recoveryBytes)
+{
+    const unsigned maxBytes = AppDataReader::GetMaxOutputBytes(Bytes);
+    if (N == 0 || !data || recoveryBytes > maxBytes) {
+        return false;
+    }
+
+    RecoveryPacket packet;
+    packet.Seed = seed;
+
+    // Zero padding matches the encoder output
+    packet.Data.resize(maxBytes, 0);
+    memcpy(&packet.Data[0], data, recoveryBytes);
+
+    Recoveries.push_back(packet);
+    return true;
+}
+
+bool Decoder::Decode()
+{
+    if (!IsReady()) {
+        return false;
+    }
+
+    // List the lost columns
+    std::vector<unsigned> lost;
+    for (unsigned j = 0; j < N; ++j) {
+        if (!Originals[j]) {
+            lost.push_back(j);
+        }
+    }
+    const unsigned m = static_cast<unsigned>(lost.size());
+    if (m == 0) {
+        return true;
+    }
+
+    /*
+        Each row of the working matrix holds the generator coefficients for
+        the lost columns of one recovery packet, followed by m tracking terms
+        that express the row as a combination of the selected recoveries.
+
+        Fraction-free elimination scales rows by the pivot instead of
+        dividing by it, so no inversions are needed to find the pivots and
+        reduce to echelon form.
+    */
+    const unsigned stride = 2 * m;
+    std::vector<uint64_t> matrix(m * stride);
+    std::vector<unsigned> pivotColumn(m);
+    std::vector<unsigned> selected(m);
+    std::vector<uint64_t> row(stride);
+    unsigned pivots = 0;
+
+    const unsigned recoveryCount = static_cast<unsigned>(Recoveries.size());
+    for (unsigned k = 0; k < recoveryCount && pivots < m; ++k)
+    {
+        const uint64_t seed = Recoveries[k].Seed;
+        for (unsigned i = 0; i < m; ++i) {
+            row[i] = GetGeneratorCoefficient(seed, lost[i]);
+        }
+        for (unsigned i = 0; i < m; ++i) {
+            row[m + i] = (i == pivots) ? 1 : 0;
+        }
+
+        // Eliminate the pivot columns found so far:
+        // row = d * row - row[c] * pivotRow
+        for (unsigned t = 0; t < pivots; ++t)
+        {
+            const uint64_t* pivotRow = &matrix[t * stride];
+            const unsigned c = pivotColumn[t];
+            const uint64_t a = Finalize(row[c]);
+            if (a == 0) {
+                continue;
+            }
+            const uint64_t d = pivotRow[c];
+            const uint64_t neg_a = kPrime - a;
+
+            for (unsigned i = 0; i < stride; ++i)
+            {
+                Accum128 sum;
+                sum.Clear();
+                sum.MultiplyAdd(d, row[i]);
+                sum.MultiplyAdd(neg_a, pivotRow[i]);
+                row[i] = sum.Reduce();
+            }
+        }
+
+        // Find a new pivot column
+        unsigned c = m;
+        for (unsigned i = 0; i < m; ++i)
+        {
+            row[i] = Finalize(row[i]);
+            if (row[i] != 0 && c == m) {
+                c = i;
+            }
+        }
+
+        // Skip recovery packets that are linearly dependent
+        if (c == m) {
+            continue;
+        }
+
+        memcpy(&matrix[pivots * stride], &row[0], stride * sizeof(uint64_t));
+        pivotColumn[pivots] = c;
+        selected[pivots] = k;
+        ++pivots;
+    }
+
+    if (pivots < m) {
+        return false;
+    }
+
+    // Invert all the pivots at once
+    std::vector<uint64_t> diag(m), scratch(m);
+    for (unsigned t = 0; t < m; ++t) {
+        diag[t] = matrix[t * stride + pivotColumn[t]];
+    }
+    BatchInverse(&diag[0], m, &scratch[0]);
+
+    // Normalize the pivots to one
+    for (unsigned t = 0; t < m; ++t)
+    {
+        uint64_t* r = &matrix[t * stride];
+        for (unsigned i = 0; i < stride; ++i) {
+            r[i] = Multiply(r[i], diag[t]);
+        }
+    }
+
+    // Back substitution to clear the coefficients above the pivots
+    for (unsigned t = m; t-- > 1;)
+    {
+        const uint64_t* pivotRow = &matrix[t * stride];
+        const unsigned c = pivotColumn[t];
+
+        for (unsigned s = 0; s < t; ++s)
+        {
+            uint64_t* r = &matrix[s * stride];
+            const uint64_t a = Finalize(r[c]);
+            if (a == 0) {
+                continue;
+            }
+            const uint64_t neg_a = kPrime - a;
+
+            for (unsigned i = 0; i < stride; ++i) {
+                r[i] = Add(r[i], Multiply(neg_a, pivotRow[i]));
+            }
+        }
+    }
+
+    // Subtract the received originals from the selected recovery packets
+    std::vector<uint8_t> workspace(AppDataReader::GetWorkspaceBytes(Bytes));
+    std::vector<uint8_t*> outputs(m);
+    std::vector<uint64_t> coeffs(m);
+    std::vector<uint64_t> generator(m * N);
+    for (unsigned t = 0; t < m; ++t)
+    {
+        outputs[t] = &Recoveries[selected[t]].Data[0];
+        GenerateCoefficients(Recoveries[selected[t]].Seed, 1, N, &generator[t * N]);
+    }
+
+    for (unsigned j = 0; j < N; ++j)
+    {
+        if (!Originals[j]) {
+            continue;
+        }
+
+        for (unsigned t = 0; t < m; ++t) {
+            coeffs[t] = kPrime - generator[t * N + j];
+        }
+
+        MultiplyAddRegionMulti(
+            Originals[j],
+            Bytes,
+            &coeffs[0],
+            m,
+            workspace.data(),
+            &outputs[0]);
+    }
+
+    // Each row t now solves for lost column pivotColumn[t]
+    const unsigned maxBytes = AppDataReader::GetMaxOutputBytes(Bytes);
+    const unsigned wordCount = maxBytes / 8;
+    std::vector<uint8_t> words(maxBytes);
+    Decoded.resize(m);
+
+    for (unsigned t = 0; t < m; ++t)
+    {
+        const uint64_t* r = &matrix[t * stride + m];
+
+        MultiplyWords(outputs[0], wordCount, r[0], &words[0]);
+        for (unsigned k = 1; k < m; ++k) {
+            MultiplyAddWords(outputs[k], wordCount, r[k], &words[0]);
+        }
+
+        const unsigned column = lost[pivotColumn[t]];
+        Decoded[t].resize(Bytes);
+        RestoreRegion(&words[0], Bytes, &Decoded[t][0]);
+        Originals[column] = &Decoded[t][0];
+    }
+
+    OriginalCount = N;
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// MDS Code
+
+/// Returns log2(n) for the MDS code parameters in logN, or false if the
+/// 2n-word decoder transform would be too large
+static bool GetMDSLogSize(unsigned K, unsigned M, unsigned& logN)
+{
+    logN = 0;
+    while ((1u << logN) < K || (1u << logN) < M)
+    {
+        if (++logN >= kMaxNTTLogSize) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool MDSEncoder::Initialize(unsigned k, unsigned m, unsigned bytes)
+{
+    unsigned logN;
+    if (k == 0 || m == 0 || bytes == 0 ||
+        !GetMDSLogSize(k, m, logN) ||
+        !Transform.Initialize(logN))
+    {
+        return false;
+    }
+
+    K = k;
+    M = m;
+    Bytes = bytes;
+
+    // The odd powers of the 2n-th root w are w * (w^2)^i, so scaling the
+    // coefficients of f(x) by w^k gives f(w * x).  This is folded into the
+    // n^-1 scale of the inverse transform
+    const unsigned n = Transform.GetSize();
+    const uint64_t w = GetRootOfUnity(logN + 1);
+    Scale.resize(n);
+    uint64_t t = Transform.GetInverseScale();
+    for (unsigned i = 0; i < n; ++i)
+    {
+        Scale[i] = t;
+        t = Finalize(Multiply(t, w));
+    }
+
+    Words.resize(k * AppDataReader::GetMaxOutputBytes(bytes));
+    Tile.resize(kMDSTileWords * n);
+    return true;
+}
+
+unsigned MDSEncoder::Encode(
+    const uint8_t* const* originals,
+    uint8_t* const* recovery)
+{
+    const unsigned n = Transform.GetSize();
+    const unsigned maxBytes = AppDataReader::GetMaxOutputBytes(Bytes);
+
+    // Convert the originals to field words
+    unsigned outputBytes = (Bytes + 7) & ~7u;
+    for (unsigned i = 0; i < K; ++i)
+    {
+        uint8_t* words = &Words[i * maxBytes];
+        memset(words, 0, maxBytes);
+
+        const unsigned written = (MultiplyRegion(originals[i], Bytes, 1, words) + 7) & ~7u;
+        if (outputBytes < written) {
+            outputBytes = written;
+        }
+    }
+
+    const unsigned wordCount = outputBytes / 8;
+    for (unsigned w0 = 0; w0 < wordCount; w0 += kMDSTileWords)
+    {
+        const unsigned tileWords = (wordCount - w0 < kMDSTileWords) ? wordCount - w0 : kMDSTileWords;
+
+        // Gather one transform per word position, with zeros past K
+        for (unsigned i = 0; i < K; ++i)
+        {
+            const uint8_t* words = &Words[i * maxBytes + w0 * 8];
+            for (unsigned t = 0; t < tileWords; ++t) {
+                Tile[t * n + i] = ReadU64_LE(words + t * 8);
+            }
+        }
+
+        for (unsigned t = 0; t < tileWords; ++t)
+        {
+            uint64_t* v = &Tile[t * n];
+            for (unsigned i = K; i < n; ++i) {
+                v[i] = 0;
+            }
+
+            // Interpolate f, move to the odd points, and evaluate
+            Transform.Inverse(v, K, &Scale[0]);
+            Transform.Forward(v, M);
+        }
+
+        for (unsigned j = 0; j < M; ++j)
+        {
+            uint8_t* words = recovery[j] + w0 * 8;
+            for (unsigned t = 0; t < tileWords; ++t) {
+                WriteU64_LE(words + t * 8, Tile[t * n + j]);
+            }
+        }
+    }
+
+    for (unsigned j = 0; j < M; ++j) {
+        memset(recovery[j] + outputBytes, 0, maxBytes - outputBytes);
+    }
+
+    return outputBytes;
+}
+
+bool MDSDecoder::Initialize(unsigned k, unsigned m, unsigned bytes)
+{
+    unsigned logN;
+    if (k == 0 || m == 0 || bytes == 0 ||
+        !GetMDSLogSize(k, m, logN) ||
+        !Transform.Initialize(logN + 1))
+    {
+        return false;
+    }
+
+    K = k;
+    M = m;
+    Bytes = bytes;
+    OriginalCount = 0;
+    RecoveryCount = 0;
+    Originals.assign(k, nullptr);
+    Recoveries.assign(m, std::vector<uint8_t>());
+    Decoded.clear();
+    return true;
+}
+
+bool MDSDecoder::AddOriginal(unsigned column, const uint8_t* data)
+{
+    if (column >= K || !data) {
+        return false;
+    }
+
+    if (!Originals[column]) {
+        ++OriginalCount;
+    }
+    Originals[column] = data;
+    return true;
+}
+
+bool MDSDecoder::AddRecovery(unsigned j, const uint8_t* data, unsigned recoveryBytes)
+{
+    const unsigned maxBytes = AppDataReader::GetMaxOutputBytes(Bytes);
+    if (j >= M || !data || recoveryBytes > maxBytes) {
+        return false;
+    }
+
+    std::vector<uint8_t>& packet = Recoveries[j];
+    if (packet.empty()) {
+        ++RecoveryCount;
+    }
+
+    // Zero padding matches the encoder output
+    packet.assign(maxBytes, 0);
+    memcpy(&packet[0], data, recoveryBytes);
+    return true;
+}
+
+bool MDSDecoder::Decode()
+{
+    if (!IsReady()) {
+        return false;
+    }
+
+    std::vector<unsigned> lost;
+    for (unsigned i = 0; i < K; ++i) {
+        if (!Originals[i]) {
+            lost.push_back(i);
+        }
+    }
+    const unsigned lostCount = static_cast<unsigned>(lost.size());
+    if (lostCount == 0) {
+        return true;
+    }
+
+    /*
+        Row r of the codeword holds f(x_r) for x_r = w^BitReverse(r), which
+        is the output order of Transform.  Rows [0, K) are the originals,
+        rows [K, n) are known zeros, and rows n + j are the recoveries.
+
+        Erased rows are the lost originals and every recovery row that was
+        not received, and Z(x) is zero at those points.  Since f * Z has
+        degree < 2n, it is found from its values:  f(x_r) * Z(x_r) where
+        known and zero where erased.  Then for erased rows,
+
+            x_r * (f * Z)'(x_r) = f(x_r) * x_r * Z'(x_r)
+
+        because Z(x_r) = 0.  Multiplying the coefficients by k gives x times
+        the derivative, so each word position takes two transforms.
+    */
+    const unsigned n2 = Transform.GetSize();
+    const unsigned n = n2 / 2;
+    const unsigned logN2 = Transform.GetLogSize();
+
+    std::vector<unsigned> erasedBefore(n2 + 1);
+    erasedBefore[0] = 0;
+    for (unsigned r = 0; r < n2; ++r)
+    {
+        const bool erased = (r < K) ? !Originals[r] : (r >= n && (r - n >= M || Recoveries[r - n].empty()));
+        erasedBefore[r + 1] = erasedBefore[r] + (erased ? 1 : 0);
+    }
+
+    // Multiply out Z(x).  An aligned block of 2^s erased rows covers all
+    // the 2^s-th roots of unity times a constant c, which contributes the
+    // factor x^(2^s) - c^(2^s) to Z(x), so the unused recovery rows are
+    // only a few sparse factors
+    std::vector<uint64_t> locator(n2, 0);
+    locator[0] = 1;
+    unsigned degree = 0;
+
+    for (unsigned r = 0; r < n2;)
+    {
+        if (erasedBefore[r + 1] == erasedBefore[r])
+        {
+            ++r;
+            continue;
+        }
+
+        unsigned s = 0;
+        while (r % (2u << s) == 0 && r + (2u << s) <= n2 &&
+               erasedBefore[r + (2u << s)] - erasedBefore[r] == (2u << s))
+        {
+            ++s;
+        }
+        const unsigned size = 1u << s;
+
+        const uint64_t c = Power(GetRootOfUnity(logN2 - s), BitReverse(r >> s, logN2 - s));
+        for (unsigned k = degree + size; k >= size; --k) {
+            locator[k] = Subtract(locator[k - size], Multiply(locator[k], c));
+        }
+        for (unsigned k = size; k-- > 0;) {
+            locator[k] = Subtract(0, Multiply(locator[k], c));
+        }
+        degree += size;
+
+        r += size;
+    }
+
+    // Z(x_r) for every row, and x_r * Z'(x_r) for the lost rows
+    std::vector<uint64_t> locatorValues = locator;
+    Transform.Forward(&locatorValues[0]);
+
+    const unsigned outputs = lost[lostCount - 1] + 1;
+    std::vector<uint64_t> derivative(n2, 0);
+    for (unsigned k = 1; k <= degree; ++k) {
+        derivative[k] = Multiply(locator[k], k);
+    }
+    Transform.Forward(&derivative[0], outputs);
+
+    std::vector<uint64_t> lostScale(lostCount), scratch(lostCount);
+    for (unsigned t = 0; t < lostCount; ++t) {
+        lostScale[t] = derivative[lost[t]];
+    }
+    BatchInverse(&lostScale[0], lostCount, &scratch[0]);
+
+    // Convert the received originals to field words
+    const unsigned maxBytes = AppDataReader::GetMaxOutputBytes(Bytes);
+    const unsigned wordCount = maxBytes / 8;
+    std::vector<uint8_t> words(K * maxBytes, 0);
+    for (unsigned i = 0; i < K; ++i) {
+        if (Originals[i]) {
+            MultiplyRegion(Originals[i], Bytes, 1, &words[i * maxBytes]);
+        }
+    }
+
+    // Coefficient k of x * P'(x) is k * P_k
+    std::vector<uint64_t> scale(n2);
+    for (unsigned k = 0; k < n2; ++k) {
+        scale[k] = Multiply(Transform.GetInverseScale(), k);
+    }
+
+    std::vector<uint8_t> lostWords(lostCount * maxBytes);
+    std::vector<uint64_t> tile(kMDSTileWords * n2);
+
+    for (unsigned w0 = 0; w0 < wordCount; w0 += kMDSTileWords)
+    {
+        const unsigned tileWords = (wordCount - w0 < kMDSTileWords) ? wordCount - w0 : kMDSTileWords;
+        std::fill(tile.begin(), tile.end(), 0);
+
+        for (unsigned r = 0; r < n + M; ++r)
+        {
+            const uint8_t* data = nullptr;
+            if (r < K && Originals[r]) {
+                data = &words[r * maxBytes];
+            }
+            else if (r >= n && !Recoveries[r - n].empty()) {
+                data = &Recoveries[r - n][0];
+            }
+            if (!data) {
+                continue;
+            }
+
+            const uint64_t z = locatorValues[r];
+            for (unsigned t = 0; t < tileWords; ++t) {
+                tile[t * n2 + r] = Multiply(ReadU64_LE(data + (w0 + t) * 8), z);
+            }
+        }
+
+        for (unsigned t = 0; t < tileWords; ++t)
+        {
+            uint64_t* v = &tile[t * n2];
+            Transform.Inverse(v, n + M, &scale[0]);
+            Transform.Forward(v, outputs);
+        }
+
+        for (unsigned t = 0; t < lostCount; ++t)
+        {
+            uint8_t* out = &lostWords[t * maxBytes + w0 * 8];
+            for (unsigned u = 0; u < tileWords; ++u) {
+                WriteU64_LE(out + u * 8, Multiply(tile[u * n2 + lost[t]], lostScale[t]));
+            }
+        }
+    }
+
+    Decoded.resize(lostCount);
+    for (unsigned t = 0; t < lostCount; ++t)
+    {
+        Decoded[t].resize(Bytes);
+        RestoreRegion(&lostWords[t * maxBytes], Bytes, &Decoded[t][0]);
+        Originals[lost[t]] = &Decoded[t][0];
+    }
+
+    OriginalCount = K;
+    return true;
+}
+
+
+} // namespace solinas64
@@ -0,0 +1,572 @@
+/*
+    Copyright (c) 2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of Solinas64 nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef CAT_SOLINAS64_CODEC_H
+#define CAT_SOLINAS64_CODEC_H
+
+/** \page Codec
+    Erasure code built on the Solinas64 bulk operations
+
+    Each recovery packet is a random linear combination of the N original
+    packets, with the generator matrix row selected by a 64-bit seed.
+    Any N packets out of the originals and recovery packets are enough to
+    rebuild the lost originals, with very high probability.
+
+    The MDS code below instead evaluates a polynomial through the originals
+    at a second set of points, so any K of the K + M packets always decode,
+    and encoding and decoding take O(n log n) work per word with the NTT.
+*/
+
+#include "solinas64.h"
+#include "solinas64_ntt.h"
+
+#include <stddef.h>
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace solinas64 {
+
+
+//------------------------------------------------------------------------------
+// Encoder
+
+/**
+    Reserved seeds that select generator matrix rows with cheap coefficients
+
+    kParitySeed: Every coefficient is 1, so the recovery packet is the plain
+    sum of the originals, which is computed without any multiplies.
+
+    kShiftSeed: Column j has coefficient 2^j for j < 64, which is computed
+    with shifts instead of multiplies.  Later columns are random.
+
+    Using these for the first two recovery packets makes the common case of
+    one or two losses cheaper to encode.  Together with random rows for the
+    other recovery packets, any set of rows still decodes with very high
+    probability.
+*/
+static const uint64_t kParitySeed = ~(uint64_t)0;
+static const uint64_t kShiftSeed = ~(uint64_t)1;
+
+/// Returns the generator matrix coefficient for a recovery packet seed and
+/// original packet column.  The result is in 1..p-1.
+/// The column goes through the full HashU64() mixer because the lighter
+/// HashToNonzeroFp() mixer alone is close to linear in the column, which
+/// makes singular submatrices far more likely than for random coefficients.
+SOLINAS64_FORCE_INLINE uint64_t GetGeneratorCoefficient(uint64_t seed, unsigned column)
+{
+    if (seed == kParitySeed) {
+        return 1;
+    }
+    if (seed == kShiftSeed && column < 64) {
+        return (uint64_t)1 << column;
+    }
+    return HashToNonzeroFp(HashU64(HashU64(seed) + column));
+}
+
+/**
+    GenerateCoefficients()
+
+    Fills in a generator matrix with `rows` consecutive seeds:
+
+        out[c * rows + r] = GetGeneratorCoefficient(seed + r, c)
+
+    for recovery row r < rows and original column c < cols.  This is the
+    coefficient layout that EncodeTiled() takes.
+
+    Each coefficient is independent of the others, so the hashes of many
+    columns are in flight at once instead of one call at a time.
+
+    Preconditions:
+        out has room for rows * cols values.
+*/
+void GenerateCoefficients(
+    uint64_t seed,  ///< Seed for the first row
+    unsigned rows,  ///< Number of recovery rows
+    unsigned cols,  ///< Number of original columns
+    uint64_t* out); ///< Output matrix
+
+/**
+    GeneratorCache
+
+    Remembers generator matrix rows so that encoding many blocks with the
+    same seeds and N only generates the coefficients once.
+
+    Each cached row uses 8 * N bytes until Clear() is called.
+*/
+class GeneratorCache
+{
+public:
+    /// Returns the N coefficients for the seed, generating them on first use.
+    /// The pointer stays valid until Clear() is called.
+    const uint64_t* GetRow(uint64_t seed, unsigned N);
+
+    /// Release all the cached rows
+    void Clear()
+    {
+        Rows.clear();
+    }
+
+protected:
+    std::map<std::pair<uint64_t, unsigned>, std::vector<uint64_t>> Rows;
+};
+
+/**
+    EncodeRecovery()
+
+    Produces one recovery packet from N original packets of the same size.
+
+    The recovery packet must be AppDataReader::GetMaxOutputBytes() in size.
+    The workspace must be solinas64::GetEncodeRowWorkspaceBytes() in size.
+
+    If a cache is provided, the coefficients for the seed are looked up in it
+    instead of being generated again.
+
+    Preconditions:
+        originals[i] != null, N > 0, bytes > 0
+
+    Returns the number of recovery bytes to send.
+*/
+unsigned EncodeRecovery(
+    const uint8_t* const* originals,    ///< Original packets, one per column
+    unsigned N,                         ///< Number of original packets
+    unsigned bytes,                     ///< Bytes in each original packet
+    uint64_t seed,                      ///< Generator matrix row seed
+    uint8_t* workspace,                 ///< Temporary workspace
+    uint8_t* recovery,                  ///< Output recovery packet
+    GeneratorCache* cache = nullptr);   ///< Optional coefficient cache
+
+/// Number of delta words that UpdateRecovery() applies to every recovery
+/// packet before moving on to the next ones
+static const unsigned kUpdateRecoveryTileWords = 512;
+
+/// Returns the number of workspace bytes needed by UpdateRecovery()
+constexpr unsigned GetUpdateRecoveryWorkspaceBytes(unsigned bytes)
+{
+    return AppDataReader::GetMaxOutputBytes(bytes) + AppDataReader::GetWorkspaceBytes(bytes);
+}
+
+/**
+    UpdateRecovery()
+
+    Updates recovery packets after one of the original packets changed.
+
+        recoveries[i][] += coeffs[i] * (newData[] - oldData[]), i = 0..count-1
+
+    The code is linear, so this gives the same recovery data, modulo p, as
+    encoding the recovery packets again from all the originals.  But it only
+    reads the one original before and after the change, so a small write to
+    a large block costs O(bytes * count) instead of O(N * bytes * count).
+
+    Both versions are expanded into field words including their overflow
+    words, and the difference is formed once in the workspace.  It is then
+    applied to all the recovery packets a tile of kUpdateRecoveryTileWords
+    at a time, so each tile is read from cache for every recovery packet.
+
+    For the recovery packets from EncodeRecovery(), the coefficient is
+    GetGeneratorCoefficient(seed, column) for the column that changed.
+
+    Preconditions:
+        0 <= coeffs[i] < p.
+        oldData != null, newData != null, workspace != null, bytes > 0
+        Each recovery packet is AppDataReader::GetMaxOutputBytes(bytes) in
+        size and zero past its data, as EncodeRecovery() leaves it.
+
+    Returns the number of bytes at the front of each recovery packet that
+    may have changed.  The recovery data to send is the larger of this and
+    the previous recovery length.
+*/
+unsigned UpdateRecovery(
+    const uint8_t* oldData,             ///< Original packet before the change
+    const uint8_t* newData,             ///< Original packet after the change
+    unsigned bytes,                     ///< Bytes in each original packet
+    const uint64_t* coeffs,             ///< Generator coefficient for each recovery packet
+    unsigned count,                     ///< Number of recovery packets
+    uint8_t* workspace,                 ///< Size calculated by GetUpdateRecoveryWorkspaceBytes()
+    uint8_t* const* recoveries);        ///< Recovery packets to update
+
+
+//------------------------------------------------------------------------------
+// Encoder Context
+
+/// Alignment of each buffer that EncoderContext hands out
+static const unsigned kEncoderContextAlignment = 64;
+
+/**
+    EncoderContext
+
+    Owns all the memory for encoding blocks of up to a maximum shape, so that
+    steady-state encoding does no allocations:
+
+    + A staging buffer for each original packet, which may be filled by the
+      application or ignored when the originals already live elsewhere.
+    + The EncodeRow() workspace and the generator row coefficients.
+    + A pool of recovery buffers of AppDataReader::GetMaxOutputBytes() each.
+
+    Call Initialize() once with the largest N and packet size to be used.
+    Then for each recovery packet, AcquireRecovery() a buffer, Encode() into
+    it, and ReleaseRecovery() it once it has been sent.
+
+    Every buffer starts on a 64-byte boundary, so the vector kernels never
+    split a load or store across cache lines, and kHintStreamOutput applies
+    to the recovery buffers on both AVX2 and AVX-512.
+*/
+class EncoderContext
+{
+public:
+    /// Allocate the arenas for blocks of up to maxN originals of up to
+    /// maxBytes each, with recoveryCount recovery buffers in the pool.
+    /// Returns false if the parameters are invalid or too large.
+    bool Initialize(unsigned maxN, unsigned maxBytes, unsigned recoveryCount);
+
+    /// Returns the N passed to Initialize()
+    unsigned GetMaxN() const
+    {
+        return MaxN;
+    }
+
+    /// Returns the bytes passed to Initialize()
+    unsigned GetMaxBytes() const
+    {
+        return MaxBytes;
+    }
+
+    /// Returns the size of each recovery buffer: GetMaxOutputBytes(maxBytes)
+    unsigned GetRecoveryBytes() const
+    {
+        return AppDataReader::GetMaxOutputBytes(MaxBytes);
+    }
+
+    /// Returns the Encode() workspace of GetEncodeRowWorkspaceBytes(maxBytes),
+    /// which is also large enough for the MultiplyRegion() workspace
+    uint8_t* GetWorkspace()
+    {
+        return Workspace;
+    }
+
+    /// Returns the staging buffer of maxBytes for an original packet column,
+    /// or null if the column is out of range
+    uint8_t* GetOriginal(unsigned column)
+    {
+        return column < MaxN ? Originals + column * static_cast<size_t>(OriginalStride) : nullptr;
+    }
+
+    /// Returns an array of the MaxN staging buffer pointers, for Encode()
+    const uint8_t* const* GetOriginals() const
+    {
+        return OriginalPtrs.data();
+    }
+
+    /// Take a recovery buffer from the pool.
+    /// Returns null if all of them are in use
+    uint8_t* AcquireRecovery();
+
+    /// Return a recovery buffer to the pool.
+    /// Returns false if it did not come from this pool or is already free
+    bool ReleaseRecovery(uint8_t* recovery);
+
+    /// Returns the number of recovery buffers that are free
+    unsigned GetFreeRecoveryCount() const
+    {
+        return static_cast<unsigned>(FreeRecoveries.size());
+    }
+
+    /**
+        Same as EncodeRecovery() with the context workspace and coefficient
+        buffer, so it does not allocate.  The recovery buffer may be any
+        GetMaxOutputBytes(bytes) buffer, not just one from the pool.
+
+        Returns the number of recovery bytes to send, or 0 if N or bytes
+        exceed the shape passed to Initialize().
+    */
+    unsigned Encode(
+        const uint8_t* const* originals,    ///< Original packets, one per column
+        unsigned N,                         ///< Number of original packets
+        unsigned bytes,                     ///< Bytes in each original packet
+        uint64_t seed,                      ///< Generator matrix row seed
+        uint8_t* recovery,                  ///< Output recovery packet
+        GeneratorCache* cache = nullptr);   ///< Optional coefficient cache
+
+protected:
+    /// Shape passed to Initialize()
+    unsigned MaxN = 0;
+    unsigned MaxBytes = 0;
+
+    /// Distance between consecutive buffers of each kind
+    unsigned OriginalStride = 0;
+    unsigned RecoveryStride = 0;
+    unsigned RecoveryCount = 0;
+
+    /// One allocation for all the buffers, with room for alignment
+    std::vector<uint8_t> Arena;
+
+    /// Aligned regions within the arena
+    uint8_t* Workspace = nullptr;
+    uint8_t* Originals = nullptr;
+    uint8_t* Recoveries = nullptr;
+
+    /// Staging buffer pointers for GetOriginals()
+    std::vector<const uint8_t*> OriginalPtrs;
+
+    /// Generator row for Encode()
+    std::vector<uint64_t> Coeffs;
+
+    /// Recovery buffers not in use, with capacity for all of them
+    std::vector<uint8_t*> FreeRecoveries;
+};
+
+
+//------------------------------------------------------------------------------
+// Decoder
+
+/**
+    Decoder
+
+    Rebuilds lost original packets from the received originals and recovery
+    packets produced by EncodeRecovery().
+
+    Call Initialize() with the code parameters.
+    Call AddOriginal() for each received original packet.
+    Call AddRecovery() for each received recovery packet.
+    When IsReady() returns true, call Decode().
+    If Decode() returns true, GetOriginal() returns each original packet.
+
+    The original packet data passed to AddOriginal() is not copied and must
+    stay valid until decoding is complete.  Recovery packets are copied.
+
+    Decode() finds an invertible square submatrix of the generator matrix
+    with fraction-free Gaussian elimination, so the only field inversion is
+    a single batched inversion of the pivots.  The row operations on packet
+    data reuse the bulk region kernels.
+*/
+class Decoder
+{
+public:
+    /// Set the code parameters and reset the decoder.
+    /// Returns false if the parameters are invalid.
+    bool Initialize(unsigned N, unsigned bytes);
+
+    /// Provide a received original packet of `bytes` size.
+    /// Returns false if the column is invalid.
+    bool AddOriginal(unsigned column, const uint8_t* data);
+
+    /// Provide a received recovery packet.
+    /// Returns false if the packet is larger than AppDataReader::GetMaxOutputBytes().
+    bool AddRecovery(uint64_t seed, const uint8_t* data, unsigned recoveryBytes);
+
+    /// Returns true if enough packets have been received to attempt Decode()
+    bool IsReady() const
+    {
+        return OriginalCount + Recoveries.size() >= N;
+    }
+
+    /// Rebuild the lost originals.
+    /// Returns false if the received recovery packets are not enough to
+    /// solve for the lost originals.  More recovery packets can be added
+    /// and Decode() tried again.
+    bool Decode();
+
+    /// Returns the original packet data for the given column,
+    /// or null if it has not been received or decoded.
+    const uint8_t* GetOriginal(unsigned column) const
+    {
+        return column < N ? Originals[column] : nullptr;
+    }
+
+protected:
+    struct RecoveryPacket
+    {
+        uint64_t Seed;
+        std::vector<uint8_t> Data;
+    };
+
+    /// Code parameters
+    unsigned N = 0;
+    unsigned Bytes = 0;
+
+    /// Number of non-null entries in Originals
+    unsigned OriginalCount = 0;
+
+    /// Pointers to original data, either received or decoded
+    std::vector<const uint8_t*> Originals;
+
+    /// Received recovery packets padded to GetMaxOutputBytes()
+    std::vector<RecoveryPacket> Recoveries;
+
+    /// Storage for decoded original packets
+    std::vector<std::vector<uint8_t>> Decoded;
+};
+
+
+//------------------------------------------------------------------------------
+// MDS Code
+
+/**
+    MDS code
+
+    A Reed-Solomon code over the roots of unity.  Let n be the smallest
+    power of two >= max(K, M), and w the primitive 2n-th root of unity.
+    Each word position of the K originals sets the values of a polynomial
+    f of degree < n at the points w^(2 * BitReverse(i)), with the n - K
+    missing originals taken to be zero.  Recovery packet j holds the values
+    of f at w^(2 * BitReverse(j) + 1), for j < M.
+
+    Since f is set by any n values and the zero originals are known, any K
+    of the K + M packets are enough to decode.
+
+    The encoder interpolates f with an inverse NTT of size n and evaluates
+    it with a forward NTT on the odd powers of w.  The decoder multiplies the
+    received values by the erasure locator polynomial Z(x), which is zero at
+    the points of the lost packets, and recovers the lost values of f from
+    the derivative of f * Z with two NTTs of size 2n.  Both work on tiles of
+    kMDSTileWords word positions at a time.
+*/
+
+/// Number of word positions the MDS code loads from each packet at a time
+static const unsigned kMDSTileWords = 8;
+
+/**
+    MDSEncoder
+
+    Call Initialize() with the code parameters, then Encode() once per block
+    of K originals.  The workspace is kept between calls.
+*/
+class MDSEncoder
+{
+public:
+    /// Set the code parameters.
+    /// Returns false if the parameters are invalid or too large.
+    bool Initialize(unsigned K, unsigned M, unsigned bytes);
+
+    /**
+        Produce all M recovery packets from the K originals.
+
+        Each recovery packet must be AppDataReader::GetMaxOutputBytes() in
+        size, and is zero-padded past the returned length.
+
+        Preconditions:
+            Initialize() succeeded, originals[i] != null, recovery[j] != null
+
+        Returns the number of recovery bytes to send, the same for each.
+    */
+    unsigned Encode(
+        const uint8_t* const* originals,    ///< K original packets of `bytes` each
+        uint8_t* const* recovery);          ///< M output recovery packets
+
+protected:
+    /// Code parameters
+    unsigned K = 0;
+    unsigned M = 0;
+    unsigned Bytes = 0;
+
+    /// Transform of size n
+    NTT Transform;
+
+    /// Scale[k] = n^-1 * w^k for the inverse transform, which moves the
+    /// coefficients of f to the odd points
+    std::vector<uint64_t> Scale;
+
+    /// Originals converted to field words, GetMaxOutputBytes() each
+    std::vector<uint8_t> Words;
+
+    /// kMDSTileWords transforms of n words
+    std::vector<uint64_t> Tile;
+};
+
+/**
+    MDSDecoder
+
+    Rebuilds lost original packets from any K of the packets produced by
+    MDSEncoder with the same parameters.
+
+    Used the same way as Decoder, except that recovery packets are identified
+    by their index j < M instead of a seed.  The original packet data passed
+    to AddOriginal() is not copied and must stay valid until decoding is
+    complete.  Recovery packets are copied.
+*/
+class MDSDecoder
+{
+public:
+    /// Set the code parameters and reset the decoder.
+    /// Returns false if the parameters are invalid or too large.
+    bool Initialize(unsigned K, unsigned M, unsigned bytes);
+
+    /// Provide a received original packet of `bytes` size.
+    /// Returns false if the column is invalid.
+    bool AddOriginal(unsigned column, const uint8_t* data);
+
+    /// Provide received recovery packet j.
+    /// Returns false if j is invalid or the packet is larger than
+    /// AppDataReader::GetMaxOutputBytes().
+    bool AddRecovery(unsigned j, const uint8_t* data, unsigned recoveryBytes);
+
+    /// Returns true if enough packets have been received to Decode()
+    bool IsReady() const
+    {
+        return OriginalCount + RecoveryCount >= K;
+    }
+
+    /// Rebuild the lost originals.
+    /// Returns false only if IsReady() is false.
+    bool Decode();
+
+    /// Returns the original packet data for the given column,
+    /// or null if it has not been received or decoded.
+    const uint8_t* GetOriginal(unsigned column) const
+    {
+        return column < K ? Originals[column] : nullptr;
+    }
+
+protected:
+    /// Code parameters
+    unsigned K = 0;
+    unsigned M = 0;
+    unsigned Bytes = 0;
+
+    /// Transform of size 2n
+    NTT Transform;
+
+    /// Number of non-null entries in Originals and received recoveries
+    unsigned OriginalCount = 0;
+    unsigned RecoveryCount = 0;
+
+    /// Pointers to original data, either received or decoded
+    std::vector<const uint8_t*> Originals;
+
+    /// Received recovery packets padded to GetMaxOutputBytes(),
+    /// or empty if not received
+    std::vector<std::vector<uint8_t>> Recoveries;
+
+    /// Storage for decoded original packets
+    std::vector<std::vector<uint8_t>> Decoded;
+};
+
+
+} // namespace solinas64
+
+#endif // CAT_SOLINAS64_CODEC_H
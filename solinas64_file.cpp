@@ -0,0 +1,570 @@
+/*
+    Copyright (c) 2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of Solinas64 nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+// 64-bit file offsets on 32-bit POSIX builds
+#ifndef _FILE_OFFSET_BITS
+# define _FILE_OFFSET_BITS 64
+#endif
+
+#include "solinas64_file.h"
+#include "solinas64_codec.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if !defined(_WIN32)
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+namespace solinas64 {
+
+
+//------------------------------------------------------------------------------
+// File Source
+
+namespace {
+
+/*
+    The source file, mapped if possible.  Otherwise each range is read into
+    a staging buffer with pread(), or with stdio on Windows.
+*/
+class FileSource
+{
+public:
+    ~FileSource()
+    {
+        Close();
+    }
+
+    bool Open(const char* path, bool useMmap);
+
+    uint64_t GetBytes() const
+    {
+        return Bytes;
+    }
+
+    /// Returns `bytes` of the file at `offset`, where bytes past the end of
+    /// the file read as zeros.  The staging buffer holds the data if it is
+    /// not mapped.  Returns null on a read error.
+    const uint8_t* Read(uint64_t offset, unsigned bytes, uint8_t* staging);
+
+protected:
+    uint64_t Bytes = 0;
+
+#if defined(_WIN32)
+    FILE* File = nullptr;
+#else
+    int Fd = -1;
+    uint8_t* Map = nullptr;
+#endif
+
+    void Close();
+
+    /// Read the part of the range before the end of the file into staging
+    bool ReadRange(uint64_t offset, unsigned bytes, uint8_t* staging);
+};
+
+#if defined(_WIN32)
+
+bool FileSource::Open(const char* path, bool useMmap)
+{
+    (void)useMmap;
+
+    File = fopen(path, "rb");
+    if (!File || _fseeki64(File, 0, SEEK_END) != 0) {
+        return false;
+    }
+    const int64_t bytes = _ftelli64(File);
+    if (bytes < 0) {
+        return false;
+    }
+    Bytes = static_cast<uint64_t>(bytes);
+    return true;
+}
+
+void FileSource::Close()
+{
+    if (File)
+    {
+        fclose(File);
+        File = nullptr;
+    }
+}
+
+bool FileSource::ReadRange(uint64_t offset, unsigned bytes, uint8_t* staging)
+{
+    return _fseeki64(File, static_cast<int64_t>(offset), SEEK_SET) == 0 &&
+        fread(staging, 1, bytes, File) == bytes;
+}
+
+#else // _WIN32
+
+bool FileSource::Open(const char* path, bool useMmap)
+{
+    Fd = open(path, O_RDONLY);
+    if (Fd < 0) {
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(Fd, &info) != 0) {
+        return false;
+    }
+    Bytes = static_cast<uint64_t>(info.st_size);
+
+    // Falls back to reading if the file does not fit in the address space
+    if (useMmap && Bytes > 0 && Bytes == static_cast<size_t>(Bytes))
+    {
+        void* map = mmap(nullptr, static_cast<size_t>(Bytes), PROT_READ, MAP_PRIVATE, Fd, 0);
+        if (map != MAP_FAILED)
+        {
+            Map = static_cast<uint8_t*>(map);
+            madvise(map, static_cast<size_t>(Bytes), MADV_SEQUENTIAL);
+        }
+    }
+
+#if defined(POSIX_FADV_SEQUENTIAL)
+    if (!Map) {
+        posix_fadvise(Fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+#endif
+
+    return true;
+}
+
+void FileSource::Close()
+{
+    if (Map)
+    {
+        munmap(Map, static_cast<size_t>(Bytes));
+        Map = nullptr;
+    }
+    if (Fd >= 0)
+    {
+        close(Fd);
+        Fd = -1;
+    }
+}
+
+bool FileSource::ReadRange(uint64_t offset, unsigned bytes, uint8_t* staging)
+{
+    if (Map)
+    {
+        memcpy(staging, Map + offset, bytes);
+        return true;
+    }
+
+    while (bytes > 0)
+    {
+        const ssize_t count = pread(Fd, staging, bytes, static_cast<off_t>(offset));
+        if (count <= 0) {
+            return false;
+        }
+        staging += count;
+        offset += static_cast<uint64_t>(count);
+        bytes -= static_cast<unsigned>(count);
+    }
+    return true;
+}
+
+#endif // _WIN32
+
+const uint8_t* FileSource::Read(uint64_t offset, unsigned bytes, uint8_t* staging)
+{
+#if !defined(_WIN32)
+    if (Map && offset + bytes <= Bytes) {
+        return Map + offset;
+    }
+#endif
+
+    unsigned available = 0;
+    if (offset < Bytes) {
+        available = (Bytes - offset < bytes) ? static_cast<unsigned>(Bytes - offset) : bytes;
+    }
+
+    if (available > 0 && !ReadRange(offset, available, staging)) {
+        return nullptr;
+    }
+    memset(staging + available, 0, bytes - available);
+    return staging;
+}
+
+
+//------------------------------------------------------------------------------
+// Recovery Ring
+
+/*
+    A fixed ring of stripe buffers between the encoder and a writer thread.
+    Each slot holds the same stripe of every recovery shard.  The encoder
+    blocks when all the slots are waiting to be written, so at most
+    `slots` stripes are in memory.
+*/
+class RecoveryRing
+{
+public:
+    RecoveryRing(
+        unsigned slots,
+        unsigned recoveryCount,
+        unsigned stripeBytes,
+        const RecoveryWriter& writer)
+        : Writer(writer)
+        , SlotCount(slots)
+        , RecoveryCount(recoveryCount)
+        , StripeBytes(stripeBytes)
+        , Buffer(static_cast<size_t>(slots) * recoveryCount * stripeBytes)
+        , Slots(slots)
+    {
+        Thread = std::thread(&RecoveryRing::WriterLoop, this);
+    }
+
+    ~RecoveryRing()
+    {
+        Finish();
+    }
+
+    /// Wait for a free slot and return its output pointers, one per recovery
+    uint8_t* const* Acquire()
+    {
+        std::unique_lock<std::mutex> locker(Lock);
+        SlotCondition.wait(locker, [&] {
+            return Produced - Written < SlotCount;
+        });
+
+        Slot& slot = Slots[Produced % SlotCount];
+        if (slot.Outputs.empty())
+        {
+            uint8_t* base = &Buffer[(Produced % SlotCount) * static_cast<size_t>(RecoveryCount) * StripeBytes];
+            for (unsigned r = 0; r < RecoveryCount; ++r) {
+                slot.Outputs.push_back(base + r * static_cast<size_t>(StripeBytes));
+            }
+        }
+        return slot.Outputs.data();
+    }
+
+    /// Hand the slot from the last Acquire() to the writer
+    void Publish(unsigned offset, unsigned bytes)
+    {
+        {
+            std::lock_guard<std::mutex> locker(Lock);
+            Slot& slot = Slots[Produced % SlotCount];
+            slot.Offset = offset;
+            slot.Bytes = bytes;
+            ++Produced;
+        }
+        WriteCondition.notify_one();
+    }
+
+    /// Returns true if the writer has returned false
+    bool IsFailed()
+    {
+        std::lock_guard<std::mutex> locker(Lock);
+        return Failed;
+    }
+
+    /// Write the remaining slots and stop the writer thread.
+    /// Returns false if the writer returned false
+    bool Finish()
+    {
+        if (Thread.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> locker(Lock);
+                Done = true;
+            }
+            WriteCondition.notify_one();
+            Thread.join();
+        }
+        return !Failed;
+    }
+
+protected:
+    struct Slot
+    {
+        std::vector<uint8_t*> Outputs;
+        unsigned Offset = 0;
+        unsigned Bytes = 0;
+    };
+
+    const RecoveryWriter& Writer;
+    const unsigned SlotCount;
+    const unsigned RecoveryCount;
+    const unsigned StripeBytes;
+
+    std::vector<uint8_t> Buffer;
+    std::vector<Slot> Slots;
+
+    std::thread Thread;
+    std::mutex Lock;
+    std::condition_variable SlotCondition;
+    std::condition_variable WriteCondition;
+
+    /// Number of slots published and written
+    uint64_t Produced = 0;
+    uint64_t Written = 0;
+    bool Done = false;
+    bool Failed = false;
+
+
+    void WriterLoop()
+    {
+        for (;;)
+        {
+            Slot* slot;
+            bool failed;
+            {
+                std::unique_lock<std::mutex> locker(Lock);
+                WriteCondition.wait(locker, [&] {
+                    return Done || Written < Produced;
+                });
+                if (Written == Produced) {
+                    return;
+                }
+                slot = &Slots[Written % SlotCount];
+                failed = Failed;
+            }
+
+            // After a failure the slots are only released, so the encoder
+            // does not block before it sees the failure
+            for (unsigned r = 0; r < RecoveryCount && !failed; ++r) {
+                failed = !Writer(r, slot->Offset, slot->Outputs[r], slot->Bytes);
+            }
+
+            {
+                std::lock_guard<std::mutex> locker(Lock);
+                Failed = failed;
+                ++Written;
+            }
+            SlotCondition.notify_one();
+        }
+    }
+};
+
+} // namespace
+
+
+//------------------------------------------------------------------------------
+// File Encoder
+
+unsigned GetFileShardBytes(uint64_t fileBytes, unsigned N)
+{
+    if (N == 0) {
+        return 0;
+    }
+    const uint64_t shardBytes = ((fileBytes + N - 1) / N + 63) & ~(uint64_t)63;
+    if (shardBytes == 0 || shardBytes > kMaxFileShardBytes) {
+        return 0;
+    }
+    return static_cast<unsigned>(shardBytes);
+}
+
+/*
+    Adds the overflow words completed so far by the reader of one original
+    to the recovery tails, and rewinds the reader to the start of its buffer.
+*/
+static void ApplyFileTailWords(
+    AppDataReader& reader,
+    unsigned wordCount,
+    const uint64_t* coeffs,
+    unsigned recoveryCount,
+    unsigned& tailIndex,
+    std::vector<std::vector<uint8_t>>& tails)
+{
+    for (unsigned k = 0; k < wordCount; ++k, ++tailIndex)
+    {
+        const uint64_t word = ReadU64_LE(reader.Data + k * 8);
+
+        for (unsigned r = 0; r < recoveryCount; ++r)
+        {
+            uint8_t* out = &tails[r][tailIndex * 8];
+            WriteU64_LE(out, Add(Multiply(coeffs[r], word), ReadU64_LE(out)));
+        }
+    }
+    reader.DataWritePtr = reader.Data;
+}
+
+bool EncodeFile(
+    const char* path,
+    const FileEncoderParams& params,
+    const RecoveryWriter& writer,
+    FileEncoderResult* result)
+{
+    const unsigned N = params.N;
+    const unsigned R = params.RecoveryCount;
+    const unsigned stripeBytes = params.StripeBytes;
+
+    if (!path || N == 0 || R == 0 || params.RingSlots == 0 ||
+        stripeBytes == 0 || stripeBytes % 64 != 0 || stripeBytes > kMaxFileShardBytes)
+    {
+        return false;
+    }
+
+    FileSource source;
+    if (!source.Open(path, params.UseMmap)) {
+        return false;
+    }
+
+    const unsigned shardBytes = GetFileShardBytes(source.GetBytes(), N);
+    if (shardBytes == 0) {
+        return false;
+    }
+
+    // Column c, recovery r is at coeffs[c * R + r], so each column's
+    // coefficients are the MultiplyAddRegionMultiSlice() layout
+    std::vector<uint64_t> coeffs(static_cast<size_t>(N) * R);
+    GenerateCoefficients(params.FirstSeed, R, N, coeffs.data());
+
+    // One reader per original, whose buffer holds the overflow words of one
+    // stripe plus the final partial word
+    const unsigned readerBytes = AppDataReader::GetWorkspaceBytes(stripeBytes) + 8;
+    std::vector<uint8_t> readerBuffers(static_cast<size_t>(N) * readerBytes);
+    std::vector<AppDataReader> readers(N);
+    std::vector<unsigned> tailIndices(N, 0);
+    for (unsigned i = 0; i < N; ++i) {
+        readers[i].SetupWorkspace(&readerBuffers[i * static_cast<size_t>(readerBytes)]);
+    }
+
+    const unsigned maxTailBytes = AppDataReader::GetMaxOutputBytes(shardBytes) - shardBytes;
+    std::vector<std::vector<uint8_t>> tails(R, std::vector<uint8_t>(maxTailBytes, 0));
+
+    std::vector<uint8_t> staging(stripeBytes);
+
+    RecoveryRing ring(params.RingSlots, R, stripeBytes, writer);
+
+    for (unsigned offset = 0; offset < shardBytes; offset += stripeBytes)
+    {
+        const unsigned remaining = shardBytes - offset;
+        const unsigned bytes = remaining < stripeBytes ? remaining : stripeBytes;
+
+        if (ring.IsFailed()) {
+            break;
+        }
+
+        uint8_t* const* outputs = ring.Acquire();
+        for (unsigned r = 0; r < R; ++r) {
+            memset(outputs[r], 0, bytes);
+        }
+
+        for (unsigned i = 0; i < N; ++i)
+        {
+            const uint8_t* data = source.Read(
+                i * static_cast<uint64_t>(shardBytes) + offset, bytes, staging.data());
+            if (!data)
+            {
+                ring.Finish();
+                return false;
+            }
+
+            MultiplyAddRegionMultiSlice(readers[i], data, bytes, &coeffs[i * static_cast<size_t>(R)], R, outputs, 0);
+
+            const unsigned wordCount = static_cast<unsigned>(readers[i].DataWritePtr - readers[i].Data) / 8;
+            ApplyFileTailWords(readers[i], wordCount, &coeffs[i * static_cast<size_t>(R)], R, tailIndices[i], tails);
+        }
+
+        ring.Publish(offset, bytes);
+    }
+
+    if (!ring.Finish()) {
+        return false;
+    }
+
+    // Finalize the overflow bits
+    unsigned tailWords = 0;
+    for (unsigned i = 0; i < N; ++i)
+    {
+        ApplyFileTailWords(readers[i], readers[i].FlushAndGetWordCount(), &coeffs[i * static_cast<size_t>(R)], R, tailIndices[i], tails);
+        if (tailWords < tailIndices[i]) {
+            tailWords = tailIndices[i];
+        }
+    }
+
+    if (tailWords > 0) {
+        for (unsigned r = 0; r < R; ++r) {
+            if (!writer(r, shardBytes, tails[r].data(), tailWords * 8)) {
+                return false;
+            }
+        }
+    }
+
+    if (result)
+    {
+        result->FileBytes = source.GetBytes();
+        result->ShardBytes = shardBytes;
+        result->RecoveryBytes = shardBytes + tailWords * 8;
+    }
+
+    return true;
+}
+
+bool EncodeFileToShards(
+    const char* path,
+    const FileEncoderParams& params,
+    const char* const* recoveryPaths,
+    FileEncoderResult* result)
+{
+    if (!recoveryPaths) {
+        return false;
+    }
+
+    std::vector<FILE*> files(params.RecoveryCount, nullptr);
+    bool success = true;
+
+    for (unsigned r = 0; r < params.RecoveryCount && success; ++r)
+    {
+        files[r] = recoveryPaths[r] ? fopen(recoveryPaths[r], "wb") : nullptr;
+        success = (files[r] != nullptr);
+    }
+
+    // The offsets of each shard arrive in order, so the writes are sequential
+    const RecoveryWriter writer = [&](unsigned recoveryIndex, unsigned offset, const uint8_t* data, unsigned bytes) {
+        (void)offset;
+        return fwrite(data, 1, bytes, files[recoveryIndex]) == bytes;
+    };
+
+    if (success) {
+        success = EncodeFile(path, params, writer, result);
+    }
+
+    for (FILE* file : files) {
+        if (file && fclose(file) != 0) {
+            success = false;
+        }
+    }
+
+    return success;
+}
+
+
+} // namespace solinas64
@@ -0,0 +1,161 @@
+/*
+    Copyright (c) 2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of Solinas64 nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef CAT_SOLINAS64_FILE_H
+#define CAT_SOLINAS64_FILE_H
+
+/** \page File
+    Recovery shards for large files
+
+    The file is split into N original shards of equal size, with the last
+    one padded with zeros, and each recovery shard is the EncodeRecovery()
+    of the N shards for its seed.  So they decode with the Decoder in
+    solinas64_codec.h like any other recovery packets.
+
+    The shards are processed one stripe at a time: The same stripe of every
+    original shard is multiplied into the same stripe of every recovery
+    shard, with one AppDataReader per original that carries the extra bits
+    from one stripe to the next.  The overflow words are applied to small
+    per-recovery tails as they fill.  So memory use depends on the stripe
+    size, N and the number of recovery shards, and not on the file size,
+    apart from the tails of about 1/504 of a shard each.
+
+    The source is memory-mapped with sequential read-ahead where possible,
+    and read in stripes otherwise.  Finished recovery stripes go through a
+    bounded ring of buffers to a writer thread, so the disk writes overlap
+    the field math for the following stripes.
+*/
+
+#include "solinas64.h"
+
+#include <functional>
+
+namespace solinas64 {
+
+
+//------------------------------------------------------------------------------
+// File Encoder
+
+/// Default bytes of each shard processed at a time: 4 pages
+static const unsigned kFileStripeBytes = 16 * 1024;
+
+/// Default number of stripes of recovery data buffered for the writer
+static const unsigned kFileRingSlots = 4;
+
+/// Largest supported shard, as for EncoderContext
+static const unsigned kMaxFileShardBytes = 1u << 28;
+
+/// Parameters for EncodeFile()
+struct FileEncoderParams
+{
+    /// Number of original shards the file is split into
+    unsigned N = 0;
+
+    /// Number of recovery shards to produce
+    unsigned RecoveryCount = 0;
+
+    /// Recovery shard r uses seed FirstSeed + r, as in GenerateCoefficients()
+    uint64_t FirstSeed = 0;
+
+    /// Bytes of each shard processed at a time, a multiple of 64
+    unsigned StripeBytes = kFileStripeBytes;
+
+    /// Number of recovery stripes buffered between the encoder and writer
+    unsigned RingSlots = kFileRingSlots;
+
+    /// Memory-map the source.  Otherwise, or if mapping fails, it is read
+    bool UseMmap = true;
+};
+
+/// Shard sizes reported by EncodeFile()
+struct FileEncoderResult
+{
+    /// Size of the source file
+    uint64_t FileBytes = 0;
+
+    /// Size of each original shard: The file is padded with zeros to N of them
+    unsigned ShardBytes = 0;
+
+    /// Size of each recovery shard
+    unsigned RecoveryBytes = 0;
+};
+
+/// Receives recovery shard data.  The offsets of each recovery shard arrive
+/// in increasing order, from one thread at a time.
+/// Returns false to stop encoding.
+typedef std::function<bool(
+    unsigned recoveryIndex,
+    unsigned offset,
+    const uint8_t* data,
+    unsigned bytes)> RecoveryWriter;
+
+/**
+    GetFileShardBytes()
+
+    Returns the size of each of the N original shards for a file of the
+    given size, rounded up to a multiple of 64 bytes, or 0 if the file is
+    empty or the shards would be larger than kMaxFileShardBytes.
+*/
+unsigned GetFileShardBytes(uint64_t fileBytes, unsigned N);
+
+/**
+    EncodeFile()
+
+    Produces params.RecoveryCount recovery shards for the file at `path`,
+    passing them to the writer in stripes.
+
+    Recovery shard r is the same as EncodeRecovery() of the N original
+    shards with seed params.FirstSeed + r.
+
+    Returns false if the file could not be read or is empty, the
+    parameters are invalid, or the writer returned false.
+*/
+bool EncodeFile(
+    const char* path,                   ///< Source file
+    const FileEncoderParams& params,    ///< Shape and buffering
+    const RecoveryWriter& writer,       ///< Receives the recovery data
+    FileEncoderResult* result = nullptr); ///< Optional: Shard sizes
+
+/**
+    EncodeFileToShards()
+
+    EncodeFile() that writes each recovery shard r to recoveryPaths[r].
+
+    Returns false on any read or write error, or if the file is empty.
+*/
+bool EncodeFileToShards(
+    const char* path,                   ///< Source file
+    const FileEncoderParams& params,    ///< Shape and buffering
+    const char* const* recoveryPaths,   ///< One output path per recovery shard
+    FileEncoderResult* result = nullptr); ///< Optional: Shard sizes
+
+
+} // namespace solinas64
+
+#endif // CAT_SOLINAS64_FILE_H
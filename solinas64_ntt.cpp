@@ -0,0 +1,247 @@
+/*
+    Copyright (c) 2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of Solinas64 nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "solinas64_ntt.h"
+
+namespace solinas64 {
+
+
+//------------------------------------------------------------------------------
+// Roots of Unity
+
+uint64_t GetRootOfUnity(unsigned logN)
+{
+    uint64_t w = kRootOfUnity;
+    for (unsigned i = logN; i < 32; ++i) {
+        w = Multiply(w, w);
+    }
+    return Finalize(w);
+}
+
+
+//------------------------------------------------------------------------------
+// NTT
+
+/// Blocks of up to 2^kNTTBlockLogSize words (32 KB) run all their stages
+/// one after another, since they stay in cache
+static const unsigned kNTTBlockLogSize = 12;
+
+bool NTT::Initialize(unsigned logN)
+{
+    if (logN > kMaxNTTLogSize) {
+        return false;
+    }
+
+    LogN = logN;
+    N = 1u << logN;
+    InvN = solinas64::Inverse(N);
+
+    Twiddles.resize(N);
+    InvTwiddles.resize(N);
+    Twiddles[0] = InvTwiddles[0] = 1;
+
+    // Fill in the largest stage, and every other stage is every other word
+    // of the stage above it: w_h^j = w_2h^2j
+    if (N >= 2)
+    {
+        const unsigned half = N / 2;
+        const uint64_t w = GetRootOfUnity(logN);
+        const uint64_t winv = solinas64::Inverse(w);
+
+        uint64_t t = 1, tinv = 1;
+        for (unsigned j = 0; j < half; ++j)
+        {
+            Twiddles[half + j] = t;
+            InvTwiddles[half + j] = tinv;
+            t = Finalize(Multiply(t, w));
+            tinv = Finalize(Multiply(tinv, winv));
+        }
+
+        for (unsigned h = half / 2; h >= 1; h /= 2)
+        {
+            for (unsigned j = 0; j < h; ++j)
+            {
+                Twiddles[h + j] = Twiddles[2 * h + 2 * j];
+                InvTwiddles[h + j] = InvTwiddles[2 * h + 2 * j];
+            }
+        }
+    }
+
+    return true;
+}
+
+/// Round x up to a multiple of the power of two `size`
+static SOLINAS64_FORCE_INLINE unsigned RoundUpPow2(unsigned x, unsigned size)
+{
+    return (x + size - 1) & ~(size - 1);
+}
+
+void NTT::ForwardBlock(uint64_t* data, unsigned logSize, unsigned outputs) const
+{
+    // Run the first stage over the whole block, and then recurse into each
+    // half, so each half stays in cache for the rest of its stages
+    if (logSize > kNTTBlockLogSize)
+    {
+        const unsigned half = 1u << (logSize - 1);
+        NTTStageDIF(data, 2 * half, half, &Twiddles[half]);
+        ForwardBlock(data, logSize - 1, outputs < half ? outputs : half);
+        if (outputs > half) {
+            ForwardBlock(data + half, logSize - 1, outputs - half);
+        }
+        return;
+    }
+
+    // Later stages only need the blocks that hold the first outputs
+    for (unsigned log = logSize; log > 2; --log)
+    {
+        const unsigned half = 1u << (log - 1);
+        NTTStageDIF(data, RoundUpPow2(outputs, 2 * half), half, &Twiddles[half]);
+    }
+
+    if (logSize == 1)
+    {
+        const uint64_t a = data[0], b = data[1];
+        data[0] = Add(a, b);
+        data[1] = Subtract(a, b);
+        return;
+    }
+
+    // Fused radix-4 pass for the last two stages
+    const uint64_t w4 = Twiddles[3];
+    for (unsigned i = 0; i < outputs; i += 4)
+    {
+        uint64_t* x = data + i;
+
+        // Stage with half = 2: Twiddles are 1 and w_4
+        const uint64_t b0 = Add(x[0], x[2]);
+        const uint64_t b1 = Add(x[1], x[3]);
+        const uint64_t b2 = Subtract(x[0], x[2]);
+        const uint64_t b3 = Multiply(Subtract(x[1], x[3]), w4);
+
+        // Stage with half = 1: Twiddle is 1
+        x[0] = Add(b0, b1);
+        x[1] = Subtract(b0, b1);
+        x[2] = Add(b2, b3);
+        x[3] = Subtract(b2, b3);
+    }
+}
+
+void NTT::InverseBlock(uint64_t* data, unsigned logSize, unsigned inputs) const
+{
+    // Mirror of ForwardBlock(): Transform each half, then the last stage
+    // runs over the whole block.  A half that is all zeros stays zero
+    if (logSize > kNTTBlockLogSize)
+    {
+        const unsigned half = 1u << (logSize - 1);
+        InverseBlock(data, logSize - 1, inputs < half ? inputs : half);
+        if (inputs > half) {
+            InverseBlock(data + half, logSize - 1, inputs - half);
+        }
+        NTTStageDIT(data, 2 * half, half, &InvTwiddles[half]);
+        return;
+    }
+
+    if (logSize == 1)
+    {
+        const uint64_t a = data[0], b = data[1];
+        data[0] = Add(a, b);
+        data[1] = Subtract(a, b);
+        return;
+    }
+
+    // Fused radix-4 pass for the first two stages
+    const uint64_t w4inv = InvTwiddles[3];
+    for (unsigned i = 0; i < inputs; i += 4)
+    {
+        uint64_t* x = data + i;
+
+        // Stage with half = 1: Twiddle is 1
+        const uint64_t b0 = Add(x[0], x[1]);
+        const uint64_t b1 = Subtract(x[0], x[1]);
+        const uint64_t b2 = Add(x[2], x[3]);
+        const uint64_t b3 = Multiply(Subtract(x[2], x[3]), w4inv);
+
+        // Stage with half = 2: Twiddles are 1 and w_4^-1
+        x[0] = Add(b0, b2);
+        x[1] = Add(b1, b3);
+        x[2] = Subtract(b0, b2);
+        x[3] = Subtract(b1, b3);
+    }
+
+    // Blocks past the inputs are still zero
+    for (unsigned log = 3; log <= logSize; ++log)
+    {
+        const unsigned half = 1u << (log - 1);
+        NTTStageDIT(data, RoundUpPow2(inputs, 2 * half), half, &InvTwiddles[half]);
+    }
+}
+
+void NTT::Forward(uint64_t* data, unsigned outputs) const
+{
+    if (LogN > 0) {
+        ForwardBlock(data, LogN, outputs);
+    }
+}
+
+void NTT::Inverse(uint64_t* data, unsigned inputs, const uint64_t* scale) const
+{
+    if (LogN > 0) {
+        InverseBlock(data, LogN, inputs);
+    }
+
+    if (scale)
+    {
+        for (unsigned i = 0; i < N; ++i) {
+            data[i] = Multiply(data[i], scale[i]);
+        }
+    }
+    else if (LogN > 0)
+    {
+        for (unsigned i = 0; i < N; ++i) {
+            data[i] = Multiply(data[i], InvN);
+        }
+    }
+}
+
+void BitReversePermute(uint64_t* data, unsigned logN)
+{
+    const unsigned n = 1u << logN;
+    for (unsigned i = 0; i < n; ++i)
+    {
+        const unsigned j = BitReverse(i, logN);
+        if (i < j)
+        {
+            const uint64_t t = data[i];
+            data[i] = data[j];
+            data[j] = t;
+        }
+    }
+}
+
+
+} // namespace solinas64
@@ -0,0 +1,198 @@
+/*
+    Copyright (c) 2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of Solinas64 nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef CAT_SOLINAS64_NTT_H
+#define CAT_SOLINAS64_NTT_H
+
+/** \page NTT
+    Number-theoretic transforms over p = 2^64-2^32+1
+
+    The multiplicative group has order p - 1 = 2^32 * 3 * 5 * 17 * 257 * 65537,
+    so there are roots of unity of every power-of-two order up to 2^32, and
+    power-of-two transforms of those sizes.  The NTT class runs them in
+    O(n log n) with the vectorized butterfly stages from solinas64.h.
+
+    The roots are chosen so that the 64th root of unity is 8.  So each
+    2^k-th root for k <= 6 is a power of two: The 4th root is 2^48 and the
+    2nd root is 2^96 = -1 (mod p).
+*/
+
+#include "solinas64.h"
+
+#include <vector>
+
+namespace solinas64 {
+
+
+//------------------------------------------------------------------------------
+// Roots of Unity
+
+/// Generator of the multiplicative group modulo p
+static const uint64_t kGenerator = 7;
+
+/// Primitive 2^32-th root of unity: kGenerator^((p - 1) / 2^32 * 13^-1),
+/// where 13^-1 is the inverse of 13 modulo 2^32.  The exponent is chosen so
+/// that kRootOfUnity^(2^26) = 8.
+static const uint64_t kRootOfUnity = 0x52fdef00f25aed07ULL;
+
+/// Largest transform size supported by NTT is 2^kMaxNTTLogSize words
+static const unsigned kMaxNTTLogSize = 30;
+
+/// Returns the primitive 2^logN-th root of unity kRootOfUnity^(2^(32-logN))
+/// for 0 <= logN <= 32.  The result is fully reduced.
+uint64_t GetRootOfUnity(unsigned logN);
+
+
+//------------------------------------------------------------------------------
+// NTT
+
+/**
+    NTT
+
+    Number-theoretic transform of 2^logN words, in place:
+
+        Forward(): X[k] = sum(x[j] * w^(j*k)), for j = 0..n-1
+        Inverse(): x[j] = n^-1 * sum(X[k] * w^-(j*k)), for k = 0..n-1
+
+    where w = GetRootOfUnity(logN).
+
+    Forward() takes the words in natural order and produces X[] in
+    bit-reversed order: data[i] = X[BitReverse(i)].  Inverse() takes this
+    bit-reversed order and produces natural order, so no permutation is
+    needed to go back and forth.  For example, a cyclic convolution is
+    Forward() on both inputs, a pointwise Multiply(), and Inverse().
+    BitReversePermute() converts between the orders if needed.
+
+    The input words can be any 64-bit values, and the outputs are not fully
+    reduced: Call Finalize() for the unique values.
+
+    The transforms are recursive: The first stage runs over all the words,
+    and then each half is transformed separately, until the blocks are
+    small enough to stay in cache for all of their remaining stages.  The
+    last two stages are fused into one radix-4 pass, whose only twiddle
+    factor besides 1 is the 4th root of unity.
+
+    Call Initialize() to precompute the twiddle factors, which are 16 bytes
+    per word of transform size.  Forward() and Inverse() may then be
+    called from multiple threads at once.
+*/
+class NTT
+{
+public:
+    /// Prepare the twiddle factors for transforms of 2^logN words.
+    /// Returns false if logN > kMaxNTTLogSize.
+    bool Initialize(unsigned logN);
+
+    /// Returns the number of words in each transform
+    unsigned GetSize() const
+    {
+        return N;
+    }
+
+    /// Returns log2 of the number of words in each transform
+    unsigned GetLogSize() const
+    {
+        return LogN;
+    }
+
+    /// Forward transform: Natural order in, bit-reversed order out
+    /// Precondition: Initialize() succeeded, data has GetSize() words
+    void Forward(uint64_t* data) const
+    {
+        Forward(data, N);
+    }
+
+    /// Forward transform that only produces the first `outputs` words of
+    /// the bit-reversed output, skipping the butterflies that only feed the
+    /// rest.  The words past `outputs` are left with intermediate values.
+    /// Precondition: 0 < outputs <= GetSize()
+    void Forward(uint64_t* data, unsigned outputs) const;
+
+    /// Inverse transform: Bit-reversed order in, natural order out
+    /// Precondition: Initialize() succeeded, data has GetSize() words
+    void Inverse(uint64_t* data) const
+    {
+        Inverse(data, N, nullptr);
+    }
+
+    /// Inverse transform of an input that is zero past the first `inputs`
+    /// words, skipping the butterflies on the zero blocks.
+    ///
+    /// If scale is not null, output word i is multiplied by scale[i] in
+    /// place of n^-1, which folds a pointwise product into the transform.
+    /// GetInverseScale() times the factor gives the scale[i] to use.
+    ///
+    /// Precondition: 0 < inputs <= GetSize(), data[inputs..] are all zero
+    void Inverse(uint64_t* data, unsigned inputs, const uint64_t* scale = nullptr) const;
+
+    /// Returns n^-1, the scale of each output word of Inverse()
+    uint64_t GetInverseScale() const
+    {
+        return InvN;
+    }
+
+protected:
+    /// Transform size
+    unsigned LogN = 0;
+    unsigned N = 1;
+
+    /// n^-1 for Inverse()
+    uint64_t InvN = 1;
+
+    /// Twiddles[h + j] = w_2h^j for the stage with half = h, j < h,
+    /// where w_2h is the primitive 2h-th root of unity
+    std::vector<uint64_t> Twiddles;
+
+    /// InvTwiddles[h + j] = w_2h^-j
+    std::vector<uint64_t> InvTwiddles;
+
+
+    /// Forward() on a block of 2^logSize words
+    void ForwardBlock(uint64_t* data, unsigned logSize, unsigned outputs) const;
+
+    /// Inverse() on a block of 2^logSize words, without the n^-1 scale
+    void InverseBlock(uint64_t* data, unsigned logSize, unsigned inputs) const;
+};
+
+/// Reverse the order of the low logN bits of i
+SOLINAS64_FORCE_INLINE unsigned BitReverse(unsigned i, unsigned logN)
+{
+    unsigned r = 0;
+    for (unsigned bit = 0; bit < logN; ++bit, i >>= 1) {
+        r = (r << 1) | (i & 1);
+    }
+    return r;
+}
+
+/// Permute 2^logN words between natural and bit-reversed order
+void BitReversePermute(uint64_t* data, unsigned logN);
+
+
+} // namespace solinas64
+
+#endif // CAT_SOLINAS64_NTT_H
@@ -0,0 +1,595 @@
+/*
+    Copyright (c) 2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of Solinas64 nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "solinas64_threads.h"
+
+#include <string.h>
+
+namespace solinas64 {
+
+
+//------------------------------------------------------------------------------
+// WorkerPool
+
+bool WorkerPool::Start(unsigned threadCount)
+{
+    Stop();
+
+    if (threadCount == 0) {
+        threadCount = std::thread::hardware_concurrency();
+    }
+
+    // The workers start out waiting for the first generation
+    Terminated = false;
+    Generation = 0;
+    NextTask = 0;
+
+    try
+    {
+        for (unsigned i = 1; i < threadCount; ++i) {
+            Threads.emplace_back(&WorkerPool::WorkerLoop, this);
+        }
+    }
+    catch (...)
+    {
+        Stop();
+        return false;
+    }
+
+    return true;
+}
+
+void WorkerPool::Stop()
+{
+    {
+        std::lock_guard<std::mutex> locker(Lock);
+        Terminated = true;
+    }
+    StartCondition.notify_all();
+
+    for (std::thread& thread : Threads) {
+        thread.join();
+    }
+    Threads.clear();
+}
+
+void WorkerPool::RunTasks()
+{
+    for (;;)
+    {
+        const unsigned i = NextTask++;
+        if (i >= TaskCount) {
+            break;
+        }
+        (*Task)(i);
+    }
+}
+
+void WorkerPool::WorkerLoop()
+{
+    uint64_t seenGeneration = 0;
+
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> locker(Lock);
+            StartCondition.wait(locker, [&] {
+                return Terminated || Generation != seenGeneration;
+            });
+            if (Terminated) {
+                return;
+            }
+            seenGeneration = Generation;
+        }
+
+        RunTasks();
+
+        {
+            std::lock_guard<std::mutex> locker(Lock);
+            --Busy;
+        }
+        DoneCondition.notify_one();
+    }
+}
+
+void WorkerPool::Run(unsigned taskCount, const std::function<void(unsigned)>& task)
+{
+    if (taskCount == 0) {
+        return;
+    }
+
+    // Small batches are not worth waking the workers up for
+    if (Threads.empty() || taskCount == 1)
+    {
+        for (unsigned i = 0; i < taskCount; ++i) {
+            task(i);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> locker(Lock);
+        Task = &task;
+        TaskCount = taskCount;
+        NextTask = 0;
+        Busy = static_cast<unsigned>(Threads.size());
+        ++Generation;
+    }
+    StartCondition.notify_all();
+
+    RunTasks();
+
+    std::unique_lock<std::mutex> locker(Lock);
+    DoneCondition.wait(locker, [&] {
+        return Busy == 0;
+    });
+    Task = nullptr;
+}
+
+
+//------------------------------------------------------------------------------
+// Extra Bit Splicing
+
+/*
+    Each stripe reader holds a bitstream packed 63 bits per word, and the
+    last word is partial.  The serial reader would have produced the
+    concatenation of these bitstreams, so the bit offset of each stripe is
+    the prefix sum of the bit counts of the stripes before it.
+*/
+
+// Writes one 63-bit word of the combined bitstream
+typedef std::function<void(unsigned wordIndex, uint64_t word)> ExtraWordSink;
+
+class ExtraBitSplicer
+{
+public:
+    explicit ExtraBitSplicer(const ExtraWordSink& sink)
+        : Sink(sink)
+    {
+    }
+
+    /// Append the extra bits from a stripe reader
+    void Append(const AppDataReader& reader)
+    {
+        const uintptr_t writtenWords = static_cast<uintptr_t>(reader.DataWritePtr - reader.Data) / 8;
+
+        for (uintptr_t i = 0; i < writtenWords; ++i) {
+            AppendBits(ReadU64_LE(reader.Data + i * 8), 63);
+        }
+
+        // The last word is still in the reader workspace
+        if (reader.Available > 0) {
+            AppendBits(reader.Workspace, reader.Available);
+        }
+    }
+
+    /// Write the final partial word.
+    /// Returns the number of words written overall.
+    unsigned Flush()
+    {
+        if (Available > 0)
+        {
+            Sink(WordCount++, Workspace);
+            Workspace = 0;
+            Available = 0;
+        }
+        return WordCount;
+    }
+
+protected:
+    const ExtraWordSink& Sink;
+    uint64_t Workspace = 0;
+    int Available = 0;
+    unsigned WordCount = 0;
+
+
+    // Precondition: 0 < count <= 63 and value < 2^count
+    void AppendBits(uint64_t value, int count)
+    {
+        Workspace |= value << Available;
+        Available += count;
+
+        if (Available >= 63)
+        {
+            Sink(WordCount++, Workspace & kHighBitMask);
+            Available -= 63;
+            Workspace = (Available > 0) ? (value >> (count - Available)) : 0;
+        }
+    }
+};
+
+
+//------------------------------------------------------------------------------
+// Parallel Bulk Operations
+
+namespace {
+
+// Stripe layout shared by the parallel operations
+struct StripePlan
+{
+    unsigned Count;
+    unsigned WorkspaceBytes;
+
+    explicit StripePlan(unsigned bytes)
+    {
+        Count = (bytes + kParallelStripeBytes - 1) / kParallelStripeBytes;
+        WorkspaceBytes = AppDataReader::GetWorkspaceBytes(kParallelStripeBytes);
+    }
+
+    unsigned GetOffset(unsigned stripe) const
+    {
+        return stripe * kParallelStripeBytes;
+    }
+
+    unsigned GetBytes(unsigned stripe, unsigned bytes) const
+    {
+        const unsigned remaining = bytes - GetOffset(stripe);
+        return remaining < kParallelStripeBytes ? remaining : kParallelStripeBytes;
+    }
+};
+
+} // namespace
+
+// Runs a single-input region operation over stripes, then splices the extra
+// bits and applies them to the output tail with the given word operation.
+template<class SliceT, class ExtraT>
+static unsigned ParallelRegion(
+    WorkerPool& pool,
+    const uint8_t* data,
+    unsigned bytes,
+    uint8_t* output,
+    SliceT slice,
+    ExtraT extra)
+{
+    const unsigned minimumOutputBytes = (bytes + 7) & ~7u;
+    const StripePlan plan(bytes);
+
+    std::vector<AppDataReader> readers(plan.Count);
+    std::vector<uint8_t> workspace(plan.Count * plan.WorkspaceBytes);
+
+    pool.Run(plan.Count, [&](unsigned stripe) {
+        AppDataReader& reader = readers[stripe];
+        reader.SetupWorkspace(&workspace[stripe * plan.WorkspaceBytes]);
+
+        const unsigned offset = plan.GetOffset(stripe);
+        slice(reader, data + offset, plan.GetBytes(stripe, bytes), output + offset);
+    });
+
+    uint8_t* tail = output + minimumOutputBytes;
+    const ExtraWordSink sink = [&](unsigned wordIndex, uint64_t word) {
+        extra(tail + wordIndex * 8, word);
+    };
+
+    ExtraBitSplicer splicer(sink);
+    for (unsigned stripe = 0; stripe < plan.Count; ++stripe) {
+        splicer.Append(readers[stripe]);
+    }
+
+    return minimumOutputBytes + splicer.Flush() * 8;
+}
+
+unsigned ParallelMultiplyRegion(
+    WorkerPool& pool,
+    const uint8_t* data,
+    unsigned bytes,
+    uint64_t coeff,
+    uint8_t* output)
+{
+    // The special cases and small regions go to the serial version
+    if (coeff == 0 || pool.GetThreadCount() <= 1 || bytes <= kParallelStripeBytes)
+    {
+        std::vector<uint8_t> workspace(AppDataReader::GetWorkspaceBytes(bytes));
+        return MultiplyRegion(data, bytes, coeff, workspace.data(), output);
+    }
+
+    return ParallelRegion(pool, data, bytes, output,
+        [coeff](AppDataReader& reader, const uint8_t* stripeData, unsigned stripeBytes, uint8_t* stripeOutput) {
+            MultiplyRegionSlice(reader, stripeData, stripeBytes, coeff, stripeOutput);
+        },
+        [coeff](uint8_t* out, uint64_t word) {
+            WriteU64_LE(out, Multiply(coeff, word));
+        });
+}
+
+unsigned ParallelMultiplyAddRegion(
+    WorkerPool& pool,
+    const uint8_t* data,
+    unsigned bytes,
+    uint64_t coeff,
+    uint8_t* output)
+{
+    // The special cases and small regions go to the serial version
+    if (coeff == 0 || pool.GetThreadCount() <= 1 || bytes <= kParallelStripeBytes)
+    {
+        std::vector<uint8_t> workspace(AppDataReader::GetWorkspaceBytes(bytes));
+        return MultiplyAddRegion(data, bytes, coeff, workspace.data(), output);
+    }
+
+    return ParallelRegion(pool, data, bytes, output,
+        [coeff](AppDataReader& reader, const uint8_t* stripeData, unsigned stripeBytes, uint8_t* stripeOutput) {
+            MultiplyAddRegionSlice(reader, stripeData, stripeBytes, coeff, stripeOutput);
+        },
+        [coeff](uint8_t* out, uint64_t word) {
+            WriteU64_LE(out, Add(Multiply(coeff, word), ReadU64_LE(out)));
+        });
+}
+
+unsigned ParallelEncodeRow(
+    WorkerPool& pool,
+    const uint8_t* const* originals,
+    unsigned N,
+    unsigned bytes,
+    const uint64_t* coeffs,
+    uint8_t* recovery)
+{
+    // Small regions go to the serial version
+    if (pool.GetThreadCount() <= 1 || bytes <= kParallelStripeBytes)
+    {
+        std::vector<uint8_t> workspace(GetEncodeRowWorkspaceBytes(bytes));
+        return EncodeRow(originals, N, bytes, coeffs, workspace.data(), recovery);
+    }
+
+    const unsigned minimumOutputBytes = (bytes + 7) & ~7u;
+    const StripePlan plan(bytes);
+
+    // One reader per (stripe, original)
+    std::vector<AppDataReader> readers(plan.Count * N);
+    std::vector<uint8_t> workspace(readers.size() * plan.WorkspaceBytes);
+    for (size_t i = 0; i < readers.size(); ++i) {
+        readers[i].SetupWorkspace(&workspace[i * plan.WorkspaceBytes]);
+    }
+
+    pool.Run(plan.Count, [&](unsigned stripe) {
+        const unsigned offset = plan.GetOffset(stripe);
+
+        std::vector<const uint8_t*> stripeData(N);
+        for (unsigned i = 0; i < N; ++i) {
+            stripeData[i] = originals[i] + offset;
+        }
+
+        EncodeRowSlice(
+            &readers[stripe * N],
+            stripeData.data(),
+            N,
+            plan.GetBytes(stripe, bytes),
+            coeffs,
+            recovery + offset);
+    });
+
+    // Overflow words are accumulated into the tail, so start it at zero
+    uint8_t* tail = recovery + minimumOutputBytes;
+    memset(tail, 0, AppDataReader::GetWorkspaceBytes(bytes));
+
+    // Apply the overflow words in the same order as EncodeRow()
+    unsigned extraWords = 0;
+    for (unsigned i = 0; i < N; ++i)
+    {
+        const uint64_t coeff = coeffs[i];
+        const ExtraWordSink sink = [&](unsigned wordIndex, uint64_t word) {
+            uint8_t* out = tail + wordIndex * 8;
+            WriteU64_LE(out, Add(Multiply(coeff, word), ReadU64_LE(out)));
+        };
+
+        ExtraBitSplicer splicer(sink);
+        for (unsigned stripe = 0; stripe < plan.Count; ++stripe) {
+            splicer.Append(readers[stripe * N + i]);
+        }
+
+        const unsigned words = splicer.Flush();
+        if (extraWords < words) {
+            extraWords = words;
+        }
+    }
+
+    return minimumOutputBytes + extraWords * 8;
+}
+
+
+//------------------------------------------------------------------------------
+// Encoder Pipeline
+
+bool EncoderPipeline::Start(unsigned maxN, unsigned maxBytes, unsigned threadCount)
+{
+    Stop();
+
+    if (threadCount == 0) {
+        threadCount = std::thread::hardware_concurrency();
+    }
+    if (threadCount == 0) {
+        threadCount = 1;
+    }
+
+    MaxN = maxN;
+    MaxBytes = maxBytes;
+    Terminated = false;
+    Outstanding = 0;
+    NextQueue = 0;
+    Queued = 0;
+
+    try
+    {
+        // Allocate all the contexts before any thread can steal from them
+        for (unsigned i = 0; i < threadCount; ++i)
+        {
+            std::unique_ptr<Worker> worker(new Worker);
+            if (!worker->Context.Initialize(maxN, maxBytes, 0)) {
+                Workers.clear();
+                return false;
+            }
+            Workers.push_back(std::move(worker));
+        }
+
+        for (unsigned i = 0; i < threadCount; ++i) {
+            Workers[i]->Thread = std::thread(&EncoderPipeline::WorkerLoop, this, i);
+        }
+    }
+    catch (...)
+    {
+        Stop();
+        return false;
+    }
+
+    return true;
+}
+
+void EncoderPipeline::Stop()
+{
+    {
+        std::lock_guard<std::mutex> locker(Lock);
+        Terminated = true;
+    }
+    WorkCondition.notify_all();
+
+    for (std::unique_ptr<Worker>& worker : Workers) {
+        if (worker->Thread.joinable()) {
+            worker->Thread.join();
+        }
+    }
+    Workers.clear();
+}
+
+bool EncoderPipeline::Submit(const EncodeJob& job)
+{
+    if (Workers.empty() ||
+        !job.Originals || !job.Recovery ||
+        job.N == 0 || job.N > MaxN ||
+        job.Bytes == 0 || job.Bytes > MaxBytes)
+    {
+        return false;
+    }
+
+    // Count the job as outstanding before a worker can take it, or else a
+    // worker could finish it first and let Wait() return while older jobs
+    // are running
+    {
+        std::lock_guard<std::mutex> locker(Lock);
+        ++Outstanding;
+    }
+
+    Worker& worker = *Workers[NextQueue++ % Workers.size()];
+    {
+        std::lock_guard<std::mutex> locker(worker.QueueLock);
+        worker.Queue.push_back(job);
+    }
+
+    // Only count it as queued once it can be taken, so that a worker woken
+    // by the count always finds a job rather than spinning until the push
+    {
+        std::lock_guard<std::mutex> locker(Lock);
+        ++Queued;
+    }
+    WorkCondition.notify_one();
+
+    return true;
+}
+
+void EncoderPipeline::Wait()
+{
+    std::unique_lock<std::mutex> locker(Lock);
+    DoneCondition.wait(locker, [&] {
+        return Outstanding == 0;
+    });
+}
+
+bool EncoderPipeline::TakeJob(unsigned self, EncodeJob& job)
+{
+    const unsigned count = static_cast<unsigned>(Workers.size());
+
+    // Own queue first, oldest job first
+    {
+        Worker& worker = *Workers[self];
+        std::lock_guard<std::mutex> locker(worker.QueueLock);
+        if (!worker.Queue.empty())
+        {
+            job = std::move(worker.Queue.front());
+            worker.Queue.pop_front();
+
+            // Lock is always taken after a QueueLock, never before
+            std::lock_guard<std::mutex> countLocker(Lock);
+            --Queued;
+            return true;
+        }
+    }
+
+    // Steal the newest job from another queue, to stay clear of its owner
+    for (unsigned i = 1; i < count; ++i)
+    {
+        Worker& victim = *Workers[(self + i) % count];
+        std::lock_guard<std::mutex> locker(victim.QueueLock);
+        if (!victim.Queue.empty())
+        {
+            job = std::move(victim.Queue.back());
+            victim.Queue.pop_back();
+
+            std::lock_guard<std::mutex> countLocker(Lock);
+            --Queued;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void EncoderPipeline::WorkerLoop(unsigned self)
+{
+    EncoderContext& context = Workers[self]->Context;
+
+    for (;;)
+    {
+        EncodeJob job;
+
+        if (!TakeJob(self, job))
+        {
+            std::unique_lock<std::mutex> locker(Lock);
+            WorkCondition.wait(locker, [&] {
+                return Terminated || Queued > 0;
+            });
+            if (Terminated && Queued <= 0) {
+                return;
+            }
+            continue;
+        }
+
+        job.RecoveryBytes = context.Encode(job.Originals, job.N, job.Bytes, job.Seed, job.Recovery);
+
+        if (job.OnComplete) {
+            job.OnComplete(job);
+        }
+
+        bool done;
+        {
+            std::lock_guard<std::mutex> locker(Lock);
+            done = (--Outstanding == 0);
+        }
+        if (done) {
+            DoneCondition.notify_all();
+        }
+    }
+}
+
+} // namespace solinas64
@@ -0,0 +1,303 @@
+/*
+    Copyright (c) 2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of Solinas64 nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef CAT_SOLINAS64_THREADS_H
+#define CAT_SOLINAS64_THREADS_H
+
+/** \page Threads
+    Multithreaded versions of the Solinas64 bulk operations
+
+    Large regions are split into stripes that are processed in parallel on
+    a WorkerPool.  The results are the same bytes as the serial versions.
+    Many independent blocks are better run one per thread on an
+    EncoderPipeline, which needs no splicing.
+
+    The AppDataReader extra bits form one sequential bitstream over the
+    whole region, so each stripe collects its own extra bits, and then the
+    bit offset of each stripe is the prefix sum of the bit counts of the
+    stripes before it.  The stripe bitstreams are spliced together at these
+    offsets to produce the same overflow words as the serial versions.
+*/
+
+#include "solinas64.h"
+#include "solinas64_codec.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace solinas64 {
+
+
+//------------------------------------------------------------------------------
+// WorkerPool
+
+/**
+    WorkerPool
+
+    A fixed set of worker threads that run batches of tasks.
+
+    Call Start() to launch the threads.
+    Call Run() to run a batch of tasks and wait for them to complete.
+    The calling thread also runs tasks, so a pool with one thread runs the
+    batch on the calling thread.
+*/
+class WorkerPool
+{
+public:
+    ~WorkerPool()
+    {
+        Stop();
+    }
+
+    /// Start the given number of threads, including the calling thread.
+    /// Pass 0 to use the number of hardware threads.
+    /// Returns false if the threads could not be started.
+    bool Start(unsigned threadCount = 0);
+
+    /// Stop all the worker threads
+    void Stop();
+
+    /// Returns the number of threads that run tasks, including the caller
+    unsigned GetThreadCount() const
+    {
+        return static_cast<unsigned>(Threads.size()) + 1;
+    }
+
+    /// Run task(i) for i = 0..taskCount-1 and wait for all of them to finish.
+    /// Run() must not be called from inside a task.
+    void Run(unsigned taskCount, const std::function<void(unsigned)>& task);
+
+protected:
+    std::vector<std::thread> Threads;
+
+    std::mutex Lock;
+    std::condition_variable StartCondition;
+    std::condition_variable DoneCondition;
+
+    /// Incremented for each batch of tasks
+    uint64_t Generation = 0;
+    bool Terminated = false;
+
+    /// Current batch
+    const std::function<void(unsigned)>* Task = nullptr;
+    unsigned TaskCount = 0;
+    std::atomic<unsigned> NextTask{0};
+
+    /// Number of workers still working on the current batch
+    unsigned Busy = 0;
+
+
+    void WorkerLoop();
+    void RunTasks();
+};
+
+
+//------------------------------------------------------------------------------
+// Parallel Bulk Operations
+
+/// Bytes of each input packet that one task processes
+static const unsigned kParallelStripeBytes = 64 * 1024;
+
+/**
+    ParallelMultiplyRegion()
+
+    Produces the same bytes as MultiplyRegion(), using the worker pool.
+    The workspace is allocated internally.
+
+    Returns the number of bytes written.
+*/
+unsigned ParallelMultiplyRegion(
+    WorkerPool& pool,       ///< Worker pool to run the stripes on
+    const uint8_t* data,    ///< Input data
+    unsigned bytes,         ///< Number of input data bytes
+    uint64_t coeff,         ///< Coefficient to multiply the data by
+    uint8_t* output);       ///< Size calculated by AppDataReader::GetMaxOutputBytes()
+
+/**
+    ParallelMultiplyAddRegion()
+
+    Produces the same bytes as MultiplyAddRegion(), using the worker pool.
+    The workspace is allocated internally.
+
+    Returns the number of bytes written.
+*/
+unsigned ParallelMultiplyAddRegion(
+    WorkerPool& pool,       ///< Worker pool to run the stripes on
+    const uint8_t* data,    ///< Input data
+    unsigned bytes,         ///< Number of input data bytes
+    uint64_t coeff,         ///< Coefficient to multiply the data by
+    uint8_t* output);       ///< Size calculated by AppDataReader::GetMaxOutputBytes()
+
+/**
+    ParallelEncodeRow()
+
+    Produces the same bytes as EncodeRow(), using the worker pool.
+    The workspace is allocated internally.
+
+    Returns the number of bytes in the recovery data.
+*/
+unsigned ParallelEncodeRow(
+    WorkerPool& pool,       ///< Worker pool to run the stripes on
+    const uint8_t* const* originals, ///< N input packets of `bytes` each
+    unsigned N,             ///< Number of input packets
+    unsigned bytes,         ///< Number of bytes in each input packet
+    const uint64_t* coeffs, ///< N coefficients, one per input packet
+    uint8_t* recovery);     ///< Size calculated by AppDataReader::GetMaxOutputBytes()
+
+
+//------------------------------------------------------------------------------
+// Encoder Pipeline
+
+/**
+    EncodeJob
+
+    One recovery packet to produce with EncodeRecovery() on an
+    EncoderPipeline.  The originals and recovery buffer must stay valid
+    until the job completes.
+*/
+struct EncodeJob
+{
+    const uint8_t* const* Originals = nullptr; ///< N original packets
+    unsigned N = 0;                 ///< Number of original packets
+    unsigned Bytes = 0;             ///< Bytes in each original packet
+    uint64_t Seed = 0;              ///< Generator matrix row seed
+
+    /// Output recovery packet of AppDataReader::GetMaxOutputBytes(Bytes).
+    /// Align it to kEncoderContextAlignment so that no cache line is shared
+    /// with the recovery buffer of a job running on another thread
+    uint8_t* Recovery = nullptr;
+
+    /// Output: Number of recovery bytes to send, set before OnComplete
+    unsigned RecoveryBytes = 0;
+
+    /// Optional: Called on the worker thread once the recovery is written.
+    /// It must not call Wait() or Stop()
+    std::function<void(const EncodeJob&)> OnComplete;
+};
+
+/**
+    EncoderPipeline
+
+    Encodes a stream of independent blocks on a pool of worker threads,
+    which suits many medium blocks (such as 64 KB x N=32) better than
+    splitting each block with ParallelEncodeRow().
+
+    Each worker has its own job queue and EncoderContext, so the workspaces
+    are never shared, and the per-worker state is padded to whole cache
+    lines.  Submit() deals the jobs out to the queues in turn.  A worker
+    takes jobs from the front of its own queue and, when that is empty,
+    steals from the back of the others, so a worker only waits when every
+    queue is empty.
+
+    Call Start() once, then Submit() jobs from one or more threads, and
+    Wait() for them to complete or rely on the OnComplete callbacks.
+*/
+class EncoderPipeline
+{
+public:
+    ~EncoderPipeline()
+    {
+        Stop();
+    }
+
+    /// Start the worker threads for blocks of up to maxN originals of up to
+    /// maxBytes each.  Pass 0 threads to use the number of hardware threads.
+    /// Returns false if the parameters are invalid or the threads could not
+    /// be started.
+    bool Start(unsigned maxN, unsigned maxBytes, unsigned threadCount = 0);
+
+    /// Finish all the submitted jobs and stop the worker threads
+    void Stop();
+
+    /// Returns the number of worker threads
+    unsigned GetThreadCount() const
+    {
+        return static_cast<unsigned>(Workers.size());
+    }
+
+    /// Queue a job for encoding.
+    /// Returns false if the pipeline is not started or the job is invalid
+    /// or larger than the shape passed to Start()
+    bool Submit(const EncodeJob& job);
+
+    /// Wait for all the submitted jobs to complete
+    void Wait();
+
+protected:
+    struct Worker
+    {
+        /// Keeps the queue lock off the cache line of the previous allocation
+        uint8_t FrontPadding[kEncoderContextAlignment];
+
+        std::mutex QueueLock;
+        std::deque<EncodeJob> Queue;
+
+        /// Workspace and coefficients for this worker only
+        EncoderContext Context;
+
+        std::thread Thread;
+
+        uint8_t BackPadding[kEncoderContextAlignment];
+    };
+
+    std::vector<std::unique_ptr<Worker>> Workers;
+
+    unsigned MaxN = 0;
+    unsigned MaxBytes = 0;
+
+    /// Queue for the next Submit()
+    std::atomic<unsigned> NextQueue{0};
+
+    std::mutex Lock;
+    std::condition_variable WorkCondition;
+    std::condition_variable DoneCondition;
+
+    /// Jobs in the queues, guarded by Lock.  Incremented after the job is
+    /// queued and decremented as it is taken, so while it is above zero
+    /// there is a job to take.  It may go below zero for a moment if a job
+    /// is taken before Submit() counts it
+    int Queued = 0;
+
+    /// Jobs submitted and not yet completed, guarded by Lock
+    unsigned Outstanding = 0;
+    bool Terminated = false;
+
+
+    void WorkerLoop(unsigned self);
+    bool TakeJob(unsigned self, EncodeJob& job);
+};
+
+} // namespace solinas64
+
+#endif // CAT_SOLINAS64_THREADS_H
@@ -27,6 +27,8 @@
 */
 
 #include "../solinas64.h"
+#include "../solinas64_codec.h"
+#include "../solinas64_threads.h"
 #include "gf256.h"
 
 #define SOLINAS64_ENABLE_GF256_COMPARE
@@ -36,11 +38,41 @@
 
     The goal of the benchmarks is to determine how fast Solinas prime field
     arithmetic is for the purpose of implementing erasure codes in software.
+
+    There are five groups of benchmarks, with names starting with:
+
+    + Prim: Multiply, Inverse, InverseCT and AppDataReader::ReadNext8Bytes
+    + Region: Bulk operations on one packet, from 64 bytes up to 16 MB
+    + Encode: One recovery packet from N originals, compared with GF(2^8)
+    + Update: UpdateRecovery() for 4 recovery packets of 64 KB x N=32,
+      compared with encoding them again
+    + Pipeline: Many 64 KB x N=32 blocks on an EncoderPipeline
+
+    Each benchmark is warmed up and then sampled many times.  A sample times
+    enough calls back to back to take a few microseconds, so that the clock
+    overhead does not count, and the p50 and p99 times per call are over the
+    samples.  Ticks come from the cycle counter (rdtsc on x86, cntvct_el0 on
+    AArch64) where there is one.  On x86 the TSC runs at a constant rate, so
+    it matches the core clock only without frequency scaling.
+
+    The inputs have a configurable percentage of ambiguous words, which take
+    the slow path in AppDataReader.
+
+    Usage: benchmarks [options]
+        --json          Print only the results, as one JSON object
+        --quick         Fewer samples and sizes, as a smoke test for CI
+        --ambiguous=P   Percent of input words that are ambiguous (default 4)
+        --max-bytes=B   Largest region size in bytes (default 16777216)
+        --filter=NAME   Only run the benchmarks whose name contains NAME
 */
 
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
 #include <iostream>
 #include <iomanip>
 #include <sstream>
+#include <string>
 #include <vector>
 using namespace std;
 
@@ -50,68 +82,324 @@ using namespace std;
         #define NOMINMAX
     #endif
     #include <windows.h>
+    #include <intrin.h>
 #elif __MACH__
     #include <mach/mach_time.h>
-    #include <mach/mach.h>
-    #include <mach/clock.h>
-
-    extern mach_port_t clock_port;
 #else
     #include <time.h>
-    #include <sys/time.h>
+#endif
+
+#if !defined(_WIN32) && (defined(__x86_64__) || defined(__i386__))
+    #include <x86intrin.h>
 #endif
 
 
 //------------------------------------------------------------------------------
 // Timing
 
+/// Returns a monotonic time in nanoseconds
+static uint64_t GetTimeNsec()
+{
 #ifdef _WIN32
-// Precomputed frequency inverse
-static double PerfFrequencyInverseUsec = 0.;
-static double PerfFrequencyInverseMsec = 0.;
+    static double nsecPerCount = 0.;
+    if (nsecPerCount == 0.)
+    {
+        LARGE_INTEGER freq = {};
+        if (!::QueryPerformanceFrequency(&freq) || freq.QuadPart == 0) {
+            return 0;
+        }
+        nsecPerCount = 1000000000. / (double)freq.QuadPart;
+    }
+    LARGE_INTEGER timeStamp = {};
+    if (!::QueryPerformanceCounter(&timeStamp)) {
+        return 0;
+    }
+    return (uint64_t)(nsecPerCount * timeStamp.QuadPart);
+#elif __MACH__
+    static mach_timebase_info_data_t timebase;
+    if (timebase.denom == 0) {
+        mach_timebase_info(&timebase);
+    }
+    return mach_absolute_time() * timebase.numer / timebase.denom;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
 
-static void InitPerfFrequencyInverse()
+/// Returns the cycle counter, or 0 where there is none
+static uint64_t GetTicks()
 {
-    LARGE_INTEGER freq = {};
-    if (!::QueryPerformanceFrequency(&freq) || freq.QuadPart == 0)
-        return;
-    const double invFreq = 1. / (double)freq.QuadPart;
-    PerfFrequencyInverseUsec = 1000000. * invFreq;
-    PerfFrequencyInverseMsec = 1000. * invFreq;
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    return 0;
+#endif
 }
-#elif __MACH__
-static bool m_clock_serv_init = false;
-static clock_serv_t m_clock_serv = 0;
 
-static void InitClockServ()
+
+//------------------------------------------------------------------------------
+// Options
+
+struct Options
+{
+    bool Json = false;
+    bool Quick = false;
+    unsigned AmbiguousPercent = 4;
+    uint64_t MaxBytes = 16 * 1024 * 1024;
+    std::string Filter;
+};
+
+static Options Opts;
+
+static bool ParseOptions(int argc, char** argv)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        const size_t eq = arg.find('=');
+        const std::string key = arg.substr(0, eq);
+        const std::string value = (eq == std::string::npos) ? "" : arg.substr(eq + 1);
+
+        if (key == "--json") {
+            Opts.Json = true;
+        }
+        else if (key == "--quick") {
+            Opts.Quick = true;
+        }
+        else if (key == "--ambiguous" && !value.empty()) {
+            Opts.AmbiguousPercent = (unsigned)strtoul(value.c_str(), nullptr, 10);
+            if (Opts.AmbiguousPercent > 100) {
+                return false;
+            }
+        }
+        else if (key == "--max-bytes" && !value.empty()) {
+            Opts.MaxBytes = strtoull(value.c_str(), nullptr, 10);
+            if (Opts.MaxBytes < 64 || Opts.MaxBytes > (1u << 28)) {
+                return false;
+            }
+        }
+        else if (key == "--filter" && !value.empty()) {
+            Opts.Filter = value;
+        }
+        else {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// Fill data with random words, with AmbiguousPercent of them ambiguous
+static void FillData(solinas64::Random& prng, uint8_t* data, uint64_t bytes)
 {
-    m_clock_serv_init = true;
-    host_get_clock_service(mach_host_self(), SYSTEM_CLOCK, &m_clock_serv);
+    for (uint64_t i = 0; i < bytes; i += 8)
+    {
+        uint64_t w = prng.Next();
+        if (prng.Next() % 100 < Opts.AmbiguousPercent)
+        {
+            // Half of them are all ones, as in padding
+            w = (w & 1) ? ~(uint64_t)0 : (w | solinas64::kAmbiguityMask);
+        }
+
+        uint8_t word[8];
+        solinas64::WriteU64_LE(word, w);
+        memcpy(data + i, word, bytes - i < 8 ? (size_t)(bytes - i) : 8);
+    }
 }
-#endif // _WIN32
 
-uint64_t GetTimeUsec()
+/// Keeps the compiler from dropping the benchmarked work
+static volatile uint64_t Sink = 0;
+
+
+//------------------------------------------------------------------------------
+// Measurement
+
+/// Each sample runs for at least this long
+static const uint64_t kMinSampleNsec = 5000;
+
+struct Result
 {
-#ifdef _WIN32
-    LARGE_INTEGER timeStamp = {};
-    if (!::QueryPerformanceCounter(&timeStamp))
-        return 0;
-    if (PerfFrequencyInverseUsec == 0.)
-        InitPerfFrequencyInverse();
-    return (uint64_t)(PerfFrequencyInverseUsec * timeStamp.QuadPart);
-#elif __MACH__
-    if (!m_clock_serv_init)
-        InitClockServ();
+    std::string Name;
+    uint64_t Bytes;         ///< Bytes in each input packet, or 0
+    unsigned N;             ///< Number of input packets per call
+    unsigned Ops;           ///< Operations per call
+    unsigned Samples;
+    double P50Nsec, P99Nsec, MeanNsec;
+    double P50Ticks;
+    uint64_t OutputBytes;   ///< Recovery bytes for the encoders, or 0
+};
 
-    mach_timespec_t tv;
-    clock_get_time(m_clock_serv, &tv);
+static std::vector<Result> Results;
 
-    return 1000000 * tv.tv_sec + tv.tv_nsec / 1000;
-#else
-    struct timeval tv;
-    gettimeofday(&tv, nullptr);
-    return 1000000 * tv.tv_sec + tv.tv_usec;
-#endif
+static bool IsSelected(const std::string& name)
+{
+    return Opts.Filter.empty() || name.find(Opts.Filter) != std::string::npos;
+}
+
+/// Returns the value at fraction q of the sorted values
+static double Percentile(const std::vector<double>& sorted, double q)
+{
+    const size_t index = (size_t)(q * (double)(sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+static void PrintResult(const Result& r)
+{
+    cout << left << setw(34) << r.Name << right;
+    if (r.Bytes > 0) {
+        cout << " bytes=" << setw(8) << r.Bytes;
+    }
+    if (r.N > 1) {
+        cout << " N=" << setw(3) << r.N;
+    }
+    cout << fixed << setprecision(1);
+    if (r.Ops > 1) {
+        cout << " ns/op=" << setw(7) << r.P50Nsec / r.Ops;
+    }
+    cout << " p50=" << setw(11) << r.P50Nsec << " ns";
+    cout << " p99=" << setw(11) << r.P99Nsec << " ns";
+    if (r.P50Ticks > 0.) {
+        cout << " ticks=" << setw(11) << r.P50Ticks;
+    }
+    if (r.Bytes > 0) {
+        cout << " MB/s=" << setw(7) << (uint64_t)(r.Bytes * r.N * 1000. / r.P50Nsec);
+    }
+    if (r.OutputBytes > 0) {
+        cout << " out=" << r.OutputBytes;
+    }
+    cout << defaultfloat << endl;
+}
+
+/**
+    Measure()
+
+    Times fn(), which does `ops` operations on N packets of `bytes` each,
+    and adds the result to Results.
+*/
+template<typename F>
+static void Measure(
+    const std::string& name,
+    uint64_t bytes,
+    unsigned N,
+    unsigned ops,
+    F fn,
+    uint64_t outputBytes = 0)
+{
+    if (!IsSelected(name)) {
+        return;
+    }
+
+    const unsigned maxSamples = Opts.Quick ? 30 : 300;
+    const unsigned minSamples = Opts.Quick ? 5 : 20;
+    const uint64_t budgetNsec = Opts.Quick ? 100000000 : 1000000000;
+
+    // Warm up the caches and branch predictors, and calibrate
+    fn();
+    uint64_t t0 = GetTimeNsec();
+    fn();
+    const uint64_t callNsec = GetTimeNsec() - t0 + 1;
+    const unsigned reps = callNsec >= kMinSampleNsec ? 1 : (unsigned)(kMinSampleNsec / callNsec + 1);
+
+    for (unsigned i = 0; i < 3 * reps && i < 1000000; ++i) {
+        fn();
+    }
+
+    std::vector<double> nsec, ticks;
+    nsec.reserve(maxSamples);
+    ticks.reserve(maxSamples);
+
+    const uint64_t start = GetTimeNsec();
+    while (nsec.size() < maxSamples)
+    {
+        const uint64_t k0 = GetTicks();
+        t0 = GetTimeNsec();
+
+        for (unsigned i = 0; i < reps; ++i) {
+            fn();
+        }
+
+        const uint64_t t1 = GetTimeNsec();
+        const uint64_t k1 = GetTicks();
+
+        nsec.push_back((t1 - t0) / (double)reps);
+        ticks.push_back((k1 - k0) / (double)reps);
+
+        if (nsec.size() >= minSamples && t1 - start > budgetNsec) {
+            break;
+        }
+    }
+
+    Result r;
+    r.Name = name;
+    r.Bytes = bytes;
+    r.N = N;
+    r.Ops = ops;
+    r.Samples = (unsigned)nsec.size();
+    r.OutputBytes = outputBytes;
+
+    double sum = 0.;
+    for (double x : nsec) {
+        sum += x;
+    }
+    r.MeanNsec = sum / nsec.size();
+
+    std::sort(nsec.begin(), nsec.end());
+    std::sort(ticks.begin(), ticks.end());
+    r.P50Nsec = Percentile(nsec, 0.5);
+    r.P99Nsec = Percentile(nsec, 0.99);
+    r.P50Ticks = Percentile(ticks, 0.5);
+
+    Results.push_back(r);
+
+    if (!Opts.Json) {
+        PrintResult(r);
+    }
+}
+
+static const char* GetBackendName()
+{
+    switch (solinas64::GetSimdBackend())
+    {
+    case solinas64::SimdBackend::AVX2: return "AVX2";
+    case solinas64::SimdBackend::AVX512: return "AVX-512";
+    default: break;
+    }
+    return "Scalar";
+}
+
+static void PrintJson()
+{
+    cout << "{" << endl;
+    cout << "  \"backend\": \"" << GetBackendName() << "\"," << endl;
+    cout << "  \"ambiguous_percent\": " << Opts.AmbiguousPercent << "," << endl;
+    cout << "  \"quick\": " << (Opts.Quick ? "true" : "false") << "," << endl;
+    cout << "  \"results\": [" << endl;
+
+    cout << setprecision(6);
+    for (size_t i = 0; i < Results.size(); ++i)
+    {
+        const Result& r = Results[i];
+        cout << "    {\"name\": \"" << r.Name << "\"";
+        cout << ", \"bytes\": " << r.Bytes;
+        cout << ", \"n\": " << r.N;
+        cout << ", \"ops\": " << r.Ops;
+        cout << ", \"samples\": " << r.Samples;
+        cout << ", \"p50_ns\": " << r.P50Nsec;
+        cout << ", \"p99_ns\": " << r.P99Nsec;
+        cout << ", \"mean_ns\": " << r.MeanNsec;
+        cout << ", \"p50_ticks\": " << r.P50Ticks;
+        cout << ", \"mbps\": " << (r.Bytes > 0 ? r.Bytes * r.N * 1000. / r.P50Nsec : 0.);
+        cout << ", \"output_bytes\": " << r.OutputBytes;
+        cout << "}" << (i + 1 < Results.size() ? "," : "") << endl;
+    }
+
+    cout << "  ]" << endl;
+    cout << "}" << endl;
 }
 
 
@@ -125,30 +413,39 @@ uint64_t GetTimeUsec()
     It accepts a set of equal-sized data packets and outputs one recovery packet
     that can repair one lost original packet.
 
-    The recovery packet must be GetRecoveryBytes() in size.
+    The recovery packet must be GetMaxOutputBytes() in size.
+
+    If `hints` is set, every pass prefetches ahead and the last pass writes
+    the recovery packet with non-temporal stores, as for a packet that is
+    sent right away.
 
     Returns the number of bytes written.
 */
 unsigned Encode(
-    const std::vector<std::vector<uint8_t>>& originals,
+    const uint8_t* const* originals,
     unsigned N,
     unsigned bytes,
     uint64_t seed,
+    uint64_t* coeffs,
     uint8_t* workspace,
     uint8_t* recovery,
-    unsigned maxRecoveryBytes)
+    unsigned maxRecoveryBytes,
+    bool hints = false)
 {
-    // Set up row seed
-    uint64_t seedMix = solinas64::HashU64(seed);
+    const unsigned passHints = hints ? solinas64::kHintPrefetch : 0;
+    const unsigned lastHints = hints ? (solinas64::kHintPrefetch | solinas64::kHintStreamOutput) : 0;
+
+    // Generate the row coefficients at once
+    solinas64::GenerateCoefficients(seed, 1, N, coeffs);
 
     // Unroll first column
-    uint64_t coeff0 = solinas64::HashToNonzeroFp(seedMix + 0);
     unsigned recoveryBytes = solinas64::MultiplyRegion(
-        &originals[0][0],
+        originals[0],
         bytes,
-        coeff0,
+        coeffs[0],
         workspace,
-        recovery);
+        recovery,
+        N == 1 ? lastHints : passHints);
 
     // Pad with zeros in case others overflow more
     memset(recovery + recoveryBytes, 0, maxRecoveryBytes - recoveryBytes);
@@ -156,14 +453,13 @@ unsigned Encode(
     // For each remaining column:
     for (unsigned i = 1; i < N; ++i)
     {
-        uint64_t coeff_i = solinas64::HashToNonzeroFp(seedMix + i);
-
         unsigned written = solinas64::MultiplyAddRegion(
-            &originals[i][0],
+            originals[i],
             bytes,
-            coeff_i,
+            coeffs[i],
             workspace,
-            recovery);
+            recovery,
+            i + 1 == N ? lastHints : passHints);
 
         if (recoveryBytes < written) {
             recoveryBytes = written;
@@ -174,7 +470,7 @@ unsigned Encode(
 }
 
 void EncodeGF256(
-    const std::vector<std::vector<uint8_t>>& originals,
+    const uint8_t* const* originals,
     unsigned N,
     unsigned bytes,
     uint64_t seed,
@@ -187,7 +483,7 @@ void EncodeGF256(
         coeff = 1;
     }
 
-    gf256_mul_mem(recovery, &originals[0][0], coeff, bytes);
+    gf256_mul_mem(recovery, originals[0], coeff, bytes);
 
     for (unsigned i = 1; i < N; ++i)
     {
@@ -196,13 +492,179 @@ void EncodeGF256(
             coeff = 1;
         }
 
-        gf256_muladd_mem(recovery, coeff, &originals[i][0], bytes);
+        gf256_muladd_mem(recovery, coeff, originals[i], bytes);
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// Primitive Benchmarks
+
+static void RunPrimitiveBenchmarks(solinas64::Random& prng)
+{
+    static const unsigned kChain = 1024;
+    const uint64_t x0 = prng.Next();
+    const uint64_t y = solinas64::HashToNonzeroFp(prng.Next());
+
+    // Each multiply depends on the one before, so this is the latency
+    Measure("PrimMultiplyLatency", 0, 1, kChain, [&]() {
+        uint64_t x = x0;
+        for (unsigned i = 0; i < kChain; ++i) {
+            x = solinas64::Multiply(x, y);
+        }
+        Sink = Sink + x;
+    });
+
+    // Four independent chains, as in the bulk kernels
+    Measure("PrimMultiplyThroughput", 0, 1, kChain, [&]() {
+        uint64_t a = x0, b = x0 + 1, c = x0 + 2, d = x0 + 3;
+        for (unsigned i = 0; i < kChain; i += 4)
+        {
+            a = solinas64::Multiply(a, y);
+            b = solinas64::Multiply(b, y);
+            c = solinas64::Multiply(c, y);
+            d = solinas64::Multiply(d, y);
+        }
+        Sink = Sink + (a ^ b ^ c ^ d);
+    });
+
+    static const unsigned kInverses = 64;
+
+    Measure("PrimInverse", 0, 1, kInverses, [&]() {
+        uint64_t x = x0;
+        for (unsigned i = 0; i < kInverses; ++i) {
+            x = solinas64::Inverse(x) + i;
+        }
+        Sink = Sink + x;
+    });
+
+    Measure("PrimInverseCT", 0, 1, kInverses, [&]() {
+        uint64_t x = x0;
+        for (unsigned i = 0; i < kInverses; ++i) {
+            x = solinas64::InverseCT(x) + i;
+        }
+        Sink = Sink + x;
+    });
+
+    // One reader pass over a buffer that fits in L1 cache
+    static const unsigned kReadBytes = 16 * 1024;
+    std::vector<uint8_t> data(kReadBytes);
+    std::vector<uint8_t> workspace(solinas64::AppDataReader::GetWorkspaceBytes(kReadBytes));
+    FillData(prng, &data[0], kReadBytes);
+
+    Measure("PrimReadNext8Bytes", kReadBytes, 1, kReadBytes / 8, [&]() {
+        solinas64::AppDataReader reader;
+        reader.SetupWorkspace(&workspace[0]);
+        uint64_t sum = 0;
+        for (unsigned i = 0; i < kReadBytes; i += 8) {
+            sum += reader.ReadNext8Bytes(&data[i]);
+        }
+        Sink = Sink + sum + reader.FlushAndGetWordCount();
+    });
+}
+
+
+//------------------------------------------------------------------------------
+// Region Benchmarks
+
+static const uint64_t kRegionSizes[] = {
+    64, 1024, 1280, 16 * 1024, 256 * 1024, 1024 * 1024, 16 * 1024 * 1024
+};
+static const unsigned kRegionSizesCount = static_cast<unsigned>(sizeof(kRegionSizes) / sizeof(kRegionSizes[0]));
+
+/// Number of originals for the EncodeRow region benchmark
+static const unsigned kRegionRowN = 16;
+
+/// Largest packet size for the EncodeRow region benchmark
+static const uint64_t kRegionRowMaxBytes = 1024 * 1024;
+
+static void RunRegionBenchmarks(solinas64::Random& prng)
+{
+    uint64_t maxBytes = Opts.MaxBytes;
+    if (Opts.Quick && maxBytes > 1024 * 1024) {
+        maxBytes = 1024 * 1024;
+    }
+
+    const unsigned maxOutputBytes = solinas64::AppDataReader::GetMaxOutputBytes((unsigned)maxBytes);
+
+    // One arena holds the inputs and a second one the outputs
+    solinas64::EncoderContext context;
+    if (!context.Initialize(kRegionRowN, (unsigned)maxBytes, 2))
+    {
+        cout << "Failed to allocate the region buffers" << endl;
+        return;
+    }
+
+    for (unsigned i = 0; i < kRegionRowN; ++i) {
+        FillData(prng, context.GetOriginal(i), maxBytes);
+    }
+
+    const uint8_t* data = context.GetOriginal(0);
+    uint8_t* workspace = context.GetWorkspace();
+    uint8_t* output = context.AcquireRecovery();
+    uint8_t* words = context.AcquireRecovery();
+
+    const uint64_t coeff = solinas64::HashToNonzeroFp(prng.Next());
+    std::vector<uint64_t> coeffs(kRegionRowN);
+    for (unsigned i = 0; i < kRegionRowN; ++i) {
+        coeffs[i] = solinas64::HashToNonzeroFp(prng.Next());
+    }
+
+    memset(output, 0, maxOutputBytes);
+
+    for (unsigned i = 0; i < kRegionSizesCount; ++i)
+    {
+        const unsigned bytes = (unsigned)kRegionSizes[i];
+        if (bytes > maxBytes) {
+            break;
+        }
+
+        Measure("RegionMultiply", bytes, 1, 1, [&]() {
+            Sink = Sink + solinas64::MultiplyRegion(data, bytes, coeff, workspace, output);
+        });
+
+        Measure("RegionMultiplyAdd", bytes, 1, 1, [&]() {
+            Sink = Sink + solinas64::MultiplyAddRegion(data, bytes, coeff, workspace, output);
+        });
+
+        Measure("RegionMultiplyAddPrefetch", bytes, 1, 1, [&]() {
+            Sink = Sink + solinas64::MultiplyAddRegion(
+                data, bytes, coeff, workspace, output, solinas64::kHintPrefetch);
+        });
+
+        Measure("RegionMultiplyNoWorkspace", bytes, 1, 1, [&]() {
+            Sink = Sink + solinas64::MultiplyRegion(data, bytes, coeff, output);
+        });
+
+        // The field words of the data are the input for the word operations
+        memset(words, 0, maxOutputBytes);
+        const unsigned wordBytes = solinas64::MultiplyRegion(data, bytes, (uint64_t)1, workspace, words);
+
+        Measure("RegionMultiplyWords", bytes, 1, 1, [&]() {
+            solinas64::MultiplyWords(words, wordBytes / 8, coeff, output);
+        });
+
+        Measure("RegionRestore", bytes, 1, 1, [&]() {
+            solinas64::RestoreRegion(words, bytes, output);
+        });
+
+        Measure("RegionPolyHash", bytes, 1, 1, [&]() {
+            Sink = Sink + solinas64::PolyHashRegion(data, bytes, coeff);
+        });
+
+        if (bytes <= kRegionRowMaxBytes)
+        {
+            Measure("RegionEncodeRow", bytes, kRegionRowN, 1, [&]() {
+                Sink = Sink + solinas64::EncodeRow(
+                    context.GetOriginals(), kRegionRowN, bytes, &coeffs[0], workspace, output);
+            });
+        }
     }
 }
 
 
 //------------------------------------------------------------------------------
-// Benchmarks
+// Encoder Benchmarks
 
 static const unsigned kFileSizes[] = {
     10, 100, 1000, 10000, 100000
@@ -214,150 +676,263 @@ static const unsigned kFileN[] = {
 };
 static const unsigned kFileNCount = static_cast<unsigned>(sizeof(kFileN) / sizeof(kFileN[0]));
 
-static const unsigned kTrials = 1000;
+/*
+    File pieces: f0, f1, f3, f4, ...
+    Coefficients: m0, m1, m2, m3, ...
 
-void RunBenchmarks()
+    R = m0 * f0 + m1 * f1 + m2 * f2 + ...
+
+    R = sum(m_i * f_i) (mod p)
+
+    To compute the recovery packet R we process the calculations for the
+    first word from all of the file pieces to produce a single word of
+    output.  This is a matrix-vector product between file data f_i (treated
+    as Fp words) and randomly chosen generator matrix coefficients m_i.
+
+    Lazy reduction can be used to simplify the add steps.
+
+    Then we continue to the next word for all the file pieces, producing the
+    next word of output.
+
+    It is possible to interleave the calculations for output words, and for
+    input words to achieve higher throughput.
+
+    The number of words for each file piece can vary slightly based on the
+    data (if the data bytes do not fit evenly into the Fp words, we have to
+    add extra bits to resolve ambiguities).
+
+    The result is a set of Fp words serialized to bytes, that is about 8
+    bytes more than the original file sizes.
+
+    The erasure code decoder in solinas64_codec.h is able to take these
+    recovery packets and fix lost data.  The decoder performance would be
+    fairly similar to the encoder performance for this type of erasure code,
+    since the runtime is dominated by this matrix-vector product.
+*/
+static void RunEncoderBenchmarks(solinas64::Random& prng)
 {
-    solinas64::Random prng;
-    prng.Seed(0);
+    // All the buffers are allocated once for the largest shape
+    solinas64::EncoderContext context;
+    if (!context.Initialize(
+        kFileN[kFileNCount - 1],
+        kFileSizes[kFileSizesCount - 1],
+        1))
+    {
+        cout << "Failed to allocate the encoder context" << endl;
+        return;
+    }
+
+    const uint8_t* const* originals = context.GetOriginals();
+    uint8_t* workspace = context.GetWorkspace();
+    std::vector<uint64_t> coeffs(context.GetMaxN());
 
-    std::vector<std::vector<uint8_t>> original_data;
-    std::vector<uint8_t> recovery_data;
-    std::vector<uint8_t> workspace_data;
+    // The recovery buffer is aligned so that kHintStreamOutput applies
+    uint8_t* recovery = context.AcquireRecovery();
 
     for (unsigned i = 0; i < kFileSizesCount; ++i)
     {
-        unsigned fileSizeBytes = kFileSizes[i];
+        const unsigned fileSizeBytes = kFileSizes[i];
+        if (Opts.Quick && fileSizeBytes > 10000) {
+            break;
+        }
+
+        const unsigned maxRecoveryBytes = solinas64::AppDataReader::GetMaxOutputBytes(fileSizeBytes);
 
-        cout << "Testing file size = " << fileSizeBytes << " bytes" << endl;
+        for (unsigned s = 0; s < context.GetMaxN(); ++s) {
+            FillData(prng, context.GetOriginal(s), fileSizeBytes);
+        }
 
         for (unsigned j = 0; j < kFileNCount; ++j)
         {
-            unsigned N = kFileN[j];
-
-            cout << "N = " << N << " : ";
-
-            uint64_t sizeSum = 0, timeSum = 0;
-            uint64_t timeSum_gf256 = 0;
-
-            for (unsigned k = 0; k < kTrials; ++k)
-            {
-                /*
-                    File pieces: f0, f1, f3, f4, ...
-                    Coefficients: m0, m1, m2, m3, ...
-
-                    R = m0 * f0 + m1 * f1 + m2 * f2 + ...
-
-                    R = sum(m_i * f_i) (mod 2^61-1)
-
-                    To compute the recovery packet R we process the calculations
-                    for the first word from all of the file pieces to produce a
-                    single word of output.  This is a matrix-vector product
-                    between file data f_i (treated as Fp words) and randomly
-                    chosen generator matrix coefficients m_i.
-
-                    Lazy reduction can be used to simplify the add steps.
-
-                    Then we continue to the next word for all the file pieces,
-                    producing the next word of output.
-
-                    It is possible to interleave the calculations for output
-                    words, and for input words to achieve higher throughput.
-
-                    The number of words for each file piece can vary slightly
-                    based on the data (if the data bytes do not fit evenly into
-                    the Fp words, we have to add extra bits to resolve
-                    ambiguities).
-
-                    The result is a set of 61-bit Fp words serialized to bytes,
-                    that is about 8 bytes more than the original file sizes.
-
-                    The erasure code decoder (not implemented) would be able
-                    to take these recovery packets and fix lost data.
-                    The decoder performance would be fairly similar to the
-                    encoder performance for this type of erasure code, since
-                    the runtime is dominated by this matrix-vector product.
-                */
-
-                original_data.resize(N);
-                for (unsigned s = 0; s < N; ++s)
-                {
-                    // Add 8 bytes padding to simplify tester
-                    original_data[s].resize(fileSizeBytes + 8);
-
-                    // Fill the data with random bytes
-                    for (unsigned r = 0; r < i; r += 8)
-                    {
-                        uint64_t w;
-                        if (prng.Next() % 100 <= 3) {
-                            w = ~(uint64_t)0;
-                        }
-                        else {
-                            w = prng.Next();
-                        }
-                        solinas64::WriteU64_LE(&original_data[s][r], w);
-                    }
-                }
-
-                const unsigned maxRecoveryBytes = solinas64::AppDataReader::GetMaxOutputBytes(fileSizeBytes);
-                const unsigned workspaceBytes = solinas64::AppDataReader::GetWorkspaceBytes(fileSizeBytes);
-                recovery_data.resize(maxRecoveryBytes);
-                workspace_data.resize(workspaceBytes);
-
-                {
-                    uint64_t t0 = GetTimeUsec();
-
-                    unsigned recoveryBytes = Encode(
-                        original_data,
-                        N,
-                        fileSizeBytes,
-                        k,
-                        &workspace_data[0],
-                        &recovery_data[0],
-                        maxRecoveryBytes);
-
-                    uint64_t t1 = GetTimeUsec();
-
-                    sizeSum += recoveryBytes;
-                    timeSum += t1 - t0;
-                }
+            const unsigned N = kFileN[j];
+            if (Opts.Quick && j % 3 != 0) {
+                continue;
+            }
 
-#ifdef SOLINAS64_ENABLE_GF256_COMPARE
-                {
-                    uint64_t t0 = GetTimeUsec();
+            uint64_t seed = 0;
 
-                    EncodeGF256(original_data, N, fileSizeBytes, k, &recovery_data[0]);
+            // The recovery size depends on the data only, not the seed
+            const unsigned outputBytes = context.Encode(originals, N, fileSizeBytes, 0, recovery);
 
-                    uint64_t t1 = GetTimeUsec();
+            Measure("EncodeRegion", fileSizeBytes, N, 1, [&]() {
+                Encode(originals, N, fileSizeBytes, ++seed, &coeffs[0], workspace, recovery, maxRecoveryBytes);
+            }, outputBytes);
 
-                    timeSum_gf256 += t1 - t0;
-                }
-#endif // SOLINAS64_ENABLE_GF256_COMPARE
-            }
+            Measure("EncodeRegionHints", fileSizeBytes, N, 1, [&]() {
+                Encode(originals, N, fileSizeBytes, ++seed, &coeffs[0], workspace, recovery, maxRecoveryBytes, true);
+            }, outputBytes);
+
+            Measure("EncodeRow", fileSizeBytes, N, 1, [&]() {
+                context.Encode(originals, N, fileSizeBytes, ++seed, recovery);
+            }, outputBytes);
 
 #ifdef SOLINAS64_ENABLE_GF256_COMPARE
-            cout << " gf256_MBPS=" << (uint64_t)fileSizeBytes * N * kTrials / timeSum_gf256;
+            Measure("EncodeGF256", fileSizeBytes, N, 1, [&]() {
+                EncodeGF256(originals, N, fileSizeBytes, ++seed, recovery);
+            }, fileSizeBytes);
 #endif // SOLINAS64_ENABLE_GF256_COMPARE
-            cout << " Solinas64_MBPS=" << (uint64_t)fileSizeBytes * N * kTrials / timeSum;
-            cout << " Solinas64_OutputBytes=" << sizeSum / (float)kTrials;
-            cout << endl;
         }
     }
 }
 
 
+//------------------------------------------------------------------------------
+// Update Benchmarks
+
+static const unsigned kUpdateN = 32;
+static const unsigned kUpdateBytes = 64 * 1024;
+static const unsigned kUpdateRecoveryCount = 4;
+
+/// UpdateRecovery() for one changed original, against encoding the
+/// recovery packets again from all the originals
+static void RunUpdateBenchmarks(solinas64::Random& prng)
+{
+    solinas64::EncoderContext context;
+    if (!context.Initialize(kUpdateN, kUpdateBytes, kUpdateRecoveryCount))
+    {
+        cout << "Failed to allocate the update buffers" << endl;
+        return;
+    }
+    for (unsigned i = 0; i < kUpdateN; ++i) {
+        FillData(prng, context.GetOriginal(i), kUpdateBytes);
+    }
+
+    // Alternate between two versions of the changed original, so the
+    // recovery packets stay valid across the calls
+    const unsigned column = kUpdateN / 2;
+    std::vector<uint8_t> versions[2];
+    for (unsigned v = 0; v < 2; ++v)
+    {
+        versions[v].resize(kUpdateBytes);
+        FillData(prng, &versions[v][0], kUpdateBytes);
+    }
+    memcpy(context.GetOriginal(column), &versions[0][0], kUpdateBytes);
+
+    uint8_t* recoveries[kUpdateRecoveryCount];
+    uint64_t coeffs[kUpdateRecoveryCount];
+    unsigned outputBytes = 0;
+    for (unsigned r = 0; r < kUpdateRecoveryCount; ++r)
+    {
+        recoveries[r] = context.AcquireRecovery();
+        outputBytes = context.Encode(context.GetOriginals(), kUpdateN, kUpdateBytes, r, recoveries[r]);
+        coeffs[r] = solinas64::GetGeneratorCoefficient(r, column);
+    }
+
+    std::vector<uint8_t> workspace(solinas64::GetUpdateRecoveryWorkspaceBytes(kUpdateBytes));
+    unsigned version = 0;
+
+    Measure("UpdateRecovery", kUpdateBytes, kUpdateRecoveryCount, 1, [&]() {
+        solinas64::UpdateRecovery(
+            &versions[version][0],
+            &versions[version ^ 1][0],
+            kUpdateBytes,
+            coeffs,
+            kUpdateRecoveryCount,
+            &workspace[0],
+            recoveries);
+        version ^= 1;
+    }, outputBytes);
+
+    Measure("UpdateReencode", kUpdateBytes, kUpdateN * kUpdateRecoveryCount, 1, [&]() {
+        for (unsigned r = 0; r < kUpdateRecoveryCount; ++r) {
+            context.Encode(context.GetOriginals(), kUpdateN, kUpdateBytes, r, recoveries[r]);
+        }
+    }, outputBytes);
+}
+
+
+//------------------------------------------------------------------------------
+// Pipeline Benchmarks
+
+static const unsigned kPipelineN = 32;
+static const unsigned kPipelineBytes = 64 * 1024;
+static const unsigned kPipelineJobs = 64;
+
+static void RunPipelineBenchmarks(solinas64::Random& prng)
+{
+    // The originals are shared by all the jobs, and each job has its own
+    // aligned recovery buffer
+    solinas64::EncoderContext buffers;
+    if (!buffers.Initialize(kPipelineN, kPipelineBytes, kPipelineJobs))
+    {
+        cout << "Failed to allocate the pipeline buffers" << endl;
+        return;
+    }
+    for (unsigned i = 0; i < kPipelineN; ++i) {
+        FillData(prng, buffers.GetOriginal(i), kPipelineBytes);
+    }
+
+    std::vector<solinas64::EncodeJob> jobs(kPipelineJobs);
+    for (unsigned i = 0; i < kPipelineJobs; ++i)
+    {
+        jobs[i].Originals = buffers.GetOriginals();
+        jobs[i].N = kPipelineN;
+        jobs[i].Bytes = kPipelineBytes;
+        jobs[i].Seed = i;
+        jobs[i].Recovery = buffers.AcquireRecovery();
+    }
+
+    unsigned maxThreads = std::thread::hardware_concurrency();
+    if (maxThreads == 0) {
+        maxThreads = 1;
+    }
+
+    for (unsigned threads = 1; threads <= maxThreads; threads *= 2)
+    {
+        solinas64::EncoderPipeline pipeline;
+        if (!pipeline.Start(kPipelineN, kPipelineBytes, threads)) {
+            return;
+        }
+
+        std::ostringstream name;
+        name << "PipelineThreads" << threads;
+
+        Measure(name.str(), kPipelineBytes, kPipelineN * kPipelineJobs, kPipelineJobs, [&]() {
+            for (const solinas64::EncodeJob& job : jobs) {
+                pipeline.Submit(job);
+            }
+            pipeline.Wait();
+        });
+    }
+}
+
+
 //------------------------------------------------------------------------------
 // Entrypoint
 
-int main()
+int main(int argc, char** argv)
 {
-    cout << "Benchmarks for Solinas64 erasure codes.  Before running the benchmarks please run the tests to make sure everything's working on your PC.  It's going to run quite a bit faster with 64-bit builds because it takes advantage of the speed of 64-bit multiplications." << endl;
-    cout << endl;
+    if (!ParseOptions(argc, argv))
+    {
+        cout << "Usage: benchmarks [--json] [--quick] [--ambiguous=P] [--max-bytes=B] [--filter=NAME]" << endl;
+        return 1;
+    }
+
+    if (!Opts.Json)
+    {
+        cout << "Benchmarks for Solinas64 erasure codes.  Before running the benchmarks please run the tests to make sure everything's working on your PC.  It's going to run quite a bit faster with 64-bit builds because it takes advantage of the speed of 64-bit multiplications." << endl;
+        cout << endl;
+        cout << "Backend: " << GetBackendName() << ", ambiguous words: " << Opts.AmbiguousPercent << "%" << endl;
+        cout << endl;
+    }
 
     gf256_init();
 
-    RunBenchmarks();
+    solinas64::Random prng;
+    prng.Seed(0);
+
+    RunPrimitiveBenchmarks(prng);
+    RunRegionBenchmarks(prng);
+    RunEncoderBenchmarks(prng);
+    RunUpdateBenchmarks(prng);
+    RunPipelineBenchmarks(prng);
+
+    if (Opts.Json) {
+        PrintJson();
+    }
+    else {
+        cout << endl;
+    }
 
-    cout << endl;
     return 0;
 }
@@ -257,7 +257,7 @@ static void _cpuid(unsigned int cpu_info[4U], const unsigned int cpu_info_type)
 }
 
 #else
-#if defined(LINUX_ARM)
+#if defined(LINUX_ARM) && !defined(__aarch64__)
 static void checkLinuxARMNeonCapabilities( bool& cpuHasNeon )
 {
     auto cpufile = open("/proc/self/auxv", O_RDONLY);
@@ -303,7 +303,7 @@ static void gf256_architecture_init()
     }
 #endif
 
-#if defined(LINUX_ARM)
+#if defined(LINUX_ARM) && !defined(__aarch64__)
     // Check for NEON support on other ARM/Linux platforms
     checkLinuxARMNeonCapabilities(CpuHasNeon);
 #endif
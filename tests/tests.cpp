@@ -26,18 +26,22 @@
     POSSIBILITY OF SUCH DAMAGE.
 */
 
-/*
-
-    TODO: Actually implement these.  Right now this does not build.
-
-*/
-
 #include "../solinas64.h"
+#include "../solinas64_codec.h"
+#include "../solinas64_file.h"
+#include "../solinas64_ntt.h"
+#include "../solinas64_threads.h"
 
+#include <stdio.h>
+#include <string.h>
 #include <iostream>
 #include <iomanip>
 #include <sstream>
 #include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
 using namespace std;
 
 
@@ -65,22 +69,15 @@ using namespace std;
 #define SOLINAS64_RET_FAIL -1
 #define SOLINAS64_RET_SUCCESS 0
 
-static const uint64_t MASK61 = ((uint64_t)1 << 61) - 1;
-static const uint64_t MASK62 = ((uint64_t)1 << 62) - 1;
+static const uint64_t MASK32 = ((uint64_t)1 << 32) - 1;
 static const uint64_t MASK63 = ((uint64_t)1 << 63) - 1;
 static const uint64_t MASK64 = ~(uint64_t)0;
-static const uint64_t MASK64_NO62 = MASK64 ^ ((uint64_t)1 << 62);
-static const uint64_t MASK64_NO61 = MASK64 ^ ((uint64_t)1 << 61);
-static const uint64_t MASK64_NO60 = MASK64 ^ ((uint64_t)1 << 60);
-static const uint64_t MASK63_NO61 = MASK63 ^ ((uint64_t)1 << 61);
-static const uint64_t MASK63_NO60 = MASK63 ^ ((uint64_t)1 << 60);
-static const uint64_t MASK62_NO60 = MASK62 ^ ((uint64_t)1 << 60);
 
 #if defined(SOLINAS64_DEBUG)
 static const unsigned kRandomTestLoops = 100000;
 static const unsigned kMaxDataLength = 4000;
 #else
-static const unsigned kRandomTestLoops = 10000000;
+static const unsigned kRandomTestLoops = 1000000;
 static const unsigned kMaxDataLength = 10000;
 #endif
 
@@ -95,233 +92,205 @@ static std::string HexString(uint64_t x)
     return ss.str();
 }
 
-
-//------------------------------------------------------------------------------
-// Tests: Negate
-
-static bool test_negate(uint64_t x)
+/// Reference (x + y) mod p for any 64-bit x, y
+static uint64_t RefAdd(uint64_t x, uint64_t y)
 {
-    uint64_t n = solinas64::Negate(x);
-    uint64_t s = (x + n) % solinas64::kPrime;
-    if (s != 0) {
-        cout << "Failed for x = " << hex << HexString(x) << endl;
-        SOLINAS64_DEBUG_BREAK();
-        return false;
+    x %= solinas64::kPrime;
+    y %= solinas64::kPrime;
+    const uint64_t r = x + y;
+    if (r < x || r >= solinas64::kPrime) {
+        return r - solinas64::kPrime;
     }
-    return true;
+    return r;
 }
 
-static bool TestNegate()
+/// Reference (x * y) mod p for any 64-bit x, y, by double-and-add
+static uint64_t RefMultiply(uint64_t x, uint64_t y)
 {
-    cout << "TestNegate...";
-
-    // Input is allowed to be 0 <= x <= p
-    for (uint64_t x = 0; x < 1000; ++x) {
-        if (!test_negate(x)) {
-            return false;
-        }
-    }
-    for (uint64_t x = solinas64::kPrime; x >= solinas64::kPrime - 1000; --x) {
-        if (!test_negate(x)) {
-            return false;
+    x %= solinas64::kPrime;
+    uint64_t r = 0;
+    for (int bit = 63; bit >= 0; --bit)
+    {
+        r = RefAdd(r, r);
+        if ((y >> bit) & 1) {
+            r = RefAdd(r, x);
         }
     }
+    return r;
+}
 
-    solinas64::Random prng;
-    prng.Seed(1);
-
-    for (unsigned i = 0; i < kRandomTestLoops; ++i)
+/// Fill data with random words, some of them ambiguous
+static void FillTestData(solinas64::Random& prng, uint8_t* data, unsigned bytes)
+{
+    for (unsigned k = 0; k < bytes; k += 8)
     {
-        uint64_t x = prng.Next() & solinas64::kPrime;
-        if (!test_negate(x)) {
-            return false;
+        uint64_t w = prng.Next();
+        const unsigned select = static_cast<unsigned>(w % 100);
+        if (select <= 3) {
+            w = MASK64;
+        }
+        else if (select <= 6) {
+            w |= solinas64::kAmbiguityMask;
         }
-    }
-
-    cout << "Passed" << endl;
 
-    return true;
+        uint8_t word[8];
+        solinas64::WriteU64_LE(word, w);
+        memcpy(data + k, word, bytes - k < 8 ? bytes - k : 8);
+    }
 }
 
-
-//------------------------------------------------------------------------------
-// Tests: Add
-
-static bool TestAdd()
+/// Values near the edges of the ranges the field operations handle
+static const uint64_t kEdgeValues[] = {
+    0, 1, 2, MASK32 - 1, MASK32, MASK32 + 1, MASK32 + 2,
+    MASK63 - 1, MASK63, MASK63 + 1,
+    solinas64::kPrime - 2, solinas64::kPrime - 1, solinas64::kPrime,
+    solinas64::kPrime + 1, solinas64::kPrime + 2,
+    MASK64 - 1, MASK64
+};
+static const unsigned kEdgeCount = sizeof(kEdgeValues) / sizeof(kEdgeValues[0]);
+
+/// Fill data with random words that are all ambiguous
+static void FillAmbiguousData(solinas64::Random& prng, uint8_t* data, unsigned bytes)
 {
-    cout << "TestAdd...";
-
-    // Preconditions: x,y,z,w <2^62
-    const uint64_t largest = ((uint64_t)1 << 62) - 1;
-    const uint64_t reduced = largest % solinas64::kPrime;
-
-    for (uint64_t x = largest; x >= largest - 1000; --x)
+    for (unsigned k = 0; k < bytes; k += 8)
     {
-        uint64_t r = solinas64::Add4(largest, largest, largest, x);
+        uint8_t word[8];
+        solinas64::WriteU64_LE(word, prng.Next() | solinas64::kAmbiguityMask);
+        memcpy(data + k, word, bytes - k < 8 ? bytes - k : 8);
+    }
+}
 
-        uint64_t expected = 0;
-        expected = (expected + reduced) % solinas64::kPrime;
-        expected = (expected + reduced) % solinas64::kPrime;
-        expected = (expected + reduced) % solinas64::kPrime;
-        expected = (expected + (x % solinas64::kPrime)) % solinas64::kPrime;
+/// Reference expansion of data into field words, one word at a time.
+/// Sets `words` to the data words followed by the extra words, zero-padded
+/// to GetMaxOutputBytes(bytes) / 8 words, and returns the number of words
+static unsigned RefExpandRegion(const uint8_t* data, unsigned bytes, std::vector<uint64_t>& words)
+{
+    std::vector<uint8_t> workspace(solinas64::AppDataReader::GetWorkspaceBytes(bytes) + 8);
+    solinas64::AppDataReader reader;
+    reader.SetupWorkspace(&workspace[0]);
 
-        if (r % solinas64::kPrime != expected) {
-            cout << "Failed for x = " << HexString(x) << endl;
-            SOLINAS64_DEBUG_BREAK();
-            return false;
-        }
-    }
+    words.assign(solinas64::AppDataReader::GetMaxOutputBytes(bytes) / 8, 0);
 
-    for (uint64_t x = largest; x >= largest - 1000; --x)
+    unsigned count = 0;
+    for (unsigned k = 0; k < bytes; k += 8)
     {
-        for (uint64_t y = largest; y >= largest - 1000; --y)
+        uint8_t word[8];
+        if (bytes - k >= 8)
         {
-            uint64_t r = solinas64::Add4(largest, largest, x, y);
-
-            uint64_t expected = 0;
-            expected = (expected + reduced) % solinas64::kPrime;
-            expected = (expected + reduced) % solinas64::kPrime;
-            expected = (expected + (y % solinas64::kPrime)) % solinas64::kPrime;
-            expected = (expected + (x % solinas64::kPrime)) % solinas64::kPrime;
-
-            if (r % solinas64::kPrime != expected) {
-                cout << "Failed for x=" << HexString(x) << " y=" << HexString(y) << endl;
-                SOLINAS64_DEBUG_BREAK();
-                return false;
-            }
+            memcpy(word, data + k, 8);
+            words[count++] = reader.ReadNext8Bytes(word);
+        }
+        else {
+            words[count++] = reader.ReadFinalBytes(data + k, bytes - k);
         }
     }
 
-    solinas64::Random prng;
-    prng.Seed(0);
-
-    for (unsigned i = 0; i < kRandomTestLoops; ++i)
-    {
-        // Select 4 values from 0..2^62-1
-        uint64_t x = prng.Next() & MASK62;
-        uint64_t y = prng.Next() & MASK62;
-        uint64_t w = prng.Next() & MASK62;
-        uint64_t z = prng.Next() & MASK62;
-
-        uint64_t r = solinas64::Add4(x, y, z, w);
+    const unsigned extraWords = reader.FlushAndGetWordCount();
+    for (unsigned i = 0; i < extraWords; ++i) {
+        words[count++] = solinas64::ReadU64_LE(&workspace[i * 8]);
+    }
 
-        uint64_t expected = 0;
-        expected = (expected + (x % solinas64::kPrime)) % solinas64::kPrime;
-        expected = (expected + (y % solinas64::kPrime)) % solinas64::kPrime;
-        expected = (expected + (z % solinas64::kPrime)) % solinas64::kPrime;
-        expected = (expected + (w % solinas64::kPrime)) % solinas64::kPrime;
+    return count;
+}
 
-        if (r % solinas64::kPrime != expected) {
-            cout << "Failed (random) for i = " << i << endl;
-            SOLINAS64_DEBUG_BREAK();
+/// Returns true if the first `count` words of the output equal `expected` mod p
+static bool IsEqualWords(const uint8_t* output, const uint64_t* expected, unsigned count)
+{
+    for (unsigned i = 0; i < count; ++i) {
+        if (solinas64::Finalize(solinas64::ReadU64_LE(output + i * 8)) != solinas64::Finalize(expected[i])) {
             return false;
         }
     }
-
-    cout << "Passed" << endl;
-
     return true;
 }
 
 
 //------------------------------------------------------------------------------
-// Tests: Partial Reduction
+// Tests: Add and Subtract
 
-static bool test_pred(uint64_t x)
+static bool test_add(uint64_t x, uint64_t y)
 {
-    uint64_t expected = x % solinas64::kPrime;
-
-    uint64_t r = solinas64::PartialReduce(x);
-
-    if ((r >> 62) != 0)
+    const uint64_t sum = solinas64::Add(x, y);
+    if (sum % solinas64::kPrime != RefAdd(x, y))
     {
-        cout << "High bit overflow failed for x=" << HexString(x) << endl;
+        cout << "Failed (add) for x=" << HexString(x) << ", y=" << HexString(y) << endl;
         SOLINAS64_DEBUG_BREAK();
         return false;
     }
 
-    uint64_t actual = solinas64::PartialReduce(x) % solinas64::kPrime;
-
-    if (actual != expected)
+    const uint64_t diff = solinas64::Subtract(x, y);
+    if (RefAdd(diff, y) != x % solinas64::kPrime)
     {
-        cout << "Failed for x=" << HexString(x) << endl;
+        cout << "Failed (subtract) for x=" << HexString(x) << ", y=" << HexString(y) << endl;
         SOLINAS64_DEBUG_BREAK();
         return false;
     }
+
     return true;
 }
 
-static bool TestPartialReduction()
+static bool TestAdd()
 {
-    cout << "TestPartialReduction...";
-
-    // Input can have any bit set
+    cout << "TestAdd...";
 
-    for (uint64_t x = 0; x < 1000; ++x) {
-        if (!test_pred(x)) {
-            return false;
-        }
-    }
-    for (uint64_t x = MASK64; x > MASK64 - 1000; --x) {
-        if (!test_pred(x)) {
-            return false;
-        }
-    }
-    for (uint64_t x = MASK64_NO62 + 1000; x > MASK64_NO62 - 1000; --x) {
-        if (!test_pred(x)) {
-            return false;
-        }
-    }
-    for (uint64_t x = MASK64_NO61 + 1000; x > MASK64_NO61 - 1000; --x) {
-        if (!test_pred(x)) {
-            return false;
-        }
-    }
-    for (uint64_t x = MASK64_NO60 + 1000; x > MASK64_NO60 - 1000; --x) {
-        if (!test_pred(x)) {
-            return false;
-        }
-    }
-    for (uint64_t x = MASK63; x > MASK63 - 1000; --x) {
-        if (!test_pred(x)) {
-            return false;
-        }
-    }
-    for (uint64_t x = MASK63_NO61 + 1000; x > MASK63_NO61 - 1000; --x) {
-        if (!test_pred(x)) {
-            return false;
-        }
-    }
-    for (uint64_t x = MASK63_NO60 + 1000; x > MASK63_NO60 - 1000; --x) {
-        if (!test_pred(x)) {
-            return false;
+    for (unsigned i = 0; i < kEdgeCount; ++i)
+    {
+        for (unsigned j = 0; j < kEdgeCount; ++j)
+        {
+            for (uint64_t k = 0; k < 100; ++k)
+            {
+                if (!test_add(kEdgeValues[i] - k, kEdgeValues[j] + k)) {
+                    return false;
+                }
+            }
         }
     }
-    for (uint64_t x = MASK62 + 1000; x > MASK62 - 1000; --x) {
-        if (!test_pred(x)) {
+
+    // Adding zero is exact
+    for (unsigned i = 0; i < kEdgeCount; ++i)
+    {
+        if (solinas64::Add(kEdgeValues[i], 0) != kEdgeValues[i]) {
+            cout << "Failed (add zero) for x=" << HexString(kEdgeValues[i]) << endl;
+            SOLINAS64_DEBUG_BREAK();
             return false;
         }
     }
-    for (uint64_t x = MASK62_NO60 + 1000; x > MASK62_NO60 - 1000; --x) {
-        if (!test_pred(x)) {
+
+    solinas64::Random prng;
+    prng.Seed(1);
+
+    for (unsigned i = 0; i < kRandomTestLoops; ++i)
+    {
+        if (!test_add(prng.Next(), prng.Next())) {
             return false;
         }
     }
-    for (uint64_t x = MASK61 + 1000; x > MASK61 - 1000; --x) {
-        if (!test_pred(x)) {
-            return false;
+
+    // The vector kernels must match for non-canonical inputs too.
+    // Multiply() by one is exact, so this adds the words as-is.
+    std::vector<uint8_t> words(kEdgeCount * kEdgeCount * 8), output(words.size());
+    for (unsigned i = 0; i < kEdgeCount; ++i)
+    {
+        for (unsigned j = 0; j < kEdgeCount; ++j)
+        {
+            solinas64::WriteU64_LE(&words[(i * kEdgeCount + j) * 8], kEdgeValues[i]);
+            solinas64::WriteU64_LE(&output[(i * kEdgeCount + j) * 8], kEdgeValues[j]);
         }
     }
 
-    solinas64::Random prng;
-    prng.Seed(2);
+    solinas64::MultiplyAddWords(&words[0], kEdgeCount * kEdgeCount, 1, &output[0]);
 
-    for (unsigned i = 0; i < kRandomTestLoops; ++i)
+    for (unsigned i = 0; i < kEdgeCount; ++i)
     {
-        uint64_t x = prng.Next();
-
-        if (!test_pred(x)) {
-            return false;
+        for (unsigned j = 0; j < kEdgeCount; ++j)
+        {
+            const uint64_t r = solinas64::ReadU64_LE(&output[(i * kEdgeCount + j) * 8]);
+            if (r % solinas64::kPrime != RefAdd(kEdgeValues[i], kEdgeValues[j]))
+            {
+                cout << "Failed (MultiplyAddWords) for x=" << HexString(kEdgeValues[i]) << ", y=" << HexString(kEdgeValues[j]) << endl;
+                SOLINAS64_DEBUG_BREAK();
+                return false;
+            }
         }
     }
 
@@ -332,17 +301,12 @@ static bool TestPartialReduction()
 
 
 //------------------------------------------------------------------------------
-// Tests: Finalize Reduction
+// Tests: Finalize
 
-static bool test_fred(uint64_t x)
+static bool test_finalize(uint64_t x)
 {
-    // EXCEPTION: This input is known to not work
-    if (x == 0x3ffffffffffffffeULL) {
-        return true;
-    }
-
-    uint64_t actual = solinas64::Finalize(x);
-    uint64_t expected = x % solinas64::kPrime;
+    const uint64_t actual = solinas64::Finalize(x);
+    const uint64_t expected = x % solinas64::kPrime;
 
     if (actual != expected)
     {
@@ -353,41 +317,28 @@ static bool test_fred(uint64_t x)
     return true;
 }
 
-static bool TestFinalizeReduction()
+static bool TestFinalize()
 {
-    cout << "TestFinalizeReduction...";
-
-    // Input has #63 and #62 clear, other bits can take on any value
+    cout << "TestFinalize...";
 
-    for (uint64_t x = 0; x < 1000; ++x) {
-        if (!test_fred(x)) {
-            return false;
-        }
-    }
-    for (uint64_t x = MASK62; x > MASK62 - 1000; --x) {
-        if (!test_fred(x)) {
-            return false;
-        }
-    }
-    for (uint64_t x = MASK62_NO60 + 1000; x > MASK62_NO60 - 1000; --x) {
-        if (!test_fred(x)) {
-            return false;
-        }
-    }
-    for (uint64_t x = MASK61 + 1000; x > MASK61 - 1000; --x) {
-        if (!test_fred(x)) {
-            return false;
+    for (unsigned i = 0; i < kEdgeCount; ++i)
+    {
+        for (uint64_t k = 0; k < 1000; ++k)
+        {
+            if (!test_finalize(kEdgeValues[i] - k) ||
+                !test_finalize(kEdgeValues[i] + k))
+            {
+                return false;
+            }
         }
     }
 
     solinas64::Random prng;
-    prng.Seed(3);
+    prng.Seed(2);
 
     for (unsigned i = 0; i < kRandomTestLoops; ++i)
     {
-        uint64_t x = prng.Next() & MASK62;
-
-        if (!test_fred(x)) {
+        if (!test_finalize(prng.Next())) {
             return false;
         }
     }
@@ -403,26 +354,10 @@ static bool TestFinalizeReduction()
 
 static bool test_mul(uint64_t x, uint64_t y)
 {
-    uint64_t p = solinas64::Multiply(x, y);
-
-    if ((p >> 62) != 0) {
-        cout << "Failed (high bit overflow) for x=" << HexString(x) << ", y=" << HexString(y) << endl;
-        SOLINAS64_DEBUG_BREAK();
-        return false;
-    }
+    const uint64_t p = solinas64::Multiply(x, y);
 
-    uint64_t r0, r1;
-    CAT_MUL128(r1, r0, x, y);
-
-    //A % B == (((AH % B) * (2^64 % B)) + (AL % B)) % B
-    //  == (((AH % B) * ((2^64 - B) % B)) + (AL % B)) % B
-    r1 %= solinas64::kPrime;
-    uint64_t NB = (uint64_t)(-(int64_t)solinas64::kPrime);
-    uint64_t mod = r1 * (NB % solinas64::kPrime);
-    mod += r0 % solinas64::kPrime;
-    mod %= solinas64::kPrime;
-
-    if (p % solinas64::kPrime != mod) {
+    if (p % solinas64::kPrime != RefMultiply(x, y))
+    {
         cout << "Failed (reduced result mismatch) for x=" << HexString(x) << ", y=" << HexString(y) << endl;
         SOLINAS64_DEBUG_BREAK();
         return false;
@@ -435,58 +370,35 @@ static bool TestMultiply()
 {
     cout << "TestMultiply...";
 
-    // Number of bits between x, y must be 124 or fewer.
-
-    for (uint64_t x = 0; x < 1000; ++x) {
-        for (uint64_t y = x; y < 1000; ++y) {
-            if (!test_mul(x, y)) {
-                return false;
-            }
-        }
-    }
-    for (uint64_t x = MASK62; x > MASK62 - 1000; --x) {
-        for (uint64_t y = x; y > MASK62 - 1000; --y) {
-            if (!test_mul(x, y)) {
-                return false;
-            }
-        }
-    }
-    for (uint64_t x = MASK62_NO60 + 1000; x > MASK62_NO60 - 1000; --x) {
-        for (uint64_t y = x; y > MASK62_NO60 - 1000; --y) {
-            if (!test_mul(x, y)) {
-                return false;
-            }
-        }
-    }
-    for (uint64_t x = MASK61 + 1000; x > MASK61 - 1000; --x) {
-        for (uint64_t y = x; y > MASK61 - 1000; --y) {
-            if (!test_mul(x, y)) {
-                return false;
+    for (unsigned i = 0; i < kEdgeCount; ++i)
+    {
+        for (unsigned j = 0; j < kEdgeCount; ++j)
+        {
+            for (uint64_t k = 0; k < 30; ++k)
+            {
+                if (!test_mul(kEdgeValues[i] - k, kEdgeValues[j] + k)) {
+                    return false;
+                }
             }
         }
     }
 
-    solinas64::Random prng;
-    prng.Seed(4);
-
-    // 62 + 62 = 124 bits
-    for (unsigned i = 0; i < kRandomTestLoops; ++i)
+    // Multiplying by one is exact
+    for (unsigned i = 0; i < kEdgeCount; ++i)
     {
-        uint64_t x = prng.Next() & MASK62;
-        uint64_t y = prng.Next() & MASK62;
-
-        if (!test_mul(x, y)) {
+        if (solinas64::Multiply(kEdgeValues[i], 1) != kEdgeValues[i]) {
+            cout << "Failed (multiply by one) for x=" << HexString(kEdgeValues[i]) << endl;
+            SOLINAS64_DEBUG_BREAK();
             return false;
         }
     }
 
-    // 61 + 63 = 124 bits
+    solinas64::Random prng;
+    prng.Seed(4);
+
     for (unsigned i = 0; i < kRandomTestLoops; ++i)
     {
-        uint64_t x = prng.Next() & MASK61;
-        uint64_t y = prng.Next() & MASK63;
-
-        if (!test_mul(x, y)) {
+        if (!test_mul(prng.Next(), prng.Next())) {
             return false;
         }
     }
@@ -494,9 +406,9 @@ static bool TestMultiply()
     // Commutivity test
     for (unsigned i = 0; i < kRandomTestLoops; ++i)
     {
-        uint64_t x = prng.Next() & MASK62;
-        uint64_t y = prng.Next() & MASK62;
-        uint64_t z = prng.Next() & MASK62;
+        uint64_t x = prng.Next();
+        uint64_t y = prng.Next();
+        uint64_t z = prng.Next();
 
         uint64_t r = solinas64::Finalize(solinas64::Multiply(solinas64::Multiply(z, y), x));
         uint64_t s = solinas64::Finalize(solinas64::Multiply(solinas64::Multiply(x, z), y));
@@ -530,7 +442,15 @@ static bool TestMultiply()
 
 static bool test_inv(uint64_t x)
 {
-    uint64_t i = solinas64::Inverse(x);
+    const uint64_t i = solinas64::Inverse(x);
+    const uint64_t ct = solinas64::InverseCT(x);
+
+    if (i != ct)
+    {
+        cout << "Failed (InverseCT mismatch) for x=" << HexString(x) << endl;
+        SOLINAS64_DEBUG_BREAK();
+        return false;
+    }
 
     // If no inverse existed:
     if (i == 0)
@@ -554,27 +474,14 @@ static bool test_inv(uint64_t x)
         return false;
     }
 
-    // mul requires partially reduced input
-    x = solinas64::PartialReduce(x);
-
-    uint64_t p = solinas64::Multiply(x, i);
-
     // If result is not 1 then it is not a multiplicative inverse
-    if (solinas64::Finalize(p) != 1)
+    if (solinas64::Finalize(solinas64::Multiply(x, i)) != 1)
     {
         cout << "Failed (finalized result not 1) for x=" << HexString(x) << endl;
         SOLINAS64_DEBUG_BREAK();
         return false;
     }
 
-    // Double check the reduce function...
-    if (p % solinas64::kPrime != 1)
-    {
-        cout << "Failed (remainder not 1) for x=" << HexString(x) << endl;
-        SOLINAS64_DEBUG_BREAK();
-        return false;
-    }
-
     return true;
 }
 
@@ -582,23 +489,42 @@ static bool TestMulInverse()
 {
     cout << "TestMulInverse...";
 
-    // x < p
-
     // Small values
-    for (uint64_t x = 1; x < 1000; ++x) {
+    for (uint64_t x = 0; x < 1000; ++x) {
         if (!test_inv(x)) {
             return false;
         }
     }
+    for (unsigned i = 0; i < kEdgeCount; ++i) {
+        if (!test_inv(kEdgeValues[i])) {
+            return false;
+        }
+    }
 
     solinas64::Random prng;
     prng.Seed(5);
 
-    for (unsigned i = 0; i < kRandomTestLoops; ++i)
+    for (unsigned i = 0; i < kRandomTestLoops / 10; ++i)
     {
-        uint64_t x = prng.Next();
+        if (!test_inv(prng.Next())) {
+            return false;
+        }
+    }
 
-        if (!test_inv(x)) {
+    // Batch inverse with some zeros mixed in
+    std::vector<uint64_t> values(1000), inverted(1000), scratch(1000);
+    for (unsigned i = 0; i < 1000; ++i) {
+        values[i] = (i % 7 == 3) ? 0 : prng.Next();
+    }
+    inverted = values;
+    solinas64::BatchInverse(&inverted[0], 1000, &scratch[0]);
+
+    for (unsigned i = 0; i < 1000; ++i)
+    {
+        if (inverted[i] != solinas64::Inverse(values[i]))
+        {
+            cout << "Failed (BatchInverse mismatch) at i=" << i << endl;
+            SOLINAS64_DEBUG_BREAK();
             return false;
         }
     }
@@ -610,116 +536,433 @@ static bool TestMulInverse()
 
 
 //------------------------------------------------------------------------------
-// Tests: ByteReader
+// Tests: Lazy Reduction
 
-bool test_byte_reader(const uint8_t* data, unsigned bytes)
+// Tests Accum128 against summing the reference products one at a time
+static bool TestAccum128()
 {
-    solinas64::ByteReader reader;
-
-    reader.BeginRead(data, bytes);
+    cout << "TestAccum128...";
 
-    // Round up to the next 61 bits
-    uint64_t expandedBits = bytes * 8;
-    unsigned actualReads = 0;
-    unsigned bits = 0;
-    bool packed = false;
-    unsigned packedBit = 0;
+    solinas64::Random prng;
+    prng.Seed(15);
 
-    uint64_t fp;
-    while (solinas64::ReadResult::Success == reader.Read(fp))
+    for (unsigned loop = 0; loop < kRandomTestLoops / 100; ++loop)
     {
-        unsigned readStart = bits / 8;
-        if (readStart >= bytes)
-        {
-            // We can read one extra bit if the packing is the last thing
-            if (!packed || readStart != bytes)
-            {
-                SOLINAS64_DEBUG_BREAK();
-                cout << "Failed (too many reads) for bytes=" << bytes << " actualReads=" << actualReads << endl;
-                return false;
-            }
-        }
-
-        int readBytes = (int)bytes - (int)readStart;
-        if (readBytes < 0) {
-            readBytes = 0;
-        }
-        else if (readBytes > 8) {
-            readBytes = 8;
-        }
-
-        uint64_t x = solinas64::ReadBytes_LE(data + readStart, readBytes) >> (bits % 8);
-
-        int readBits = (readBytes * 8) - (bits % 8);
-        if (readBytes >= 8 && readBits > 0 && readBits < 61 && readStart + readBytes < bytes)
-        {
-            // Need to read one more byte sometimes
-            uint64_t high = data[readStart + readBytes];
-            high <<= readBits;
-            x |= high;
-        }
+        solinas64::Accum128 sum;
+        sum.Clear();
+        uint64_t expected = 0;
 
-        // Test packing
-        if (packed)
-        {
-            x <<= 1;
-            x |= packedBit;
-            bits += 60;
-            ++expandedBits;
-        }
-        else
+        // Mix edge values into long sums to exercise the carries into Top
+        const unsigned terms = 1 + static_cast<unsigned>(prng.Next() % 64);
+        for (unsigned i = 0; i < terms; ++i)
         {
-            bits += 61;
-        }
+            const uint64_t r = prng.Next();
+            const uint64_t x = (r & 1) ? kEdgeValues[(r >> 8) % kEdgeCount] : prng.Next();
+            const uint64_t y = (r & 2) ? kEdgeValues[(r >> 16) % kEdgeCount] : prng.Next();
 
-        x &= solinas64::kPrime;
-
-        packed = solinas64::IsU64Ambiguous(x);
-        if (packed)
-        {
-            packedBit = (x == solinas64::kPrime);
-            x = solinas64::kAmbiguityMask;
+            switch ((r >> 2) % 4)
+            {
+            case 0:
+                sum.Add(x);
+                expected = RefAdd(expected, x);
+                break;
+            case 1:
+            {
+                const unsigned shift = static_cast<unsigned>((r >> 24) % 64);
+                sum.ShiftAdd(x, shift);
+                expected = RefAdd(expected, RefMultiply(x, (uint64_t)1 << shift));
+                break;
+            }
+            case 2:
+                if (i == terms / 2) {
+                    sum.Fold();
+                }
+                // Fall through
+            default:
+                sum.MultiplyAdd(x, y);
+                expected = RefAdd(expected, RefMultiply(x, y));
+                break;
+            }
         }
 
-        if (fp != x)
+        const uint64_t result = sum.Reduce();
+        if (solinas64::Finalize(result) != expected)
         {
+            cout << "Failed (sum mismatch) for " << terms << " terms: "
+                << HexString(result) << " != " << HexString(expected) << endl;
             SOLINAS64_DEBUG_BREAK();
-            cout << "Failed (wrong value) for bytes=" << bytes << " actualReads=" << actualReads << endl;
             return false;
         }
-        ++actualReads;
     }
 
-    const unsigned expectedReads = (unsigned)((expandedBits + 60) / 61);
-    if (actualReads != expectedReads)
+    // Worst case: many maximal products
+    solinas64::Accum128 sum;
+    sum.Clear();
+    uint64_t expected = 0;
+    for (unsigned i = 0; i < 1000; ++i)
     {
-        SOLINAS64_DEBUG_BREAK();
-        cout << "Failed (read count wrong) for bytes=" << bytes << endl;
-        return false;
+        sum.MultiplyAdd(MASK64, MASK64);
+        expected = RefAdd(expected, RefMultiply(MASK64, MASK64));
     }
-
-    const unsigned maxWords = solinas64::ByteReader::MaxWords(bytes);
-    if (maxWords < actualReads)
+    if (solinas64::Finalize(sum.Reduce()) != expected)
     {
+        cout << "Failed (maximal products)" << endl;
         SOLINAS64_DEBUG_BREAK();
-        cout << "Failed (MaxWords wrong) for bytes=" << bytes << endl;
         return false;
     }
 
+    cout << "Passed" << endl;
+
     return true;
 }
 
-bool TestByteReader()
+
+//------------------------------------------------------------------------------
+// Tests: Extension Fields
+
+/// Reference Fp2 product from the base field reference operations
+static solinas64::Fp2 RefMultiplyFp2(const solinas64::Fp2& x, const solinas64::Fp2& y)
 {
-    cout << "TestByteReader...";
+    const solinas64::Fp2 r = {
+        RefAdd(RefMultiply(x.c0, y.c0), RefMultiply(7, RefMultiply(x.c1, y.c1))),
+        RefAdd(RefMultiply(x.c0, y.c1), RefMultiply(x.c1, y.c0))
+    };
+    return r;
+}
 
-    uint8_t data[10 + 8] = {
-        1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
-        0, 0, 0, 0, 0, 0, 0, 0 // Padding to simplify test
+/// Reference Fp3 product from the base field reference operations
+static solinas64::Fp3 RefMultiplyFp3(const solinas64::Fp3& x, const solinas64::Fp3& y)
+{
+    const solinas64::Fp3 r = {
+        RefAdd(RefMultiply(x.c0, y.c0), RefMultiply(2, RefAdd(RefMultiply(x.c1, y.c2), RefMultiply(x.c2, y.c1)))),
+        RefAdd(RefAdd(RefMultiply(x.c0, y.c1), RefMultiply(x.c1, y.c0)), RefMultiply(2, RefMultiply(x.c2, y.c2))),
+        RefAdd(RefAdd(RefMultiply(x.c0, y.c2), RefMultiply(x.c1, y.c1)), RefMultiply(x.c2, y.c0))
     };
+    return r;
+}
 
-    uint64_t w = solinas64::ReadU64_LE(data);
-    if (w != 0x0807060504030201ULL) {
+static bool IsEqualFp2(const solinas64::Fp2& x, const solinas64::Fp2& y)
+{
+    const solinas64::Fp2 a = solinas64::Finalize(x), b = solinas64::Finalize(y);
+    return a.c0 == b.c0 && a.c1 == b.c1;
+}
+
+static bool IsEqualFp3(const solinas64::Fp3& x, const solinas64::Fp3& y)
+{
+    const solinas64::Fp3 a = solinas64::Finalize(x), b = solinas64::Finalize(y);
+    return a.c0 == b.c0 && a.c1 == b.c1 && a.c2 == b.c2;
+}
+
+static uint64_t RandomTestWord(solinas64::Random& prng)
+{
+    const uint64_t w = prng.Next();
+    return (w % 4 == 0) ? kEdgeValues[(w >> 2) % kEdgeCount] : prng.Next();
+}
+
+static bool TestExtensionFields()
+{
+    cout << "TestExtensionFields...";
+
+    solinas64::Random prng;
+    prng.Seed(21);
+
+    const solinas64::Fp2 one2 = { 1, 0 }, zero2 = { 0, 0 };
+    const solinas64::Fp3 one3 = { 1, 0, 0 }, zero3 = { 0, 0, 0 };
+
+    // u^2 = 7 and u^3 = 2
+    const solinas64::Fp2 u2 = { 0, 1 };
+    const solinas64::Fp3 u3 = { 0, 1, 0 };
+    const solinas64::Fp2 seven = { 7, 0 };
+    const solinas64::Fp3 two = { 2, 0, 0 };
+    if (!IsEqualFp2(solinas64::Square(u2), seven) ||
+        !IsEqualFp3(solinas64::Multiply(solinas64::Square(u3), u3), two) ||
+        !IsEqualFp2(solinas64::Inverse(zero2), zero2) ||
+        !IsEqualFp3(solinas64::Inverse(zero3), zero3))
+    {
+        cout << "Failed (non-residues)" << endl;
+        SOLINAS64_DEBUG_BREAK();
+        return false;
+    }
+
+    for (unsigned i = 0; i < kRandomTestLoops / 10; ++i)
+    {
+        const solinas64::Fp2 x2 = { RandomTestWord(prng), RandomTestWord(prng) };
+        const solinas64::Fp2 y2 = { RandomTestWord(prng), RandomTestWord(prng) };
+        const solinas64::Fp3 x3 = { RandomTestWord(prng), RandomTestWord(prng), RandomTestWord(prng) };
+        const solinas64::Fp3 y3 = { RandomTestWord(prng), RandomTestWord(prng), RandomTestWord(prng) };
+
+        if (!IsEqualFp2(solinas64::Multiply(x2, y2), RefMultiplyFp2(x2, y2)) ||
+            !IsEqualFp2(solinas64::Square(x2), RefMultiplyFp2(x2, x2)) ||
+            !IsEqualFp2(solinas64::Subtract(solinas64::Add(x2, y2), y2), x2))
+        {
+            cout << "Failed (Fp2) for x = " << HexString(x2.c0) << " " << HexString(x2.c1) << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+
+        if (!IsEqualFp3(solinas64::Multiply(x3, y3), RefMultiplyFp3(x3, y3)) ||
+            !IsEqualFp3(solinas64::Square(x3), RefMultiplyFp3(x3, x3)) ||
+            !IsEqualFp3(solinas64::Subtract(solinas64::Add(x3, y3), y3), x3))
+        {
+            cout << "Failed (Fp3) for x = " << HexString(x3.c0) << " " << HexString(x3.c1)
+                << " " << HexString(x3.c2) << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+
+        const solinas64::Fp2 f2 = solinas64::Finalize(x2);
+        const solinas64::Fp3 f3 = solinas64::Finalize(x3);
+        if ((f2.c0 != 0 || f2.c1 != 0) &&
+            !IsEqualFp2(solinas64::Multiply(x2, solinas64::Inverse(x2)), one2))
+        {
+            cout << "Failed (Fp2 inverse) for x = " << HexString(x2.c0) << " " << HexString(x2.c1) << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+        if ((f3.c0 != 0 || f3.c1 != 0 || f3.c2 != 0) &&
+            !IsEqualFp3(solinas64::Multiply(x3, solinas64::Inverse(x3)), one3))
+        {
+            cout << "Failed (Fp3 inverse) for x = " << HexString(x3.c0) << " " << HexString(x3.c1)
+                << " " << HexString(x3.c2) << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+    }
+
+    // Region kernels match Multiply(), and the vector paths match the
+    // scalar path that handles a single element
+    for (unsigned count = 1; count <= 40; ++count)
+    {
+        std::vector<uint8_t> words(count * 24), output(count * 24), single(count * 24);
+        for (unsigned i = 0; i < count * 3; ++i) {
+            solinas64::WriteU64_LE(&words[i * 8], RandomTestWord(prng));
+        }
+        for (unsigned i = 0; i < count * 3; ++i) {
+            solinas64::WriteU64_LE(&output[i * 8], RandomTestWord(prng));
+        }
+
+        const solinas64::Fp2 c2 = { RandomTestWord(prng), RandomTestWord(prng) };
+        const solinas64::Fp3 c3 = { RandomTestWord(prng), RandomTestWord(prng), RandomTestWord(prng) };
+
+        for (unsigned add = 0; add <= 1; ++add)
+        {
+            single = output;
+            const std::vector<uint8_t> before = output;
+            if (add) {
+                solinas64::MultiplyAddWordsFp2(&words[0], count, c2, &output[0]);
+            }
+            else {
+                solinas64::MultiplyWordsFp2(&words[0], count, c2, &output[0]);
+            }
+
+            for (unsigned e = 0; e < count; ++e)
+            {
+                const solinas64::Fp2 x = { solinas64::ReadU64_LE(&words[e * 16]), solinas64::ReadU64_LE(&words[e * 16 + 8]) };
+                const solinas64::Fp2 prev = { solinas64::ReadU64_LE(&before[e * 16]), solinas64::ReadU64_LE(&before[e * 16 + 8]) };
+                const solinas64::Fp2 r = { solinas64::ReadU64_LE(&output[e * 16]), solinas64::ReadU64_LE(&output[e * 16 + 8]) };
+                solinas64::Fp2 expected = RefMultiplyFp2(x, c2);
+                if (add) {
+                    expected = solinas64::Add(expected, prev);
+                }
+
+                if (add) {
+                    solinas64::MultiplyAddWordsFp2(&words[e * 16], 1, c2, &single[e * 16]);
+                }
+                else {
+                    solinas64::MultiplyWordsFp2(&words[e * 16], 1, c2, &single[e * 16]);
+                }
+
+                if (!IsEqualFp2(r, expected))
+                {
+                    cout << "Failed (Fp2 region) at count = " << count << " e = " << e << " add = " << add << endl;
+                    SOLINAS64_DEBUG_BREAK();
+                    return false;
+                }
+            }
+            if (0 != memcmp(&single[0], &output[0], count * 16))
+            {
+                cout << "Failed (Fp2 region vector mismatch) at count = " << count << " add = " << add << endl;
+                SOLINAS64_DEBUG_BREAK();
+                return false;
+            }
+
+            const std::vector<uint8_t> before3 = output;
+            if (add) {
+                solinas64::MultiplyAddWordsFp3(&words[0], count, c3, &output[0]);
+            }
+            else {
+                solinas64::MultiplyWordsFp3(&words[0], count, c3, &output[0]);
+            }
+
+            for (unsigned e = 0; e < count; ++e)
+            {
+                const uint8_t* w = &words[e * 24];
+                const uint8_t* b = &before3[e * 24];
+                const uint8_t* o = &output[e * 24];
+                const solinas64::Fp3 x = { solinas64::ReadU64_LE(w), solinas64::ReadU64_LE(w + 8), solinas64::ReadU64_LE(w + 16) };
+                const solinas64::Fp3 prev = { solinas64::ReadU64_LE(b), solinas64::ReadU64_LE(b + 8), solinas64::ReadU64_LE(b + 16) };
+                const solinas64::Fp3 r = { solinas64::ReadU64_LE(o), solinas64::ReadU64_LE(o + 8), solinas64::ReadU64_LE(o + 16) };
+                solinas64::Fp3 expected = RefMultiplyFp3(x, c3);
+                if (add) {
+                    expected = solinas64::Add(expected, prev);
+                }
+
+                if (!IsEqualFp3(r, expected))
+                {
+                    cout << "Failed (Fp3 region) at count = " << count << " e = " << e << " add = " << add << endl;
+                    SOLINAS64_DEBUG_BREAK();
+                    return false;
+                }
+            }
+        }
+    }
+
+    cout << "Passed" << endl;
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// Tests: Compile-Time Arithmetic
+
+// These are evaluated by the compiler, so they fail the build if wrong
+static_assert(solinas64::ConstMultiply(solinas64::kPrime - 1, solinas64::kPrime - 1) == 1, "(-1)^2");
+static_assert(solinas64::ConstMultiply(MASK64, MASK64) == 0xfffffffc00000004ULL, "(2^32 - 2)^2");
+static_assert(solinas64::ConstPower(2, 96) == solinas64::kPrime - 1, "2^96 = -1");
+static_assert(solinas64::ConstPower(8, 64) == 1, "8 is a 64th root of unity");
+static_assert(solinas64::ConstAdd(solinas64::kPrime - 1, 2) == 1, "add wraps");
+static_assert(solinas64::ConstAdd(MASK64, MASK64) == 0x1fffffffcULL, "add of non-canonical inputs");
+static_assert(solinas64::ConstSubtract(0, 1) == solinas64::kPrime - 1, "subtract borrows");
+static_assert(solinas64::AppDataReader::GetMaxOutputBytes(1024) == 1024 + 3 * 8, "sizes");
+
+static bool TestConstArithmetic()
+{
+    cout << "TestConstArithmetic...";
+
+    solinas64::Random prng;
+    prng.Seed(23);
+
+    for (unsigned i = 0; i < kRandomTestLoops; ++i)
+    {
+        const uint64_t x = RandomTestWord(prng);
+        const uint64_t y = RandomTestWord(prng);
+
+        if (solinas64::ConstMultiply(x, y) != solinas64::Finalize(solinas64::Multiply(x, y)) ||
+            solinas64::ConstAdd(x, y) != solinas64::Finalize(solinas64::Add(x, y)) ||
+            solinas64::ConstSubtract(x, y) != solinas64::Finalize(solinas64::Subtract(x, y)))
+        {
+            cout << "Failed (mismatch) for x=" << HexString(x) << ", y=" << HexString(y) << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+
+        const uint64_t e = (i % 2 == 0) ? (y % 100) : y;
+        if (i % 16 == 0 && solinas64::ConstPower(x, e) != solinas64::Power(x, e))
+        {
+            cout << "Failed (power) for x=" << HexString(x) << ", e=" << HexString(e) << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+    }
+
+    cout << "Passed" << endl;
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// Tests: AppDataReader
+
+static bool test_app_data_reader(const uint8_t* data, unsigned bytes)
+{
+    std::vector<uint8_t> workspace(solinas64::AppDataReader::GetWorkspaceBytes(bytes) + 8);
+
+    solinas64::AppDataReader reader;
+    reader.SetupWorkspace(&workspace[0]);
+
+    // Expected extra bits, packed 63 per word
+    std::vector<uint64_t> expectedExtra;
+    unsigned extraBits = 0;
+
+    const unsigned fullWords = bytes / 8;
+    for (unsigned i = 0; i < fullWords; ++i)
+    {
+        const uint64_t original = solinas64::ReadU64_LE(data + i * 8);
+        const uint64_t w = reader.ReadNext8Bytes(data + i * 8);
+
+        if (w >= solinas64::kPrime)
+        {
+            cout << "Failed (word not in field) for bytes=" << bytes << " i=" << i << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+
+        if (solinas64::IsU64Ambiguous(original))
+        {
+            if (extraBits % 63 == 0) {
+                expectedExtra.push_back(0);
+            }
+            expectedExtra.back() |= (original >> 63) << (extraBits % 63);
+            ++extraBits;
+
+            if (w != (original & solinas64::kHighBitMask)) {
+                cout << "Failed (ambiguous word) for bytes=" << bytes << " i=" << i << endl;
+                SOLINAS64_DEBUG_BREAK();
+                return false;
+            }
+        }
+        else if (w != original)
+        {
+            cout << "Failed (word changed) for bytes=" << bytes << " i=" << i << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+    }
+
+    if (bytes % 8 != 0)
+    {
+        const uint64_t w = reader.ReadFinalBytes(data + fullWords * 8, bytes % 8);
+        if (w != solinas64::ReadBytes_LE(data + fullWords * 8, bytes % 8)) {
+            cout << "Failed (final bytes) for bytes=" << bytes << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+    }
+
+    const unsigned wordCount = reader.FlushAndGetWordCount();
+    if (wordCount != expectedExtra.size() ||
+        wordCount * 8 > solinas64::AppDataReader::GetWorkspaceBytes(bytes))
+    {
+        cout << "Failed (extra word count) for bytes=" << bytes << endl;
+        SOLINAS64_DEBUG_BREAK();
+        return false;
+    }
+
+    for (unsigned i = 0; i < wordCount; ++i)
+    {
+        if (solinas64::ReadU64_LE(reader.Data + i * 8) != expectedExtra[i]) {
+            cout << "Failed (extra word) for bytes=" << bytes << " i=" << i << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool TestAppDataReader()
+{
+    cout << "TestAppDataReader...";
+
+    uint8_t data[10 + 8] = {
+        1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+        0, 0, 0, 0, 0, 0, 0, 0 // Padding to simplify test
+    };
+
+    uint64_t w = solinas64::ReadU64_LE(data);
+    if (w != 0x0807060504030201ULL) {
         cout << "Failed (ReadU64_LE)" << endl;
         SOLINAS64_DEBUG_BREAK();
         return false;
@@ -751,69 +994,177 @@ bool TestByteReader()
         }
     }
 
-    uint8_t simpledata[16 + 8] = {
-        0, 1, 2, 3, 4, 5, 6, 7,
-        8, 9, 10, 11, 12, 13, 14, 15,
-        0
-    };
-
-    for (unsigned i = 0; i <= 16; ++i)
+    // Every word ambiguous, which fills multiple extra words
+    std::vector<uint8_t> allones(8 * 200, 0xff);
+    for (unsigned i = 0; i <= allones.size(); ++i)
     {
-        if (!test_byte_reader(simpledata, i)) {
+        if (!test_app_data_reader(&allones[0], i)) {
             return false;
         }
     }
 
-    uint8_t allones[16 + 8] = {
-        254,255,255,255,255,255,255,255,
-        255,255,255,255,255,255,255,255,
-        0
-    };
+    std::vector<uint8_t> randBytes(kMaxDataLength);
+
+    solinas64::Random prng;
+    prng.Seed(10);
 
-    for (unsigned i = 0; i <= 16; ++i)
+    for (unsigned i = 1; i < kMaxDataLength; i += 7)
     {
-        if (!test_byte_reader(allones, i)) {
+        FillTestData(prng, &randBytes[0], i);
+
+        if (!test_app_data_reader(&randBytes[0], i)) {
             return false;
         }
     }
 
-    uint8_t mixed[20 + 8] = {
-        254,255,255,255,255,255,255,255,0, // Inject a non-overflowing bit in the middle
-        255,255,255,255,255,255,255,
-        255,255,255,255,
-        0
-    };
-
-    for (unsigned i = 0; i <= 16; ++i)
+    // Half the words ambiguous with random high bits, so the vector readers
+    // emit every pattern of extra bits.  Multiplying by 1 must give the same
+    // words and extra words as the scalar reader.
+    std::vector<uint8_t> expected, output, workspace;
+    for (unsigned bytes = 1; bytes < kMaxDataLength; bytes += 5)
     {
-        if (!test_byte_reader(allones, i)) {
+        for (unsigned k = 0; k < bytes; ++k) {
+            randBytes[k] = (uint8_t)prng.Next();
+        }
+        for (unsigned k = 0; k + 8 <= bytes; k += 8)
+        {
+            const uint64_t w = prng.Next();
+            solinas64::WriteU64_LE(&randBytes[k], (w & 1) ? (w | solinas64::kAmbiguityMask) : w);
+        }
+
+        const unsigned maxBytes = solinas64::AppDataReader::GetMaxOutputBytes(bytes);
+        const unsigned fullWords = bytes / 8;
+        expected.assign(maxBytes, 0);
+        workspace.resize(solinas64::AppDataReader::GetWorkspaceBytes(bytes) + 8);
+
+        solinas64::AppDataReader reader;
+        reader.SetupWorkspace(&workspace[0]);
+        for (unsigned i = 0; i < fullWords; ++i) {
+            solinas64::WriteU64_LE(&expected[i * 8], reader.ReadNext8Bytes(&randBytes[i * 8]));
+        }
+        unsigned expectedBytes = fullWords * 8;
+        if (bytes % 8 != 0)
+        {
+            solinas64::WriteU64_LE(&expected[expectedBytes], reader.ReadFinalBytes(&randBytes[expectedBytes], bytes % 8));
+            expectedBytes += 8;
+        }
+        const unsigned extraBytes = reader.FlushAndGetWordCount() * 8;
+        memcpy(&expected[expectedBytes], reader.Data, extraBytes);
+        expectedBytes += extraBytes;
+
+        output.assign(maxBytes, 0);
+        if (solinas64::MultiplyRegion(&randBytes[0], bytes, (uint64_t)1, &workspace[0], &output[0]) != expectedBytes ||
+            0 != memcmp(&output[0], &expected[0], maxBytes))
+        {
+            cout << "Failed (vector reader mismatch) for bytes=" << bytes << endl;
+            SOLINAS64_DEBUG_BREAK();
             return false;
         }
     }
 
-    vector<uint8_t> randBytes(kMaxDataLength + 8, 0); // +8 to avoid bounds checking
+    cout << "Passed" << endl;
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// Tests: AppDataWriter
+
+static bool TestAppDataWriter()
+{
+    cout << "TestAppDataWriter...";
 
     solinas64::Random prng;
-    prng.Seed(10);
+    prng.Seed(14);
+
+    std::vector<uint8_t> original, words, workspace, recovered;
 
-    for (unsigned i = 0; i < kMaxDataLength; ++i)
+    for (unsigned bytes = 1; bytes < kMaxDataLength; bytes += 3)
     {
-        for (unsigned j = 0; j < 1; ++j)
+        original.resize(bytes);
+        FillTestData(prng, &original[0], bytes);
+
+        // Some inputs are all ambiguous to exercise the extra bits
+        if (bytes % 17 == 0) {
+            memset(&original[0], 0xff, bytes);
+        }
+
+        const unsigned maxBytes = solinas64::AppDataReader::GetMaxOutputBytes(bytes);
+        words.assign(maxBytes, 0);
+        workspace.resize(solinas64::AppDataReader::GetWorkspaceBytes(bytes) + 8);
+
+        // Multiplying by one produces the AppDataReader words as-is
+        const unsigned written = solinas64::MultiplyRegion(
+            &original[0], bytes, 1, &workspace[0], &words[0]);
+
+        if (written > maxBytes)
         {
-            // Fill the data with random bytes
-            for (unsigned k = 0; k < i; k += 8)
-            {
-                uint64_t w;
-                if (prng.Next() % 100 <= 3) {
-                    w = ~(uint64_t)0;
-                }
-                else {
-                    w = prng.Next();
-                }
-                solinas64::WriteU64_LE(&randBytes[k], w);
+            cout << "Failed (byte count mismatch) at bytes = " << bytes << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+
+        recovered.assign(bytes, 0);
+        solinas64::RestoreRegion(&words[0], bytes, &recovered[0]);
+
+        if (0 != memcmp(&recovered[0], &original[0], bytes))
+        {
+            cout << "Failed (data corruption) at bytes = " << bytes << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+
+        // Non-canonical words must restore to the same data
+        for (unsigned i = 0; i < maxBytes; i += 8)
+        {
+            const uint64_t x = solinas64::ReadU64_LE(&words[i]);
+            if (x < solinas64::kPrimeSubC) {
+                solinas64::WriteU64_LE(&words[i], x + solinas64::kPrime);
             }
+        }
+
+        recovered.assign(bytes, 0);
+        solinas64::RestoreRegion(&words[0], bytes, &recovered[0]);
+
+        if (0 != memcmp(&recovered[0], &original[0], bytes))
+        {
+            cout << "Failed (non-canonical corruption) at bytes = " << bytes << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+    }
+
+    cout << "Passed" << endl;
+
+    return true;
+}
+
 
-            if (!test_byte_reader(&randBytes[0], i)) {
+//------------------------------------------------------------------------------
+// Tests: Random
+
+static bool TestRandom()
+{
+    cout << "TestRandom...";
+
+    for (int i = -1000; i < 1000; ++i)
+    {
+        const uint64_t x = static_cast<uint64_t>(static_cast<int64_t>(i));
+        const uint64_t inputs[3] = {
+            x,
+            solinas64::kPrime + x,
+            solinas64::HashU64(x)
+        };
+
+        for (unsigned j = 0; j < 3; ++j)
+        {
+            const uint64_t r = solinas64::HashToNonzeroFp(inputs[j]);
+
+            if (r == 0 || r >= solinas64::kPrime)
+            {
+                cout << "Failed (HashToNonzeroFp) at i = " << i << endl;
+                SOLINAS64_DEBUG_BREAK();
                 return false;
             }
         }
@@ -825,58 +1176,1793 @@ bool TestByteReader()
 }
 
 
-//------------------------------------------------------------------------------
-// Tests: Random
+//------------------------------------------------------------------------------
+// Tests: Integration
+
+// Tests the region operations and packet reconstruction together
+static bool TestIntegration()
+{
+    cout << "TestIntegration...";
+
+    std::vector<uint8_t> data, recovery, workspace, words, recovered;
+
+    solinas64::Random prng;
+    prng.Seed(13);
+
+    // Test a range of data sizes
+    for (unsigned bytes = 1; bytes < kMaxDataLength; ++bytes)
+    {
+        data.resize(bytes);
+        FillTestData(prng, &data[0], bytes);
+
+        // Pick random coefficient to multiply between 1..p-1
+        const uint64_t coeff = solinas64::HashToNonzeroFp(prng.Next());
+        const uint64_t inv_coeff = solinas64::Inverse(coeff);
+
+        // Preallocate enough space in recovery packets for the worst case
+        const unsigned maxBytes = solinas64::AppDataReader::GetMaxOutputBytes(bytes);
+        recovery.assign(maxBytes, 0);
+        workspace.resize(solinas64::AppDataReader::GetWorkspaceBytes(bytes) + 8);
+
+        // recovery = data * coeff
+        const unsigned recoveryBytes = solinas64::MultiplyRegion(
+            &data[0], bytes, coeff, &workspace[0], &recovery[0]);
+
+        if (recoveryBytes > maxBytes || recoveryBytes < ((bytes + 7) & ~7u))
+        {
+            cout << "Failed (byte count mismatch) at bytes = " << bytes << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+
+        // The workspace-free version must produce the same bytes
+        words.assign(maxBytes, 0);
+        if (solinas64::MultiplyRegion(&data[0], bytes, coeff, &words[0]) != recoveryBytes ||
+            0 != memcmp(&words[0], &recovery[0], maxBytes))
+        {
+            cout << "Failed (workspace-free mismatch) at bytes = " << bytes << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+
+        // words = recovery * coeff^-1
+        words.resize(maxBytes);
+        solinas64::MultiplyWords(&recovery[0], maxBytes / 8, inv_coeff, &words[0]);
+
+        recovered.assign(bytes, 0);
+        solinas64::RestoreRegion(&words[0], bytes, &recovered[0]);
+
+        if (0 != memcmp(&recovered[0], &data[0], bytes))
+        {
+            cout << "Failed (data corruption) at bytes = " << bytes << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+    }
+
+    cout << "Passed" << endl;
+
+    return true;
+}
+
+
+// Sizes buffers exactly with GetWorkspaceBytes() / GetMaxOutputBytes() for
+// input where every full word is ambiguous, which is the worst case: each
+// word emits one extra bit and each extra word holds 63 of them
+static bool TestWorkspaceSizing()
+{
+    cout << "TestWorkspaceSizing...";
+
+    static const unsigned kWordCounts[] = {
+        1, 2, 62, 63, 64, 65, 125, 126, 127, 128, 189, 190, 252, 4032, 4033
+    };
+    static const uint8_t kCanary = 0xa5;
+    static const unsigned kCanaryBytes = 16;
+
+    std::vector<uint8_t> data, workspace, output, recovered;
+
+    solinas64::Random prng;
+    prng.Seed(23);
+
+    for (unsigned wordCount : kWordCounts)
+    {
+        for (unsigned tailBytes = 0; tailBytes < 8; tailBytes += 3)
+        {
+            const unsigned bytes = wordCount * 8 + tailBytes;
+            const unsigned workspaceBytes = solinas64::AppDataReader::GetWorkspaceBytes(bytes);
+            const unsigned maxBytes = solinas64::AppDataReader::GetMaxOutputBytes(bytes);
+
+            // One extra word per 63 ambiguous words, rounded up
+            const unsigned extraWords = (wordCount + 62) / 63;
+            if (workspaceBytes != extraWords * 8 ||
+                maxBytes != workspaceBytes + (bytes + 7) / 8 * 8)
+            {
+                cout << "Failed (size formula) at bytes = " << bytes << endl;
+                SOLINAS64_DEBUG_BREAK();
+                return false;
+            }
+
+            for (unsigned fill = 0; fill < 2; ++fill)
+            {
+                data.resize(bytes);
+                if (fill == 0) {
+                    memset(&data[0], 0xff, bytes);
+                }
+                else {
+                    FillAmbiguousData(prng, &data[0], bytes);
+                }
+
+                const uint64_t coeff = solinas64::HashToNonzeroFp(prng.Next());
+
+                workspace.assign(workspaceBytes + kCanaryBytes, kCanary);
+                output.assign(maxBytes + kCanaryBytes, kCanary);
+
+                const unsigned written = solinas64::MultiplyRegion(
+                    &data[0], bytes, coeff, &workspace[0], &output[0]);
+
+                bool canaryOk = true;
+                for (unsigned i = 0; i < kCanaryBytes; ++i) {
+                    if (workspace[workspaceBytes + i] != kCanary ||
+                        output[maxBytes + i] != kCanary) {
+                        canaryOk = false;
+                    }
+                }
+
+                if (written != maxBytes || !canaryOk)
+                {
+                    cout << "Failed (overrun) at bytes = " << bytes << " fill = " << fill << endl;
+                    SOLINAS64_DEBUG_BREAK();
+                    return false;
+                }
+
+                // The workspace-free version fills the same exact-size buffer
+                output.assign(maxBytes + kCanaryBytes, kCanary);
+                if (solinas64::MultiplyRegion(&data[0], bytes, coeff, &output[0]) != maxBytes)
+                {
+                    cout << "Failed (workspace-free size) at bytes = " << bytes << endl;
+                    SOLINAS64_DEBUG_BREAK();
+                    return false;
+                }
+                for (unsigned i = 0; i < kCanaryBytes; ++i)
+                {
+                    if (output[maxBytes + i] != kCanary)
+                    {
+                        cout << "Failed (workspace-free overrun) at bytes = " << bytes << endl;
+                        SOLINAS64_DEBUG_BREAK();
+                        return false;
+                    }
+                }
+
+                // And the data round-trips out of the exact-size buffer
+                solinas64::MultiplyWords(&output[0], maxBytes / 8,
+                    solinas64::Inverse(coeff), &output[0]);
+                recovered.assign(bytes, 0);
+                solinas64::RestoreRegion(&output[0], bytes, &recovered[0]);
+
+                if (0 != memcmp(&recovered[0], &data[0], bytes))
+                {
+                    cout << "Failed (data corruption) at bytes = " << bytes << endl;
+                    SOLINAS64_DEBUG_BREAK();
+                    return false;
+                }
+            }
+        }
+    }
+
+    cout << "Passed" << endl;
+
+    return true;
+}
+
+// Tests that the workspace-free MultiplyAddRegion() produces the same bytes
+// as the workspace version, up to the largest number of overflow words
+static bool TestMultiplyAddRegionTail()
+{
+    cout << "TestMultiplyAddRegionTail...";
+
+    solinas64::Random prng;
+    prng.Seed(22);
+
+    std::vector<uint8_t> data, workspace, tail, expected;
+
+    for (unsigned loop = 0; loop < 3000; ++loop)
+    {
+        // Sizes around the multiples of the 4032-byte tail steps, then random
+        const unsigned bytes = (loop < 600) ?
+            (loop / 40 + 1) * 63 * 64 + loop % 40 - 20 :
+            1 + static_cast<unsigned>(prng.Next() % kMaxDataLength);
+
+        data.resize(bytes);
+        switch (loop % 3)
+        {
+        case 0: memset(&data[0], 0xff, bytes); break;
+        case 1: FillAmbiguousData(prng, &data[0], bytes); break;
+        default: FillTestData(prng, &data[0], bytes); break;
+        }
+
+        const uint64_t coeff = solinas64::HashToNonzeroFp(prng.Next());
+
+        const unsigned maxBytes = solinas64::AppDataReader::GetMaxOutputBytes(bytes);
+        tail.resize(maxBytes);
+        for (unsigned j = 0; j < maxBytes; ++j) {
+            tail[j] = static_cast<uint8_t>(prng.Next());
+        }
+        expected = tail;
+
+        workspace.resize(solinas64::AppDataReader::GetWorkspaceBytes(bytes) + 8);
+        const unsigned tailBytes = solinas64::MultiplyAddRegion(&data[0], bytes, coeff, &tail[0]);
+        const unsigned expectedBytes = solinas64::MultiplyAddRegion(
+            &data[0], bytes, coeff, &workspace[0], &expected[0]);
+
+        if (tailBytes != expectedBytes || tail != expected)
+        {
+            cout << "Failed (mismatch) at bytes = " << bytes << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+
+        // With every full word ambiguous the overflow words fill the buffer
+        if (loop % 3 != 2 && bytes % 8 == 0 && tailBytes != maxBytes)
+        {
+            cout << "Failed (overflow length) at bytes = " << bytes << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+    }
+
+    cout << "Passed" << endl;
+
+    return true;
+}
+
+
+// Tests the prepared coefficient kernels against the scalar Multiply()
+static bool TestMulConst()
+{
+    cout << "TestMulConst...";
+
+    std::vector<uint8_t> data, workspace, words, product, expected, aligned;
+
+    solinas64::Random prng;
+    prng.Seed(14);
+
+    // A default-constructed coefficient is 0
+    {
+        solinas64::MulConst zero;
+        uint8_t input[20], output[solinas64::AppDataReader::GetMaxOutputBytes(20)];
+        memset(input, 0xff, sizeof(input));
+        memset(output, 0xcc, sizeof(output));
+
+        const unsigned zeroBytes = solinas64::MultiplyRegion(input, sizeof(input), zero, output);
+        bool allZero = (zeroBytes == 24);
+        for (unsigned j = 0; j < zeroBytes; ++j) {
+            allZero = allZero && output[j] == 0;
+        }
+        if (zero.Coeff != 0 || !allZero)
+        {
+            cout << "Failed (default coefficient)" << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+    }
+
+    for (unsigned i = 0; i < 2000; ++i)
+    {
+        const unsigned bytes = 1 + (unsigned)(prng.Next() % kMaxDataLength);
+        data.resize(bytes);
+        FillTestData(prng, &data[0], bytes);
+
+        // Cover each kernel: one, shift, below 2^32 and general
+        uint64_t coeff;
+        switch (i % 4)
+        {
+        case 0: coeff = 1; break;
+        case 1: coeff = (uint64_t)1 << (prng.Next() % 64); break;
+        case 2: coeff = (uint32_t)prng.Next(); break;
+        default: coeff = solinas64::HashToNonzeroFp(prng.Next()); break;
+        }
+        coeff %= solinas64::kPrime;
+
+        solinas64::MulConst prepared;
+        prepared.Set(coeff);
+
+        const unsigned maxBytes = solinas64::AppDataReader::GetMaxOutputBytes(bytes);
+        workspace.resize(solinas64::AppDataReader::GetWorkspaceBytes(bytes) + 8);
+        words.assign(maxBytes, 0);
+        const unsigned wordBytes = solinas64::MultiplyRegion(
+            &data[0], bytes, (uint64_t)1, &workspace[0], &words[0]);
+
+        // product = random + words * coeff
+        product.resize(maxBytes);
+        for (unsigned j = 0; j < maxBytes; ++j) {
+            product[j] = (uint8_t)prng.Next();
+        }
+        expected = product;
+        for (unsigned j = 0; j < wordBytes; j += 8)
+        {
+            const uint64_t x = solinas64::ReadU64_LE(&words[j]);
+            const uint64_t y = solinas64::ReadU64_LE(&expected[j]);
+            solinas64::WriteU64_LE(&expected[j], solinas64::Add(y, solinas64::Multiply(x, coeff)));
+        }
+
+        if (solinas64::MultiplyAddRegion(&data[0], bytes, prepared, &workspace[0], &product[0]) != wordBytes ||
+            0 != memcmp(&product[0], &expected[0], maxBytes))
+        {
+            cout << "Failed (multiply-add mismatch) for coeff = " << coeff << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+
+        for (unsigned j = 0; j < wordBytes; j += 8)
+        {
+            const uint64_t x = solinas64::ReadU64_LE(&words[j]);
+            solinas64::WriteU64_LE(&expected[j], solinas64::Multiply(x, coeff));
+        }
+
+        if (solinas64::MultiplyRegion(&data[0], bytes, prepared, &product[0]) != wordBytes ||
+            0 != memcmp(&product[0], &expected[0], wordBytes))
+        {
+            cout << "Failed (multiply mismatch) for coeff = " << coeff << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+
+        // The memory hints must not change the output.  The non-temporal
+        // stores need an aligned output
+        aligned.resize(maxBytes + 64);
+        uint8_t* out = &aligned[0] + (64 - reinterpret_cast<uintptr_t>(&aligned[0]) % 64) % 64;
+        const unsigned hints = solinas64::kHintPrefetch | solinas64::kHintStreamOutput;
+
+        if (solinas64::MultiplyRegion(&data[0], bytes, prepared, &workspace[0], out, hints) != wordBytes ||
+            0 != memcmp(out, &expected[0], wordBytes))
+        {
+            cout << "Failed (multiply hints mismatch) for coeff = " << coeff << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+
+        for (unsigned j = 0; j < wordBytes; j += 8)
+        {
+            const uint64_t x = solinas64::ReadU64_LE(&words[j]);
+            solinas64::WriteU64_LE(&expected[j], solinas64::Add(solinas64::ReadU64_LE(&expected[j]), solinas64::Multiply(x, coeff)));
+        }
+
+        if (solinas64::MultiplyAddRegion(&data[0], bytes, coeff, &workspace[0], out, hints) != wordBytes ||
+            0 != memcmp(out, &expected[0], wordBytes))
+        {
+            cout << "Failed (multiply-add hints mismatch) for coeff = " << coeff << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+    }
+
+    cout << "Passed" << endl;
+
+    return true;
+}
+
+
+// Tests the region operations, which use the vector kernels when the CPU
+// has them, against the word-at-a-time reference with general coefficients
+// and mostly ambiguous data
+static bool TestRegionKernels()
+{
+    cout << "TestRegionKernels...";
+
+    solinas64::Random prng;
+    prng.Seed(18);
+
+    std::vector<uint8_t> data, workspace, output, initial;
+    std::vector<uint64_t> words, expected;
+
+    for (unsigned loop = 0; loop < 3000; ++loop)
+    {
+        // Every size up to a few vectors of words, then larger ones
+        const unsigned bytes = (loop < 1200) ?
+            1 + loop / 3 :
+            1 + static_cast<unsigned>(prng.Next() % kMaxDataLength);
+
+        data.resize(bytes);
+        switch (loop % 3)
+        {
+        case 0: memset(&data[0], 0xff, bytes); break;
+        case 1: FillAmbiguousData(prng, &data[0], bytes); break;
+        default: FillTestData(prng, &data[0], bytes); break;
+        }
+
+        uint64_t coeff = solinas64::HashToNonzeroFp(prng.Next());
+        if (loop % 7 == 0) {
+            coeff = solinas64::kPrime - 1 - (prng.Next() % 4);
+        }
+
+        const unsigned wordCount = RefExpandRegion(&data[0], bytes, words);
+        const unsigned maxBytes = solinas64::AppDataReader::GetMaxOutputBytes(bytes);
+        workspace.resize(solinas64::AppDataReader::GetWorkspaceBytes(bytes) + 8);
+
+        initial.resize(maxBytes);
+        for (unsigned j = 0; j < maxBytes; ++j) {
+            initial[j] = static_cast<uint8_t>(prng.Next());
+        }
+
+        // output = data * coeff
+        expected.resize(wordCount);
+        for (unsigned j = 0; j < wordCount; ++j) {
+            expected[j] = solinas64::Multiply(words[j], coeff);
+        }
+
+        output = initial;
+        if (solinas64::MultiplyRegion(&data[0], bytes, coeff, &workspace[0], &output[0]) != wordCount * 8 ||
+            !IsEqualWords(&output[0], &expected[0], wordCount))
+        {
+            cout << "Failed (multiply mismatch) at bytes = " << bytes << " coeff = " << coeff << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+
+        // output = initial + data * coeff
+        for (unsigned j = 0; j < wordCount; ++j) {
+            expected[j] = solinas64::Add(expected[j], solinas64::ReadU64_LE(&initial[j * 8]));
+        }
+
+        output = initial;
+        if (solinas64::MultiplyAddRegion(&data[0], bytes, coeff, &workspace[0], &output[0]) != wordCount * 8 ||
+            !IsEqualWords(&output[0], &expected[0], wordCount))
+        {
+            cout << "Failed (multiply-add mismatch) at bytes = " << bytes << " coeff = " << coeff << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+    }
+
+    cout << "Passed" << endl;
+
+    return true;
+}
+
+
+// Tests applying one input to many outputs against one MultiplyAddRegion()
+// call per output and the word-at-a-time reference
+static bool TestMultiplyAddRegionMulti()
+{
+    cout << "TestMultiplyAddRegionMulti...";
+
+    solinas64::Random prng;
+    prng.Seed(15);
+
+    static const unsigned kSizes[] = { 1, 7, 8, 9, 63, 65, 1003 };
+    static const unsigned kCount = 6;
+
+    std::vector<uint8_t> data, workspace;
+    std::vector<uint64_t> words;
+    std::vector<uint8_t> multi[kCount], expected[kCount];
+    uint8_t* outputs[kCount];
+    uint64_t coeffs[kCount];
+
+    for (unsigned loop = 0; loop < 300; ++loop)
+    {
+        const unsigned bytes = (loop < 7 * 3) ?
+            kSizes[loop % 7] :
+            1 + static_cast<unsigned>(prng.Next() % kMaxDataLength);
+
+        data.resize(bytes);
+        switch (loop % 3)
+        {
+        case 0: memset(&data[0], 0xff, bytes); break;
+        case 1: FillAmbiguousData(prng, &data[0], bytes); break;
+        default: FillTestData(prng, &data[0], bytes); break;
+        }
+
+        coeffs[0] = 0;
+        coeffs[1] = 1;
+        coeffs[2] = solinas64::kPrime - 1;
+        for (unsigned i = 3; i < kCount; ++i) {
+            coeffs[i] = solinas64::HashToNonzeroFp(prng.Next());
+        }
+
+        const unsigned maxBytes = solinas64::AppDataReader::GetMaxOutputBytes(bytes);
+        for (unsigned i = 0; i < kCount; ++i)
+        {
+            multi[i].resize(maxBytes);
+            for (unsigned j = 0; j < maxBytes; ++j) {
+                multi[i][j] = static_cast<uint8_t>(prng.Next());
+            }
+            expected[i] = multi[i];
+            outputs[i] = &multi[i][0];
+        }
+
+        const std::vector<uint8_t> original = multi[kCount - 1];
+
+        workspace.resize(solinas64::AppDataReader::GetWorkspaceBytes(bytes) + 8);
+        const unsigned multiBytes = solinas64::MultiplyAddRegionMulti(
+            &data[0], bytes, coeffs, kCount, &workspace[0], outputs);
+
+        const unsigned wordCount = RefExpandRegion(&data[0], bytes, words);
+        if (multiBytes != wordCount * 8)
+        {
+            cout << "Failed (length mismatch) at bytes = " << bytes << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+
+        for (unsigned i = 0; i < kCount; ++i)
+        {
+            const unsigned expectedBytes = solinas64::MultiplyAddRegion(
+                &data[0], bytes, coeffs[i], &workspace[0], &expected[i][0]);
+
+            // A zero coefficient leaves the tail alone and returns a shorter length
+            const unsigned zeroBytes = (bytes + 7) & ~7u;
+            if (expectedBytes != (coeffs[i] == 0 ? zeroBytes : multiBytes))
+            {
+                cout << "Failed (per-output length mismatch) at bytes = " << bytes << " coeff = " << coeffs[i] << endl;
+                SOLINAS64_DEBUG_BREAK();
+                return false;
+            }
+
+            for (unsigned j = 0; j < maxBytes; j += 8)
+            {
+                if (solinas64::Finalize(solinas64::ReadU64_LE(&multi[i][j])) !=
+                    solinas64::Finalize(solinas64::ReadU64_LE(&expected[i][j])))
+                {
+                    cout << "Failed (per-output mismatch) at bytes = " << bytes << " coeff = " << coeffs[i] << endl;
+                    SOLINAS64_DEBUG_BREAK();
+                    return false;
+                }
+            }
+        }
+
+        // Check the last output against the reference words as well
+        for (unsigned j = 0; j < wordCount; ++j) {
+            words[j] = solinas64::Add(
+                solinas64::Multiply(words[j], coeffs[kCount - 1]),
+                solinas64::ReadU64_LE(&original[j * 8]));
+        }
+        if (!IsEqualWords(&multi[kCount - 1][0], &words[0], wordCount))
+        {
+            cout << "Failed (reference mismatch) at bytes = " << bytes << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+    }
+
+    cout << "Passed" << endl;
+
+    return true;
+}
+
+
+// Tests the matrix-vector encoder against MultiplyRegion() for the first
+// original followed by MultiplyAddRegion() for the rest, across several
+// groups of kEncodeRowGroup originals
+static bool TestEncodeRow()
+{
+    cout << "TestEncodeRow...";
+
+    solinas64::Random prng;
+    prng.Seed(17);
+
+    static const unsigned kCounts[] = { 1, 15, 16, 17, 32, 33, 50 };
+    static const unsigned kMaxN = 50;
+
+    std::vector<uint8_t> storage, workspace, recovery, expected;
+    std::vector<uint64_t> words;
+    const uint8_t* originals[kMaxN];
+    uint64_t coeffs[kMaxN];
+
+    for (unsigned loop = 0; loop < 70; ++loop)
+    {
+        const unsigned N = kCounts[loop % 7];
+        const unsigned bytes = 1 + static_cast<unsigned>(prng.Next() % 3000);
+        const unsigned mode = (loop / 7) % 3;
+
+        storage.resize(N * bytes);
+        for (unsigned i = 0; i < N; ++i)
+        {
+            uint8_t* original = &storage[i * bytes];
+            originals[i] = original;
+
+            if (mode == 0)
+            {
+                // Largest unambiguous words and the largest coefficient, to
+                // push the lazy reduction to its bound
+                for (unsigned k = 0; k < bytes; ++k) {
+                    original[k] = (k % 8 == 4) ? 0xfe : 0xff;
+                }
+                coeffs[i] = solinas64::kPrime - 1;
+            }
+            else
+            {
+                if (mode == 1) {
+                    FillAmbiguousData(prng, original, bytes);
+                }
+                else {
+                    FillTestData(prng, original, bytes);
+                }
+                coeffs[i] = (i % 5 == 3) ? 0 : solinas64::HashToNonzeroFp(prng.Next());
+            }
+        }
+
+        const unsigned maxBytes = solinas64::AppDataReader::GetMaxOutputBytes(bytes);
+        workspace.resize(solinas64::GetEncodeRowWorkspaceBytes(bytes) + 8);
+        recovery.assign(maxBytes, 0xcc);
+
+        const unsigned recoveryBytes = solinas64::EncodeRow(
+            originals, N, bytes, coeffs, &workspace[0], &recovery[0]);
+
+        // The chain only clears the data words, so start it at zero
+        expected.assign(maxBytes, 0);
+        unsigned expectedBytes = 0;
+        for (unsigned i = 0; i < N; ++i)
+        {
+            if (i == 0) {
+                solinas64::MultiplyRegion(originals[i], bytes, coeffs[i], &workspace[0], &expected[0]);
+            }
+            else {
+                solinas64::MultiplyAddRegion(originals[i], bytes, coeffs[i], &workspace[0], &expected[0]);
+            }
+
+            const unsigned wordCount = RefExpandRegion(originals[i], bytes, words);
+            if (expectedBytes < wordCount * 8) {
+                expectedBytes = wordCount * 8;
+            }
+        }
+
+        if (recoveryBytes != expectedBytes)
+        {
+            cout << "Failed (length mismatch) at N = " << N << " bytes = " << bytes << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+
+        for (unsigned j = 0; j < maxBytes; j += 8)
+        {
+            if (solinas64::Finalize(solinas64::ReadU64_LE(&recovery[j])) !=
+                solinas64::Finalize(solinas64::ReadU64_LE(&expected[j])))
+            {
+                cout << "Failed (data mismatch) at N = " << N << " bytes = " << bytes << endl;
+                SOLINAS64_DEBUG_BREAK();
+                return false;
+            }
+        }
+    }
+
+    cout << "Passed" << endl;
+
+    return true;
+}
+
+
+// Tests the tiled encoder against a MultiplyRegion()/MultiplyAddRegion()
+// chain into zeroed buffers, and against EncodeRow()
+static bool TestEncodeTiled()
+{
+    cout << "TestEncodeTiled...";
+
+    solinas64::Random prng;
+    prng.Seed(20);
+
+    static const unsigned kTileSizes[] = { 64, 4096, solinas64::kDefaultEncodeTileBytes };
+    static const unsigned kMaxN = 12;
+    static const unsigned kMaxR = 4;
+
+    std::vector<uint8_t> storage, workspace, rowWorkspace, row;
+    std::vector<uint8_t> tiled[kMaxR], expected[kMaxR];
+    uint8_t* recoveries[kMaxR];
+    const uint8_t* originals[kMaxN];
+    uint64_t coeffs[kMaxN * kMaxR];
+    uint64_t rowCoeffs[kMaxN];
+
+    for (unsigned loop = 0; loop < 60; ++loop)
+    {
+        const unsigned tileBytes = kTileSizes[loop % 3];
+        const unsigned N = 1 + static_cast<unsigned>(prng.Next() % kMaxN);
+        const unsigned R = 1 + static_cast<unsigned>(prng.Next() % kMaxR);
+
+        // Up to several tiles, rarely a multiple of the tile size
+        const unsigned bytes = 1 + static_cast<unsigned>(prng.Next() % (3 * tileBytes + 100));
+
+        storage.resize(N * bytes);
+        for (unsigned i = 0; i < N; ++i)
+        {
+            uint8_t* original = &storage[i * bytes];
+            originals[i] = original;
+
+            // Mostly ambiguous words, so the overflow words complete mid-tile
+            if (loop % 2 == 0) {
+                FillAmbiguousData(prng, original, bytes);
+            }
+            else {
+                FillTestData(prng, original, bytes);
+            }
+
+            for (unsigned r = 0; r < R; ++r) {
+                coeffs[i * R + r] = (prng.Next() % 8 == 0) ? 0 : solinas64::HashToNonzeroFp(prng.Next());
+            }
+        }
+
+        const unsigned maxBytes = solinas64::AppDataReader::GetMaxOutputBytes(bytes);
+        for (unsigned r = 0; r < R; ++r)
+        {
+            tiled[r].assign(maxBytes, 0xcc);
+            recoveries[r] = &tiled[r][0];
+        }
+
+        workspace.resize(solinas64::GetEncodeTiledWorkspaceBytes(N, bytes) + 8);
+        const unsigned tiledBytes = solinas64::EncodeTiled(
+            originals, N, bytes, coeffs, R, &workspace[0], recoveries, tileBytes);
+
+        rowWorkspace.resize(solinas64::GetEncodeRowWorkspaceBytes(bytes) + 8);
+        for (unsigned r = 0; r < R; ++r)
+        {
+            // The chain leaves the overflow words of a zero first coefficient
+            // alone, so it is bit-identical only into a zeroed buffer
+            expected[r].assign(maxBytes, 0);
+            for (unsigned i = 0; i < N; ++i)
+            {
+                if (i == 0) {
+                    solinas64::MultiplyRegion(originals[i], bytes, coeffs[i * R + r], &rowWorkspace[0], &expected[r][0]);
+                }
+                else {
+                    solinas64::MultiplyAddRegion(originals[i], bytes, coeffs[i * R + r], &rowWorkspace[0], &expected[r][0]);
+                }
+            }
+
+            if (tiled[r] != expected[r])
+            {
+                cout << "Failed (chain mismatch) at bytes = " << bytes << " tile = " << tileBytes << endl;
+                SOLINAS64_DEBUG_BREAK();
+                return false;
+            }
+
+            for (unsigned i = 0; i < N; ++i) {
+                rowCoeffs[i] = coeffs[i * R + r];
+            }
+            row.resize(maxBytes);
+            const unsigned rowBytes = solinas64::EncodeRow(
+                originals, N, bytes, rowCoeffs, &rowWorkspace[0], &row[0]);
+
+            if (tiledBytes != rowBytes)
+            {
+                cout << "Failed (length mismatch) at bytes = " << bytes << " tile = " << tileBytes << endl;
+                SOLINAS64_DEBUG_BREAK();
+                return false;
+            }
+
+            for (unsigned j = 0; j < maxBytes; j += 8)
+            {
+                if (solinas64::Finalize(solinas64::ReadU64_LE(&row[j])) !=
+                    solinas64::Finalize(solinas64::ReadU64_LE(&tiled[r][j])))
+                {
+                    cout << "Failed (encode row mismatch) at bytes = " << bytes << " tile = " << tileBytes << endl;
+                    SOLINAS64_DEBUG_BREAK();
+                    return false;
+                }
+            }
+        }
+    }
+
+    cout << "Passed" << endl;
+
+    return true;
+}
+
+
+// Tests that streaming the input in chunks split at arbitrary offsets
+// produces the same bytes as one MultiplyRegion() or MultiplyAddRegion() call
+static bool TestRegionStream()
+{
+    cout << "TestRegionStream...";
+
+    solinas64::Random prng;
+    prng.Seed(21);
+
+    std::vector<uint8_t> data, streamWorkspace, workspace, streamed, expected;
+
+    for (unsigned loop = 0; loop < 2000; ++loop)
+    {
+        const bool accumulate = (loop % 2) != 0;
+        const unsigned bytes = 1 + static_cast<unsigned>(prng.Next() % 3000);
+
+        data.resize(bytes);
+        if (loop % 4 < 2) {
+            FillAmbiguousData(prng, &data[0], bytes);
+        }
+        else {
+            FillTestData(prng, &data[0], bytes);
+        }
+
+        const uint64_t coeff = (loop % 50 == 0) ? 0 : solinas64::HashToNonzeroFp(prng.Next());
+
+        // Sometimes allow more input than is provided
+        const unsigned maxBytes = bytes + ((loop % 3 == 0) ? 17 : 0);
+        const unsigned outputBytes = solinas64::AppDataReader::GetMaxOutputBytes(maxBytes);
+
+        streamed.resize(outputBytes);
+        for (unsigned j = 0; j < outputBytes; ++j) {
+            streamed[j] = static_cast<uint8_t>(prng.Next());
+        }
+        expected = streamed;
+
+        streamWorkspace.resize(solinas64::AppDataReader::GetWorkspaceBytes(maxBytes) + 8);
+        solinas64::RegionStream stream;
+        stream.Begin(coeff, &streamed[0], &streamWorkspace[0], maxBytes, accumulate);
+
+        // Mostly small odd chunks, so ambiguous words straddle the chunks
+        for (unsigned offset = 0; offset < bytes;)
+        {
+            unsigned chunk = (prng.Next() % 10 == 0) ?
+                static_cast<unsigned>(prng.Next() % 700) :
+                1 + 2 * static_cast<unsigned>(prng.Next() % 9);
+            if (chunk > bytes - offset) {
+                chunk = bytes - offset;
+            }
+
+            if (!stream.Update(&data[0] + offset, chunk))
+            {
+                cout << "Failed (update rejected) at bytes = " << bytes << endl;
+                SOLINAS64_DEBUG_BREAK();
+                return false;
+            }
+            offset += chunk;
+        }
+
+        if (stream.GetInputBytes() != bytes ||
+            stream.Update(&data[0], maxBytes - bytes + 1))
+        {
+            cout << "Failed (input length) at bytes = " << bytes << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+
+        const unsigned streamedBytes = stream.Finish();
+
+        workspace.resize(solinas64::AppDataReader::GetWorkspaceBytes(bytes) + 8);
+        const unsigned expectedBytes = accumulate ?
+            solinas64::MultiplyAddRegion(&data[0], bytes, coeff, &workspace[0], &expected[0]) :
+            solinas64::MultiplyRegion(&data[0], bytes, coeff, &workspace[0], &expected[0]);
+
+        if (streamedBytes != expectedBytes || streamed != expected)
+        {
+            cout << "Failed (stream mismatch) at bytes = " << bytes << " coeff = " << coeff << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+    }
+
+    cout << "Passed" << endl;
+
+    return true;
+}
+
+
+// Tests the batch operations against one call per region
+static bool TestRegionBatch()
+{
+    cout << "TestRegionBatch...";
+
+    solinas64::Random prng;
+    prng.Seed(16);
+
+    static const unsigned kItems = 40;
+    std::vector<std::vector<uint8_t>> data(kItems), batched(kItems), expected(kItems);
+    solinas64::RegionBatchItem items[kItems];
+
+    for (unsigned loop = 0; loop < 200; ++loop)
+    {
+        const bool accumulate = (loop % 2) != 0;
+
+        for (unsigned i = 0; i < kItems; ++i)
+        {
+            // Mostly small regions, with some zero coefficients and large regions
+            const unsigned bytes = (i % 13 == 0) ?
+                static_cast<unsigned>(prng.Next() % kMaxDataLength) :
+                static_cast<unsigned>(prng.Next() % 200);
+
+            data[i].resize(bytes + 1);
+            FillTestData(prng, &data[i][0], bytes);
+
+            const unsigned maxBytes = solinas64::AppDataReader::GetMaxOutputBytes(bytes);
+            batched[i].resize(maxBytes + 8);
+            for (unsigned j = 0; j < batched[i].size(); ++j) {
+                batched[i][j] = static_cast<uint8_t>(prng.Next());
+            }
+            expected[i] = batched[i];
+
+            items[i].Data = &data[i][0];
+            items[i].Bytes = bytes;
+            // Runs of items share a coefficient, including 0 and 1
+            if (i > 0 && prng.Next() % 2 == 0) {
+                items[i].Coeff = items[i - 1].Coeff;
+            }
+            else if (i % 7 == 0) {
+                items[i].Coeff = (i % 14 == 0) ? 0 : 1;
+            }
+            else {
+                items[i].Coeff = solinas64::HashToNonzeroFp(prng.Next());
+            }
+            items[i].Output = &batched[i][0];
+        }
+
+        if (accumulate) {
+            solinas64::MultiplyAddRegionBatch(items, kItems);
+        }
+        else {
+            solinas64::MultiplyRegionBatch(items, kItems);
+        }
+
+        for (unsigned i = 0; i < kItems; ++i)
+        {
+            const unsigned expectedBytes = accumulate ?
+                solinas64::MultiplyAddRegion(items[i].Data, items[i].Bytes, items[i].Coeff, &expected[i][0]) :
+                solinas64::MultiplyRegion(items[i].Data, items[i].Bytes, items[i].Coeff, &expected[i][0]);
+
+            if (items[i].OutputBytes != expectedBytes || batched[i] != expected[i])
+            {
+                cout << "Failed (batch mismatch) at bytes = " << items[i].Bytes << endl;
+                SOLINAS64_DEBUG_BREAK();
+                return false;
+            }
+        }
+    }
+
+    cout << "Passed" << endl;
+
+    return true;
+}
+
+
+// Tests the polynomial hash against Horner's rule over the expanded words
+static bool TestPolyHash()
+{
+    cout << "TestPolyHash...";
+
+    solinas64::Random prng;
+    prng.Seed(22);
+
+    std::vector<uint8_t> data, workspace, words;
+
+    for (unsigned i = 0; i < 2000; ++i)
+    {
+        // Cover the lanes, the serial tail and several workspace-free slices
+        const unsigned bytes = (i % 10 == 0) ?
+            static_cast<unsigned>(prng.Next() % (3 * kMaxDataLength)) :
+            static_cast<unsigned>(prng.Next() % 300);
+        const uint64_t key = (i % 50 == 0) ? 1 : solinas64::HashToNonzeroFp(prng.Next());
+
+        data.resize(bytes + 1);
+        FillTestData(prng, &data[0], bytes);
+
+        uint64_t expected = 0;
+        if (bytes > 0)
+        {
+            words.resize(solinas64::AppDataReader::GetMaxOutputBytes(bytes));
+            workspace.resize(solinas64::AppDataReader::GetWorkspaceBytes(bytes) + 8);
+            const unsigned wordBytes = solinas64::MultiplyRegion(
+                &data[0], bytes, (uint64_t)1, &workspace[0], &words[0]);
+
+            for (unsigned j = 0; j < wordBytes; j += 8) {
+                expected = solinas64::Multiply(solinas64::Add(expected, solinas64::ReadU64_LE(&words[j])), key);
+            }
+        }
+        expected = solinas64::Finalize(solinas64::Multiply(solinas64::Add(expected, bytes), key));
+
+        const uint64_t hash = solinas64::PolyHashRegion(&data[0], bytes, key);
+        if (hash != expected)
+        {
+            cout << "Failed (hash mismatch) at bytes = " << bytes << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+    }
+
+    // The fused encoder must produce the same hashes and recovery data
+    static const unsigned kOriginals = 37;
+    std::vector<std::vector<uint8_t>> originals(kOriginals);
+    std::vector<const uint8_t*> ptrs(kOriginals);
+    std::vector<uint64_t> coeffs(kOriginals), hashes(kOriginals);
+    std::vector<uint8_t> recovery, expectedRecovery;
+
+    for (unsigned loop = 0; loop < 40; ++loop)
+    {
+        const unsigned bytes = 1 + static_cast<unsigned>(prng.Next() % 2000);
+        const uint64_t key = solinas64::HashToNonzeroFp(prng.Next());
+
+        for (unsigned i = 0; i < kOriginals; ++i)
+        {
+            originals[i].resize(bytes);
+            FillTestData(prng, &originals[i][0], bytes);
+            ptrs[i] = &originals[i][0];
+            coeffs[i] = (loop % 4 == 0) ? 1 : solinas64::HashToNonzeroFp(prng.Next());
+        }
+
+        const unsigned maxBytes = solinas64::AppDataReader::GetMaxOutputBytes(bytes);
+        workspace.resize(solinas64::GetEncodeRowWorkspaceBytes(bytes));
+        recovery.resize(maxBytes);
+        expectedRecovery.resize(maxBytes);
+
+        const unsigned expectedBytes = solinas64::EncodeRow(
+            &ptrs[0], kOriginals, bytes, &coeffs[0], &workspace[0], &expectedRecovery[0]);
+        const unsigned recoveryBytes = solinas64::EncodeRow(
+            &ptrs[0], kOriginals, bytes, &coeffs[0], &workspace[0], &recovery[0], key, &hashes[0]);
+
+        if (recoveryBytes != expectedBytes || recovery != expectedRecovery)
+        {
+            cout << "Failed (fused recovery mismatch) at bytes = " << bytes << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+
+        for (unsigned i = 0; i < kOriginals; ++i)
+        {
+            if (hashes[i] != solinas64::PolyHashRegion(ptrs[i], bytes, key))
+            {
+                cout << "Failed (fused hash mismatch) at bytes = " << bytes << endl;
+                SOLINAS64_DEBUG_BREAK();
+                return false;
+            }
+        }
+    }
+
+    cout << "Passed" << endl;
+
+    return true;
+}
+
+
+// Checks MultiplyRegion<Bytes>() and MultiplyAddRegion<Bytes>() against the
+// versions with a runtime length, for each coefficient form
+template<unsigned Bytes>
+static bool TestFixedRegionSize(solinas64::Random& prng)
+{
+    uint8_t data[Bytes];
+    uint8_t workspace[solinas64::AppDataReader::GetWorkspaceBytes(Bytes) + 8];
+    uint8_t fixed[solinas64::AppDataReader::GetMaxOutputBytes(Bytes)];
+    uint8_t expected[sizeof(fixed)];
+
+    for (unsigned loop = 0; loop < 40; ++loop)
+    {
+        FillTestData(prng, data, Bytes);
+
+        uint64_t coeff;
+        switch (loop % 5)
+        {
+        case 0: coeff = 1; break;
+        case 1: coeff = (uint64_t)1 << (prng.Next() % 64); break;
+        case 2: coeff = (uint32_t)prng.Next(); break;
+        case 3: coeff = 0; break;
+        default: coeff = solinas64::HashToNonzeroFp(prng.Next()); break;
+        }
+        coeff %= solinas64::kPrime;
+
+        solinas64::MulConst prepared;
+        prepared.Set(coeff);
+
+        for (unsigned j = 0; j < sizeof(fixed); ++j) {
+            fixed[j] = expected[j] = static_cast<uint8_t>(prng.Next());
+        }
+
+        const bool accumulate = (loop % 2) != 0;
+        const unsigned expectedBytes = accumulate ?
+            solinas64::MultiplyAddRegion(data, Bytes, prepared, workspace, expected) :
+            solinas64::MultiplyRegion(data, Bytes, prepared, workspace, expected);
+        const unsigned fixedBytes = accumulate ?
+            solinas64::MultiplyAddRegion<Bytes>(data, prepared, workspace, fixed) :
+            solinas64::MultiplyRegion<Bytes>(data, prepared, workspace, fixed);
+
+        if (fixedBytes != expectedBytes || 0 != memcmp(fixed, expected, sizeof(fixed)))
+        {
+            cout << "Failed (fixed region mismatch) at bytes = " << Bytes << " coeff = " << coeff << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool TestFixedRegion()
+{
+    cout << "TestFixedRegion...";
+
+    solinas64::Random prng;
+    prng.Seed(24);
+
+    if (!TestFixedRegionSize<1>(prng) ||
+        !TestFixedRegionSize<7>(prng) ||
+        !TestFixedRegionSize<8>(prng) ||
+        !TestFixedRegionSize<63>(prng) ||
+        !TestFixedRegionSize<64>(prng) ||
+        !TestFixedRegionSize<100>(prng) ||
+        !TestFixedRegionSize<1024>(prng) ||
+        !TestFixedRegionSize<1280>(prng) ||
+        !TestFixedRegionSize<1283>(prng) ||
+        !TestFixedRegionSize<8192>(prng))
+    {
+        return false;
+    }
+
+    cout << "Passed" << endl;
+
+    return true;
+}
+
+
+// Tests the region counters, which are all zero without SOLINAS64_ENABLE_STATS
+static bool TestRegionStats()
+{
+    cout << "TestRegionStats...";
+
+    solinas64::Random prng;
+    prng.Seed(26);
+
+#if defined(SOLINAS64_ENABLE_STATS)
+    const bool enabled = true;
+#else
+    const bool enabled = false;
+#endif
+
+    solinas64::ResetThreadRegionStats();
+    const solinas64::RegionStats totalsBefore = solinas64::GetRegionStats();
+
+    solinas64::RegionStats stats = solinas64::GetThreadRegionStats();
+    if (stats.Enabled != enabled ||
+        stats.Backend != solinas64::GetSimdBackend() ||
+        stats.Calls != 0 || stats.Bytes != 0)
+    {
+        cout << "Failed (reset)" << endl;
+        SOLINAS64_DEBUG_BREAK();
+        return false;
+    }
+
+    solinas64::RegionStats expected = stats;
+
+    std::vector<uint8_t> data(kMaxDataLength);
+    std::vector<uint8_t> output(solinas64::AppDataReader::GetMaxOutputBytes(kMaxDataLength));
+    std::vector<uint8_t> workspace(solinas64::AppDataReader::GetWorkspaceBytes(kMaxDataLength));
+
+    for (unsigned loop = 0; loop < 100; ++loop)
+    {
+        const unsigned bytes = static_cast<unsigned>(prng.Next() % kMaxDataLength) + 1;
+        FillTestData(prng, &data[0], bytes);
+
+        uint64_t coeff = solinas64::HashToNonzeroFp(prng.Next());
+        if (loop % 5 == 0) {
+            coeff = 0;
+        }
+        else if (loop % 5 == 1) {
+            coeff = 1;
+        }
+
+        unsigned outputBytes;
+        switch (loop % 4)
+        {
+        case 0:
+            outputBytes = solinas64::MultiplyRegion(&data[0], bytes, coeff, &workspace[0], &output[0]);
+            break;
+        case 1:
+            outputBytes = solinas64::MultiplyAddRegion(&data[0], bytes, coeff, &workspace[0], &output[0]);
+            break;
+        case 2:
+            outputBytes = solinas64::MultiplyRegion(&data[0], bytes, coeff, &output[0]);
+            break;
+        default:
+            {
+                solinas64::RegionBatchItem item;
+                item.Data = &data[0];
+                item.Bytes = bytes;
+                item.Coeff = coeff;
+                item.Output = &output[0];
+                solinas64::MultiplyAddRegionBatch(&item, 1);
+                outputBytes = item.OutputBytes;
+            }
+            break;
+        }
+
+        expected.Calls++;
+        expected.Bytes += bytes;
+        if (coeff == 0) {
+            expected.ZeroCoeffCalls++;
+            continue;
+        }
+        if (coeff == 1) {
+            expected.OneCoeffCalls++;
+        }
+        for (unsigned i = 0; i + 8 <= bytes; i += 8) {
+            if (solinas64::IsU64Ambiguous(solinas64::ReadU64_LE(&data[i]))) {
+                expected.AmbiguousWords++;
+            }
+        }
+        expected.OverflowBytes += outputBytes - ((bytes + 7) & ~7u);
+    }
+
+    if (!enabled) {
+        expected = solinas64::GetThreadRegionStats();
+    }
+
+    stats = solinas64::GetThreadRegionStats();
+    if (stats.Calls != expected.Calls ||
+        stats.Bytes != expected.Bytes ||
+        stats.ZeroCoeffCalls != expected.ZeroCoeffCalls ||
+        stats.OneCoeffCalls != expected.OneCoeffCalls ||
+        stats.AmbiguousWords != expected.AmbiguousWords ||
+        stats.OverflowBytes != expected.OverflowBytes ||
+        (!enabled && stats.Calls != 0))
+    {
+        cout << "Failed (thread counts)" << endl;
+        SOLINAS64_DEBUG_BREAK();
+        return false;
+    }
+
+    // Work on another thread shows up in the totals after it exits
+    std::thread worker([&]() {
+        solinas64::MultiplyRegion(&data[0], 1000, 3, &workspace[0], &output[0]);
+    });
+    worker.join();
+
+    solinas64::ResetThreadRegionStats();
+    const solinas64::RegionStats totalsAfter = solinas64::GetRegionStats();
+
+    const uint64_t expectedCalls = enabled ? expected.Calls + 1 : 0;
+    const uint64_t expectedBytes = enabled ? expected.Bytes + 1000 : 0;
+    if (totalsAfter.Calls - totalsBefore.Calls != expectedCalls ||
+        totalsAfter.Bytes - totalsBefore.Bytes != expectedBytes ||
+        solinas64::GetThreadRegionStats().Calls != 0)
+    {
+        cout << "Failed (totals)" << endl;
+        SOLINAS64_DEBUG_BREAK();
+        return false;
+    }
+
+    cout << "Passed" << endl;
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// Tests: Codec
+
+static bool TestCodec()
+{
+    cout << "TestCodec...";
+
+    solinas64::Random prng;
+    prng.Seed(15);
+
+    const unsigned kN = 20;
+    const unsigned kLosses = 5;
+    const unsigned bytes = 1000;
+
+    std::vector<std::vector<uint8_t>> originals(kN, std::vector<uint8_t>(bytes));
+    std::vector<const uint8_t*> originalPtrs(kN);
+    for (unsigned i = 0; i < kN; ++i)
+    {
+        FillTestData(prng, &originals[i][0], bytes);
+        originalPtrs[i] = &originals[i][0];
+    }
+
+    const unsigned maxBytes = solinas64::AppDataReader::GetMaxOutputBytes(bytes);
+    std::vector<uint8_t> workspace(solinas64::GetEncodeRowWorkspaceBytes(bytes) + 8);
+    std::vector<uint8_t> recovery(maxBytes);
+
+    // The bulk generator matches the coefficients one at a time,
+    // including the reserved rows at kShiftSeed and kParitySeed
+    const unsigned kRows = 4, kCols = 100;
+    std::vector<uint64_t> matrix(kRows * kCols);
+    solinas64::GenerateCoefficients(solinas64::kShiftSeed, kRows, kCols, &matrix[0]);
+
+    solinas64::GeneratorCache cache;
+    for (unsigned r = 0; r < kRows; ++r)
+    {
+        const uint64_t seed = solinas64::kShiftSeed + r;
+        const uint64_t* cached = cache.GetRow(seed, kCols);
+
+        for (unsigned c = 0; c < kCols; ++c)
+        {
+            const uint64_t expected = solinas64::GetGeneratorCoefficient(seed, c);
+            if (matrix[c * kRows + r] != expected || cached[c] != expected)
+            {
+                cout << "Failed (generator mismatch) at r = " << r << " c = " << c << endl;
+                SOLINAS64_DEBUG_BREAK();
+                return false;
+            }
+        }
+    }
+
+    for (unsigned trial = 0; trial < 20; ++trial)
+    {
+        solinas64::Decoder decoder;
+        decoder.Initialize(kN, bytes);
+
+        // Lose the first few originals starting at a different place each time
+        for (unsigned i = 0; i < kN; ++i) {
+            if ((i + kN - trial) % kN >= kLosses) {
+                decoder.AddOriginal(i, originalPtrs[i]);
+            }
+        }
+
+        // Include the cheap rows
+        const uint64_t seeds[kLosses] = {
+            solinas64::kParitySeed,
+            solinas64::kShiftSeed,
+            trial * 3 + 1,
+            trial * 3 + 2,
+            trial * 3 + 3
+        };
+
+        for (unsigned r = 0; r < kLosses; ++r)
+        {
+            const unsigned recoveryBytes = solinas64::EncodeRecovery(
+                &originalPtrs[0], kN, bytes, seeds[r], &workspace[0], &recovery[0],
+                (trial % 2 == 0) ? &cache : nullptr);
+            decoder.AddRecovery(seeds[r], &recovery[0], recoveryBytes);
+        }
+
+        if (!decoder.IsReady() || !decoder.Decode())
+        {
+            cout << "Failed (decode) at trial = " << trial << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+
+        for (unsigned i = 0; i < kN; ++i)
+        {
+            if (0 != memcmp(decoder.GetOriginal(i), originalPtrs[i], bytes))
+            {
+                cout << "Failed (data corruption) at trial = " << trial << " i = " << i << endl;
+                SOLINAS64_DEBUG_BREAK();
+                return false;
+            }
+        }
+    }
+
+    cout << "Passed" << endl;
+
+    return true;
+}
+
+// Tests that updating recovery packets for a changed original matches
+// encoding them again, including changes to the number of overflow words
+static bool TestUpdateRecovery()
+{
+    cout << "TestUpdateRecovery...";
+
+    solinas64::Random prng;
+    prng.Seed(16);
+
+    const unsigned kN = 12;
+    const unsigned kRecoveryCount = 4;
+    const uint64_t seeds[kRecoveryCount] = {
+        solinas64::kParitySeed, solinas64::kShiftSeed, 100, 101
+    };
+    const unsigned kSizes[] = { 1, 8, 1003, 8 * solinas64::kUpdateRecoveryTileWords + 40 };
+
+    for (unsigned bytes : kSizes)
+    {
+        std::vector<std::vector<uint8_t>> originals(kN, std::vector<uint8_t>(bytes));
+        std::vector<const uint8_t*> originalPtrs(kN);
+        for (unsigned i = 0; i < kN; ++i)
+        {
+            FillTestData(prng, &originals[i][0], bytes);
+            originalPtrs[i] = &originals[i][0];
+        }
+
+        const unsigned maxBytes = solinas64::AppDataReader::GetMaxOutputBytes(bytes);
+        std::vector<uint8_t> encodeWorkspace(solinas64::GetEncodeRowWorkspaceBytes(bytes) + 8);
+        std::vector<uint8_t> updateWorkspace(solinas64::GetUpdateRecoveryWorkspaceBytes(bytes));
+        std::vector<std::vector<uint8_t>> recoveries(kRecoveryCount, std::vector<uint8_t>(maxBytes));
+        std::vector<uint8_t*> recoveryPtrs(kRecoveryCount);
+        std::vector<unsigned> recoveryBytes(kRecoveryCount);
+        std::vector<uint8_t> expected(maxBytes);
+
+        for (unsigned r = 0; r < kRecoveryCount; ++r)
+        {
+            recoveryPtrs[r] = &recoveries[r][0];
+            recoveryBytes[r] = solinas64::EncodeRecovery(
+                &originalPtrs[0], kN, bytes, seeds[r], &encodeWorkspace[0], recoveryPtrs[r]);
+        }
+
+        // Random data, all ambiguous words, then no ambiguous words
+        for (unsigned change = 0; change < 6; ++change)
+        {
+            const unsigned column = (change * 5) % kN;
+            std::vector<uint8_t> newData(bytes);
+            if (change % 3 == 0) {
+                FillTestData(prng, &newData[0], bytes);
+            }
+            else if (change % 3 == 1) {
+                memset(&newData[0], 0xff, bytes);
+            }
+            else {
+                for (unsigned k = 0; k < bytes; ++k) {
+                    newData[k] = static_cast<uint8_t>(prng.Next() & 0x7f);
+                }
+            }
+
+            uint64_t coeffs[kRecoveryCount];
+            for (unsigned r = 0; r < kRecoveryCount; ++r) {
+                coeffs[r] = solinas64::GetGeneratorCoefficient(seeds[r], column);
+            }
+
+            const unsigned changedBytes = solinas64::UpdateRecovery(
+                originalPtrs[column], &newData[0], bytes, coeffs, kRecoveryCount,
+                &updateWorkspace[0], &recoveryPtrs[0]);
+            originals[column] = newData;
+            originalPtrs[column] = &originals[column][0];
+
+            for (unsigned r = 0; r < kRecoveryCount; ++r)
+            {
+                recoveryBytes[r] = std::max(recoveryBytes[r], changedBytes);
+
+                const unsigned expectedBytes = solinas64::EncodeRecovery(
+                    &originalPtrs[0], kN, bytes, seeds[r], &encodeWorkspace[0], &expected[0]);
+
+                if (expectedBytes > recoveryBytes[r])
+                {
+                    cout << "Failed (recovery length) for bytes = " << bytes << " change = " << change << endl;
+                    SOLINAS64_DEBUG_BREAK();
+                    return false;
+                }
+
+                for (unsigned k = 0; k < maxBytes; k += 8)
+                {
+                    const uint64_t x = solinas64::Finalize(solinas64::ReadU64_LE(&recoveries[r][k]));
+                    const uint64_t y = solinas64::Finalize(solinas64::ReadU64_LE(&expected[k]));
+                    if (x != y)
+                    {
+                        cout << "Failed (recovery mismatch) for bytes = " << bytes << " change = " << change << " r = " << r << endl;
+                        SOLINAS64_DEBUG_BREAK();
+                        return false;
+                    }
+                }
+            }
+        }
+
+        // The updated recovery packets still decode, including the last changed column
+        solinas64::Decoder decoder;
+        decoder.Initialize(kN, bytes);
+        for (unsigned i = kRecoveryCount; i < kN; ++i) {
+            decoder.AddOriginal(i, originalPtrs[i]);
+        }
+        for (unsigned r = 0; r < kRecoveryCount; ++r) {
+            decoder.AddRecovery(seeds[r], recoveryPtrs[r], recoveryBytes[r]);
+        }
+
+        if (!decoder.Decode())
+        {
+            cout << "Failed (decode) for bytes = " << bytes << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+        for (unsigned i = 0; i < kN; ++i)
+        {
+            if (0 != memcmp(decoder.GetOriginal(i), originalPtrs[i], bytes))
+            {
+                cout << "Failed (data corruption) for bytes = " << bytes << " i = " << i << endl;
+                SOLINAS64_DEBUG_BREAK();
+                return false;
+            }
+        }
+    }
+
+    cout << "Passed" << endl;
+
+    return true;
+}
+
+// Tests that the encoder context buffers are aligned and pooled, and that it
+// encodes the same recovery packets as EncodeRecovery()
+static bool TestEncoderContext()
+{
+    cout << "TestEncoderContext...";
+
+    solinas64::Random prng;
+    prng.Seed(25);
+
+    const unsigned kMaxN = 40, kMaxBytes = 3000, kPool = 3;
+
+    solinas64::EncoderContext context;
+    if (context.Initialize(0, kMaxBytes, kPool) || !context.Initialize(kMaxN, kMaxBytes, kPool))
+    {
+        cout << "Failed (initialize)" << endl;
+        SOLINAS64_DEBUG_BREAK();
+        return false;
+    }
+
+    uint8_t* buffers[kPool];
+    for (unsigned i = 0; i < kPool; ++i)
+    {
+        buffers[i] = context.AcquireRecovery();
+        if (!buffers[i] || reinterpret_cast<uintptr_t>(buffers[i]) % solinas64::kEncoderContextAlignment != 0)
+        {
+            cout << "Failed (acquire)" << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+    }
+
+    if (context.AcquireRecovery() != nullptr ||
+        context.ReleaseRecovery(buffers[0] + 8) ||
+        !context.ReleaseRecovery(buffers[1]) ||
+        context.ReleaseRecovery(buffers[1]) ||
+        context.AcquireRecovery() != buffers[1] ||
+        !context.ReleaseRecovery(buffers[1]) ||
+        context.GetFreeRecoveryCount() != 1)
+    {
+        cout << "Failed (pool)" << endl;
+        SOLINAS64_DEBUG_BREAK();
+        return false;
+    }
+
+    for (unsigned i = 0; i < kMaxN; ++i)
+    {
+        if (reinterpret_cast<uintptr_t>(context.GetOriginal(i)) % solinas64::kEncoderContextAlignment != 0)
+        {
+            cout << "Failed (original alignment)" << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+        FillTestData(prng, context.GetOriginal(i), kMaxBytes);
+    }
+
+    std::vector<uint8_t> workspace(solinas64::GetEncodeRowWorkspaceBytes(kMaxBytes) + 8);
+    std::vector<uint8_t> expected(context.GetRecoveryBytes());
+    uint8_t* recovery = buffers[0];
+
+    for (unsigned trial = 0; trial < 50; ++trial)
+    {
+        // Smaller shapes than the maximum reuse the same buffers
+        const unsigned N = 1 + static_cast<unsigned>(prng.Next() % kMaxN);
+        const unsigned bytes = 1 + static_cast<unsigned>(prng.Next() % kMaxBytes);
+        const uint64_t seed = prng.Next();
+
+        const unsigned expectedBytes = solinas64::EncodeRecovery(
+            context.GetOriginals(), N, bytes, seed, &workspace[0], &expected[0]);
+        const unsigned recoveryBytes = context.Encode(
+            context.GetOriginals(), N, bytes, seed, recovery);
+
+        if (recoveryBytes != expectedBytes || 0 != memcmp(recovery, &expected[0], recoveryBytes))
+        {
+            cout << "Failed (encode mismatch) at N = " << N << " bytes = " << bytes << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+    }
+
+    if (context.Encode(context.GetOriginals(), kMaxN + 1, kMaxBytes, 0, recovery) != 0 ||
+        context.Encode(context.GetOriginals(), kMaxN, kMaxBytes + 1, 0, recovery) != 0)
+    {
+        cout << "Failed (shape check)" << endl;
+        SOLINAS64_DEBUG_BREAK();
+        return false;
+    }
+
+    cout << "Passed" << endl;
+
+    return true;
+}
+
+// Tests that the parallel region operations produce the same bytes as the
+// serial versions, where the extra bits of each stripe must be spliced at
+// bit offsets that are not a multiple of the 63-bit words
+static bool TestParallelRegion()
+{
+    cout << "TestParallelRegion...";
+
+    solinas64::Random prng;
+    prng.Seed(19);
+
+    static const unsigned kStripe = solinas64::kParallelStripeBytes;
+    static const unsigned kSizes[] = {
+        kStripe + 1, kStripe + 8, 2 * kStripe - 1, 2 * kStripe,
+        2 * kStripe + 9, 3 * kStripe - 3, 3 * kStripe + 5
+    };
+    static const unsigned kSizeCount = sizeof(kSizes) / sizeof(kSizes[0]);
+    static const unsigned kN = 20;
+
+    // More threads than the largest number of stripes
+    solinas64::WorkerPool pool;
+    if (!pool.Start(8))
+    {
+        cout << "Failed (start)" << endl;
+        SOLINAS64_DEBUG_BREAK();
+        return false;
+    }
+
+    std::vector<uint8_t> storage, workspace, parallel, serial;
+    const uint8_t* originals[kN];
+    uint64_t coeffs[kN];
+
+    for (unsigned loop = 0; loop < kSizeCount * 3; ++loop)
+    {
+        const unsigned bytes = kSizes[loop % kSizeCount];
+        const unsigned mode = loop / kSizeCount;
+
+        storage.resize(kN * bytes);
+        for (unsigned i = 0; i < kN; ++i)
+        {
+            uint8_t* original = &storage[i * bytes];
+            originals[i] = original;
+            coeffs[i] = solinas64::HashToNonzeroFp(prng.Next());
+
+            if (mode == 0) {
+                memset(original, 0xff, bytes);
+            }
+            else if (mode == 1) {
+                FillAmbiguousData(prng, original, bytes);
+            }
+            else
+            {
+                // Alternate between mostly plain and all ambiguous stripes
+                for (unsigned offset = 0; offset < bytes; offset += kStripe)
+                {
+                    const unsigned stripeBytes = (bytes - offset < kStripe) ? bytes - offset : kStripe;
+                    if ((offset / kStripe) % 2 == 0) {
+                        FillTestData(prng, original + offset, stripeBytes);
+                    }
+                    else {
+                        FillAmbiguousData(prng, original + offset, stripeBytes);
+                    }
+                }
+            }
+        }
+
+        const unsigned maxBytes = solinas64::AppDataReader::GetMaxOutputBytes(bytes);
+        parallel.resize(maxBytes);
+        for (unsigned j = 0; j < maxBytes; ++j) {
+            parallel[j] = static_cast<uint8_t>(prng.Next());
+        }
+        serial = parallel;
+
+        // MultiplyRegion()
+        workspace.resize(solinas64::AppDataReader::GetWorkspaceBytes(bytes) + 8);
+        const unsigned parallelBytes = solinas64::ParallelMultiplyRegion(
+            pool, originals[0], bytes, coeffs[0], &parallel[0]);
+        const unsigned serialBytes = solinas64::MultiplyRegion(
+            originals[0], bytes, coeffs[0], &workspace[0], &serial[0]);
+
+        if (parallelBytes != serialBytes || parallel != serial)
+        {
+            cout << "Failed (multiply mismatch) at bytes = " << bytes << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+
+        // MultiplyAddRegion() on top of that
+        if (solinas64::ParallelMultiplyAddRegion(pool, originals[1], bytes, coeffs[1], &parallel[0]) !=
+            solinas64::MultiplyAddRegion(originals[1], bytes, coeffs[1], &workspace[0], &serial[0]) ||
+            parallel != serial)
+        {
+            cout << "Failed (multiply-add mismatch) at bytes = " << bytes << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+
+        // EncodeRow()
+        workspace.resize(solinas64::GetEncodeRowWorkspaceBytes(bytes) + 8);
+        if (solinas64::ParallelEncodeRow(pool, originals, kN, bytes, coeffs, &parallel[0]) !=
+            solinas64::EncodeRow(originals, kN, bytes, coeffs, &workspace[0], &serial[0]) ||
+            parallel != serial)
+        {
+            cout << "Failed (encode row mismatch) at bytes = " << bytes << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+    }
+
+    cout << "Passed" << endl;
+
+    return true;
+}
+
 
-static bool TestRandom()
+// Tests that the pipeline produces the same recovery packets as
+// EncodeRecovery() for a stream of uneven blocks
+static bool TestEncoderPipeline()
 {
-    cout << "TestRandom...";
+    cout << "TestEncoderPipeline...";
 
-    for (int i = -1000; i < 1000; ++i)
+    solinas64::Random prng;
+    prng.Seed(27);
+
+    static const unsigned kMaxN = 32;
+    static const unsigned kMaxBytes = 70000;
+    static const unsigned kJobs = 60;
+
+    std::vector<uint8_t> originalData(kMaxN * kMaxBytes);
+    FillTestData(prng, &originalData[0], static_cast<unsigned>(originalData.size()));
+    std::vector<const uint8_t*> originals(kMaxN);
+    for (unsigned i = 0; i < kMaxN; ++i) {
+        originals[i] = &originalData[i * kMaxBytes];
+    }
+
+    // One aligned recovery buffer per job
+    solinas64::EncoderContext buffers;
+    if (!buffers.Initialize(kMaxN, kMaxBytes, kJobs))
     {
-        uint64_t loWord = static_cast<int64_t>(i);
-        loWord <<= 3; // Put it in the high bits
-        uint64_t loResult = solinas64::Random::ConvertRandToFp(loWord);
+        cout << "Failed (buffers)" << endl;
+        SOLINAS64_DEBUG_BREAK();
+        return false;
+    }
 
-        if (loResult >= solinas64::kPrime)
+    for (unsigned threads = 1; threads <= 4; threads += 3)
+    {
+        solinas64::EncoderPipeline pipeline;
+        if (!pipeline.Start(kMaxN, kMaxBytes, threads) ||
+            pipeline.GetThreadCount() != threads)
         {
-            cout << "Failed (RandToFp low) at i = " << i << endl;
+            cout << "Failed (start)" << endl;
             SOLINAS64_DEBUG_BREAK();
             return false;
         }
 
-        uint64_t hiWord = solinas64::kPrime + static_cast<int64_t>(i);
-        hiWord <<= 3; // Put it in the high bits
-        uint64_t hiResult = solinas64::Random::ConvertRandToFp(hiWord);
+        std::vector<solinas64::EncodeJob> jobs(kJobs);
+        std::vector<unsigned> completedBytes(kJobs, 0);
+        std::atomic<unsigned> completed(0);
+
+        for (unsigned i = 0; i < kJobs; ++i)
+        {
+            solinas64::EncodeJob& job = jobs[i];
+            job.Originals = &originals[0];
+            job.N = static_cast<unsigned>(prng.Next() % kMaxN) + 1;
+            job.Bytes = (i % 3 == 0) ? kMaxBytes : static_cast<unsigned>(prng.Next() % kMaxBytes) + 1;
+            job.Seed = prng.Next();
+            job.Recovery = buffers.AcquireRecovery();
+            job.OnComplete = [&completed, &completedBytes, i](const solinas64::EncodeJob& done) {
+                completedBytes[i] = done.RecoveryBytes;
+                ++completed;
+            };
+
+            if (!pipeline.Submit(job))
+            {
+                cout << "Failed (submit)" << endl;
+                SOLINAS64_DEBUG_BREAK();
+                return false;
+            }
+        }
 
-        if (hiResult >= solinas64::kPrime)
+        // Jobs larger than the shape are rejected
+        solinas64::EncodeJob tooLarge = jobs[0];
+        tooLarge.Bytes = kMaxBytes + 1;
+        if (pipeline.Submit(tooLarge))
         {
-            cout << "Failed (RandToFp high) at i = " << i << endl;
+            cout << "Failed (shape)" << endl;
             SOLINAS64_DEBUG_BREAK();
             return false;
         }
-    }
 
-    for (int i = -1000; i < 1000; ++i)
-    {
-        uint64_t loWord = static_cast<int64_t>(i);
-        loWord <<= 3; // Put it in the high bits
-        uint64_t loResult = solinas64::Random::ConvertRandToNonzeroFp(loWord);
+        pipeline.Wait();
 
-        if (loResult <= 0 || loResult >= solinas64::kPrime)
+        if (completed != kJobs)
         {
-            cout << "Failed (RandToNonzeroFp low) at i = " << i << endl;
+            cout << "Failed (callbacks)" << endl;
             SOLINAS64_DEBUG_BREAK();
             return false;
         }
 
-        uint64_t hiWord = solinas64::kPrime + static_cast<int64_t>(i);
-        hiWord <<= 3; // Put it in the high bits
-        uint64_t hiResult = solinas64::Random::ConvertRandToNonzeroFp(hiWord);
+        std::vector<uint8_t> workspace(solinas64::GetEncodeRowWorkspaceBytes(kMaxBytes));
+        std::vector<uint8_t> expected(solinas64::AppDataReader::GetMaxOutputBytes(kMaxBytes));
+
+        for (unsigned i = 0; i < kJobs; ++i)
+        {
+            const solinas64::EncodeJob& job = jobs[i];
+            const unsigned expectedBytes = solinas64::EncodeRecovery(
+                job.Originals, job.N, job.Bytes, job.Seed, &workspace[0], &expected[0]);
+
+            if (completedBytes[i] != expectedBytes ||
+                0 != memcmp(job.Recovery, &expected[0], expectedBytes))
+            {
+                cout << "Failed (mismatch) at job " << i << endl;
+                SOLINAS64_DEBUG_BREAK();
+                return false;
+            }
+
+            buffers.ReleaseRecovery(job.Recovery);
+        }
 
-        if (hiResult <= 0 || hiResult >= solinas64::kPrime)
+        pipeline.Stop();
+        if (pipeline.Submit(jobs[0]))
         {
-            cout << "Failed (RandToNonzeroFp high) at i = " << i << endl;
+            cout << "Failed (stopped)" << endl;
             SOLINAS64_DEBUG_BREAK();
             return false;
         }
@@ -887,52 +2973,112 @@ static bool TestRandom()
     return true;
 }
 
-
-//------------------------------------------------------------------------------
-// Tests: WordReader/WordWriter
-
-static bool TestWordSerialization()
+// Tests that Wait() does not return while an earlier job is still running,
+// when small jobs are submitted and finished while a large job encodes
+static bool TestEncoderPipelineWait()
 {
-    cout << "TestWordSerialization...";
-
-    solinas64::WordWriter writer;
-    solinas64::WordReader reader;
+    cout << "TestEncoderPipelineWait...";
 
     solinas64::Random prng;
-    prng.Seed(11);
+    prng.Seed(28);
 
-    std::vector<uint8_t> data;
-    std::vector<uint64_t> wordData;
+    static const unsigned kMaxN = 32;
+    static const unsigned kMaxBytes = 70000;
+    static const unsigned kRounds = 20;
+    static const unsigned kSmallJobs = 3000;
 
-    for (unsigned i = 1; i < kMaxDataLength; ++i)
-    {
-        unsigned words = i;
-        unsigned bytesNeeded = solinas64::WordWriter::BytesNeeded(words);
+    std::vector<uint8_t> originalData(kMaxN * kMaxBytes);
+    FillTestData(prng, &originalData[0], static_cast<unsigned>(originalData.size()));
+    std::vector<const uint8_t*> originals(kMaxN);
+    for (unsigned i = 0; i < kMaxN; ++i) {
+        originals[i] = &originalData[i * kMaxBytes];
+    }
+
+    const unsigned smallRecoveryBytes = solinas64::AppDataReader::GetMaxOutputBytes(8);
+    std::vector<uint8_t> largeRecovery(solinas64::AppDataReader::GetMaxOutputBytes(kMaxBytes));
+    std::vector<uint8_t> smallRecovery(kSmallJobs * smallRecoveryBytes);
 
-        data.resize(bytesNeeded);
-        wordData.resize(words);
+    solinas64::EncoderPipeline pipeline;
+    if (!pipeline.Start(kMaxN, kMaxBytes, 4))
+    {
+        cout << "Failed (start)" << endl;
+        SOLINAS64_DEBUG_BREAK();
+        return false;
+    }
 
-        writer.BeginWrite(&data[0]);
-        reader.BeginRead(&data[0], bytesNeeded);
+    // done[0] is the large job, followed by the small jobs in submit order
+    std::vector<std::atomic<bool>> done(kSmallJobs + 1);
+    std::atomic<unsigned> submitted(0);
 
-        for (unsigned j = 0; j < words; ++j)
+    for (unsigned round = 0; round < kRounds; ++round)
+    {
+        for (std::atomic<bool>& flag : done) {
+            flag = false;
+        }
+        submitted = 0;
+
+        solinas64::EncodeJob job;
+        job.Originals = &originals[0];
+        job.N = kMaxN;
+        job.Bytes = kMaxBytes;
+        job.Seed = prng.Next();
+        job.Recovery = &largeRecovery[0];
+        // Keep the large job in progress while the small jobs run
+        job.OnComplete = [&done](const solinas64::EncodeJob&) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            done[0] = true;
+        };
+
+        if (!pipeline.Submit(job))
         {
-            // Generate a value from 0..p because the writer technically does not care about staying within the field
-            uint64_t w = prng.Next() & MASK61;
-            wordData[j] = w;
-            writer.Write(w);
+            cout << "Failed (submit)" << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
         }
-        writer.Flush();
+        submitted = 1;
+
+        // Every job submitted before Wait() was called must be done after it
+        std::atomic<bool> early(false);
+        std::thread waiter([&] {
+            const unsigned before = submitted;
+            pipeline.Wait();
+            for (unsigned i = 0; i < before; ++i) {
+                if (!done[i]) {
+                    early = true;
+                }
+            }
+        });
 
-        for (unsigned j = 0; j < words; ++j)
+        for (unsigned i = 0; i < kSmallJobs; ++i)
         {
-            uint64_t u = reader.Read();
-            if (u != wordData[j])
+            solinas64::EncodeJob small;
+            small.Originals = &originals[0];
+            small.N = 1;
+            small.Bytes = 8;
+            small.Seed = i;
+            small.Recovery = &smallRecovery[i * smallRecoveryBytes];
+            small.OnComplete = [&done, i](const solinas64::EncodeJob&) {
+                done[i + 1] = true;
+            };
+
+            if (!pipeline.Submit(small))
             {
-                cout << "Failed (readback failed) at i = " << i << " j = " << j << endl;
+                waiter.join();
+                cout << "Failed (submit)" << endl;
                 SOLINAS64_DEBUG_BREAK();
                 return false;
             }
+            ++submitted;
+        }
+
+        waiter.join();
+        pipeline.Wait();
+
+        if (early)
+        {
+            cout << "Failed (Wait returned early) in round " << round << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
         }
     }
 
@@ -941,78 +3087,160 @@ static bool TestWordSerialization()
     return true;
 }
 
-
-//------------------------------------------------------------------------------
-// Tests: ByteWriter
-
-bool TestByteWriter()
+// Tests that the file encoder produces the same recovery shards as
+// EncodeRecovery() of the zero-padded original shards
+static bool TestFileEncoder()
 {
-    cout << "TestByteWriter...";
-
-    solinas64::ByteReader reader;
-    solinas64::ByteWriter writer;
+    cout << "TestFileEncoder...";
 
     solinas64::Random prng;
-    prng.Seed(14);
+    prng.Seed(28);
 
-    std::vector<uint8_t> original, recovered;
+    static const char* kPath = "solinas64_test_source.bin";
+    static const char* kRecoveryPaths[2] = {
+        "solinas64_test_recovery0.bin", "solinas64_test_recovery1.bin"
+    };
 
-    for (unsigned i = 1; i < kMaxDataLength; ++i)
+    // Removes the test files on every return path
+    struct TestFileRemover
     {
-        unsigned bytes = i;
-
-        for (unsigned j = 0; j < 10; ++j)
+        ~TestFileRemover()
         {
-            // Padding to simplify tester
-            original.resize(bytes + 8);
+            remove(kPath);
+            remove(kRecoveryPaths[0]);
+            remove(kRecoveryPaths[1]);
+        }
+    } remover;
 
-            // Fill the data with random bytes
-            for (unsigned k = 0; k < i; k += 8)
-            {
-                uint64_t w;
-                if (prng.Next() % 100 <= 3) {
-                    w = ~(uint64_t)0;
-                }
-                else {
-                    w = prng.Next();
-                }
-                solinas64::WriteU64_LE(&original[k], w);
-            }
+    static const unsigned kFileSizes[] = { 1, 100, 6400, 70001, 250007 };
 
-            reader.BeginRead(&original[0], bytes);
+    for (unsigned fileBytes : kFileSizes)
+    {
+        std::vector<uint8_t> file(fileBytes);
+        FillTestData(prng, &file[0], fileBytes);
 
-            unsigned maxWords = solinas64::ByteReader::MaxWords(bytes);
-            unsigned maxBytes = solinas64::ByteWriter::MaxBytesNeeded(maxWords);
+        FILE* source = fopen(kPath, "wb");
+        if (!source || fwrite(&file[0], 1, fileBytes, source) != fileBytes || fclose(source) != 0)
+        {
+            cout << "Failed (write source)" << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
 
-            recovered.resize(maxBytes);
-            writer.BeginWrite(&recovered[0]);
+        for (unsigned loop = 0; loop < 4; ++loop)
+        {
+            solinas64::FileEncoderParams params;
+            params.N = static_cast<unsigned>(prng.Next() % 12) + 1;
+            params.RecoveryCount = (loop == 3) ? 2 : static_cast<unsigned>(prng.Next() % 4) + 1;
+            params.FirstSeed = prng.Next();
+            params.StripeBytes = (loop % 2 == 0) ? 1024 : solinas64::kFileStripeBytes;
+            params.RingSlots = loop + 1;
+            params.UseMmap = (loop % 2 == 0);
+
+            const unsigned shardBytes = solinas64::GetFileShardBytes(fileBytes, params.N);
+
+            // The padded originals and the expected recovery shards
+            std::vector<uint8_t> padded(static_cast<size_t>(shardBytes) * params.N, 0);
+            memcpy(&padded[0], &file[0], fileBytes);
+            std::vector<const uint8_t*> originals(params.N);
+            for (unsigned i = 0; i < params.N; ++i) {
+                originals[i] = &padded[i * static_cast<size_t>(shardBytes)];
+            }
 
-            // Write words we get directly back out
-            uint64_t word;
-            while (reader.Read(word) != solinas64::ReadResult::Empty) {
-                writer.Write(word);
+            std::vector<uint8_t> workspace(solinas64::GetEncodeRowWorkspaceBytes(shardBytes));
+            std::vector<std::vector<uint8_t>> expected(params.RecoveryCount);
+            for (unsigned r = 0; r < params.RecoveryCount; ++r)
+            {
+                expected[r].resize(solinas64::AppDataReader::GetMaxOutputBytes(shardBytes));
+                const unsigned bytes = solinas64::EncodeRecovery(
+                    &originals[0], params.N, shardBytes, params.FirstSeed + r, &workspace[0], &expected[r][0]);
+                expected[r].resize(bytes);
             }
-            unsigned writtenBytes = writer.Flush();
 
-            // TBD: Check if high bits are 0?
+            std::vector<std::vector<uint8_t>> shards(params.RecoveryCount);
+            bool ordered = true;
+            const solinas64::RecoveryWriter writer = [&](unsigned r, unsigned offset, const uint8_t* data, unsigned bytes) {
+                ordered = ordered && (offset == shards[r].size());
+                shards[r].insert(shards[r].end(), data, data + bytes);
+                return true;
+            };
 
-            if (writtenBytes > maxBytes ||
-                writtenBytes > bytes + 8)
+            solinas64::FileEncoderResult result;
+            if (loop == 3)
+            {
+                // Write the shards to files and read them back
+                if (!solinas64::EncodeFileToShards(kPath, params, kRecoveryPaths, &result))
+                {
+                    cout << "Failed (encode to files)" << endl;
+                    SOLINAS64_DEBUG_BREAK();
+                    return false;
+                }
+                for (unsigned r = 0; r < params.RecoveryCount; ++r)
+                {
+                    FILE* shard = fopen(kRecoveryPaths[r], "rb");
+                    shards[r].resize(result.RecoveryBytes + 1);
+                    const size_t readBytes = shard ? fread(&shards[r][0], 1, shards[r].size(), shard) : 0;
+                    if (shard) {
+                        fclose(shard);
+                    }
+                    shards[r].resize(readBytes);
+                }
+            }
+            else if (!solinas64::EncodeFile(kPath, params, writer, &result))
             {
-                cout << "Failed (byte count mismatch) at i = " << i << " j = " << j << endl;
+                cout << "Failed (encode)" << endl;
                 SOLINAS64_DEBUG_BREAK();
                 return false;
             }
 
-            if (0 != memcmp(&recovered[0], &original[0], bytes))
-            {
-                cout << "Failed (data corruption) at i = " << i << " j = " << j << endl;
+            if (!ordered || result.FileBytes != fileBytes || result.ShardBytes != shardBytes) {
+                cout << "Failed (result)" << endl;
                 SOLINAS64_DEBUG_BREAK();
                 return false;
             }
+
+            for (unsigned r = 0; r < params.RecoveryCount; ++r)
+            {
+                if (shards[r] != expected[r] || result.RecoveryBytes != expected[r].size())
+                {
+                    cout << "Failed (mismatch) for file bytes = " << fileBytes << endl;
+                    SOLINAS64_DEBUG_BREAK();
+                    return false;
+                }
+            }
         }
     }
 
+    // A writer error stops the encoder
+    solinas64::FileEncoderParams params;
+    params.N = 4;
+    params.RecoveryCount = 2;
+    params.StripeBytes = 1024;
+    const solinas64::RecoveryWriter failing = [](unsigned, unsigned, const uint8_t*, unsigned) {
+        return false;
+    };
+    if (solinas64::EncodeFile(kPath, params, failing) ||
+        solinas64::EncodeFile("solinas64_test_missing.bin", params, failing))
+    {
+        cout << "Failed (errors)" << endl;
+        SOLINAS64_DEBUG_BREAK();
+        return false;
+    }
+
+    // An empty file has no shards
+    const solinas64::RecoveryWriter accepting = [](unsigned, unsigned, const uint8_t*, unsigned) {
+        return true;
+    };
+    FILE* empty = fopen(kPath, "wb");
+    if (!empty || fclose(empty) != 0 ||
+        solinas64::EncodeFile(kPath, params, accepting) ||
+        solinas64::EncodeFileToShards(kPath, params, kRecoveryPaths))
+    {
+        cout << "Failed (empty file)" << endl;
+        SOLINAS64_DEBUG_BREAK();
+        return false;
+    }
+
     cout << "Passed" << endl;
 
     return true;
@@ -1020,138 +3248,325 @@ bool TestByteWriter()
 
 
 //------------------------------------------------------------------------------
-// Tests: Integration
+// Tests: NTT
 
-// Tests all of the serialization/deserialization and some math code
-bool TestIntegration()
+/// Reference butterfly stage, one scalar operation at a time
+static void RefNTTStage(bool dit, uint64_t* data, unsigned count, unsigned half, const uint64_t* twiddles)
 {
-    cout << "TestIntegration...";
+    for (unsigned i = 0; i < count; i += 2 * half)
+    {
+        for (unsigned j = 0; j < half; ++j)
+        {
+            uint64_t& x = data[i + j];
+            uint64_t& y = data[i + j + half];
+            if (dit)
+            {
+                const uint64_t t = solinas64::Multiply(y, twiddles[j]);
+                y = solinas64::Subtract(x, t);
+                x = solinas64::Add(x, t);
+            }
+            else
+            {
+                const uint64_t t = solinas64::Subtract(x, y);
+                x = solinas64::Add(x, y);
+                y = solinas64::Multiply(t, twiddles[j]);
+            }
+        }
+    }
+}
+
+/// Reference X[k] = sum(x[j] * w^(j*k)) mod p
+static uint64_t RefDFT(const uint64_t* x, unsigned n, uint64_t w, unsigned k)
+{
+    const uint64_t wk = solinas64::Power(w, k);
+    uint64_t sum = 0, t = 1;
+    for (unsigned j = 0; j < n; ++j)
+    {
+        sum = RefAdd(sum, RefMultiply(x[j], t));
+        t = RefMultiply(t, wk);
+    }
+    return sum;
+}
 
-    std::vector<uint8_t> data, recovery, recovered;
+static bool TestNTT()
+{
+    cout << "TestNTT...";
 
     solinas64::Random prng;
-    prng.Seed(13);
-
-    // Test a range of data sizes
-    for (unsigned i = 1; i < kMaxDataLength; ++i)
+    prng.Seed(19);
+
+    // Root of unity properties
+    if (solinas64::GetRootOfUnity(6) != 8 ||
+        solinas64::GetRootOfUnity(2) != ((uint64_t)1 << 48) ||
+        solinas64::GetRootOfUnity(1) != solinas64::kPrime - 1 ||
+        solinas64::GetRootOfUnity(0) != 1 ||
+        solinas64::Power(solinas64::kRootOfUnity, (uint64_t)1 << 31) != solinas64::kPrime - 1 ||
+        solinas64::Power(solinas64::kGenerator, (solinas64::kPrime - 1) / 2) != solinas64::kPrime - 1)
     {
-        unsigned bytes = i;
+        cout << "Failed (roots of unity)" << endl;
+        SOLINAS64_DEBUG_BREAK();
+        return false;
+    }
 
-        // Run a few tests for each size
-        for (unsigned j = 0; j < 10; ++j)
+    for (unsigned i = 0; i < 1000; ++i)
+    {
+        const uint64_t x = prng.Next();
+        const uint64_t e = prng.Next() % 1000;
+        uint64_t expected = 1;
+        for (uint64_t k = 0; k < e; ++k) {
+            expected = RefMultiply(expected, x);
+        }
+        if (solinas64::Power(x, e) != expected)
         {
-            // Generate some test data:
+            cout << "Failed (power) for x = " << HexString(x) << " e = " << e << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+    }
 
-            // Allocate padded data to simplify tester
-            data.resize(bytes + 8);
+    // Vectorized stages match the scalar butterflies, including edge values
+    for (unsigned half = 1; half <= 64; half *= 2)
+    {
+        for (unsigned blocks = 1; blocks <= 3; ++blocks)
+        {
+            const unsigned count = 2 * half * blocks;
+            std::vector<uint64_t> twiddles(half), data(count);
+            for (unsigned j = 0; j < half; ++j) {
+                twiddles[j] = (j % 3 == 0) ? kEdgeValues[prng.Next() % kEdgeCount] : prng.Next();
+            }
 
-            // Fill the data with random bytes
-            for (unsigned k = 0; k < i; k += 8)
+            for (unsigned dit = 0; dit <= 1; ++dit)
             {
-                uint64_t w;
-                if (prng.Next() % 100 <= 3) {
-                    w = ~(uint64_t)0;
+                for (unsigned i = 0; i < count; ++i) {
+                    data[i] = (i % 2 == 0) ? kEdgeValues[prng.Next() % kEdgeCount] : prng.Next();
+                }
+                std::vector<uint64_t> expected = data;
+
+                RefNTTStage(dit != 0, &expected[0], count, half, &twiddles[0]);
+                if (dit) {
+                    solinas64::NTTStageDIT(&data[0], count, half, &twiddles[0]);
                 }
                 else {
-                    w = prng.Next();
+                    solinas64::NTTStageDIF(&data[0], count, half, &twiddles[0]);
+                }
+
+                if (data != expected)
+                {
+                    cout << "Failed (stage mismatch) at half = " << half << " dit = " << dit << endl;
+                    SOLINAS64_DEBUG_BREAK();
+                    return false;
                 }
-                solinas64::WriteU64_LE(&data[k], w);
             }
+        }
+    }
+
+    solinas64::NTT tooBig;
+    if (tooBig.Initialize(solinas64::kMaxNTTLogSize + 1))
+    {
+        cout << "Failed (size limit)" << endl;
+        SOLINAS64_DEBUG_BREAK();
+        return false;
+    }
+
+    // Forward() matches the DFT in bit-reversed order, and Inverse() undoes it.
+    // 2^13 and 2^14 take the recursive path for big blocks
+    for (unsigned logN = 0; logN <= 14; ++logN)
+    {
+        solinas64::NTT ntt;
+        if (!ntt.Initialize(logN) || ntt.GetSize() != (1u << logN) || ntt.GetLogSize() != logN)
+        {
+            cout << "Failed (initialize) at logN = " << logN << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
 
-            // Read data from the simulated packet,
-            // perform some example Fp operation on it,
-            // and then store it to a simulated recovery packet.
+        const unsigned n = ntt.GetSize();
+        const uint64_t w = solinas64::GetRootOfUnity(logN);
 
-            // Preallocate enough space in recovery packets for the worst case
-            const unsigned maxWords = solinas64::ByteReader::MaxWords(bytes);
-            recovery.resize(solinas64::WordWriter::BytesNeeded(maxWords));
+        std::vector<uint64_t> original(n), data(n);
+        for (unsigned i = 0; i < n; ++i) {
+            original[i] = (i % 5 == 0) ? kEdgeValues[prng.Next() % kEdgeCount] : prng.Next();
+        }
+        data = original;
 
-            solinas64::WordWriter recovery_writer;
-            recovery_writer.BeginWrite(&recovery[0]);
+        ntt.Forward(&data[0]);
 
-            solinas64::ByteReader original_reader;
-            original_reader.BeginRead(&data[0], bytes);
+        const unsigned checks = (logN <= 8) ? n : 16;
+        for (unsigned c = 0; c < checks; ++c)
+        {
+            const unsigned i = (logN <= 8) ? c : static_cast<unsigned>(prng.Next() % n);
+            const uint64_t expected = RefDFT(&original[0], n, w, solinas64::BitReverse(i, logN));
+            if (solinas64::Finalize(data[i]) != expected)
+            {
+                cout << "Failed (forward) at logN = " << logN << " i = " << i << endl;
+                SOLINAS64_DEBUG_BREAK();
+                return false;
+            }
+        }
 
-            solinas64::Random coeff_prng;
-            coeff_prng.Seed(bytes + j * 500000);
+        ntt.Inverse(&data[0]);
 
-            // Start reading words from the original file/packet,
-            // multiplying them by a random coefficient,
-            // and writing them to the recovery file/packet.
-            uint64_t r;
-            while (original_reader.Read(r) == solinas64::ReadResult::Success)
+        for (unsigned i = 0; i < n; ++i)
+        {
+            if (solinas64::Finalize(data[i]) != solinas64::Finalize(original[i]))
             {
-                // Pick random coefficient to multiply between 1..p-1
-                uint64_t coeff = coeff_prng.NextNonzeroFp();
+                cout << "Failed (round trip) at logN = " << logN << " i = " << i << endl;
+                SOLINAS64_DEBUG_BREAK();
+                return false;
+            }
+        }
+
+        // Truncated transforms match the full ones on the words they produce
+        if (n >= 2)
+        {
+            const unsigned partial = 1 + static_cast<unsigned>(prng.Next() % (n - 1));
 
-                // x = r * coeff (62 bits)
-                uint64_t x = solinas64::Multiply(r, coeff);
+            std::vector<uint64_t> full = original, truncated = original;
+            ntt.Forward(&full[0]);
+            ntt.Forward(&truncated[0], partial);
+            for (unsigned i = 0; i < partial; ++i)
+            {
+                if (truncated[i] != full[i])
+                {
+                    cout << "Failed (truncated forward) at logN = " << logN << " i = " << i << endl;
+                    SOLINAS64_DEBUG_BREAK();
+                    return false;
+                }
+            }
 
-                // Finalize x (61 bits < p)
-                uint64_t f = solinas64::Finalize(x);
+            full = original;
+            for (unsigned i = partial; i < n; ++i) {
+                full[i] = 0;
+            }
+            truncated = full;
+            ntt.Inverse(&full[0]);
+            ntt.Inverse(&truncated[0], partial);
+            if (truncated != full)
+            {
+                cout << "Failed (zero tail inverse) at logN = " << logN << endl;
+                SOLINAS64_DEBUG_BREAK();
+                return false;
+            }
+        }
 
-                // Write to recovery file/packet
-                recovery_writer.Write(f);
+        // Converting to natural order and back is the identity
+        std::vector<uint64_t> permuted = original;
+        solinas64::BitReversePermute(&permuted[0], logN);
+        for (unsigned i = 0; i < n; ++i)
+        {
+            if (permuted[solinas64::BitReverse(i, logN)] != original[i])
+            {
+                cout << "Failed (permute) at logN = " << logN << " i = " << i << endl;
+                SOLINAS64_DEBUG_BREAK();
+                return false;
             }
+        }
+    }
+
+    cout << "Passed" << endl;
 
-            // Flush the remaining bits to the recovery file/packet
-            unsigned writtenRecoveryBytes = recovery_writer.Flush();
+    return true;
+}
 
-            // Simulate reading data from the recovery file/packet
-            // and recovering the original data:
 
-            solinas64::WordReader recovery_reader;
-            recovery_reader.BeginRead(&recovery[0], writtenRecoveryBytes);
+//------------------------------------------------------------------------------
+// Tests: MDS Code
 
-            // Allocate space for recovered data (may be up to 1.6% larger than needed)
-            const unsigned recoveryWords = solinas64::WordReader::WordCount(writtenRecoveryBytes);
-            const unsigned maxBytes = solinas64::ByteWriter::MaxBytesNeeded(recoveryWords);
-            recovered.resize(maxBytes);
+static bool TestMDS()
+{
+    cout << "TestMDS...";
 
-            solinas64::ByteWriter original_writer;
-            original_writer.BeginWrite(&recovered[0]);
+    solinas64::Random prng;
+    prng.Seed(20);
 
-            // Reproduce the same random sequence
-            coeff_prng.Seed(bytes + j * 500000);
+    struct Params { unsigned K, M, bytes; };
+    static const Params kParams[] = {
+        { 1, 1, 8 }, { 1, 3, 13 }, { 2, 2, 100 }, { 3, 10, 64 },
+        { 20, 5, 1000 }, { 37, 11, 333 }, { 64, 64, 16 }, { 200, 40, 77 }
+    };
 
-            // For each word to read:
-            const unsigned readWords = solinas64::WordReader::WordCount(writtenRecoveryBytes);
-            for (unsigned i = 0; i < readWords; ++i)
-            {
-                // Pick random coefficient to multiply between 1..p-1
-                uint64_t coeff = coeff_prng.NextNonzeroFp();
-                uint64_t inv_coeff = solinas64::Inverse(coeff);
+    for (const Params& params : kParams)
+    {
+        const unsigned K = params.K, M = params.M, bytes = params.bytes;
+        const unsigned maxBytes = solinas64::AppDataReader::GetMaxOutputBytes(bytes);
 
-                // Read the next word (61 bits)
-                uint64_t f = recovery_reader.Read();
+        std::vector<std::vector<uint8_t>> originals(K, std::vector<uint8_t>(bytes));
+        std::vector<const uint8_t*> originalPtrs(K);
+        for (unsigned i = 0; i < K; ++i)
+        {
+            FillTestData(prng, &originals[i][0], bytes);
+            originalPtrs[i] = &originals[i][0];
+        }
 
-                // Invert the multiplication (62 bits)
-                uint64_t x = solinas64::Multiply(f, inv_coeff);
+        std::vector<std::vector<uint8_t>> recovery(M, std::vector<uint8_t>(maxBytes));
+        std::vector<uint8_t*> recoveryPtrs(M);
+        for (unsigned j = 0; j < M; ++j) {
+            recoveryPtrs[j] = &recovery[j][0];
+        }
 
-                // Finalize x (61 bits < p)
-                x = solinas64::Finalize(x);
+        solinas64::MDSEncoder encoder;
+        if (!encoder.Initialize(K, M, bytes))
+        {
+            cout << "Failed (encoder initialize) at K = " << K << " M = " << M << endl;
+            SOLINAS64_DEBUG_BREAK();
+            return false;
+        }
+        const unsigned recoveryBytes = encoder.Encode(&originalPtrs[0], &recoveryPtrs[0]);
 
-                // Write to recovered original data buffer
-                original_writer.Write(x);
+        for (unsigned trial = 0; trial < 10; ++trial)
+        {
+            // Lose up to M originals, and receive just enough recoveries
+            const unsigned lossCount = 1 + static_cast<unsigned>(prng.Next() % (M < K ? M : K));
+            std::vector<unsigned> columns(K), rows(M);
+            for (unsigned i = 0; i < K; ++i) {
+                columns[i] = i;
+            }
+            for (unsigned j = 0; j < M; ++j) {
+                rows[j] = j;
+            }
+            for (unsigned i = K; i > 1; --i) {
+                std::swap(columns[i - 1], columns[prng.Next() % i]);
+            }
+            for (unsigned j = M; j > 1; --j) {
+                std::swap(rows[j - 1], rows[prng.Next() % j]);
             }
 
-            // Flush the remaining bits to the recovered original file/packet
-            unsigned recoveredBytes = original_writer.Flush();
+            solinas64::MDSDecoder decoder;
+            decoder.Initialize(K, M, bytes);
+            for (unsigned i = lossCount; i < K; ++i) {
+                decoder.AddOriginal(columns[i], originalPtrs[columns[i]]);
+            }
+            for (unsigned j = 0; j + 1 < lossCount; ++j) {
+                decoder.AddRecovery(rows[j], recoveryPtrs[rows[j]], recoveryBytes);
+            }
 
-            if (recoveredBytes > maxBytes ||
-                recoveredBytes > bytes + 8)
+            if (decoder.IsReady() || decoder.Decode())
             {
-                cout << "Failed (byte count mismatch) at i = " << i << " j = " << j << endl;
+                cout << "Failed (ready too early) at K = " << K << " M = " << M << endl;
                 SOLINAS64_DEBUG_BREAK();
                 return false;
             }
 
-            if (0 != memcmp(&recovered[0], &data[0], bytes))
+            const unsigned last = rows[lossCount - 1];
+            decoder.AddRecovery(last, recoveryPtrs[last], recoveryBytes);
+
+            if (!decoder.IsReady() || !decoder.Decode())
             {
-                cout << "Failed (data corruption) at i = " << i << " j = " << j << endl;
+                cout << "Failed (decode) at K = " << K << " M = " << M << " trial = " << trial << endl;
                 SOLINAS64_DEBUG_BREAK();
                 return false;
             }
+
+            for (unsigned i = 0; i < K; ++i)
+            {
+                if (0 != memcmp(decoder.GetOriginal(i), originalPtrs[i], bytes))
+                {
+                    cout << "Failed (data corruption) at K = " << K << " M = " << M
+                        << " trial = " << trial << " i = " << i << endl;
+                    SOLINAS64_DEBUG_BREAK();
+                    return false;
+                }
+            }
         }
     }
 
@@ -1171,37 +3586,100 @@ int main()
 
     int result = SOLINAS64_RET_SUCCESS;
 
-    if (!TestByteWriter()) {
+    if (!TestAdd()) {
         result = SOLINAS64_RET_FAIL;
     }
-    if (!TestIntegration()) {
+    if (!TestFinalize()) {
+        result = SOLINAS64_RET_FAIL;
+    }
+    if (!TestMultiply()) {
+        result = SOLINAS64_RET_FAIL;
+    }
+    if (!TestMulInverse()) {
+        result = SOLINAS64_RET_FAIL;
+    }
+    if (!TestAccum128()) {
+        result = SOLINAS64_RET_FAIL;
+    }
+    if (!TestExtensionFields()) {
+        result = SOLINAS64_RET_FAIL;
+    }
+    if (!TestConstArithmetic()) {
         result = SOLINAS64_RET_FAIL;
     }
     if (!TestRandom()) {
         result = SOLINAS64_RET_FAIL;
     }
-    if (!TestWordSerialization()) {
+    if (!TestAppDataReader()) {
         result = SOLINAS64_RET_FAIL;
     }
-    if (!TestNegate()) {
+    if (!TestAppDataWriter()) {
         result = SOLINAS64_RET_FAIL;
     }
-    if (!TestAdd()) {
+    if (!TestIntegration()) {
         result = SOLINAS64_RET_FAIL;
     }
-    if (!TestPartialReduction()) {
+    if (!TestWorkspaceSizing()) {
         result = SOLINAS64_RET_FAIL;
     }
-    if (!TestFinalizeReduction()) {
+    if (!TestMultiplyAddRegionTail()) {
         result = SOLINAS64_RET_FAIL;
     }
-    if (!TestMultiply()) {
+    if (!TestMulConst()) {
         result = SOLINAS64_RET_FAIL;
     }
-    if (!TestMulInverse()) {
+    if (!TestRegionKernels()) {
+        result = SOLINAS64_RET_FAIL;
+    }
+    if (!TestMultiplyAddRegionMulti()) {
+        result = SOLINAS64_RET_FAIL;
+    }
+    if (!TestEncodeRow()) {
+        result = SOLINAS64_RET_FAIL;
+    }
+    if (!TestEncodeTiled()) {
+        result = SOLINAS64_RET_FAIL;
+    }
+    if (!TestRegionStream()) {
+        result = SOLINAS64_RET_FAIL;
+    }
+    if (!TestRegionBatch()) {
+        result = SOLINAS64_RET_FAIL;
+    }
+    if (!TestPolyHash()) {
+        result = SOLINAS64_RET_FAIL;
+    }
+    if (!TestFixedRegion()) {
+        result = SOLINAS64_RET_FAIL;
+    }
+    if (!TestRegionStats()) {
+        result = SOLINAS64_RET_FAIL;
+    }
+    if (!TestCodec()) {
+        result = SOLINAS64_RET_FAIL;
+    }
+    if (!TestUpdateRecovery()) {
+        result = SOLINAS64_RET_FAIL;
+    }
+    if (!TestEncoderContext()) {
+        result = SOLINAS64_RET_FAIL;
+    }
+    if (!TestParallelRegion()) {
+        result = SOLINAS64_RET_FAIL;
+    }
+    if (!TestEncoderPipeline()) {
+        result = SOLINAS64_RET_FAIL;
+    }
+    if (!TestEncoderPipelineWait()) {
+        result = SOLINAS64_RET_FAIL;
+    }
+    if (!TestFileEncoder()) {
+        result = SOLINAS64_RET_FAIL;
+    }
+    if (!TestNTT()) {
         result = SOLINAS64_RET_FAIL;
     }
-    if (!TestByteReader()) {
+    if (!TestMDS()) {
         result = SOLINAS64_RET_FAIL;
     }
 